@@ -236,14 +236,19 @@ UDFFileDirInfoToNT(
     PFILE_ENTRY FileEntry;
     UNICODE_STRING UdfName;
     UNICODE_STRING DosName;
-    PEXTENDED_FILE_ENTRY ExFileEntry;
     USHORT Ident;
     BOOLEAN ReadSizes = FALSE;
+    BOOLEAN AttrFresh;
     NTSTATUS status;
     PFCB Fcb;
 
     UDFPrint(("@=%#x, FileDirNdx %x\n", &Vcb, FileDirNdx));
 
+    // attributes of linked entry loaded by UDFLoadDirInfoBatch() for this
+    // query are used once, the next query re-reads them as usual
+    AttrFresh = (FileDirNdx->FI_Flags & UDF_FI_FLAG_ATTR_FRESH) ? TRUE : FALSE;
+    FileDirNdx->FI_Flags &= ~UDF_FI_FLAG_ATTR_FRESH;
+
     ASSERT((ULONG_PTR)NTFileInfo > 0x1000);
     RtlZeroMemory(NTFileInfo, sizeof(FILE_BOTH_DIR_INFORMATION));
 
@@ -293,7 +298,7 @@ UDFFileDirInfoToNT(
         }
         ASSERT(FileEntry);
     } else if(!(FileDirNdx->FI_Flags & UDF_FI_FLAG_SYS_ATTR) ||
-               (FileDirNdx->FI_Flags & UDF_FI_FLAG_LINKED)) {
+              ((FileDirNdx->FI_Flags & UDF_FI_FLAG_LINKED) && !AttrFresh)) {
         LONG_AD feloc;
 
         UDFPrint(("  !SYS_ATTR\n"));
@@ -311,6 +316,8 @@ UDFFileDirInfoToNT(
         }
         ReadSizes = TRUE;
     } else {
+        FileEntry = NULL;
+use_dirndx:
         UDFPrint(("  FileDirNdx\n"));
         NTFileInfo->CreationTime.QuadPart   = FileDirNdx->CreationTime;
         NTFileInfo->LastWriteTime.QuadPart  = FileDirNdx->LastWriteTime;
@@ -320,7 +327,6 @@ UDFFileDirInfoToNT(
         NTFileInfo->AllocationSize.QuadPart = FileDirNdx->AllocationSize;
         NTFileInfo->EndOfFile.QuadPart = FileDirNdx->FileSize;
         NTFileInfo->EaSize = 0;
-        FileEntry = NULL;
         goto get_name_only;
     }
 
@@ -328,57 +334,18 @@ UDFFileDirInfoToNT(
         goto get_name_only;
 
     UDFPrint(("  direct\n"));
-    if(FileEntry->descTag.tagIdent == TID_FILE_ENTRY) {
-        UDFPrint(("  TID_FILE_ENTRY\n"));
-        if(ReadSizes) {
-            UDFPrint(("    ReadSizes\n"));
-            // Times
-            FileDirNdx->CreationTime   = NTFileInfo->CreationTime.QuadPart   =
-            FileDirNdx->LastWriteTime  = NTFileInfo->LastWriteTime.QuadPart  = UDFTimeToNT(&(FileEntry->modificationTime));
-            FileDirNdx->LastAccessTime = NTFileInfo->LastAccessTime.QuadPart = UDFTimeToNT(&(FileEntry->accessTime));
-            FileDirNdx->ChangeTime     = NTFileInfo->ChangeTime.QuadPart     = UDFTimeToNT(&(FileEntry->attrTime));
-            // FileSize
-            FileDirNdx->FileSize =
-            NTFileInfo->EndOfFile.QuadPart =
-                FileEntry->informationLength;
-            UDFPrint(("    informationLength=%I64x, lengthAllocDescs=%I64x\n",
-                FileEntry->informationLength,
-                FileEntry->lengthAllocDescs
-                ));
-            // AllocSize
-            FileDirNdx->AllocationSize =
-            NTFileInfo->AllocationSize.QuadPart =
-                (FileEntry->informationLength + Vcb->LBlockSize - 1) & ~((LONGLONG)(Vcb->LBlockSize) - 1);
-        }
-//        NTFileInfo->EaSize = 0;//FileEntry->lengthExtendedAttr;
-    } else if(FileEntry->descTag.tagIdent == TID_EXTENDED_FILE_ENTRY) {
-        ExFileEntry = (PEXTENDED_FILE_ENTRY)FileEntry;
-        UDFPrint(("  PEXTENDED_FILE_ENTRY\n"));
-        if(ReadSizes) {
-            UDFPrint(("    ReadSizes\n"));
-            // Times
-            FileDirNdx->CreationTime   = NTFileInfo->CreationTime.QuadPart   = UDFTimeToNT(&(ExFileEntry->createTime));
-            FileDirNdx->LastWriteTime  = NTFileInfo->LastWriteTime.QuadPart  = UDFTimeToNT(&(ExFileEntry->modificationTime));
-            FileDirNdx->LastAccessTime = NTFileInfo->LastAccessTime.QuadPart = UDFTimeToNT(&(ExFileEntry->accessTime));
-            FileDirNdx->ChangeTime     = NTFileInfo->ChangeTime.QuadPart     = UDFTimeToNT(&(ExFileEntry->attrTime));
-            // FileSize
-            FileDirNdx->FileSize =
-            NTFileInfo->EndOfFile.QuadPart =
-                ExFileEntry->informationLength;
-            UDFPrint(("    informationLength=%I64x, lengthAllocDescs=%I64x\n",
-                FileEntry->informationLength,
-                FileEntry->lengthAllocDescs
-                ));
-            // AllocSize
-            FileDirNdx->AllocationSize =
-            NTFileInfo->AllocationSize.QuadPart =
-                (ExFileEntry->informationLength + Vcb->LBlockSize - 1) & ~((LONGLONG)(Vcb->LBlockSize) - 1);
-        }
-//        NTFileInfo->EaSize = 0;//ExFileEntry->lengthExtendedAttr;
-    } else {
+    if((FileEntry->descTag.tagIdent != TID_FILE_ENTRY) &&
+       (FileEntry->descTag.tagIdent != TID_EXTENDED_FILE_ENTRY)) {
         UDFPrint(("  ???\n"));
         goto get_name_only;
     }
+    if(ReadSizes) {
+        UDFPrint(("    ReadSizes\n"));
+        // times, sizes & attributes are cached in DirIndex the same way
+        // as UDFLoadDirInfoBatch() does it
+        UDFFileEntryToDirNdx(Vcb, FileDirNdx, FileEntry);
+        goto use_dirndx;
+    }
 
 get_attr_only:
 
@@ -406,6 +373,7 @@ get_name_only:
     UdfName = FileDirNdx->FName;
     NTFileInfo->FileNameLength = UdfName.Length;
     RtlCopyMemory((PCHAR)&(NTFileInfo->FileName), (PCHAR)(UdfName.Buffer), UdfName.MaximumLength);
+    UDFDirIndexEnsureHashes(Vcb, FileDirNdx, HASH_DOS);
     if(!(FileDirNdx->FI_Flags & UDF_FI_FLAG_DOS)) {
         UDFPrint(("  !UDF_FI_FLAG_DOS"));
         UDFDOSName(Vcb, &DosName, &UdfName,
@@ -426,6 +394,129 @@ get_name_only:
     return STATUS_SUCCESS;
 } // end UDFFileDirInfoToNT()
 
+/*
+    This routine fills cached times, sizes & attributes of  DirIndex
+    entry from (Ext)FileEntry. UDFFileDirInfoToNT() uses it for unopened
+    files and fills NT structure from the cached values then.
+ */
+VOID
+UDFFileEntryToDirNdx(
+    IN PVCB Vcb,
+    IN PDIR_INDEX_ITEM FileDirNdx,
+    IN PFILE_ENTRY FileEntry
+    )
+{
+    PEXTENDED_FILE_ENTRY ExFileEntry;
+
+    if(FileEntry->descTag.tagIdent == TID_FILE_ENTRY) {
+        FileDirNdx->CreationTime   =
+        FileDirNdx->LastWriteTime  = UDFTimeToNT(&(FileEntry->modificationTime));
+        FileDirNdx->LastAccessTime = UDFTimeToNT(&(FileEntry->accessTime));
+        FileDirNdx->ChangeTime     = UDFTimeToNT(&(FileEntry->attrTime));
+        FileDirNdx->FileSize       = FileEntry->informationLength;
+    } else if(FileEntry->descTag.tagIdent == TID_EXTENDED_FILE_ENTRY) {
+        ExFileEntry = (PEXTENDED_FILE_ENTRY)FileEntry;
+        FileDirNdx->CreationTime   = UDFTimeToNT(&(ExFileEntry->createTime));
+        FileDirNdx->LastWriteTime  = UDFTimeToNT(&(ExFileEntry->modificationTime));
+        FileDirNdx->LastAccessTime = UDFTimeToNT(&(ExFileEntry->accessTime));
+        FileDirNdx->ChangeTime     = UDFTimeToNT(&(ExFileEntry->attrTime));
+        FileDirNdx->FileSize       = ExFileEntry->informationLength;
+    } else {
+        return;
+    }
+    FileDirNdx->AllocationSize =
+        (FileDirNdx->FileSize + Vcb->LBlockSize - 1) & ~((LONGLONG)(Vcb->LBlockSize) - 1);
+    // do some substitutions
+    if(!FileDirNdx->CreationTime)
+        FileDirNdx->CreationTime = Vcb->VolCreationTime;
+    if(!FileDirNdx->LastAccessTime)
+        FileDirNdx->LastAccessTime = FileDirNdx->CreationTime;
+    if(!FileDirNdx->LastWriteTime)
+        FileDirNdx->LastWriteTime = FileDirNdx->CreationTime;
+    if(!FileDirNdx->ChangeTime)
+        FileDirNdx->ChangeTime = FileDirNdx->CreationTime;
+
+    FileDirNdx->SysAttr = UDFAttributesToNT(FileDirNdx, (tag*)FileEntry);
+    FileDirNdx->FI_Flags |= UDF_FI_FLAG_SYS_ATTR;
+} // end UDFFileEntryToDirNdx()
+
+/*
+    This routine loads FileEntries for a page of  directory  query
+    results at once. Entries without cached attributes are  sorted
+    by FE location & read with coalesced multi-block requests into
+    a single reusable buffer. Entries which can't be loaded here are
+    left untouched & will be read by UDFFileDirInfoToNT() as usual.
+ */
+VOID
+UDFLoadDirInfoBatch(
+    IN PVCB Vcb,
+    IN PDIR_INDEX_ITEM* DirNdxList,
+    IN ULONG Count
+    )
+{
+    uint32 Lba[UDF_DIR_INFO_BATCH_MAX];
+    PDIR_INDEX_ITEM DirNdx;
+    ULONG i, j, n;
+    uint32 lba, RunStart, RunLen;
+    int8* Buffer;
+    SIZE_T ReadBytes;
+    uint16 Ident;
+
+    if(Vcb->VCBFlags & UDF_VCB_FLAGS_RAW_DISK)
+        return;
+    if(Count > UDF_DIR_INFO_BATCH_MAX)
+        Count = UDF_DIR_INFO_BATCH_MAX;
+
+    // gather uncached FE locations (insertion sort by Lba)
+    n = 0;
+    for(i=0; i<Count; i++) {
+        DirNdx = DirNdxList[i];
+        if(DirNdx->FileInfo ||
+           ((DirNdx->FI_Flags & UDF_FI_FLAG_SYS_ATTR) && !(DirNdx->FI_Flags & UDF_FI_FLAG_LINKED)))
+            continue;
+        lba = UDFPartLbaToPhys(Vcb, &(DirNdx->FileEntryLoc));
+        if(lba == LBA_OUT_OF_EXTENT)
+            continue;
+        for(j=n; j && (Lba[j-1] > lba); j--) {
+            Lba[j] = Lba[j-1];
+            DirNdxList[j] = DirNdxList[j-1];
+        }
+        Lba[j] = lba;
+        DirNdxList[j] = DirNdx;
+        n++;
+    }
+    // a single FE is read by UDFFileDirInfoToNT() as before
+    if(n < 2)
+        return;
+
+    Buffer = (int8*)MyAllocatePool__(NonPagedPool, UDF_DIR_INFO_BATCH_RUN << Vcb->BlockSizeBits);
+    if(!Buffer)
+        return;
+
+    for(i=0; i<n; i=j) {
+        // merge neighbouring FEs (with small gaps) into a single request
+        RunStart = Lba[i];
+        for(j=i+1; (j<n) && (Lba[j] - RunStart < UDF_DIR_INFO_BATCH_RUN); j++);
+        RunLen = Lba[j-1] - RunStart + 1;
+
+        if(!OS_SUCCESS(UDFReadSectors(Vcb, FALSE, RunStart, RunLen, FALSE, Buffer, &ReadBytes)))
+            continue;
+
+        for(ULONG k=i; k<j; k++) {
+            DirNdx = DirNdxList[k];
+            if(!OS_SUCCESS(UDFCheckTagged(Vcb, Buffer + ((Lba[k] - RunStart) << Vcb->BlockSizeBits),
+                                          Lba[k], DirNdx->FileEntryLoc.logicalBlockNum, &Ident)))
+                continue;
+            if((Ident != TID_FILE_ENTRY) && (Ident != TID_EXTENDED_FILE_ENTRY))
+                continue;
+            UDFFileEntryToDirNdx(Vcb, DirNdx, (PFILE_ENTRY)(Buffer + ((Lba[k] - RunStart) << Vcb->BlockSizeBits)));
+            if(DirNdx->FI_Flags & UDF_FI_FLAG_LINKED)
+                DirNdx->FI_Flags |= UDF_FI_FLAG_ATTR_FRESH;
+        }
+    }
+    MyFreePool__(Buffer);
+} // end UDFLoadDirInfoBatch()
+
 #ifndef UDF_READ_ONLY_BUILD
 /*
     This routine changes xxxTime field(s) in (Ext)FileEntry
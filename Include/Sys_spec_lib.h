@@ -39,6 +39,18 @@ VOID     UDFAttributesToUDF(IN PDIR_INDEX_ITEM FileDirNdx,
 NTSTATUS UDFFileDirInfoToNT(IN PVCB Vcb,
                             IN PDIR_INDEX_ITEM FileDirNdx,
                             OUT PFILE_BOTH_DIR_INFORMATION NTFileInfo);
+// fill cached DirIndex attributes from (Ext)FileEntry
+VOID     UDFFileEntryToDirNdx(IN PVCB Vcb,
+                              IN PDIR_INDEX_ITEM FileDirNdx,
+                              IN PFILE_ENTRY FileEntry);
+// max number of DirIndex entries loaded by UDFLoadDirInfoBatch()
+#define UDF_DIR_INFO_BATCH_MAX  32
+// max length of single coalesced request (in sectors)
+#define UDF_DIR_INFO_BATCH_RUN  16
+// load attributes for a page of directory query results at once
+VOID     UDFLoadDirInfoBatch(IN PVCB Vcb,
+                             IN PDIR_INDEX_ITEM* DirNdxList,
+                             IN ULONG Count);
 // convert NT time to UDF timestamp
 VOID     UDFTimeToUDF(IN LONGLONG NtTime,
                       OUT PUDF_TIME_STAMP UdfTime);
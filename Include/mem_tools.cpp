@@ -606,6 +606,287 @@ MyAllocFreeFrame(
     }
 } // end MyAllocFreeFrame()
 
+#ifdef MY_HEAP_USE_SLABS
+
+#define MY_SLAB_HDR_SIZE            MyAlignSize__(sizeof(MY_SLAB_PAGE))
+
+static const ULONG MySlabSizes[MY_SLAB_CLASSES] = {64, 128, 192, 256, 320, 384, 448, 512, 768, 1024};
+MY_SLAB_CLASS MySlabClass[MY_SLAB_CLASSES];
+UCHAR MySlabClassBySize[MY_SLAB_MAX_SIZE >> 6];
+PMY_SLAB_CPU_CACHE MySlabCpuCache = NULL;
+ULONG MySlabCpuCount;
+
+/*
+    This routine returns header of slab page containing addr or NULL
+    if addr was not allocated from slabs
+ */
+__inline
+PMY_SLAB_PAGE
+MySlabPageByAddr(
+    PCHAR addr
+    )
+{
+    PMY_SLAB_PAGE Page;
+
+    Page = (PMY_SLAB_PAGE)((ULONG_PTR)addr & ~((ULONG_PTR)PAGE_SIZE_ALIGN));
+    // first bytes of slab page are occupied by header
+    if(!MySlabCpuCache || ((PCHAR)Page + MY_SLAB_HDR_SIZE > addr))
+        return NULL;
+    if((Page->Magic != MY_SLAB_MAGIC) ||
+       (Page->Self != Page) ||
+       (Page->Class >= MY_SLAB_CLASSES))
+        return NULL;
+    return Page;
+} // end MySlabPageByAddr()
+
+/*
+    This routine takes object of specified class from slab pages,
+    new page is allocated if there are no free objects
+ */
+PCHAR
+__fastcall
+MySlabAllocFromClass(
+    ULONG c
+    )
+{
+    PMY_SLAB_CLASS Class = &MySlabClass[c];
+    PMY_SLAB_PAGE Page;
+    PCHAR addr;
+    KIRQL irql;
+    ULONG i;
+
+    KeAcquireSpinLock(&Class->Lock, &irql);
+    if(IsListEmpty(&Class->Partial)) {
+        KeReleaseSpinLock(&Class->Lock, irql);
+        // page-sized pool blocks are always page-aligned, DbgAllocatePool()
+        // may add tracking header, so call ExAllocatePoolWithTag() directly
+        Page = (PMY_SLAB_PAGE)ExAllocatePoolWithTag(NonPagedPool, PAGE_SIZE, 'bSWD');
+        if(!Page)
+            return NULL;
+        ASSERT(!((ULONG_PTR)Page & PAGE_SIZE_ALIGN));
+        Page->Magic = MY_SLAB_MAGIC;
+        Page->Class = c;
+        Page->Self = Page;
+        Page->InUse = 0;
+        Page->FreeList = NULL;
+        addr = (PCHAR)Page + MY_SLAB_HDR_SIZE;
+        for(i=0; i<Class->PerPage; i++, addr += Class->Size) {
+            *((PCHAR*)addr) = Page->FreeList;
+            Page->FreeList = addr;
+        }
+        InterlockedIncrement(&Class->Pages);
+        KeAcquireSpinLock(&Class->Lock, &irql);
+        InsertHeadList(&Class->Partial, &Page->Link);
+    }
+    Page = CONTAINING_RECORD(Class->Partial.Flink, MY_SLAB_PAGE, Link);
+    addr = Page->FreeList;
+    Page->FreeList = *((PCHAR*)addr);
+    Page->InUse++;
+    if(!Page->FreeList) {
+        // page is full
+        RemoveEntryList(&Page->Link);
+    }
+    KeReleaseSpinLock(&Class->Lock, irql);
+    return addr;
+} // end MySlabAllocFromClass()
+
+/*
+    This routine returns object to its slab page. Empty page is released
+    unless it is the only page of the class having free objects
+ */
+VOID
+__fastcall
+MySlabFreeToClass(
+    PMY_SLAB_PAGE Page,
+    PCHAR addr
+    )
+{
+    PMY_SLAB_CLASS Class = &MySlabClass[Page->Class];
+    KIRQL irql;
+
+    KeAcquireSpinLock(&Class->Lock, &irql);
+    if(!Page->FreeList) {
+        InsertHeadList(&Class->Partial, &Page->Link);
+    }
+    *((PCHAR*)addr) = Page->FreeList;
+    Page->FreeList = addr;
+    Page->InUse--;
+    if(!Page->InUse &&
+       (Class->Partial.Flink != Class->Partial.Blink)) {
+        RemoveEntryList(&Page->Link);
+    } else {
+        Page = NULL;
+    }
+    KeReleaseSpinLock(&Class->Lock, irql);
+
+    if(Page) {
+        Page->Magic = 0;
+        InterlockedDecrement(&Class->Pages);
+        ExFreePool(Page);
+    }
+} // end MySlabFreeToClass()
+
+/*
+    This routine allocates NonPaged block of size <= MY_SLAB_MAX_SIZE.
+    Common case is served by per-CPU cache without taking any lock
+ */
+PCHAR
+__fastcall
+MySlabAlloc(
+    ULONG size
+    )
+{
+    ULONG c = MySlabClassBySize[(size-1) >> 6];
+    PMY_SLAB_CLASS Class = &MySlabClass[c];
+    PMY_SLAB_CPU_CACHE Cache;
+    PCHAR addr = NULL;
+    KIRQL irql;
+    LONG live;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    Cache = &MySlabCpuCache[KeGetCurrentProcessorNumber() % MySlabCpuCount];
+    if(Cache->Count[c]) {
+        addr = Cache->Obj[c][--(Cache->Count[c])];
+    }
+    KeLowerIrql(irql);
+
+    if(!addr) {
+        addr = MySlabAllocFromClass(c);
+        if(!addr)
+            return NULL;
+    }
+
+    live = InterlockedExchangeAdd(&Class->LiveBytes, Class->Size) + Class->Size;
+    if(live > Class->PeakBytes)
+        Class->PeakBytes = live;
+
+    // this will set IntegrityTag to zero
+    *((PULONG)addr) = 0x00000000;
+    return addr;
+} // end MySlabAlloc()
+
+/*
+    This routine releases block allocated by MySlabAlloc().
+    Returns FALSE if addr doesn't belong to slabs
+ */
+BOOLEAN
+__fastcall
+MySlabFree(
+    PCHAR addr
+    )
+{
+    PMY_SLAB_PAGE Page;
+    PMY_SLAB_CLASS Class;
+    PMY_SLAB_CPU_CACHE Cache;
+    ULONG c;
+    KIRQL irql;
+
+    if(!(Page = MySlabPageByAddr(addr)))
+        return FALSE;
+    c = Page->Class;
+    Class = &MySlabClass[c];
+    ASSERT(!((addr - (PCHAR)Page - MY_SLAB_HDR_SIZE) % Class->Size));
+
+#ifdef UDF_DBG
+    // see MyFreePoolInFrame()
+    *((PULONG)addr) = 0xDEADDA7A;
+#endif
+    InterlockedExchangeAdd(&Class->LiveBytes, -(LONG)(Class->Size));
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    Cache = &MySlabCpuCache[KeGetCurrentProcessorNumber() % MySlabCpuCount];
+    if(Cache->Count[c] < MY_SLAB_CPU_CACHE_DEPTH) {
+        Cache->Obj[c][(Cache->Count[c])++] = addr;
+        addr = NULL;
+    }
+    KeLowerIrql(irql);
+
+    if(addr)
+        MySlabFreeToClass(Page, addr);
+    return TRUE;
+} // end MySlabFree()
+
+BOOLEAN
+MySlabInit(VOID)
+{
+    ULONG c, i;
+
+    RtlZeroMemory(&MySlabClass, sizeof(MySlabClass));
+    for(c=0, i=0; c<MY_SLAB_CLASSES; c++) {
+        MySlabClass[c].Size = MySlabSizes[c];
+        MySlabClass[c].PerPage = (PAGE_SIZE - MY_SLAB_HDR_SIZE) / MySlabSizes[c];
+        KeInitializeSpinLock(&MySlabClass[c].Lock);
+        InitializeListHead(&MySlabClass[c].Partial);
+        for(; (i << 6) < MySlabSizes[c]; i++) {
+            MySlabClassBySize[i] = (UCHAR)c;
+        }
+    }
+    MySlabCpuCount = KeNumberProcessors;
+    MySlabCpuCache = (PMY_SLAB_CPU_CACHE)DbgAllocatePool(NonPagedPool, MySlabCpuCount*sizeof(MY_SLAB_CPU_CACHE));
+    if(!MySlabCpuCache) {
+        // fall back to frames
+        return FALSE;
+    }
+    RtlZeroMemory(MySlabCpuCache, MySlabCpuCount*sizeof(MY_SLAB_CPU_CACHE));
+    return TRUE;
+} // end MySlabInit()
+
+VOID
+MySlabRelease(VOID)
+{
+    PMY_SLAB_CPU_CACHE Cache;
+    PMY_SLAB_PAGE Page;
+    ULONG c, i;
+
+    if(!MySlabCpuCache)
+        return;
+    // return cached objects to their pages
+    for(i=0; i<MySlabCpuCount; i++) {
+        Cache = &MySlabCpuCache[i];
+        for(c=0; c<MY_SLAB_CLASSES; c++) {
+            while(Cache->Count[c]) {
+                PCHAR addr = Cache->Obj[c][--(Cache->Count[c])];
+                MySlabFreeToClass(MySlabPageByAddr(addr), addr);
+            }
+        }
+    }
+    for(c=0; c<MY_SLAB_CLASSES; c++) {
+        while(!IsListEmpty(&MySlabClass[c].Partial)) {
+            Page = CONTAINING_RECORD(RemoveHeadList(&MySlabClass[c].Partial), MY_SLAB_PAGE, Link);
+            if(Page->InUse) {
+                UDFPrint(("Mem: %d blocks of size %x are not released\n", Page->InUse, MySlabClass[c].Size));
+            }
+            Page->Magic = 0;
+            ExFreePool(Page);
+        }
+    }
+    DbgFreePool(MySlabCpuCache);
+    MySlabCpuCache = NULL;
+} // end MySlabRelease()
+
+/*
+    This routine returns usage statistics of specified size class
+ */
+BOOLEAN
+MyAllocQuerySlabStats(
+    ULONG Class,
+    PULONG Size,
+    PULONG LiveBytes,
+    PULONG PeakBytes,
+    PULONG Pages
+    )
+{
+    if(Class >= MY_SLAB_CLASSES)
+        return FALSE;
+    (*Size) = MySlabClass[Class].Size;
+    (*LiveBytes) = MySlabClass[Class].LiveBytes;
+    (*PeakBytes) = MySlabClass[Class].PeakBytes;
+    (*Pages) = MySlabClass[Class].Pages;
+    return TRUE;
+} // end MyAllocQuerySlabStats()
+
+#endif //MY_HEAP_USE_SLABS
+
 PCHAR
 #ifndef MY_HEAP_TRACK_OWNERS
 __fastcall
@@ -629,6 +910,15 @@ MyAllocatePool(
 
     if(!size || (size > MY_HEAP_FRAME_SIZE)) return NULL;
 
+#ifdef MY_HEAP_USE_SLABS
+    if((type == NonPagedPool) && (size <= MY_SLAB_MAX_SIZE) && MySlabCpuCache) {
+        if((addr = (ULONG)MySlabAlloc(size))) {
+            DbgTouch((PVOID)addr);
+            return (PCHAR)addr;
+        }
+    }
+#endif //MY_HEAP_USE_SLABS
+
 #ifdef DUMP_MEM_FRAMES2
     if(MyDumpMem)
         MyAllocDumpFrames();
@@ -732,6 +1022,11 @@ MyFreePool(
 
 //    UDFPrint(("MemFrames: %x\n",FrameCount));
 
+#ifdef MY_HEAP_USE_SLABS
+    if(MySlabFree(addr))
+        return;
+#endif //MY_HEAP_USE_SLABS
+
     LockMemoryManager();
     i = MyFindFrameByAddr(addr);
     if(i < 0) {
@@ -795,6 +1090,31 @@ MyReallocPool(
         return 0;
     }
 
+#ifdef MY_HEAP_USE_SLABS
+    PMY_SLAB_PAGE Page;
+    if((Page = MySlabPageByAddr(addr))) {
+        if(NewLength <= MySlabClass[Page->Class].Size) {
+            // fits into the same slot
+            return NewLength;
+        }
+        new_buff = MyAllocatePool(NonPagedPool, MyAlignSize__(NewLength)
+#ifdef MY_HEAP_TRACK_OWNERS
+                                                                      ,Src,Line
+#endif
+#ifdef MY_HEAP_TRACK_REF
+                                                                               ,NULL
+#endif //MY_HEAP_TRACK_REF
+                                                                                );
+        if(!new_buff)
+            return 0;
+        if(OldLength > NewLength) OldLength = NewLength;
+        RtlCopyMemory(new_buff, addr, OldLength);
+        MySlabFree(addr);
+        (*NewBuff) = new_buff;
+        return OldLength;
+    }
+#endif //MY_HEAP_USE_SLABS
+
     LockMemoryManager();
     i = MyFindFrameByAddr(addr);
     if(i < 0) {
@@ -903,6 +1223,14 @@ MyFindMemBaseByAddr(
 {
     ULONG Frame, Base, i;
 
+#ifdef MY_HEAP_USE_SLABS
+    PMY_SLAB_PAGE Page;
+    if((Page = MySlabPageByAddr(addr))) {
+        i = (ULONG)(addr - (PCHAR)Page - MY_SLAB_HDR_SIZE) / MySlabClass[Page->Class].Size;
+        return (LONG)((PCHAR)Page + MY_SLAB_HDR_SIZE + i*MySlabClass[Page->Class].Size);
+    }
+#endif //MY_HEAP_USE_SLABS
+
     LockMemoryManager();
     Frame = MyFindFrameByAddr(addr);
     if(Frame < 0) {
@@ -927,6 +1255,9 @@ MyAllocInit(VOID)
     }
     MyAllocInitFrame(NonPagedPool, 0);
     LastFrame = 0;
+#ifdef MY_HEAP_USE_SLABS
+    MySlabInit();
+#endif //MY_HEAP_USE_SLABS
     return (MyMemInitialized = TRUE);
 } // end MyAllocInit()
 
@@ -938,6 +1269,9 @@ MyAllocRelease(VOID)
 
     if(!MyMemInitialized)
         return;
+#ifdef MY_HEAP_USE_SLABS
+    MySlabRelease();
+#endif //MY_HEAP_USE_SLABS
     LockMemoryManager();
     for(i=0;i<MY_HEAP_MAX_FRAMES; i++) {
         if(Allocs = FrameList[i].Frame) {
@@ -39,6 +39,38 @@ typedef struct _MEM_FRAME_ALLOC_DESC {
     ULONG Type;
 } MEM_FRAME_ALLOC_DESC, *PMEM_FRAME_ALLOC_DESC;
 
+// Small NonPaged blocks are served by size-class slabs, one page each.
+// Slab page starts with MY_SLAB_PAGE header, objects follow it
+#define MY_SLAB_MAGIC               0x626c6153  // 'Slab'
+#define MY_SLAB_CLASSES             10
+#define MY_SLAB_MAX_SIZE            1024
+#define MY_SLAB_CPU_CACHE_DEPTH     16
+
+typedef struct _MY_SLAB_PAGE {
+    ULONG Magic;
+    ULONG Class;
+    struct _MY_SLAB_PAGE* Self;
+    LIST_ENTRY Link;        // link in class list of pages having free objects
+    PCHAR FreeList;
+    ULONG InUse;
+} MY_SLAB_PAGE, *PMY_SLAB_PAGE;
+
+typedef struct _MY_SLAB_CLASS {
+    ULONG Size;
+    ULONG PerPage;
+    KSPIN_LOCK Lock;
+    LIST_ENTRY Partial;     // pages having free objects
+    LONG Pages;
+    LONG LiveBytes;
+    LONG PeakBytes;
+} MY_SLAB_CLASS, *PMY_SLAB_CLASS;
+
+// accessed only at DISPATCH_LEVEL on owning CPU, so it needs no lock
+typedef struct _MY_SLAB_CPU_CACHE {
+    ULONG Count[MY_SLAB_CLASSES];
+    PCHAR Obj[MY_SLAB_CLASSES][MY_SLAB_CPU_CACHE_DEPTH];
+} MY_SLAB_CPU_CACHE, *PMY_SLAB_CPU_CACHE;
+
 extern PCHAR BreakAddr;
 extern ULONG MemTotalAllocated;
 
@@ -110,6 +142,12 @@ VOID __fastcall MyFreePool(PCHAR addr);
 
 #define MyFreePool__(addr) MyFreePool((PCHAR)(addr))
 
+#ifdef MY_HEAP_USE_SLABS
+BOOLEAN MyAllocQuerySlabStats(ULONG Class, PULONG Size, PULONG LiveBytes, PULONG PeakBytes, PULONG Pages);
+#else //MY_HEAP_USE_SLABS
+#define MyAllocQuerySlabStats(Class, Size, LiveBytes, PeakBytes, Pages) (FALSE)
+#endif //MY_HEAP_USE_SLABS
+
 #ifdef MY_HEAP_TRACK_OWNERS
 #define MyReallocPool__(addr, len, pnewaddr, newlen) MyReallocPool((PCHAR)(addr), MyAlignSize__(len), pnewaddr, MyAlignSize__(newlen), UDF_BUG_CHECK_ID, __LINE__)
 #else
@@ -139,6 +177,7 @@ MyFindMemBaseByAddr(
 
 BOOLEAN inline MyAllocInit(VOID) {return TRUE;}
 #define MyAllocRelease()
+#define MyAllocQuerySlabStats(Class, Size, LiveBytes, PeakBytes, Pages) (FALSE)
 
 #ifndef MY_MEM_BOUNDS_CHECK
 
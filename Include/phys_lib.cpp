@@ -243,21 +243,21 @@ UDFTIOVerify(
         RtlZeroMemory(p, Vcb->BlockSize);
 
         // check if block valid
-        if(Vcb->BSBM_Bitmap) {
-            if(UDFGetBit((uint32*)(Vcb->BSBM_Bitmap), UDFRelocateSector(Vcb, lba0+i))) {
+        if(UDFSparseBitmapInited(&(Vcb->BSBM_Bitmap))) {
+            if(UDFSparseGetBit(&(Vcb->BSBM_Bitmap), UDFRelocateSector(Vcb, lba0+i))) {
                 UDFPrint(("  remap: known BB @ %x, mapped to %x\n", lba0+i, UDFRelocateSector(Vcb, lba0+i)));
                 need_remap = TRUE;
             }
         }
         zero = FALSE;
-        if(Vcb->FSBM_Bitmap) {
-            if(UDFGetFreeBit((uint32*)(Vcb->FSBM_Bitmap), lba0+i)) {
+        if(UDFSparseBitmapInited(&(Vcb->FSBM_Bitmap))) {
+            if(UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), lba0+i)) {
                 UDFPrint(("  unused @ %x\n", lba0+i));
                 zero = TRUE;
             }
         }
-        if(!zero && Vcb->ZSBM_Bitmap) {
-            if(UDFGetZeroBit((uint32*)(Vcb->ZSBM_Bitmap), lba0+i)) {
+        if(!zero && UDFSparseBitmapInited(&(Vcb->ZSBM_Bitmap))) {
+            if(UDFSparseGetZeroBit(&(Vcb->ZSBM_Bitmap), lba0+i)) {
                 UDFPrint(("  unused @ %x (Z)\n", lba0+i));
                 zero = TRUE;
             }
@@ -347,11 +347,24 @@ UDFTIOVerify(
 
         if(!packet_ok || need_remap) {
             UDFPrint(("  block in bad packet @ %x\n", lba0+i));
-            if(Vcb->BSBM_Bitmap) {
-                UDFSetBit(Vcb->BSBM_Bitmap, lba0+i);
+            if(UDFSparseBitmapInited(&(Vcb->BSBM_Bitmap))) {
+                UDFSparseSetBit(&(Vcb->BSBM_Bitmap), lba0+i);
             }
-            if(Vcb->FSBM_Bitmap) {
-                UDFSetUsedBit(Vcb->FSBM_Bitmap, lba0+i);
+            if(UDFSparseBitmapInited(&(Vcb->FSBM_Bitmap))) {
+                // BitMapResource1 may be already owned exclusively by this
+                // thread (e.g. when space bitmaps are flushed), so don't
+                // touch free block counters here, let UDFGetPartFreeSpace()
+                // rebuild them. Invalidation is made under the resource,
+                // so concurrent recount can't publish stale counters
+                UDFAcquireResourceExclusive(&(Vcb->BitMapResource1),TRUE);
+                Vcb->FSBM_FreeCountValid = FALSE;
+                if(UDFSparseSetUsedBit(&(Vcb->FSBM_Bitmap), lba0+i)) {
+                    UDFSetBitmapDirty(Vcb, lba0+i, 1);
+                } else {
+                    // remains free, but BSBM keeps allocator away from it
+                    UDFPrint(("  can't mark BB @ %x as used\n", lba0+i));
+                }
+                UDFReleaseResource(&(Vcb->BitMapResource1));
             }
         }
 
@@ -844,16 +857,12 @@ UDFPrepareForWriteOperation(
 #ifndef UDF_READ_ONLY_BUILD
 
 #ifdef _UDF_STRUCTURES_H_
-    if(Vcb->BSBM_Bitmap) {
-        ULONG i;
-        for(i=0; i<BCount; i++) {
-            if(UDFGetBit((uint32*)(Vcb->BSBM_Bitmap), Lba+i)) {
-                UDFPrint(("W: Known BB @ %#x\n", Lba));
-                //return STATUS_FT_WRITE_RECOVERY; // this shall not be treated as error and
-                                                   // we shall get IO request to BAD block
-                return STATUS_DEVICE_DATA_ERROR;
-            }
-        }
+    // clear regions of BSBM are skipped without per-block checks
+    if(UDFSparseTestBits(&(Vcb->BSBM_Bitmap), Lba, BCount)) {
+        UDFPrint(("W: Known BB @ %#x\n", Lba));
+        //return STATUS_FT_WRITE_RECOVERY; // this shall not be treated as error and
+                                           // we shall get IO request to BAD block
+        return STATUS_DEVICE_DATA_ERROR;
     }
 #endif //_UDF_STRUCTURES_H_
 
@@ -1458,16 +1467,12 @@ UDFPrepareForReadOperation(
 #endif //_BROWSE_UDF_
 
 #ifdef _UDF_STRUCTURES_H_
-    if(Vcb->BSBM_Bitmap) {
-        ULONG i;
-        for(i=0; i<BCount; i++) {
-            if(UDFGetBit((uint32*)(Vcb->BSBM_Bitmap), Lba+i)) {
-                UDFPrint(("R: Known BB @ %#x\n", Lba));
-                //return STATUS_FT_WRITE_RECOVERY; // this shall not be treated as error and
-                                                   // we shall get IO request to BAD block
-                return STATUS_DEVICE_DATA_ERROR;
-            }
-        }
+    // clear regions of BSBM are skipped without per-block checks
+    if(UDFSparseTestBits(&(Vcb->BSBM_Bitmap), Lba, BCount)) {
+        UDFPrint(("R: Known BB @ %#x\n", Lba));
+        //return STATUS_FT_WRITE_RECOVERY; // this shall not be treated as error and
+                                           // we shall get IO request to BAD block
+        return STATUS_DEVICE_DATA_ERROR;
     }
 #endif //_UDF_STRUCTURES_H_
 
@@ -1649,6 +1654,71 @@ UDFReadData(
     return status;
 } // end UDFReadData()
 
+/*
+    This routine checks if block-aligned transfer of specified size
+    may go directly to device, bypassing WCache
+ */
+BOOLEAN
+UDFCanBypassWCache(
+    IN PVCB Vcb,
+    IN int64 Offset,
+    IN SIZE_T Length
+    )
+{
+    if((Length < UDF_DIRECT_IO_THRESHOLD) ||
+       (Offset & (Vcb->BlockSize-1)) ||
+       Vcb->CDR_Mode ||
+       (Vcb->VCBFlags & UDF_VCB_FLAGS_DEAD))
+        return FALSE;
+    // WCache is the only place where packets are assembled on
+    // sequential media, so only HDD-like devices are handled here
+    if(!Vcb->FastCache.ReadProc ||
+       (WCacheGetMode__(&(Vcb->FastCache)) != WCACHE_MODE_RAM) ||
+       (KeGetCurrentIrql() >= DISPATCH_LEVEL))
+        return FALSE;
+    return TRUE;
+} // end UDFCanBypassWCache()
+
+/*
+    This routine reads data for non-cached request. Large block-aligned
+    transfers are read directly into caller's buffer after modified
+    cached copies of requested blocks are flushed. Other requests are
+    passed to UDFReadData()
+ */
+OSSTATUS
+UDFReadDataNoCache(
+    IN PVCB Vcb,
+    IN int64 Offset,
+    IN uint32 Length,
+    OUT int8* Buffer,
+    OUT PSIZE_T ReadBytes
+    )
+{
+    uint32 Lba, BCount;
+    uint32 BSh = Vcb->BlockSizeBits;
+    OSSTATUS status;
+    SIZE_T _ReadBytes = 0;
+
+    (*ReadBytes) = 0;
+    if(!UDFCanBypassWCache(Vcb, Offset, Length))
+        return UDFReadData(Vcb, TRUE, Offset, Length, FALSE, Buffer, ReadBytes);
+
+    Lba = (uint32)(Offset >> BSh);
+    BCount = Length >> BSh;
+    // device must see data modified in cache
+    status = WCacheFlushBlocks__(&(Vcb->FastCache), Vcb, Lba, BCount);
+    if(!OS_SUCCESS(status))
+        return UDFReadData(Vcb, TRUE, Offset, Length, FALSE, Buffer, ReadBytes);
+    status = UDFTRead(Vcb, Buffer, BCount << BSh, Lba, ReadBytes);
+    if(!OS_SUCCESS(status) || !(Length & (Vcb->BlockSize-1)))
+        return status;
+    // read head of the last sector
+    status = UDFReadData(Vcb, TRUE, Offset + (BCount << BSh), Length & (Vcb->BlockSize-1),
+                         FALSE, Buffer + (BCount << BSh), &_ReadBytes);
+    (*ReadBytes) += _ReadBytes;
+    return status;
+} // end UDFReadDataNoCache()
+
 #endif //_BROWSE_UDF_
 
 #ifndef UDF_READ_ONLY_BUILD
@@ -1687,7 +1757,7 @@ UDFWriteSectors(
         status = WCacheWriteBlocks__(&(Vcb->FastCache), Vcb, Buffer, Lba, BCount, WrittenBytes, Direct);
         ASSERT(OS_SUCCESS(status));
 #ifdef _BROWSE_UDF_
-        UDFClrZeroBits(Vcb->ZSBM_Bitmap, Lba, BCount);
+        UDFSparseClrZeroBits(&(Vcb->ZSBM_Bitmap), Lba, BCount);
 #endif //_BROWSE_UDF_
         return status;
     }
@@ -1695,7 +1765,7 @@ UDFWriteSectors(
     status = UDFTWrite(Vcb, Buffer, BCount<<Vcb->BlockSizeBits, Lba, WrittenBytes);
     ASSERT(OS_SUCCESS(status));
 #ifdef _BROWSE_UDF_
-    UDFClrZeroBits(Vcb->ZSBM_Bitmap, Lba, BCount);
+    UDFSparseClrZeroBits(&(Vcb->ZSBM_Bitmap), Lba, BCount);
 #endif //_BROWSE_UDF_
     return status;
 } // end UDFWriteSectors()
@@ -1737,7 +1807,7 @@ UDFWriteInSector(
         status = WCacheDirect__(&(Vcb->FastCache), Vcb, Lba, TRUE, &tmp_buff, Direct);
         if(OS_SUCCESS(status)) {
 #ifdef _BROWSE_UDF_
-            UDFClrZeroBit(Vcb->ZSBM_Bitmap, Lba);
+            UDFSparseClrZeroBit(&(Vcb->ZSBM_Bitmap), Lba);
 #endif //_BROWSE_UDF_
             (*WrittenBytes) += l;
             RtlCopyMemory(tmp_buff+i, Buffer, l);
@@ -1819,7 +1889,7 @@ UDFWriteData(
         if(!OS_SUCCESS(status)) return status;
         l = i<<BSh;
 #ifdef _BROWSE_UDF_
-        UDFClrZeroBits(Vcb->ZSBM_Bitmap, Lba, i);
+        UDFSparseClrZeroBits(&(Vcb->ZSBM_Bitmap), Lba, i);
 #endif //_BROWSE_UDF_
         if(!(Length = Length - l)) return STATUS_SUCCESS;
         Lba += i;
@@ -1828,10 +1898,62 @@ UDFWriteData(
     status = UDFWriteInSector(Vcb, Translate, Lba, 0, Length, Direct, Buffer, &_WrittenBytes);
     (*WrittenBytes) += _WrittenBytes;
 #ifdef _BROWSE_UDF_
-    UDFClrZeroBit(Vcb->ZSBM_Bitmap, Lba);
+    UDFSparseClrZeroBit(&(Vcb->ZSBM_Bitmap), Lba);
 #endif //_BROWSE_UDF_
 
     return status;
 } // end UDFWriteData()
 
+#ifdef _BROWSE_UDF_
+/*
+    This routine writes data for non-cached request. Large block-aligned
+    transfers are written directly from caller's buffer, cached copies
+    of overwritten blocks are discarded. Other requests are passed to
+    UDFWriteData()
+ */
+OSSTATUS
+UDFWriteDataNoCache(
+    IN PVCB Vcb,
+    IN int64 Offset,
+    IN SIZE_T Length,
+    IN int8* Buffer,
+    OUT PSIZE_T WrittenBytes
+    )
+{
+    uint32 Lba, BCount;
+    uint32 BSh = Vcb->BlockSizeBits;
+    OSSTATUS status;
+    SIZE_T _WrittenBytes = 0;
+
+    (*WrittenBytes) = 0;
+    if(!UDFCanBypassWCache(Vcb, Offset, Length))
+        return UDFWriteData(Vcb, TRUE, Offset, Length, FALSE, Buffer, WrittenBytes);
+
+    Vcb->VCBFlags |= UDF_VCB_SKIP_EJECT_CHECK;
+    if(!Vcb->Modified || (Vcb->IntegrityType == INTEGRITY_TYPE_CLOSE)) {
+        UDFSetModified(Vcb);
+        if(Vcb->LVid)
+            status = UDFUpdateLogicalVolInt(Vcb,FALSE);
+    }
+
+    Lba = (uint32)(Offset >> BSh);
+    BCount = (uint32)(Length >> BSh);
+    // old modified copies must not be flushed over new data
+    WCacheDiscardBlocks__(&(Vcb->FastCache), Vcb, Lba, BCount);
+    status = UDFTWrite(Vcb, Buffer, ((SIZE_T)BCount) << BSh, Lba, WrittenBytes);
+    // drop copies read in while the write was in progress
+    WCacheDiscardBlocks__(&(Vcb->FastCache), Vcb, Lba, BCount);
+    if(!OS_SUCCESS(status))
+        return status;
+    UDFSparseClrZeroBits(&(Vcb->ZSBM_Bitmap), Lba, BCount);
+    if(!(Length & (Vcb->BlockSize-1)))
+        return status;
+    // write head of the last sector
+    status = UDFWriteData(Vcb, TRUE, Offset + (BCount << BSh), Length & (Vcb->BlockSize-1),
+                          FALSE, Buffer + (BCount << BSh), &_WrittenBytes);
+    (*WrittenBytes) += _WrittenBytes;
+    return status;
+} // end UDFWriteDataNoCache()
+#endif //_BROWSE_UDF_
+
 #endif //UDF_READ_ONLY_BUILD
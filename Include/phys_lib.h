@@ -143,6 +143,23 @@ OSSTATUS UDFWriteData(IN PVCB Vcb,
                       IN PCHAR Buffer,
                       OUT PSIZE_T WrittenBytes);
 
+// check if non-cached transfer may bypass WCache
+BOOLEAN UDFCanBypassWCache(IN PVCB Vcb,
+                           IN LONGLONG Offset,
+                           IN SIZE_T Length);
+// read data for non-cached request
+OSSTATUS UDFReadDataNoCache(IN PVCB Vcb,
+                            IN LONGLONG Offset,
+                            IN ULONG Length,
+                            OUT PCHAR Buffer,
+                            OUT PSIZE_T ReadBytes);
+// write data for non-cached request
+OSSTATUS UDFWriteDataNoCache(IN PVCB Vcb,
+                             IN LONGLONG Offset,
+                             IN SIZE_T Length,
+                             IN PCHAR Buffer,
+                             OUT PSIZE_T WrittenBytes);
+
 OSSTATUS UDFResetDeviceDriver(IN PVCB Vcb,
                               IN PDEVICE_OBJECT TargetDeviceObject,
                               IN BOOLEAN Unlock);
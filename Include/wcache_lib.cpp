@@ -6,6 +6,20 @@
 
 /*********************************************************************/
 
+#ifdef UDF_LOCK_PROFILER
+#define WCacheInitLock(Cache)         DLDProfInitializeResource(&((Cache)->WCacheLock), DLD_PROF_WCACHE)
+#define WCacheDeleteLock(Cache)       DLDProfDeleteResource(&((Cache)->WCacheLock))
+#define WCacheAcquireExclusive(Cache) DLDProfAcquire(&((Cache)->WCacheLock), TRUE, DLD_PROF_EXCLUSIVE, UDF_BUG_CHECK_ID, __LINE__)
+#define WCacheAcquireShared(Cache)    DLDProfAcquire(&((Cache)->WCacheLock), TRUE, DLD_PROF_SHARED, UDF_BUG_CHECK_ID, __LINE__)
+#define WCacheReleaseLock(Cache)      DLDProfRelease(&((Cache)->WCacheLock))
+#else //UDF_LOCK_PROFILER
+#define WCacheInitLock(Cache)         ExInitializeResourceLite(&((Cache)->WCacheLock))
+#define WCacheDeleteLock(Cache)       ExDeleteResourceLite(&((Cache)->WCacheLock))
+#define WCacheAcquireExclusive(Cache) ExAcquireResourceExclusiveLite(&((Cache)->WCacheLock), TRUE)
+#define WCacheAcquireShared(Cache)    ExAcquireResourceSharedLite(&((Cache)->WCacheLock), TRUE)
+#define WCacheReleaseLock(Cache)      ExReleaseResourceForThreadLite(&((Cache)->WCacheLock), ExGetCurrentResourceThread())
+#endif //UDF_LOCK_PROFILER
+
 OSSTATUS __fastcall WCacheCheckLimits(IN PW_CACHE Cache,
                              IN PVOID Context,
                              IN lba_t ReqLba,
@@ -51,6 +65,12 @@ OSSTATUS __fastcall WCacheDecodeFlags(IN PW_CACHE Cache,
 
 #define WCACHE_MAX_CHAIN      (0x10)
 
+// PrefereWrite values for WCacheUpdatePacket()
+#define WCACHE_UPDATE_NO_WRITE  FALSE // write nothing, return STATUS_RETRY
+#define WCACHE_UPDATE_FORCE     TRUE  // write packet
+#define WCACHE_UPDATE_COMBINE   2     // write packet if it doesn't require
+                                      //   read from media or is aged
+
 #define MEM_WCCTX_TAG         'xtCW'
 #define MEM_WCFRM_TAG         'rfCW'
 #define MEM_WCBUF_TAG         'fbCW'
@@ -91,6 +111,14 @@ ValidateFrameBlocksList(
     IN PW_CACHE Cache,
     IN lba_t Lba);
 
+__inline
+ULONG
+WCacheGetSortedListIndex(
+    IN ULONG BlockCount,      // number of items in array (pointed by List)
+    IN lba_t* List,           // pointer to sorted (ASC) array of ULONGs
+    IN lba_t Lba              // ULONG value to be searched for
+    );
+
 /*********************************************************************/
 ULONG WCache_random;
 
@@ -291,12 +319,23 @@ WCacheInit__(
             UDFPrint(("Cache init err 5.R\n"));
             try_return(RC = STATUS_INSUFFICIENT_RESOURCES);
         }
+        // adjacent packets are merged into transfers of up to
+        // MaxBytesToRead bytes (but not longer than max chain)
+        Cache->MaxWriteBlocks = min((ULONG)(MaxBytesToRead >> BlockSizeSh) & ~(PacketSize-1),
+                                    WCACHE_MAX_CHAIN*PacketSize);
+        if(Cache->MaxWriteBlocks < PacketSize)
+            Cache->MaxWriteBlocks = PacketSize;
+        if(!(Cache->tmp_buff_w =
+            (PCHAR)MyAllocatePoolTag__(NonPagedPool, Cache->MaxWriteBlocks*BlockSize, MEM_WCFRM_TAG))) {
+            UDFPrint(("Cache init err 5.M\n"));
+            try_return(RC = STATUS_INSUFFICIENT_RESOURCES);
+        }
         if(!(Cache->reloc_tab =
             (PULONG)MyAllocatePoolTag__(NonPagedPool, Cache->PacketSize*sizeof(ULONG), MEM_WCFRM_TAG))) {
             UDFPrint(("Cache init err 6\n"));
             try_return(RC = STATUS_INSUFFICIENT_RESOURCES);
         }
-        if(!OS_SUCCESS(RC = ExInitializeResourceLite(&(Cache->WCacheLock)))) {
+        if(!OS_SUCCESS(RC = WCacheInitLock(Cache))) {
             UDFPrint(("Cache init err (res)\n"));
             try_return(RC);
         }
@@ -310,7 +349,7 @@ try_exit: NOTHING;
 
         if(!OS_SUCCESS(RC)) {
             if(res_init_flags & WCLOCK_RES)
-                ExDeleteResourceLite(&(Cache->WCacheLock));
+                WCacheDeleteLock(Cache);
             if(Cache->FrameList)
                 MyFreePool__(Cache->FrameList);
             if(Cache->CachedBlocksList)
@@ -323,6 +362,8 @@ try_exit: NOTHING;
                 MyFreePool__(Cache->tmp_buff_r);
             if(Cache->tmp_buff)
                 MyFreePool__(Cache->tmp_buff);
+            if(Cache->tmp_buff_w)
+                MyFreePool__(Cache->tmp_buff_w);
             if(Cache->reloc_tab)
                 MyFreePool__(Cache->reloc_tab);
             RtlZeroMemory(Cache, sizeof(W_CACHE));
@@ -349,7 +390,10 @@ WCacheRandom(VOID)
 
 /*
   WCacheFindLbaToRelease() finds Block to be flushed and purged from cache
-  Returns random LBA
+  Cached blocks are released in C-SCAN order: the 1st cached block
+  following previously released packet is returned, the scan wraps
+  to the lowest cached LBA at the end of the list. Thus, evicted
+  packets are written out in ascending order.
   Internal routine
  */
 lba_t
@@ -358,9 +402,17 @@ WCacheFindLbaToRelease(
     IN PW_CACHE Cache
     )
 {
+    ULONG i;
+    lba_t Lba;
+
     if(!(Cache->BlockCount))
         return WCACHE_INVALID_LBA;
-    return(Cache->CachedBlocksList[((ULONG)WCacheRandom() % Cache->BlockCount)]);
+    i = WCacheGetSortedListIndex(Cache->BlockCount, Cache->CachedBlocksList, Cache->ReleaseLba);
+    if(i >= Cache->BlockCount)
+        i = 0;
+    Lba = Cache->CachedBlocksList[i];
+    Cache->ReleaseLba = (Lba & ~(Cache->PacketSize-1)) + Cache->PacketSize;
+    return Lba;
 } // end WCacheFindLbaToRelease()
 
 /*
@@ -383,7 +435,9 @@ WCacheFindModifiedLbaToRelease(
 /*
   WCacheFindFrameToRelease() finds Frame to be flushed and purged with all
   Blocks (from this Frame) from cache
-  Returns random Frame number
+  Returns least used Frame number. Among equally used Frames the nearest
+  one following the last written block is chosen (C-SCAN order).
+  If there are no modified Frames, random Frame number is returned.
   Internal routine
  */
 lba_t
@@ -397,6 +451,7 @@ WCacheFindFrameToRelease(
     ULONG prev_uc = -1;
     ULONG uc = -1;
     lba_t lba;
+    lba_t dist = WCACHE_INVALID_LBA;
     BOOLEAN mod = FALSE;
 
     if(!(Cache->FrameCount))
@@ -412,9 +467,12 @@ WCacheFindFrameToRelease(
         mod |= (Cache->FrameList[j].UpdateCount != 0);
         uc = Cache->FrameList[j].UpdateCount*32 + Cache->FrameList[j].AccessCount;
 
-        if(prev_uc > uc) {
+        lba = (j << Cache->BlocksPerFrameSh) - Cache->LastWrittenLba;
+        if((prev_uc > uc) ||
+           ((prev_uc == uc) && (lba < dist))) {
             prev_uc = uc;
             frame = j;
+            dist = lba;
         }
     }
     if(!mod) {
@@ -903,6 +961,10 @@ WCacheRaiseIoError(
   If packet containing target Block is modified and PrefereWrite flag
   is NOT set, function returns with status STATUS_RETRY. This setting is
   user in WCACHE_MODE_R mode to reduce physical writes on flush.
+  If PrefereWrite is WCACHE_UPDATE_COMBINE, partially modified packet,
+  that must be read from media, is kept in cache (STATUS_RETRY) until it is
+  completed by further writes or gets older than WCACHE_PACKET_MAX_AGE.
+  Non-cached blocks, that are not read from media, are written as zeros.
   'State' parameter is used in async mode to determine the next processing
   stege for given request
   Internal routine
@@ -972,6 +1034,11 @@ WCacheUpdatePacket(
     if(mod && !PrefereWrite) {
         return STATUS_RETRY;
     }
+    // keep partially modified packet for write combining
+    if(mod && read && (PrefereWrite == WCACHE_UPDATE_COMBINE) &&
+       (Cache->WriteSeq - Cache->FrameList[firstLba >> Cache->BlocksPerFrameSh].LastWriteSeq) < WCACHE_PACKET_MAX_AGE) {
+        return STATUS_RETRY;
+    }
     // return STATUS_SUCCESS if requested packet contains no modified blocks
     if(!mod) {
         (*ReadBytes) = PS;
@@ -979,6 +1046,9 @@ WCacheUpdatePacket(
     }
 
     // pefrorm full update cycle: prepare(optional)/read/modify/write
+    Cache->PacketWrites++;
+    if(read)
+        Cache->PacketReads++;
 
     // do some preparations
     if(Chained || Async) {
@@ -1021,8 +1091,9 @@ WCacheUpdatePacket(
                 return status;
             }
         }
-    } else
-    if(zero) {
+    } else {
+        // pre-zero packet instead of reading it: all non-cached blocks are
+        // either zero-filled or unallocated
         RtlZeroMemory(tmp_buff, PS);
     }
 
@@ -1091,6 +1162,7 @@ try_write:
                 status = WCacheRaiseIoError(Cache, Context, status, Lba, PSs, tmp_buff2, WCACHE_W_OP, NULL);
             }
         }
+        Cache->LastWrittenLba = Lba + (PS >> Cache->BlockSizeSh);
     } else {
         if(Async)
             WCacheCompleteAsync__(WContext, STATUS_SUCCESS);
@@ -1126,6 +1198,57 @@ WCacheFreePacket(
     }
 } // end WCacheFreePacket()
 
+/*
+  WCacheWriteChainRun() gathers chained packets, which are prepared for
+  writing and follow each other on media, into single transfer of up to
+  MaxWriteBlocks blocks and writes them out.
+  Returns the last context of written run or NULL if the packet has no
+  adjacent prepared packets (it shall be written by WCacheUpdatePacket()).
+  Internal routine
+ */
+PW_CACHE_ASYNC
+WCacheWriteChainRun(
+    IN PW_CACHE Cache,        // pointer to the Cache Control structure
+    IN PVOID Context,         // user-supplied context for IO callbacks
+    IN PW_CACHE_ASYNC WContext // 1st context of the run
+    )
+{
+    PW_CACHE_ASYNC LastWContext = WContext;
+    PW_CACHE_ASYNC NextWContext;
+    ULONG PS = Cache->BlockSize << Cache->PacketSizeSh; // packet size (bytes)
+    ULONG PSs = Cache->PacketSize;
+    ULONG n = 1;
+    ULONG i;
+    SIZE_T WrittenBytes;
+    OSSTATUS status;
+
+    if(Cache->ReadProcAsync && Cache->WriteProcAsync)
+        return NULL;
+    while((n+1)*PSs <= Cache->MaxWriteBlocks &&
+          (NextWContext = LastWContext->NextWContext) &&
+          NextWContext->Cmd == ASYNC_CMD_UPDATE &&
+          NextWContext->State == ASYNC_STATE_WRITE_PRE &&
+          NextWContext->Lba == LastWContext->Lba + PSs) {
+        LastWContext = NextWContext;
+        n++;
+    }
+    if(n < 2)
+        return NULL;
+
+    NextWContext = WContext;
+    for(i=0; i<n; i++) {
+        DbgCopyMemory(Cache->tmp_buff_w + i*PS, NextWContext->Buffer, PS);
+        NextWContext->State = ASYNC_STATE_DONE;
+        NextWContext = NextWContext->NextWContext;
+    }
+    status = Cache->WriteProc(Context, Cache->tmp_buff_w, n*PS, WContext->Lba, &WrittenBytes, 0);
+    if(!OS_SUCCESS(status)) {
+        WCacheRaiseIoError(Cache, Context, status, WContext->Lba, n*PSs, Cache->tmp_buff_w, WCACHE_W_OP, NULL);
+    }
+    Cache->LastWrittenLba = WContext->Lba + n*PSs;
+    return LastWContext;
+} // end WCacheWriteChainRun()
+
 /*
   WCacheUpdatePacketComplete() is called to continue processing of packet
   being updated.
@@ -1147,6 +1270,7 @@ WCacheUpdatePacketComplete(
     if(!WContext)
         return;
     PW_CACHE_ASYNC NextWContext;
+    PW_CACHE_ASYNC LastWContext;
     ULONG PS = Cache->BlockSize << Cache->PacketSizeSh; // packet size (bytes)
     ULONG PSs = Cache->PacketSize;
     ULONG frame;
@@ -1169,6 +1293,11 @@ WCacheUpdatePacketComplete(
            WContext->State == ASYNC_STATE_WRITE_PRE) {
             // invoke physical write it the packet is prepared for writing
             // by previuous call to WCacheUpdatePacket()
+            // Adjacent prepared packets are written by single request.
+            if((LastWContext = WCacheWriteChainRun(Cache, Context, WContext))) {
+                WContext = LastWContext->NextWContext;
+                continue;
+            }
             WContext->State = ASYNC_STATE_WRITE;
             WCacheUpdatePacket(Cache, Context, NULL, &WContext, NULL, -1, WContext->Lba, -1, -1,
                                PS, -1, &(WContext->TransferredBytes), TRUE, ASYNC_STATE_WRITE);
@@ -1311,6 +1440,8 @@ WCacheCheckLimitsRW(
     PW_CACHE_ASYNC FirstWContext = NULL;
     PW_CACHE_ASYNC PrevWContext = NULL;
     ULONG chain_count = 0;
+    LONGLONG StartTime = 0;
+    LONGLONG CurTime;
 
     if(Cache->FrameCount >= Cache->MaxFrames) {
         FreeFrameCount = Cache->FramesToKeepFree;
@@ -1335,6 +1466,8 @@ Try_Another_Frame:
                 break;
         }
 
+        if(!StartTime)
+            StartTime = KeQueryInterruptTime();
         frame = WCacheFindFrameToRelease(Cache);
 #if 0
         if(Cache->FrameList[frame].WriteCount) {
@@ -1396,6 +1529,15 @@ Try_Another_Frame:
         WCacheRemoveRangeFromList(Cache->CachedModifiedBlocksList, &(Cache->WriteCount), firstLba, Cache->BlocksPerFrame);
 
         WCacheRemoveFrame(Cache, Context, frame);
+
+        // don't spend more than WCACHE_FLUSH_BUDGET on extra free frames
+        if(FreeFrameCount && (Cache->FrameCount < Cache->MaxFrames)) {
+            CurTime = KeQueryInterruptTime();
+            if(CurTime - StartTime > WCACHE_FLUSH_BUDGET) {
+                WcPrint(("WC:flush budget, %x frames left\n", FreeFrameCount));
+                FreeFrameCount = 0;
+            }
+        }
     }
 
     // check if we try to read too much data
@@ -1429,8 +1571,13 @@ Try_Another_Block:
         }
 
         // write packet out or prepare and add to chain (if chained mode enabled)
+        // Prefer unmodified packets, then ones that can be written without
+        // Read/Modify/Write. Partially modified packets are flushed last.
         status = WCacheUpdatePacket(Cache, Context, &FirstWContext, &PrevWContext, block_array, firstLba,
-            Lba, BSh, BS, PS, PSs, &ReadBytes, (try_count >= MAX_TRIES_FOR_NA), ASYNC_STATE_NONE);
+            Lba, BSh, BS, PS, PSs, &ReadBytes,
+            (try_count < MAX_TRIES_FOR_NA) ? WCACHE_UPDATE_NO_WRITE :
+            ((try_count < MAX_TRIES_FOR_NA + MAX_TRIES_FOR_PARTIAL) ? WCACHE_UPDATE_COMBINE : WCACHE_UPDATE_FORCE),
+            ASYNC_STATE_NONE);
 
         if(status == STATUS_RETRY) {
             try_count++;
@@ -1499,7 +1646,7 @@ WCacheFlushBlocksRAM(
             firstPos++;
             continue;
         }
-        tmp_buff = Cache->tmp_buff;
+        tmp_buff = Cache->tmp_buff_w;
         PrevLba = Lba;
         n=1;
         while((firstPos+n < lastPos) &&
@@ -1511,7 +1658,7 @@ WCacheFlushBlocksRAM(
                         (PVOID)WCacheSectorAddr(block_array, PrevLba - firstLba),
                         BS);
             n++;
-            if(n >= PSs)
+            if(n >= Cache->MaxWriteBlocks)
                 break;
         }
         if(n > 1) {
@@ -1529,6 +1676,7 @@ WCacheFlushBlocksRAM(
                 BrutePoint();
             }
         }
+        Cache->LastWrittenLba = Lba + n;
         firstPos += n;
         if(Purge) {
             // free memory
@@ -1579,6 +1727,8 @@ WCacheCheckLimitsRAM(
 //    OSSTATUS status;
     ULONG FreeFrameCount = 0;
 //    PVOID addr;
+    LONGLONG StartTime = 0;
+    LONGLONG CurTime;
 
     if(Cache->FrameCount >= Cache->MaxFrames) {
         FreeFrameCount = Cache->FramesToKeepFree;
@@ -1601,6 +1751,8 @@ Try_Another_Frame:
                 break;
         }
 
+        if(!StartTime)
+            StartTime = KeQueryInterruptTime();
         frame = WCacheFindFrameToRelease(Cache);
 #if 0
         if(Cache->FrameList[frame].WriteCount) {
@@ -1640,6 +1792,15 @@ Try_Another_Frame:
         WCacheRemoveRangeFromList(Cache->CachedModifiedBlocksList, &(Cache->WriteCount), firstLba, Cache->BlocksPerFrame);
         ASSERT(Cache->FrameList[frame].BlockCount == 0);
         WCacheRemoveFrame(Cache, Context, frame);
+
+        // don't spend more than WCACHE_FLUSH_BUDGET on extra free frames
+        if(FreeFrameCount && (Cache->FrameCount < Cache->MaxFrames)) {
+            CurTime = KeQueryInterruptTime();
+            if(CurTime - StartTime > WCACHE_FLUSH_BUDGET) {
+                WcPrint(("WC:flush budget, %x frames left\n", FreeFrameCount));
+                FreeFrameCount = 0;
+            }
+        }
     }
 
     // check if we try to read too much data
@@ -1751,11 +1912,15 @@ WCacheFlushAllRAM(
     ULONG lastPos;
     PW_CACHE_ENTRY block_array;
 //    OSSTATUS status;
+    ULONG pos;
 
-    // flush frames
+    // flush frames in C-SCAN order starting from the last written block
+    pos = WCacheGetSortedListIndex(Cache->WriteCount, Cache->CachedModifiedBlocksList, Cache->LastWrittenLba);
     while(Cache->WriteCount) {
 
-        frame = Cache->CachedModifiedBlocksList[0] >> Cache->BlocksPerFrameSh;
+        if(pos >= Cache->WriteCount)
+            pos = 0;
+        frame = Cache->CachedModifiedBlocksList[pos] >> Cache->BlocksPerFrameSh;
 
         firstLba = frame << Cache->BlocksPerFrameSh;
         lastLba = firstLba + Cache->BlocksPerFrame;
@@ -1771,6 +1936,7 @@ WCacheFlushAllRAM(
         WCacheFlushBlocksRAM(Cache, Context, block_array, List, firstPos, lastPos, FALSE);
 
         WCacheRemoveRangeFromList(Cache->CachedModifiedBlocksList, &(Cache->WriteCount), firstLba, Cache->BlocksPerFrame);
+        pos = WCacheGetSortedListIndex(Cache->WriteCount, Cache->CachedModifiedBlocksList, lastLba);
     }
 
     return STATUS_SUCCESS;
@@ -2001,7 +2167,7 @@ WCacheReadBlocks__(
         return status;
     }
     if(!CachedOnly) {
-        ExAcquireResourceExclusiveLite(&(Cache->WCacheLock), TRUE);
+        WCacheAcquireExclusive(Cache);
     }
 
     frame = Lba >> Cache->BlocksPerFrameSh;
@@ -2010,13 +2176,13 @@ WCacheReadBlocks__(
     if(Cache->CacheWholePacket && (BCount < PS)) {
         if(!CachedOnly &&
            !OS_SUCCESS(status = WCacheCheckLimits(Cache, Context, Lba & ~(PS-1), PS*2)) ) {
-            ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+            WCacheReleaseLock(Cache);
             return status;
         }
     } else {
         if(!CachedOnly &&
            !OS_SUCCESS(status = WCacheCheckLimits(Cache, Context, Lba, BCount))) {
-            ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+            WCacheReleaseLock(Cache);
             return status;
         }
     }
@@ -2209,7 +2375,7 @@ EO_WCache_R:
 //    Cache->FrameList[frame].BlockCount -= BCount;
 EO_WCache_R2:
     if(!CachedOnly) {
-        ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+        WCacheReleaseLock(Cache);
     }
 
     return status;
@@ -2280,7 +2446,7 @@ WCacheWriteBlocks__(
         return STATUS_INVALID_PARAMETER;
     }
     if(!CachedOnly) {
-        ExAcquireResourceExclusiveLite(&(Cache->WCacheLock), TRUE);
+        WCacheAcquireExclusive(Cache);
     }
 
     frame = Lba >> Cache->BlocksPerFrameSh;
@@ -2288,7 +2454,7 @@ WCacheWriteBlocks__(
 
     if(!CachedOnly &&
        !OS_SUCCESS(status = WCacheCheckLimits(Cache, Context, Lba, BCount))) {
-        ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+        WCacheReleaseLock(Cache);
         return status;
     }
 
@@ -2333,12 +2499,15 @@ WCacheWriteBlocks__(
     }
 
     Cache->FrameList[frame].UpdateCount++;
+    Cache->WriteSeq++;
+    Cache->FrameList[frame].LastWriteSeq = Cache->WriteSeq;
 //    UDFPrint(("    BCount:%x\n",BCount));
     while(BCount) {
         if(i >= Cache->BlocksPerFrame) {
             frame++;
             block_array = Cache->FrameList[frame].Frame;
             i -= Cache->BlocksPerFrame;
+            Cache->FrameList[frame].LastWriteSeq = Cache->WriteSeq;
         }
         if(!block_array) {
             ASSERT(Cache->FrameCount < Cache->MaxFrames);
@@ -2495,8 +2664,9 @@ EO_WCache_W:
 
 EO_WCache_W2:
 
+    Cache->BytesWritten += (*WrittenBytes);
     if(!CachedOnly) {
-        ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+        WCacheReleaseLock(Cache);
     }
     return status;
 } // end WCacheWriteBlocks__()
@@ -2512,7 +2682,7 @@ WCacheFlushAll__(
     IN PVOID Context)         // user-supplied context for IO callbacks
 {
     if(!(Cache->ReadProc)) return;
-    ExAcquireResourceExclusiveLite(&(Cache->WCacheLock), TRUE);
+    WCacheAcquireExclusive(Cache);
 
     switch(Cache->Mode) {
     case WCACHE_MODE_RAM:
@@ -2527,7 +2697,7 @@ WCacheFlushAll__(
         break;
     }
 
-    ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+    WCacheReleaseLock(Cache);
     return;
 } // end WCacheFlushAll__()
 
@@ -2542,7 +2712,7 @@ WCachePurgeAll__(
     IN PVOID Context)         // user-supplied context for IO callbacks
 {
     if(!(Cache->ReadProc)) return;
-    ExAcquireResourceExclusiveLite(&(Cache->WCacheLock), TRUE);
+    WCacheAcquireExclusive(Cache);
 
     switch(Cache->Mode) {
     case WCACHE_MODE_RAM:
@@ -2557,7 +2727,7 @@ WCachePurgeAll__(
         break;
     }
 
-    ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+    WCacheReleaseLock(Cache);
     return;
 } // end WCachePurgeAll__()
 /*
@@ -2659,12 +2829,18 @@ WCacheFlushAllRW(
     PW_CACHE_ASYNC PrevWContext = NULL;
     ULONG i;
     ULONG chain_count = 0;
+    ULONG pos;
 
     if(!(Cache->ReadProc)) return;
 
-    // walk through modified blocks
+    // walk through modified blocks in C-SCAN order starting from
+    // the last written block. Adjacent packets are queued one after
+    // another, so they are merged into single write in chained mode.
+    pos = WCacheGetSortedListIndex(Cache->WriteCount, List, Cache->LastWrittenLba);
     while(Cache->WriteCount) {
-        Lba = List[0] & ~(PSs-1);
+        if(pos >= Cache->WriteCount)
+            pos = 0;
+        Lba = List[pos] & ~(PSs-1);
         frame = Lba >> BFs;
         firstLba = frame << BFs;
 //        firstPos = WCacheGetSortedListIndex(Cache->WriteCount, List, Lba);
@@ -2679,6 +2855,7 @@ WCacheFlushAllRW(
             Lba, BSh, BS, PS, PSs, &ReadBytes, TRUE, ASYNC_STATE_NONE);
         // clear MODIFIED flag for queued blocks
         WCacheRemoveRangeFromList(List, &(Cache->WriteCount), Lba, PSs);
+        pos = WCacheGetSortedListIndex(Cache->WriteCount, List, Lba+PSs);
         Lba -= firstLba;
         for(i=0; i<PSs; i++) {
             WCacheClrModFlag(block_array, Lba+i);
@@ -2726,7 +2903,7 @@ WCacheRelease__(
     Cache->Tag = 0xDEADCACE;
     if(!(Cache->ReadProc)) return;
 //    ASSERT(Cache->Tag == 0xCAC11E00);
-    ExAcquireResourceExclusiveLite(&(Cache->WCacheLock), TRUE);
+    WCacheAcquireExclusive(Cache);
     for(i=0; i<Cache->FrameCount; i++) {
         j = Cache->CachedFramesList[i];
         block_array = Cache->FrameList[j].Frame;
@@ -2751,10 +2928,12 @@ WCacheRelease__(
         MyFreePool__(Cache->tmp_buff_r);
     if(Cache->CachedFramesList)
         MyFreePool__(Cache->tmp_buff);
+    if(Cache->tmp_buff_w)
+        MyFreePool__(Cache->tmp_buff_w);
     if(Cache->CachedFramesList)
         MyFreePool__(Cache->reloc_tab);
-    ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
-    ExDeleteResourceLite(&(Cache->WCacheLock));
+    WCacheReleaseLock(Cache);
+    WCacheDeleteLock(Cache);
     RtlZeroMemory(Cache, sizeof(W_CACHE));
     return;
 } // end WCacheRelease__()
@@ -2857,7 +3036,7 @@ WCacheFlushBlocks__(
     OSSTATUS status;
 
     if(!(Cache->ReadProc)) return STATUS_INVALID_PARAMETER;
-    ExAcquireResourceExclusiveLite(&(Cache->WCacheLock), TRUE);
+    WCacheAcquireExclusive(Cache);
 
     // check if we try to access beyond cached area
     if((Lba < Cache->FirstLba) ||
@@ -2881,7 +3060,7 @@ WCacheFlushBlocks__(
         break;
     }
 EO_WCache_F:
-    ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+    WCacheReleaseLock(Cache);
     return status;
 } // end WCacheFlushBlocks__()
 
@@ -2919,7 +3098,7 @@ WCacheDirect__(
 
     // lock cache if nececcary
     if(!CachedOnly) {
-        ExAcquireResourceExclusiveLite(&(Cache->WCacheLock), TRUE);
+        WCacheAcquireExclusive(Cache);
     }
     // check if we try to access beyond cached area
     if((Lba < Cache->FirstLba) ||
@@ -3038,7 +3217,7 @@ WCacheEODirect__(
     IN PVOID Context          // user-supplied context for IO callbacks
     )
 {
-    ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+    WCacheReleaseLock(Cache);
     return STATUS_SUCCESS;
 } // end WCacheEODirect__()
 
@@ -3059,10 +3238,10 @@ WCacheStartDirect__(
     )
 {
     if(Exclusive) {
-        ExAcquireResourceExclusiveLite(&(Cache->WCacheLock), TRUE);
+        WCacheAcquireExclusive(Cache);
     } else {
         BrutePoint();
-        ExAcquireResourceSharedLite(&(Cache->WCacheLock), TRUE);
+        WCacheAcquireShared(Cache);
     }
     return STATUS_SUCCESS;
 } // end WCacheStartDirect__()
@@ -3489,13 +3668,13 @@ WCacheDiscardBlocks__(
     BOOLEAN mod;
     ULONG i;
 
-    ExAcquireResourceExclusiveLite(&(Cache->WCacheLock), TRUE);
+    WCacheAcquireExclusive(Cache);
 
     UDFPrint(("  Discard req: %x@%x\n",BCount, ReqLba));
 
     List = Cache->CachedBlocksList;
     if(!List) {
-        ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+        WCacheReleaseLock(Cache);
         return;
     }
     i = WCacheGetSortedListIndex(Cache->BlockCount, List, ReqLba);
@@ -3508,7 +3687,7 @@ WCacheDiscardBlocks__(
         firstLba = frame << Cache->BlocksPerFrameSh;
         block_array = Cache->FrameList[frame].Frame;
         if(!block_array) {
-            ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+            WCacheReleaseLock(Cache);
             BrutePoint();
             return;
         }
@@ -3537,7 +3716,7 @@ WCacheDiscardBlocks__(
             BrutePoint();
         }
     }
-    ExReleaseResourceForThreadLite(&(Cache->WCacheLock), ExGetCurrentResourceThread());
+    WCacheReleaseLock(Cache);
 } // end WCacheDiscardBlocks__()
 
 OSSTATUS
@@ -103,11 +103,22 @@ typedef struct _W_CACHE_FRAME {
     //ULONG WriteCount;      // number of modified packets in cache frame, is always 0, shall be removed
     ULONG UpdateCount;     // number of updates in cache frame
     ULONG AccessCount;     // number of accesses to cache frame
+    ULONG LastWriteSeq;    // W_CACHE::WriteSeq at the last write to cache frame
 } W_CACHE_FRAME, *PW_CACHE_FRAME;
 
 // memory type for cached blocks
 #define CACHED_BLOCK_MEMORY_TYPE PagedPool
 #define MAX_TRIES_FOR_NA         3
+// additional tries to find a packet that can be written without
+// Read/Modify/Write before partially modified packets are flushed
+#define MAX_TRIES_FOR_PARTIAL    4
+// partially modified packet is considered aged (and may be flushed)
+// when this number of writes to cache happened since its last update
+#define WCACHE_PACKET_MAX_AGE    64
+// time limit for releasing extra (FramesToKeepFree) frames during a single
+// cache limits check (100ns units of interrupt time). Frames required for the request itself
+// are released regardless of this limit
+#define WCACHE_FLUSH_BUDGET      (50*10000)
 
 #ifdef _WIN64
     #define WCACHE_ADDR_MASK     0xfffffffffffffff8
@@ -180,7 +191,17 @@ typedef struct _W_CACHE {
     // preallocated tmp buffers
     PCHAR tmp_buff;
     PCHAR tmp_buff_r;
+    PCHAR tmp_buff_w;           // buffer for merged writes of adjacent packets
     PULONG reloc_tab;
+    // flush scheduling (C-SCAN)
+    lba_t LastWrittenLba;       // LBA following the last written block
+    lba_t ReleaseLba;           // position of block release scan
+    ULONG MaxWriteBlocks;       // maximum length of merged write (blocks)
+    // write combining
+    ULONG WriteSeq;             // number of write requests to cache
+    ULONGLONG PacketWrites;     // packets written by Read/Modify/Write cycle
+    ULONGLONG PacketReads;      // packets read from media for update
+    ULONGLONG BytesWritten;     // bytes written to cache by caller
 
 } W_CACHE, *PW_CACHE;
 
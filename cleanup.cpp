@@ -458,8 +458,11 @@ DiscardDelete_1:
                 // file is deleted, so forget about it
                 ASSERT(!(Fcb->FCBFlags & UDF_FCB_ROOT_DIRECTORY));
                 ForcedCleanUp = TRUE;
-                if(NT_SUCCESS(RC))
+                if(NT_SUCCESS(RC)) {
                     Fcb->FCBFlags &= ~UDF_FCB_DELETE_ON_CLOSE;
+                    UDFMarkFcbDirty(Vcb, Fcb->ParentFcb);
+                    UDFPathCacheInvalidate(Vcb);
+                }
                 Fcb->FCBFlags |= UDF_FCB_DELETED;
                 RC = STATUS_SUCCESS;
             }
@@ -610,6 +613,9 @@ DiscardDelete:
                 UDFSetFileXTime(NextFileInfo, NULL, NULL, &NtTime, NULL);
                 Fcb->ChangeTime.QuadPart = NtTime;
             }
+            // times & attributes are written by the next flush
+            if(NextFileInfo->Dloc->FE_Flags & UDF_FE_FLAG_FE_MODIFIED)
+                UDFMarkFcbDirty(Vcb, Fcb);
         }
 
         if(!(Fcb->FCBFlags & UDF_FCB_DIRECTORY) &&
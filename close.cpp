@@ -458,6 +458,7 @@ UDFCleanUpFcbChain(
                 ASSERT(ThisFcb->ReferenceCount < fi->RefCount);
                 UDFFlushFile__(Vcb, fi);
                 UDFUnlinkFile__(Vcb, fi, TRUE);
+                UDFPathCacheInvalidate(Vcb);
                 UDFCloseFile__(Vcb, fi);
                 ASSERT(ThisFcb->ReferenceCount == fi->RefCount);
                 ThisFcb->FCBFlags |= UDF_FCB_DELETED;
@@ -490,6 +491,10 @@ UDFCleanUpFcbChain(
                 UDFPrint(("UDFRelease Fcb: %x\n", ThisFcb));
                 ret_val |= UDF_CLOSE_NTREQFCB_DELETED;
 
+                // parent directory lost an entry
+                if (ThisParentFcb && (ThisFcb->FCBFlags & UDF_FCB_DELETED)) {
+                    UDFMarkFcbDirty(Vcb, ThisParentFcb);
+                }
                 ThisFcb->ParentFcb = NULL;
                 UDFCleanUpFCB(ThisFcb);
 
@@ -560,63 +565,136 @@ UDFDoDelayedClose(
 } // end UDFDoDelayedClose()
 
 /*
-    This routine removes request from Delayed Close queue.
-    It operates until reach lower threshold
+    This routine removes up to UDF_DELAYED_CLOSE_BATCH requests from
+    Delayed Close queues while they are above lower threshold.
+    Requests are taken from the given shard first, then from others.
  */
-VOID
-NTAPI
-UDFDelayedClose(
-    PVOID unused
+ULONG
+UDFRemoveDelayedCloseBatch(
+    IN PUDF_DELAYED_CLOSE_SHARD Shard,
+    OUT PIRP_CONTEXT_LITE* Batch
     )
 {
+    PUDF_DELAYED_CLOSE_SHARD CurShard;
     PLIST_ENTRY             Entry;
-    PIRP_CONTEXT_LITE NextIrpContextLite;
+    ULONG                   BatchCount = 0;
+    ULONG                   First;
+    ULONG                   i;
+    KIRQL                   SavedIrql;
 
-    AdPrint(("  UDFDelayedClose\n"));
-    // Acquire DelayedCloseResource
-    UDFAcquireResourceExclusive(&(UDFGlobalData.DelayedCloseResource), TRUE);
+    First = (ULONG)(Shard - UDFGlobalData.DelayedCloseShards);
 
-    while (UDFGlobalData.ReduceDelayedClose &&
-          (UDFGlobalData.DelayedCloseCount > UDFGlobalData.MinDelayedCloseCount)) {
+    for(i=0; i<UDFGlobalData.DelayedCloseShardCount; i++) {
 
-        Entry = UDFGlobalData.DelayedCloseQueue.Flink;
+        CurShard = &UDFGlobalData.DelayedCloseShards[(First+i) % UDFGlobalData.DelayedCloseShardCount];
+        KeAcquireSpinLock(&(CurShard->Lock), &SavedIrql);
 
-        if (!IsListEmpty(Entry)) {
-            //  Extract the IrpContext.
-            NextIrpContextLite = CONTAINING_RECORD( Entry,
-                                                    IRP_CONTEXT_LITE,
-                                                    DelayedCloseLinks );
+        while ((BatchCount < UDF_DELAYED_CLOSE_BATCH) &&
+               UDFGlobalData.ReduceDelayedClose &&
+              (UDFGlobalData.DelayedCloseCount > UDFGlobalData.MinDelayedCloseCount) &&
+               !IsListEmpty(&(CurShard->DelayedCloseQueue))) {
 
-            RemoveEntryList( Entry );
-            UDFGlobalData.DelayedCloseCount--;
-            UDFDoDelayedClose(NextIrpContextLite);
-        } else {
-            BrutePoint();
+            Entry = RemoveHeadList(&(CurShard->DelayedCloseQueue));
+            InterlockedDecrement((PLONG)&(UDFGlobalData.DelayedCloseCount));
+            Batch[BatchCount++] = CONTAINING_RECORD( Entry,
+                                                     IRP_CONTEXT_LITE,
+                                                     DelayedCloseLinks );
         }
-    }
 
-    while (UDFGlobalData.ReduceDirDelayedClose &&
-          (UDFGlobalData.DirDelayedCloseCount > UDFGlobalData.MinDirDelayedCloseCount)) {
+        while ((BatchCount < UDF_DELAYED_CLOSE_BATCH) &&
+               UDFGlobalData.ReduceDirDelayedClose &&
+              (UDFGlobalData.DirDelayedCloseCount > UDFGlobalData.MinDirDelayedCloseCount) &&
+               !IsListEmpty(&(CurShard->DirDelayedCloseQueue))) {
 
-        Entry = UDFGlobalData.DirDelayedCloseQueue.Flink;
+            Entry = RemoveHeadList(&(CurShard->DirDelayedCloseQueue));
+            InterlockedDecrement((PLONG)&(UDFGlobalData.DirDelayedCloseCount));
+            Batch[BatchCount++] = CONTAINING_RECORD( Entry,
+                                                     IRP_CONTEXT_LITE,
+                                                     DelayedCloseLinks );
+        }
 
-        if (!IsListEmpty(Entry)) {
-            //  Extract the IrpContext.
-            NextIrpContextLite = CONTAINING_RECORD( Entry,
-                                                    IRP_CONTEXT_LITE,
-                                                    DelayedCloseLinks );
+        KeReleaseSpinLock(&(CurShard->Lock), SavedIrql);
 
-            RemoveEntryList( Entry );
-            UDFGlobalData.DirDelayedCloseCount--;
-            UDFDoDelayedClose(NextIrpContextLite);
-        } else {
-            BrutePoint();
+        if(BatchCount >= UDF_DELAYED_CLOSE_BATCH)
+            break;
+    }
+    return BatchCount;
+} // end UDFRemoveDelayedCloseBatch()
+
+/*
+    This routine removes request from Delayed Close queue.
+    It operates until reach lower threshold.
+    One instance may run for each shard, DelayedCloseResource is
+    acquired shared, so workers do not block each other.
+ */
+VOID
+NTAPI
+UDFDelayedClose(
+    PVOID Context
+    )
+{
+    PUDF_DELAYED_CLOSE_SHARD Shard = (PUDF_DELAYED_CLOSE_SHARD)Context;
+    PIRP_CONTEXT_LITE       Batch[UDF_DELAYED_CLOSE_BATCH];
+    ULONG                   BatchCount;
+    ULONG                   i;
+    KIRQL                   SavedIrql;
+    LARGE_INTEGER           StartTime;
+    LARGE_INTEGER           EndTime;
+    ULONGLONG               DrainTime;
+
+    AdPrint(("  UDFDelayedClose\n"));
+    // Acquire DelayedCloseResource
+    UDFAcquireResourceShared(&(UDFGlobalData.DelayedCloseResource), TRUE);
+
+    while (TRUE) {
+
+        StartTime.QuadPart = KeQueryInterruptTime();
+        BatchCount = UDFRemoveDelayedCloseBatch(Shard, Batch);
+        if(!BatchCount) {
+            // The closer that raises the counter above upper threshold
+            // sets Reduce... flag after increment, so it is either seen
+            // by the re-check or set again after reset
+            if(UDFGlobalData.DelayedCloseCount <= UDFGlobalData.MinDelayedCloseCount) {
+                InterlockedExchange(&(UDFGlobalData.ReduceDelayedClose), FALSE);
+                if(UDFGlobalData.DelayedCloseCount > UDFGlobalData.MaxDelayedCloseCount)
+                    InterlockedExchange(&(UDFGlobalData.ReduceDelayedClose), TRUE);
+            }
+            if(UDFGlobalData.DirDelayedCloseCount <= UDFGlobalData.MinDirDelayedCloseCount) {
+                InterlockedExchange(&(UDFGlobalData.ReduceDirDelayedClose), FALSE);
+                if(UDFGlobalData.DirDelayedCloseCount > UDFGlobalData.MaxDirDelayedCloseCount)
+                    InterlockedExchange(&(UDFGlobalData.ReduceDirDelayedClose), TRUE);
+            }
+            // Closer checks FspCloseActive under the same lock after
+            // queueing, so a request queued after this check starts
+            // a new worker
+            KeAcquireSpinLock(&(Shard->Lock), &SavedIrql);
+            if((UDFGlobalData.ReduceDelayedClose &&
+                (UDFGlobalData.DelayedCloseCount > UDFGlobalData.MinDelayedCloseCount) &&
+                !IsListEmpty(&(Shard->DelayedCloseQueue))) ||
+               (UDFGlobalData.ReduceDirDelayedClose &&
+                (UDFGlobalData.DirDelayedCloseCount > UDFGlobalData.MinDirDelayedCloseCount) &&
+                !IsListEmpty(&(Shard->DirDelayedCloseQueue)))) {
+                KeReleaseSpinLock(&(Shard->Lock), SavedIrql);
+                continue;
+            }
+            Shard->FspCloseActive = FALSE;
+            KeReleaseSpinLock(&(Shard->Lock), SavedIrql);
+            break;
+        }
+
+        for(i=0; i<BatchCount; i++) {
+            UDFDoDelayedClose(Batch[i]);
         }
+
+        EndTime.QuadPart = KeQueryInterruptTime();
+        DrainTime = EndTime.QuadPart - StartTime.QuadPart;
+        Shard->Drained += BatchCount;
+        Shard->DrainTime += DrainTime;
+        if(DrainTime > Shard->MaxDrainTime)
+            Shard->MaxDrainTime = DrainTime;
     }
 
-    UDFGlobalData.FspCloseActive = FALSE;
-    UDFGlobalData.ReduceDelayedClose = FALSE;
-    UDFGlobalData.ReduceDirDelayedClose = FALSE;
+    InterlockedDecrement(&(UDFGlobalData.DelayedCloseWorkers));
 
     // Release DelayedCloseResource
     UDFReleaseResource(&(UDFGlobalData.DelayedCloseResource));
@@ -635,6 +713,11 @@ UDFCloseAllDelayed(
 {
     PLIST_ENTRY             Entry;
     PIRP_CONTEXT_LITE NextIrpContextLite;
+    PUDF_DELAYED_CLOSE_SHARD Shard;
+    LIST_ENTRY              CloseQueue;
+    LIST_ENTRY              DirCloseQueue;
+    KIRQL                   SavedIrql;
+    ULONG                   i;
     BOOLEAN                 GlobalDataAcquired = FALSE;
 
     AdPrint(("  UDFCloseAllDelayed\n"));
@@ -644,34 +727,57 @@ UDFCloseAllDelayed(
         GlobalDataAcquired = TRUE;
     }
 
-    Entry = UDFGlobalData.DelayedCloseQueue.Flink;
-
-    while (Entry != &UDFGlobalData.DelayedCloseQueue) {
-        //  Extract the IrpContext.
-        NextIrpContextLite = CONTAINING_RECORD( Entry,
-                                                IRP_CONTEXT_LITE,
-                                                DelayedCloseLinks );
-        Entry = Entry->Flink;
-        if (NextIrpContextLite->Fcb->Vcb == Vcb) {
-            RemoveEntryList( &(NextIrpContextLite->DelayedCloseLinks) );
-            UDFGlobalData.DelayedCloseCount--;
-            UDFDoDelayedClose(NextIrpContextLite);
+    InitializeListHead(&CloseQueue);
+    InitializeListHead(&DirCloseQueue);
+
+    // collect requests for this volume from all shards
+    for(i=0; i<UDFGlobalData.DelayedCloseShardCount; i++) {
+
+        Shard = &UDFGlobalData.DelayedCloseShards[i];
+        KeAcquireSpinLock(&(Shard->Lock), &SavedIrql);
+
+        Entry = Shard->DelayedCloseQueue.Flink;
+
+        while (Entry != &Shard->DelayedCloseQueue) {
+            //  Extract the IrpContext.
+            NextIrpContextLite = CONTAINING_RECORD( Entry,
+                                                    IRP_CONTEXT_LITE,
+                                                    DelayedCloseLinks );
+            Entry = Entry->Flink;
+            if (NextIrpContextLite->Fcb->Vcb == Vcb) {
+                RemoveEntryList( &(NextIrpContextLite->DelayedCloseLinks) );
+                InterlockedDecrement((PLONG)&(UDFGlobalData.DelayedCloseCount));
+                InsertTailList( &CloseQueue, &(NextIrpContextLite->DelayedCloseLinks) );
+            }
         }
-    }
 
-    Entry = UDFGlobalData.DirDelayedCloseQueue.Flink;
-
-    while (Entry != &UDFGlobalData.DirDelayedCloseQueue) {
-        //  Extract the IrpContext.
-        NextIrpContextLite = CONTAINING_RECORD(Entry,
-                                               IRP_CONTEXT_LITE,
-                                               DelayedCloseLinks);
-        Entry = Entry->Flink;
-        if (NextIrpContextLite->Fcb->Vcb == Vcb) {
-            RemoveEntryList( &(NextIrpContextLite->DelayedCloseLinks) );
-            UDFGlobalData.DirDelayedCloseCount--;
-            UDFDoDelayedClose(NextIrpContextLite);
+        Entry = Shard->DirDelayedCloseQueue.Flink;
+
+        while (Entry != &Shard->DirDelayedCloseQueue) {
+            //  Extract the IrpContext.
+            NextIrpContextLite = CONTAINING_RECORD(Entry,
+                                                   IRP_CONTEXT_LITE,
+                                                   DelayedCloseLinks);
+            Entry = Entry->Flink;
+            if (NextIrpContextLite->Fcb->Vcb == Vcb) {
+                RemoveEntryList( &(NextIrpContextLite->DelayedCloseLinks) );
+                InterlockedDecrement((PLONG)&(UDFGlobalData.DirDelayedCloseCount));
+                InsertTailList( &DirCloseQueue, &(NextIrpContextLite->DelayedCloseLinks) );
+            }
         }
+
+        KeReleaseSpinLock(&(Shard->Lock), SavedIrql);
+    }
+
+    // files are closed before directories
+    while (!IsListEmpty(&CloseQueue)) {
+        Entry = RemoveHeadList(&CloseQueue);
+        UDFDoDelayedClose(CONTAINING_RECORD(Entry, IRP_CONTEXT_LITE, DelayedCloseLinks));
+    }
+
+    while (!IsListEmpty(&DirCloseQueue)) {
+        Entry = RemoveHeadList(&DirCloseQueue);
+        UDFDoDelayedClose(CONTAINING_RECORD(Entry, IRP_CONTEXT_LITE, DelayedCloseLinks));
     }
 
     // Release DelayedCloseResource
@@ -918,6 +1024,8 @@ UDFCloseAllXXXDelayedInDir(
         } else {
             // Remove from internal queue
             PIRP_CONTEXT_LITE NextIrpContextLite;
+            PUDF_DELAYED_CLOSE_SHARD Shard;
+            KIRQL SavedIrql;
 
             for(i=FoundListSize;i>0;i--) {
 
@@ -930,12 +1038,15 @@ UDFCloseAllXXXDelayedInDir(
                 if(CurFileInfo &&
                    CurFileInfo->Fcb &&
                     (NextIrpContextLite = CurFileInfo->Fcb->IrpContextLite)) {
+                    Shard = &UDFGlobalData.DelayedCloseShards[NextIrpContextLite->Shard];
+                    KeAcquireSpinLock(&(Shard->Lock), &SavedIrql);
                     RemoveEntryList( &(NextIrpContextLite->DelayedCloseLinks) );
+                    KeReleaseSpinLock(&(Shard->Lock), SavedIrql);
                     if (NextIrpContextLite->Fcb->FCBFlags & UDF_FCB_DIRECTORY) {
 //                            BrutePoint();
-                        UDFGlobalData.DirDelayedCloseCount--;
+                        InterlockedDecrement((PLONG)&(UDFGlobalData.DirDelayedCloseCount));
                     } else {
-                        UDFGlobalData.DelayedCloseCount--;
+                        InterlockedDecrement((PLONG)&(UDFGlobalData.DelayedCloseCount));
                     }
                     UDFDoDelayedClose(NextIrpContextLite);
                 }
@@ -985,6 +1096,8 @@ UDFQueueDelayedClose(
     )
 {
     PIRP_CONTEXT_LITE IrpContextLite;
+    PUDF_DELAYED_CLOSE_SHARD Shard;
+    KIRQL                   SavedIrql;
     BOOLEAN                 StartWorker = FALSE;
     _SEH2_VOLATILE BOOLEAN  AcquiredVcb = FALSE;
     NTSTATUS                RC;
@@ -992,8 +1105,9 @@ UDFQueueDelayedClose(
     AdPrint(("  UDFQueueDelayedClose\n"));
 
     _SEH2_TRY {
-        // Acquire DelayedCloseResource
-        UDFAcquireResourceExclusive(&(UDFGlobalData.DelayedCloseResource), TRUE);
+        // Acquire DelayedCloseResource. Shared access is enough here,
+        // each shard is protected by its own spin lock.
+        UDFAcquireResourceShared(&(UDFGlobalData.DelayedCloseResource), TRUE);
 
         UDFAcquireResourceShared(&Fcb->Vcb->VCBResource, TRUE);
         AcquiredVcb = TRUE;
@@ -1012,44 +1126,50 @@ UDFQueueDelayedClose(
             try_return(RC);
         }
 
+        // the same Fcb may be closed on another CPU at the same time
+        if(InterlockedCompareExchangePointer((PVOID*)&(Fcb->IrpContextLite), IrpContextLite, NULL)) {
+            MyFreePool__(IrpContextLite);
+            try_return(RC = STATUS_UNSUCCESSFUL);
+        }
+
+        IrpContextLite->Shard = KeGetCurrentProcessorNumber() % UDFGlobalData.DelayedCloseShardCount;
+        Shard = &UDFGlobalData.DelayedCloseShards[IrpContextLite->Shard];
+
+        KeAcquireSpinLock(&(Shard->Lock), &SavedIrql);
+
+        //  If we are above our threshold then start the delayed
+        //  close operation.
         if(Fcb->FCBFlags & UDF_FCB_DIRECTORY) {
-            InsertTailList( &UDFGlobalData.DirDelayedCloseQueue,
+            InsertTailList( &Shard->DirDelayedCloseQueue,
                             &IrpContextLite->DelayedCloseLinks );
-            UDFGlobalData.DirDelayedCloseCount++;
+            if((ULONG)InterlockedIncrement((PLONG)&(UDFGlobalData.DirDelayedCloseCount)) >
+               UDFGlobalData.MaxDirDelayedCloseCount) {
+                InterlockedExchange(&(UDFGlobalData.ReduceDirDelayedClose), TRUE);
+            }
         } else {
-            InsertTailList( &UDFGlobalData.DelayedCloseQueue,
+            InsertTailList( &Shard->DelayedCloseQueue,
                             &IrpContextLite->DelayedCloseLinks );
-            UDFGlobalData.DelayedCloseCount++;
+            if((ULONG)InterlockedIncrement((PLONG)&(UDFGlobalData.DelayedCloseCount)) >
+               UDFGlobalData.MaxDelayedCloseCount) {
+                InterlockedExchange(&(UDFGlobalData.ReduceDelayedClose), TRUE);
+            }
         }
-        Fcb->IrpContextLite = IrpContextLite;
 
-        //  If we are above our threshold then start the delayed
-        //  close operation.
-        if(UDFGlobalData.DelayedCloseCount > UDFGlobalData.MaxDelayedCloseCount) {
-
-            UDFGlobalData.ReduceDelayedClose = TRUE;
+        // Each shard has its own worker, so the number of running
+        // workers grows with the number of CPUs closing files
+        if((UDFGlobalData.ReduceDelayedClose || UDFGlobalData.ReduceDirDelayedClose) &&
+           !Shard->FspCloseActive) {
 
-            if(!UDFGlobalData.FspCloseActive) {
-
-                UDFGlobalData.FspCloseActive = TRUE;
-                StartWorker = TRUE;
-            }
+            Shard->FspCloseActive = TRUE;
+            StartWorker = TRUE;
         }
-        //  If we are above our threshold then start the delayed
-        //  close operation.
-        if(UDFGlobalData.DirDelayedCloseCount > UDFGlobalData.MaxDirDelayedCloseCount) {
-
-            UDFGlobalData.ReduceDirDelayedClose = TRUE;
 
-            if(!UDFGlobalData.FspCloseActive) {
+        KeReleaseSpinLock(&(Shard->Lock), SavedIrql);
 
-                UDFGlobalData.FspCloseActive = TRUE;
-                StartWorker = TRUE;
-            }
-        }
         // Start the FspClose thread if we need to.
         if(StartWorker) {
-            ExQueueWorkItem( &UDFGlobalData.CloseItem, CriticalWorkQueue );
+            InterlockedIncrement(&(UDFGlobalData.DelayedCloseWorkers));
+            ExQueueWorkItem( &Shard->CloseItem, CriticalWorkQueue );
         }
         RC = STATUS_SUCCESS;
 
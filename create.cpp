@@ -273,6 +273,16 @@ UDFCommonCreate(
     BOOLEAN                     StreamOpen = FALSE;
     BOOLEAN                     StreamTargetOpen = FALSE;
     BOOLEAN                     StreamExists = FALSE;
+    BOOLEAN                     SharedLookup = FALSE;
+    BOOLEAN                     Res1Shared = FALSE;
+    BOOLEAN                     PathCacheable = FALSE;
+    UNICODE_STRING              PathKey;
+    ULONG                       PathIndex[UDF_PATH_CACHE_MAX_DEPTH];
+    ULONG                       PathHintDepth = 0;
+    ULONG                       PathLevel = 0;
+    LONG                        PathGeneration = 0;
+    lb_addr                     PathFELoc;
+    uint_di                     PathHint;
     BOOLEAN                     RestoreVCBOpenCounter = FALSE;
     BOOLEAN                     RestoreShareAccess = FALSE;
     PWCHAR                      TailNameBuffer = NULL;
@@ -1115,6 +1125,20 @@ op_vol_accs_dnd:
         UDFAcquireParent(RelatedFileInfo, &Res1, &Res2);
         TreeLength++;
 
+        // repeated opens of the same path may use DirIndex positions
+        // remembered by previous walk instead of directory scans
+        if((RelatedFileInfo == Vcb->RootDirFCB->FileInfo) &&
+           !StreamOpen) {
+            PathKey = TailName;
+            while(PathKey.Length && (PathKey.Buffer[0] == L'\\')) {
+                PathKey.Buffer++;
+                PathKey.Length -= sizeof(WCHAR);
+            }
+            PathGeneration = Vcb->PathCacheGeneration;
+            PathCacheable = TRUE;
+            PathHintDepth = UDFPathCacheLookup(Vcb, &PathKey, IgnoreCase, PathIndex, &PathFELoc);
+        }
+
         // go into a loop parsing the supplied name
 
         //  Note that we may have to "open" intermediate directory objects
@@ -1193,7 +1217,49 @@ op_vol_accs_dnd:
                 // acquire new _parent_ directory & try to open what
                 // we want.
 
+                // Lookup-only components (intermediate ones and the last one
+                // of plain Open) are served with parent held shared, so opens
+                // in the same directory do not serialize. Parent is held
+                // exclusively if the component is to be created, replaced or
+                // deleted, or if it is not opened yet. Directory without
+                // opened files is scanned by UDFOpenFile__() only.
+                SharedLookup = (CurName.Buffer[0] != L':') &&
+                               UDFIsDirOpened__(RelatedFileInfo) &&
+                               (TailName.Length ||
+                                ((RequestedDisposition == FILE_OPEN) &&
+                                 !OpenTargetDirectory &&
+                                 !DeleteOnCloseSpecified));
+                PathHint = (PathLevel < PathHintDepth) ? PathIndex[PathLevel] : 0;
                 UDF_CHECK_PAGING_IO_RESOURCE(RelatedFileInfo->Fcb);
+                Res1Shared = FALSE;
+                if(SharedLookup) {
+                    UDFAcquireResourceShared(Res1 = &RelatedFileInfo->Fcb->MainResource, TRUE);
+                    Res1Shared = TRUE;
+
+                    // check traverse rights
+                    RC = UDFCheckAccessRights(NULL, NULL, RelatedFileInfo->Fcb, PtrRelatedCCB, FILE_TRAVERSE, 0);
+                    if(!NT_SUCCESS(RC)) {
+                        NewFileInfo = NULL;
+                        AdPrint(("    Traverse check failed\n"));
+                        goto Skip_open_attempt;
+                    }
+                    NewFileInfo = UDFFindOpenedFile(Vcb, IgnoreCase, &CurName, RelatedFileInfo,
+                                                    PathHint ? &PathHint : NULL);
+                    if(NewFileInfo &&
+                       (PtrNewFcb = NewFileInfo->Fcb) &&
+                       (PtrNewFcb->FCBFlags & UDF_FCB_VALID) &&
+                       !(PtrNewFcb->FCBFlags & (UDF_FCB_DELETE_ON_CLOSE |
+                                                UDF_FCB_DELETED |
+                                                UDF_FCB_POSTED_RENAME))) {
+                        UDFReferenceFile__(NewFileInfo);
+                        goto Skip_open_attempt;
+                    }
+                    // not opened yet, DirIndex & FileInfo tree are to be
+                    // updated
+                    UDFReleaseResource(Res1);
+                    Res1Shared = FALSE;
+                    SharedLookup = FALSE;
+                }
                 UDFAcquireResourceExclusive(Res1 = &RelatedFileInfo->Fcb->MainResource, TRUE);
 
                 // check traverse rights
@@ -1206,9 +1272,18 @@ op_vol_accs_dnd:
                 // check if we should open normal File/Dir or SDir
                 if(CurName.Buffer[0] != ':') {
                     // standard open, nothing interesting....
-                    RC = UDFOpenFile__(Vcb,
-                                       IgnoreCase,TRUE,&CurName,
-                                       RelatedFileInfo,&NewFileInfo,NULL);
+                    if(PathHint &&
+                       UDFDirIndexCheckHint(RelatedFileInfo, &CurName, PathHint,
+                                            (PathLevel+1 == PathHintDepth) ? &PathFELoc : NULL)) {
+                        // position is known from path cache
+                        RC = UDFOpenFile__(Vcb,
+                                           IgnoreCase,TRUE,&CurName,
+                                           RelatedFileInfo,&NewFileInfo,&PathHint);
+                    } else {
+                        RC = UDFOpenFile__(Vcb,
+                                           IgnoreCase,TRUE,&CurName,
+                                           RelatedFileInfo,&NewFileInfo,NULL);
+                    }
                     if(RC == STATUS_FILE_DELETED) {
                         // file has gone, but system still remembers it...
                         NewFileInfo = NULL;
@@ -1304,7 +1379,14 @@ Skip_open_attempt:
                     // Acquire newly opened File...
                     Res2 = Res1;
                     UDF_CHECK_PAGING_IO_RESOURCE(NewFileInfo->Fcb);
-                    UDFAcquireResourceExclusive(Res1 = &NewFileInfo->Fcb->MainResource, TRUE);
+                    if(TailName.Length && !OpenTargetDirectory) {
+                        // it will be released before the next lookup
+                        UDFAcquireResourceShared(Res1 = &NewFileInfo->Fcb->MainResource, TRUE);
+                        Res1Shared = TRUE;
+                    } else {
+                        UDFAcquireResourceExclusive(Res1 = &NewFileInfo->Fcb->MainResource, TRUE);
+                        Res1Shared = FALSE;
+                    }
                     // ...and reference it
                     UDFInterlockedIncrement((PLONG)&PtrNewFcb->ReferenceCount);
                     UDFInterlockedIncrement((PLONG)&PtrNewFcb->CommonRefCount);
@@ -1314,6 +1396,14 @@ Skip_open_attempt:
                     LastGoodFileInfo = NewFileInfo;
                     LastGoodName = CurName;
                     TreeLength++;
+                    if(PathCacheable) {
+                        if(PathLevel < UDF_PATH_CACHE_MAX_DEPTH) {
+                            PathIndex[PathLevel] = NewFileInfo->Index;
+                            PathLevel++;
+                        } else {
+                            PathCacheable = FALSE;
+                        }
+                    }
                     // update current path
                     if(!StreamOpen ||
                          ((CurName.Buffer[0] != L':') &&
@@ -1341,6 +1431,7 @@ Skip_open_attempt:
                             Res2 = Res1;
                             UDF_CHECK_PAGING_IO_RESOURCE(PtrNewFcb);
                             UDFAcquireResourceExclusive(Res1 = &PtrNewFcb->MainResource, TRUE);
+                            Res1Shared = FALSE;
                         }
                         // cleanup pointer to Fcb in FileInfo to allow
                         // UDF_INFO package release FileInfo if there are
@@ -1420,12 +1511,41 @@ Skip_open_attempt:
                 UDFInterlockedDecrement((PLONG)&PtrNewFcb->CommonRefCount);
                 RC = STATUS_SUCCESS;
                 ASSERT(!OpenTargetDirectory);
+                // remember the path for subsequent opens
+                if(PathCacheable && PathLevel) {
+                    PDIR_INDEX_ITEM DirNdx;
+                    DirNdx = UDFDirIndex(UDFGetDirIndexByFileInfo(LastGoodFileInfo), LastGoodFileInfo->Index);
+                    if(DirNdx) {
+                        UDFPathCacheStore(Vcb, &PathKey, IgnoreCase, PathIndex, PathLevel,
+                                          &(DirNdx->FileEntryLoc), PathGeneration);
+                    }
+                }
                 // break open loop and continue with Open
                 // (Create will be skipped)
                 break;
             }
         } // end of while(TRUE)
 
+        // path tail is processed with the last object held exclusively
+        if(Res1 && Res1Shared) {
+            UDFReleaseResource(Res1);
+            UDFAcquireResourceExclusive(Res1, TRUE);
+            Res1Shared = FALSE;
+            // the object was not held for a while, it could be deleted
+            // or moved to another directory, so check it once more
+            if(LastGoodFileInfo->Fcb->FCBFlags & (UDF_FCB_DELETE_ON_CLOSE |
+                                                  UDF_FCB_DELETED |
+                                                  UDF_FCB_POSTED_RENAME)) {
+                AdPrint(("  Return DeletePending (after upgrade)\n"));
+                try_return(RC = STATUS_DELETE_PENDING);
+            }
+            if((LastGoodFileInfo == RelatedFileInfo) &&
+               (LastGoodFileInfo->ParentFile != OldRelatedFileInfo)) {
+                AdPrint(("  Parent has changed (after upgrade)\n"));
+                try_return(RC = STATUS_DELETE_PENDING);
+            }
+        }
+
         // ****************
         // If "open target directory" was specified
         // ****************
@@ -1841,6 +1961,11 @@ Undo_Create_1:
                 }
             }
 #endif*/
+            // new entry & parent directory are written by the next flush
+            UDFMarkFcbDirty(Vcb, PtrNewFcb);
+            UDFMarkFcbDirty(Vcb, PtrNewFcb->ParentFcb);
+            // new name may be better match for cached paths
+            UDFPathCacheInvalidate(Vcb);
             ReturnedInformation = FILE_CREATED;
 
             try_return(RC);
@@ -2060,6 +2185,7 @@ AlreadyOpened:
                                        NewFileInfo->Dloc->FileEntry, FileAttributes);
                     ReturnedInformation = FILE_OVERWRITTEN;
                 }
+                UDFMarkFcbDirty(Vcb, PtrNewFcb);
             }
             // notify changes
             UDFNotifyFullReportChange( Vcb, NewFileInfo,
@@ -2532,6 +2658,8 @@ UDFInitializeFCB(
             UDFDeleteResource(&PtrNewFcb->MainResource);
             return status;
         }
+        UDFProfileResource(&PtrNewFcb->MainResource, DLD_PROF_FCB_MAIN);
+        UDFProfileResource(&PtrNewFcb->PagingIoResource, DLD_PROF_FCB_PAGING);
 
         ExInitializeFastMutex(&PtrNewFcb->AdvancedFCBHeaderMutex);
 
@@ -32,6 +32,7 @@ NTSTATUS UDFFindNextMatch(
     IN PDIR_INDEX_HDR  hDirIndex,
     IN PLONG           CurrentNumber,      // Must be modified
     IN PUNICODE_STRING PtrSearchPattern,
+    IN PUDF_COMPILED_PATTERN Pattern,
     IN UCHAR           FNM_Flags,
     IN PHASH_ENTRY     hashes,
    OUT PDIR_INDEX_ITEM* _DirNdx);
@@ -253,6 +254,13 @@ UDFQueryDirectory(
     UCHAR                       FNM_Flags = 0;
     PHASH_ENTRY                 cur_hashes = NULL;
     PDIR_INDEX_ITEM             DirNdx;
+    PDIR_INDEX_ITEM             BatchList[UDF_DIR_INFO_BATCH_MAX];
+    LONG                        BatchMatch[UDF_DIR_INFO_BATCH_MAX];
+    LONG                        BatchIndex;
+    ULONG                       BatchCount = 0;
+    ULONG                       BatchPos = 0;
+    ULONG                       BatchMax;
+    BOOLEAN                     BatchEnd = FALSE;
     // do some pre-init...
     SearchPattern.Buffer = NULL;
 
@@ -401,6 +409,10 @@ UDFQueryDirectory(
             }
             if(UDFCanNameBeA8dot3(PtrSearchPattern))
                 Ccb->CCBFlags |= UDF_CCB_CAN_BE_8_DOT_3;
+            // classify the pattern once for all subsequent queries
+            UDFCompilePattern(Ccb->DirectorySearchPattern,
+                              (Ccb->CCBFlags & UDF_CCB_CAN_BE_8_DOT_3) ? TRUE : FALSE,
+                              &(Ccb->CompiledPattern));
 
         } else if(!Ccb->DirectorySearchPattern &&
                   !(Ccb->CCBFlags & UDF_CCB_MATCH_ALL) ) {
@@ -474,6 +486,29 @@ UDFQueryDirectory(
             try_return( RC = STATUS_NO_MORE_FILES);
         }
 
+        // Load uncached attributes for the whole page of results at once,
+        // so that UDFFileDirInfoToNT() doesn't have to read FileEntries
+        // one by one. Names-only queries don't need attributes at all.
+        if(!ReturnSingleEntry &&
+           (FileInformationClass != FileNamesInformation)) {
+            BatchIndex = NextMatch;
+            BatchMax = min(UDF_DIR_INFO_BATCH_MAX,
+                           BytesRemainingInBuffer / (BaseLength + 8*sizeof(WCHAR)) + 1);
+            while(BatchCount < BatchMax) {
+                if(!NT_SUCCESS(UDFFindNextMatch(Vcb, hDirIndex, &BatchIndex, PtrSearchPattern, &(Ccb->CompiledPattern),
+                                                FNM_Flags, cur_hashes, &DirNdx))) {
+                    BatchEnd = TRUE;
+                    break;
+                }
+                // matches are returned by the loop below without rescan
+                BatchMatch[BatchCount] = BatchIndex;
+                BatchList[BatchCount++] = DirNdx;
+                BatchIndex++;
+            }
+            // BatchList is reordered here, BatchMatch keeps directory order
+            UDFLoadDirInfoBatch(Vcb, BatchList, BatchCount);
+        }
+
         // One final note though:
         // If we do not find a directory entry OR while searching we reach the
         // end of the directory, then the return code should be set as follows:
@@ -491,8 +526,19 @@ UDFQueryDirectory(
             if(ReturnSingleEntry && AtLeastOneFound) {
                 try_return(RC);
             }
-            // We call UDFFindNextMatch to look down the next matching dirent.
-            RC = UDFFindNextMatch(Vcb, hDirIndex,&NextMatch,PtrSearchPattern, FNM_Flags, cur_hashes, &DirNdx);
+            if(BatchPos < BatchCount) {
+                // already found while loading attributes
+                NextMatch = BatchMatch[BatchPos++];
+                DirNdx = UDFDirIndex(hDirIndex, NextMatch);
+                RC = STATUS_SUCCESS;
+            } else if(BatchEnd) {
+                // batch has already reached the end of directory
+                NextMatch = BatchIndex;
+                RC = STATUS_NO_MORE_FILES;
+            } else {
+                // We call UDFFindNextMatch to look down the next matching dirent.
+                RC = UDFFindNextMatch(Vcb, hDirIndex,&NextMatch,PtrSearchPattern, &(Ccb->CompiledPattern), FNM_Flags, cur_hashes, &DirNdx);
+            }
             // If we didn't receive next match, then we are at the end of the
             // directory.  If we have returned any files, we exit with
             // success, otherwise we return STATUS_NO_MORE_FILES.
@@ -582,6 +628,12 @@ UDFQueryDirectory(
 
 try_exit:   NOTHING;
 
+        // attributes loaded for entries that didn't fit into the buffer
+        // are not used by this query, the next one must re-read them
+        while(BatchPos < BatchCount) {
+            DirNdx = UDFDirIndex(hDirIndex, BatchMatch[BatchPos++]);
+            DirNdx->FI_Flags &= ~UDF_FI_FLAG_ATTR_FRESH;
+        }
 
     } _SEH2_FINALLY {
 
@@ -640,6 +692,7 @@ UDFFindNextMatch(
     IN PDIR_INDEX_HDR  hDirIndex,
     IN PLONG           CurrentNumber,      // Must be modified in case, when we found next match
     IN PUNICODE_STRING PtrSearchPattern,
+    IN PUDF_COMPILED_PATTERN Pattern,   // compiled PtrSearchPattern
     IN UCHAR           FNM_Flags,
     IN PHASH_ENTRY     hashes,
    OUT PDIR_INDEX_ITEM* _DirNdx
@@ -656,13 +709,19 @@ UDFFindNextMatch(
         if(!DirNdx->FName.Buffer ||
            UDFIsDeleted(DirNdx))
             continue;
+        if(hashes) {
+            UDFDirIndexEnsureHashes(Vcb, DirNdx, CanBe8dot3 ? HASH_ALL : (HASH_POSIX | HASH_ULFN));
+        } else
+        if(CanBe8dot3) {
+            UDFDirIndexEnsureHashes(Vcb, DirNdx, HASH_DOS);
+        }
         if(hashes &&
            (DirNdx->hashes.hLfn != hashes->hLfn) &&
            (DirNdx->hashes.hPosix != hashes->hPosix) &&
            (!CanBe8dot3 || ((DirNdx->hashes.hDos != hashes->hLfn) && (DirNdx->hashes.hDos != hashes->hPosix))) )
             continue;
-        if(UDFIsNameInExpression(Vcb, &(DirNdx->FName),PtrSearchPattern, NULL,IgnoreCase,
-                                ContainsWC, CanBe8dot3 && !(DirNdx->FI_Flags & UDF_FI_FLAG_DOS),
+        if(UDFIsNameInCompiledPattern(Vcb, &(DirNdx->FName), PtrSearchPattern, Pattern, IgnoreCase,
+                                CanBe8dot3 && !(DirNdx->FI_Flags & UDF_FI_FLAG_DOS),
                                 EntryNumber < 2) &&
            !(DirNdx->FI_Flags & UDF_FI_FLAG_FI_INTERNAL))
             break;
@@ -24,6 +24,7 @@
 /// define the file specific bug-check id
 #define         UDF_BUG_CHECK_ID                UDF_FILE_DLD
 
+#ifdef UDF_DLD
 
 /// Resource event (ExclusiveWaiters)
 #define RESOURCE_EVENT_TAG      'vEeR'
@@ -483,3 +484,353 @@ VOID DLDAcquireShared(PERESOURCE Resource,
     return;
 
 }
+
+#endif //UDF_DLD
+
+#ifdef UDF_LOCK_PROFILER
+
+/// Resource -> lock class table. Lookups are lock-free, insertion and
+/// removal are serialized by DLDProfResLock
+PDLD_PROF_RES       DLDProfResTable = NULL;
+KSPIN_LOCK          DLDProfResLock;
+/// Per-CPU counters, DLDProfCpuCount * DLD_PROF_CLASSES entries
+PDLD_PROF_STATS     DLDProfStats = NULL;
+ULONG               DLDProfCpuCount;
+/// Top contending call sites
+DLD_PROF_SITES      DLDProfSites[DLD_PROF_CLASSES];
+/// Performance counter frequency
+LONGLONG            DLDProfFreq;
+
+#define DLDProfHash(Resource) \
+    ((ULONG)(((ULONG_PTR)(Resource) >> 4) * 2654435761UL) & (DLD_PROF_RES_TABLE_SIZE-1))
+
+#define DLDProfCurrentStats(Class) \
+    (&DLDProfStats[(KeGetCurrentProcessorNumber() % DLDProfCpuCount)*DLD_PROF_CLASSES + (Class)])
+
+/// Initialize lock profiler
+BOOLEAN DLDProfInit(VOID)
+{
+    LARGE_INTEGER Freq;
+    ULONG i;
+
+    KeQueryPerformanceCounter(&Freq);
+    DLDProfFreq = Freq.QuadPart ? Freq.QuadPart : 1;
+
+    DLDProfCpuCount = KeNumberProcessors;
+    KeInitializeSpinLock(&DLDProfResLock);
+    DLDProfResTable = (PDLD_PROF_RES)DLDAllocatePool(DLD_PROF_RES_TABLE_SIZE*sizeof(DLD_PROF_RES));
+    DLDProfStats = (PDLD_PROF_STATS)DLDAllocatePool(DLDProfCpuCount*DLD_PROF_CLASSES*sizeof(DLD_PROF_STATS));
+    if(!DLDProfResTable || !DLDProfStats) {
+        DLDProfFree();
+        return FALSE;
+    }
+    RtlZeroMemory(DLDProfResTable, DLD_PROF_RES_TABLE_SIZE*sizeof(DLD_PROF_RES));
+    RtlZeroMemory(DLDProfStats, DLDProfCpuCount*DLD_PROF_CLASSES*sizeof(DLD_PROF_STATS));
+    RtlZeroMemory(&DLDProfSites, sizeof(DLDProfSites));
+    for(i=0; i<DLD_PROF_CLASSES; i++) {
+        KeInitializeSpinLock(&DLDProfSites[i].Lock);
+    }
+    return TRUE;
+}
+
+VOID DLDProfFree(VOID)
+{
+    if(DLDProfResTable) {
+        DLDFreePool(DLDProfResTable);
+        DLDProfResTable = NULL;
+    }
+    if(DLDProfStats) {
+        DLDFreePool(DLDProfStats);
+        DLDProfStats = NULL;
+    }
+}
+
+/// Find Resource in class table, returns NULL if Resource is not registered
+PDLD_PROF_RES DLDProfFindResource(PERESOURCE Resource)
+{
+    ULONG i, n;
+    PDLD_PROF_RES Entry;
+
+    if(!DLDProfResTable)
+        return NULL;
+    i = DLDProfHash(Resource);
+    for(n=0; n<DLD_PROF_RES_TABLE_SIZE; n++) {
+        Entry = &DLDProfResTable[i];
+        if(Entry->Resource == Resource)
+            return Entry;
+        if(!Entry->Resource)
+            break;
+        i = (i+1) & (DLD_PROF_RES_TABLE_SIZE-1);
+    }
+    return NULL;
+}
+
+/// Register Resource in class table. Resources, that don't fit, are not profiled
+PDLD_PROF_RES DLDProfAddResource(PERESOURCE Resource,
+                                 ULONG Class)
+{
+    ULONG i, n;
+    PDLD_PROF_RES Entry;
+    PERESOURCE Old;
+    KIRQL oldIrql;
+
+    if(!DLDProfResTable)
+        return NULL;
+    i = DLDProfHash(Resource);
+    KeAcquireSpinLock(&DLDProfResLock, &oldIrql);
+    for(n=0; n<DLD_PROF_RES_TABLE_SIZE; n++) {
+        Entry = &DLDProfResTable[i];
+        Old = Entry->Resource;
+        if(!Old || (Old == DLD_PROF_RES_DELETED)) {
+            // nobody acquires Resource until its initialization is completed
+            Entry->Class = Class;
+            Entry->ExclDepth = 0;
+            Entry->Resource = Resource;
+            KeReleaseSpinLock(&DLDProfResLock, oldIrql);
+            return Entry;
+        }
+        i = (i+1) & (DLD_PROF_RES_TABLE_SIZE-1);
+    }
+    KeReleaseSpinLock(&DLDProfResLock, oldIrql);
+    return NULL;
+}
+
+/// Unregister Resource. Tombstones at the end of probe chain are turned
+/// back to free slots, so lookups don't have to walk long tombstone runs
+/// after FCB create/delete churn
+VOID DLDProfRemoveResource(PERESOURCE Resource)
+{
+    ULONG i;
+    PDLD_PROF_RES Entry;
+    KIRQL oldIrql;
+
+    if(!(Entry = DLDProfFindResource(Resource)))
+        return;
+    i = (ULONG)(Entry - DLDProfResTable);
+    KeAcquireSpinLock(&DLDProfResLock, &oldIrql);
+    Entry->Resource = DLD_PROF_RES_DELETED;
+    // no entry behind free slot belongs to this probe chain
+    while(!DLDProfResTable[(i+1) & (DLD_PROF_RES_TABLE_SIZE-1)].Resource &&
+          (DLDProfResTable[i].Resource == DLD_PROF_RES_DELETED)) {
+        DLDProfResTable[i].Resource = NULL;
+        i = (i-1) & (DLD_PROF_RES_TABLE_SIZE-1);
+    }
+    KeReleaseSpinLock(&DLDProfResLock, oldIrql);
+}
+
+/// Convert performance counter delta to 100ns units
+__inline ULONG DLDProfTo100ns(LONGLONG Delta)
+{
+    Delta = (Delta * 10000000) / DLDProfFreq;
+    return (Delta > MAXULONG) ? MAXULONG : (ULONG)Delta;
+}
+
+/// Histogram bucket for time in 100ns units
+__inline ULONG DLDProfBucket(ULONG Time)
+{
+    ULONG us = Time / 10;
+    ULONG b = 0;
+
+    while(us && (b < UDF_LOCK_PROF_BUCKETS-1)) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/// Account wait at specified call site
+VOID DLDProfRecordSite(ULONG Class,
+                       ULONG BugCheckId,
+                       ULONG Line,
+                       ULONG WaitTime)
+{
+    PDLD_PROF_SITES Sites = &DLDProfSites[Class];
+    PUDF_LOCK_PROF_SITE Site;
+    PUDF_LOCK_PROF_SITE Min = NULL;
+    KIRQL oldIrql;
+    ULONG i;
+
+    KeAcquireSpinLock(&Sites->Lock, &oldIrql);
+    for(i=0; i<UDF_LOCK_PROF_SITES; i++) {
+        Site = &Sites->Site[i];
+        if(Site->BugCheckId == BugCheckId && Site->Line == Line)
+            break;
+        if(!Min || (Site->WaitTime < Min->WaitTime))
+            Min = Site;
+    }
+    if(i >= UDF_LOCK_PROF_SITES) {
+        // replace the least contended site, new one inherits its
+        // counters, so it is not evicted immediately
+        Site = Min;
+        Site->BugCheckId = BugCheckId;
+        Site->Line = Line;
+    }
+    Site->Contentions++;
+    Site->WaitTime += WaitTime;
+    KeReleaseSpinLock(&Sites->Lock, oldIrql);
+}
+
+/// Initialize Resource and register it with specified lock class
+NTSTATUS DLDProfInitializeResource(PERESOURCE Resource,
+                                   ULONG Class)
+{
+    NTSTATUS RC;
+
+    RC = ExInitializeResourceLite(Resource);
+    if(NT_SUCCESS(RC))
+        DLDProfAddResource(Resource, Class);
+    return RC;
+}
+
+NTSTATUS DLDProfDeleteResource(PERESOURCE Resource)
+{
+    DLDProfRemoveResource(Resource);
+    return ExDeleteResourceLite(Resource);
+}
+
+VOID DLDProfSetClass(PERESOURCE Resource,
+                     ULONG Class)
+{
+    PDLD_PROF_RES Entry;
+
+    if((Entry = DLDProfFindResource(Resource))) {
+        Entry->Class = Class;
+    } else {
+        DLDProfAddResource(Resource, Class);
+    }
+}
+
+__inline BOOLEAN DLDProfAcquireResource(PERESOURCE Resource,
+                                        BOOLEAN Wait,
+                                        ULONG Mode)
+{
+    switch(Mode) {
+    case DLD_PROF_EXCLUSIVE:
+        return ExAcquireResourceExclusiveLite(Resource, Wait);
+    case DLD_PROF_SHARED:
+        return ExAcquireResourceSharedLite(Resource, Wait);
+    case DLD_PROF_STARVE_EXCL:
+        return ExAcquireSharedStarveExclusive(Resource, Wait);
+    default:
+        return ExAcquireSharedWaitForExclusive(Resource, Wait);
+    }
+}
+
+/// Acquire Resource and account acquisition. Uncontended case costs
+/// one extra non-blocking attempt, timestamps are taken only when
+/// we have to wait or become exclusive owner
+BOOLEAN DLDProfAcquire(PERESOURCE Resource,
+                       BOOLEAN CanWait,
+                       ULONG Mode,
+                       ULONG BugCheckId,
+                       ULONG Line)
+{
+    PDLD_PROF_RES Entry;
+    PDLD_PROF_STATS Stats;
+    ULONG Class;
+    ULONG WaitTime;
+    LARGE_INTEGER t0, t1;
+
+    Entry = DLDProfFindResource(Resource);
+    Class = Entry ? Entry->Class : DLD_PROF_OTHER;
+
+    if(!DLDProfAcquireResource(Resource, FALSE, Mode)) {
+        if(!CanWait) {
+            if(DLDProfStats)
+                ExInterlockedAddLargeStatistic(&(DLDProfCurrentStats(Class)->Failed), 1);
+            return FALSE;
+        }
+        t0 = KeQueryPerformanceCounter(NULL);
+        DLDProfAcquireResource(Resource, TRUE, Mode);
+        t1 = KeQueryPerformanceCounter(NULL);
+        if(DLDProfStats) {
+            WaitTime = DLDProfTo100ns(t1.QuadPart - t0.QuadPart);
+            Stats = DLDProfCurrentStats(Class);
+            ExInterlockedAddLargeStatistic(&Stats->Contended, 1);
+            ExInterlockedAddLargeStatistic(&Stats->WaitTime, WaitTime);
+            InterlockedIncrement(&Stats->WaitHist[DLDProfBucket(WaitTime)]);
+            DLDProfRecordSite(Class, BugCheckId, Line, WaitTime);
+        }
+    }
+    if(DLDProfStats)
+        ExInterlockedAddLargeStatistic(&(DLDProfCurrentStats(Class)->Acquired), 1);
+
+    if(Entry && ExIsResourceAcquiredExclusiveLite(Resource)) {
+        if(!(Entry->ExclDepth++)) {
+            Entry->AcquireTime = KeQueryPerformanceCounter(NULL).QuadPart;
+        }
+    }
+    return TRUE;
+}
+
+/// Account end of exclusive ownership
+VOID DLDProfEndHold(PDLD_PROF_RES Entry)
+{
+    PDLD_PROF_STATS Stats;
+    ULONG HoldTime;
+
+    if(!DLDProfStats)
+        return;
+    HoldTime = DLDProfTo100ns(KeQueryPerformanceCounter(NULL).QuadPart - Entry->AcquireTime);
+    Stats = DLDProfCurrentStats(Entry->Class);
+    ExInterlockedAddLargeStatistic(&Stats->HoldTime, HoldTime);
+    InterlockedIncrement(&Stats->HoldHist[DLDProfBucket(HoldTime)]);
+}
+
+VOID DLDProfRelease(PERESOURCE Resource)
+{
+    PDLD_PROF_RES Entry;
+
+    Entry = DLDProfFindResource(Resource);
+    if(Entry && Entry->ExclDepth && ExIsResourceAcquiredExclusiveLite(Resource)) {
+        if(!(--Entry->ExclDepth))
+            DLDProfEndHold(Entry);
+    }
+    ExReleaseResourceForThreadLite(Resource, ExGetCurrentResourceThread());
+}
+
+VOID DLDProfConvertExclusiveToShared(PERESOURCE Resource)
+{
+    PDLD_PROF_RES Entry;
+
+    Entry = DLDProfFindResource(Resource);
+    if(Entry && Entry->ExclDepth) {
+        Entry->ExclDepth = 0;
+        DLDProfEndHold(Entry);
+    }
+    ExConvertExclusiveToSharedLite(Resource);
+}
+
+/// Sum per-CPU counters
+VOID DLDProfQuery(PUDF_LOCK_PROFILE_OUT Profile)
+{
+    PDLD_PROF_STATS Stats;
+    PUDF_LOCK_PROF_CLASS Out;
+    KIRQL oldIrql;
+    ULONG c, i, b;
+
+    Profile->header.Length = sizeof(UDF_LOCK_PROFILE_OUT);
+    Profile->header.Classes = DLD_PROF_CLASSES;
+    if(!DLDProfStats)
+        return;
+    for(c=0; c<DLD_PROF_CLASSES; c++) {
+        Out = &Profile->Class[c];
+        for(i=0; i<DLDProfCpuCount; i++) {
+            Stats = &DLDProfStats[i*DLD_PROF_CLASSES + c];
+            Out->Acquired  += Stats->Acquired.QuadPart;
+            Out->Contended += Stats->Contended.QuadPart;
+            Out->Failed    += Stats->Failed.QuadPart;
+            Out->WaitTime  += Stats->WaitTime.QuadPart;
+            Out->HoldTime  += Stats->HoldTime.QuadPart;
+            for(b=0; b<UDF_LOCK_PROF_BUCKETS; b++) {
+                Out->WaitHist[b] += Stats->WaitHist[b];
+                Out->HoldHist[b] += Stats->HoldHist[b];
+            }
+        }
+        KeAcquireSpinLock(&DLDProfSites[c].Lock, &oldIrql);
+        RtlCopyMemory(&Out->Sites, &DLDProfSites[c].Site, sizeof(Out->Sites));
+        KeReleaseSpinLock(&DLDProfSites[c].Lock, oldIrql);
+    }
+}
+
+#endif //UDF_LOCK_PROFILER
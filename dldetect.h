@@ -68,4 +68,79 @@ typedef struct _THREAD_REC_BLOCK {
     PERESOURCE          HoldingResource;
 } THREAD_REC_BLOCK, *PTHREAD_REC_BLOCK;
 
+#ifdef UDF_LOCK_PROFILER
+
+/// Lock classes, see UDF_LOCK_PROFILE_OUT
+#define DLD_PROF_OTHER          0
+#define DLD_PROF_VCB            1
+#define DLD_PROF_BITMAP         2
+#define DLD_PROF_DLOC           3
+#define DLD_PROF_IO             4
+#define DLD_PROF_PREALLOC       5
+#define DLD_PROF_WCACHE         6
+#define DLD_PROF_FCB_MAIN       7
+#define DLD_PROF_FCB_PAGING     8
+#define DLD_PROF_CLASSES        UDF_LOCK_PROF_CLASSES
+
+/// Acquisition modes
+#define DLD_PROF_EXCLUSIVE      0
+#define DLD_PROF_SHARED         1
+#define DLD_PROF_STARVE_EXCL    2
+#define DLD_PROF_WAIT_EXCL      3
+
+/// Size of Resource -> lock class table, must be power of 2
+#define DLD_PROF_RES_TABLE_SIZE 8192
+
+typedef struct _DLD_PROF_RES {
+    PERESOURCE          Resource;       // NULL - free, DLD_PROF_RES_DELETED - deleted
+    ULONG               Class;
+    ULONG               ExclDepth;      // modified by exclusive owner only
+    LONGLONG            AcquireTime;
+} DLD_PROF_RES, *PDLD_PROF_RES;
+
+#define DLD_PROF_RES_DELETED    ((PERESOURCE)(ULONG_PTR)1)
+
+/// Per-CPU counters of one lock class
+typedef struct _DLD_PROF_STATS {
+    LARGE_INTEGER       Acquired;
+    LARGE_INTEGER       Contended;
+    LARGE_INTEGER       Failed;
+    LARGE_INTEGER       WaitTime;
+    LARGE_INTEGER       HoldTime;
+    LONG                WaitHist[UDF_LOCK_PROF_BUCKETS];
+    LONG                HoldHist[UDF_LOCK_PROF_BUCKETS];
+} DLD_PROF_STATS, *PDLD_PROF_STATS;
+
+/// Top contending call sites of one lock class
+typedef struct _DLD_PROF_SITES {
+    KSPIN_LOCK          Lock;
+    UDF_LOCK_PROF_SITE  Site[UDF_LOCK_PROF_SITES];
+} DLD_PROF_SITES, *PDLD_PROF_SITES;
+
+BOOLEAN DLDProfInit(VOID);
+
+VOID DLDProfFree(VOID);
+
+NTSTATUS DLDProfInitializeResource(PERESOURCE Resource,
+                                   ULONG Class);
+
+NTSTATUS DLDProfDeleteResource(PERESOURCE Resource);
+
+VOID DLDProfSetClass(PERESOURCE Resource,
+                     ULONG Class);
+
+BOOLEAN DLDProfAcquire(PERESOURCE Resource,
+                       BOOLEAN CanWait,
+                       ULONG Mode,
+                       ULONG BugCheckId,
+                       ULONG Line);
+
+VOID DLDProfRelease(PERESOURCE Resource);
+
+VOID DLDProfConvertExclusiveToShared(PERESOURCE Resource);
+
+VOID DLDProfQuery(PUDF_LOCK_PROFILE_OUT Profile);
+
+#endif //UDF_LOCK_PROFILER
+
 #endif // _DL_DETECT_H_
@@ -683,125 +683,15 @@ try_exit: NOTHING;
 } // end UDFFastIoQueryNetInfo()
 
 
-/*************************************************************************
-*
-* Function: UDFFastIoMdlRead()
-*
-* Description:
-*   Bypass the traditional IRP method to perform a MDL read operation.
-*
-* Expected Interrupt Level (for execution) :
-*
-*  IRQL_PASSIVE_LEVEL
-*
-* Return Value: TRUE/FALSE
-*
-*************************************************************************/
-/*BOOLEAN UDFFastIoMdlRead(
-IN PFILE_OBJECT             FileObject,
-IN PLARGE_INTEGER           FileOffset,
-IN ULONG                    Length,
-IN ULONG                    LockKey,
-OUT PMDL*                   MdlChain,
-OUT PIO_STATUS_BLOCK        IoStatus,
-IN PDEVICE_OBJECT           DeviceObject)
-{
-    BOOLEAN ReturnedStatus = FALSE;     // fast i/o failed/not allowed
-    NTSTATUS RC = STATUS_SUCCESS;
-    PtrUDFIrpContext IrpContext = NULL;
-
-    FsRtlEnterFileSystem();
-
-    _SEH2_TRY {
-
-        _SEH2_TRY {
-
-            // See description in UDFFastIoRead() before filling-in the
-            // stub here.
-            NOTHING;
-
-
-        } __except (UDFExceptionFilter(IrpContext, GetExceptionInformation())) {
-
-            RC = UDFExceptionHandler(IrpContext, NULL);
-
-            UDFLogEvent(UDF_ERROR_INTERNAL_ERROR, RC);
-
-        }
-
-        //try_exit: NOTHING;
-
-    } _SEH2_FINALLY {
-
-    }
-
-    FsRtlExitFileSystem();
-
-    return(ReturnedStatus);
-}*/
-
-
-/*************************************************************************
-*
-* Function: UDFFastIoMdlReadComplete()
-*
-* Description:
-*   Bypass the traditional IRP method to inform the NT Cache Manager and the
-*   FSD that the caller no longer requires the data locked in the system cache
-*   or the MDL to stay around anymore ..
-*
-* Expected Interrupt Level (for execution) :
-*
-*  IRQL_PASSIVE_LEVEL
-*
-* Return Value: TRUE/FALSE
-*
-*************************************************************************/
-/*BOOLEAN UDFFastIoMdlReadComplete(
-IN PFILE_OBJECT             FileObject,
-OUT PMDL                            MdlChain,
-IN PDEVICE_OBJECT               DeviceObject)
-{
-    BOOLEAN             ReturnedStatus = FALSE;     // fast i/o failed/not allowed
-    NTSTATUS                RC = STATUS_SUCCESS;
-   PtrUDFIrpContext IrpContext = NULL;
-
-    FsRtlEnterFileSystem();
-
-    _SEH2_TRY {
-
-        _SEH2_TRY {
-
-            // See description in UDFFastIoRead() before filling-in the
-            // stub here.
-            NOTHING;
-
-        } __except (UDFExceptionFilter(IrpContext, GetExceptionInformation())) {
-
-            RC = UDFExceptionHandler(IrpContext, NULL);
-
-            UDFLogEvent(UDF_ERROR_INTERNAL_ERROR, RC);
-
-        }
-
-        //try_exit: NOTHING;
-
-    } _SEH2_FINALLY {
-
-    }
-
-    FsRtlExitFileSystem();
-
-    return(ReturnedStatus);
-}*/
-
-
 /*************************************************************************
 *
 * Function: UDFFastIoPrepareMdlWrite()
 *
 * Description:
 *   Bypass the traditional IRP method to prepare for a MDL write operation.
+*   The caller gets MDL describing system cache pages and fills them in
+*   place. Other MDL fast i/o entries go directly to FsRtl (see
+*   UDFInitializeFunctionPointers()).
 *
 * Expected Interrupt Level (for execution) :
 *
@@ -810,7 +700,8 @@ IN PDEVICE_OBJECT               DeviceObject)
 * Return Value: TRUE/FALSE
 *
 *************************************************************************/
-/*BOOLEAN
+BOOLEAN
+NTAPI
 UDFFastIoPrepareMdlWrite(
     IN PFILE_OBJECT      FileObject,
     IN PLARGE_INTEGER    FileOffset,
@@ -821,94 +712,22 @@ UDFFastIoPrepareMdlWrite(
     IN PDEVICE_OBJECT    DeviceObject
     )
 {
-    BOOLEAN              ReturnedStatus = FALSE; // fast i/o failed/not allowed
-    NTSTATUS             RC = STATUS_SUCCESS;
-   PtrUDFIrpContext IrpContext = NULL;
-
-    FsRtlEnterFileSystem();
-
-    _SEH2_TRY {
-
-        _SEH2_TRY {
-
-            // See description in UDFFastIoRead() before filling-in the
-            // stub here.
-            NOTHING;
-
-        } __except (UDFExceptionFilter(IrpContext, GetExceptionInformation())) {
-
-            RC = UDFExceptionHandler(IrpContext, NULL);
-
-            UDFLogEvent(UDF_ERROR_INTERNAL_ERROR, RC);
-
-        }
-
-        //try_exit: NOTHING;
-
-    } _SEH2_FINALLY {
-
-    }
-
-    FsRtlExitFileSystem();
-
-    return(ReturnedStatus);
-}*/
-
-
-/*************************************************************************
-*
-* Function: UDFFastIoMdlWriteComplete()
-*
-* Description:
-*   Bypass the traditional IRP method to inform the NT Cache Manager and the
-*   FSD that the caller has updated the contents of the MDL. This data can
-*   now be asynchronously written out to secondary storage by the Cache Mgr.
-*
-* Expected Interrupt Level (for execution) :
-*
-*  IRQL_PASSIVE_LEVEL
-*
-* Return Value: TRUE/FALSE
-*
-*************************************************************************/
-/*BOOLEAN UDFFastIoMdlWriteComplete(
-IN PFILE_OBJECT             FileObject,
-IN PLARGE_INTEGER               FileOffset,
-OUT PMDL                            MdlChain,
-IN PDEVICE_OBJECT               DeviceObject)
-{
-    BOOLEAN             ReturnedStatus = FALSE;     // fast i/o failed/not allowed
-    NTSTATUS                RC = STATUS_SUCCESS;
-   PtrUDFIrpContext IrpContext = NULL;
-
-    FsRtlEnterFileSystem();
-
-    _SEH2_TRY {
-
-        _SEH2_TRY {
-
-            // See description in UDFFastIoRead() before filling-in the
-            // stub here.
-            NOTHING;
-
-        } __except (UDFExceptionFilter(IrpContext, GetExceptionInformation())) {
-
-            RC = UDFExceptionHandler(IrpContext, NULL);
-
-            UDFLogEvent(UDF_ERROR_INTERNAL_ERROR, RC);
-
-        }
-
-        //try_exit: NOTHING;
-
-    } _SEH2_FINALLY {
+    // Obtain a pointer to the FCB and CCB for the file stream.
+    PCCB Ccb = (PCCB)FileObject->FsContext2;
+    ASSERT(Ccb);
+    PFCB Fcb = Ccb->Fcb;
+    ASSERT(Fcb);
 
+    // same back pressure as in UDFFastIoCopyWrite()
+    if(Fcb->Vcb->VerifyCtx.QueuedCount ||
+       Fcb->Vcb->VerifyCtx.ItemCount >= UDF_MAX_VERIFY_CACHE) {
+        AdPrint(("    Verify queue overflow -> UDFFastIoPrepareMdlWrite() = FALSE\n"));
+        return FALSE;
     }
 
-    FsRtlExitFileSystem();
+    return FsRtlPrepareMdlWriteDev(FileObject, FileOffset, Length, LockKey, MdlChain, IoStatus, DeviceObject);
 
-    return(ReturnedStatus);
-}*/
+} // end UDFFastIoPrepareMdlWrite()
 
 
 /*************************************************************************
@@ -628,6 +628,11 @@ UDFCommonSetInfo(
             try_return(RC);
         }
 
+        if(NT_SUCCESS(RC) &&
+           (FunctionalityRequested != FilePositionInformation)) {
+            UDFMarkFcbDirty(Vcb, Fcb);
+        }
+
 try_exit:   NOTHING;
 
     } _SEH2_FINALLY {
@@ -2345,6 +2350,12 @@ post_rename:
         if(!NT_SUCCESS(RC))
             try_return (RC);
 
+        UDFMarkFcbDirty(Vcb, DirInfo->Fcb);
+        UDFMarkFcbDirty(Vcb, TargetDirInfo->Fcb);
+        // FE (parent ICB) and, for directories, ".." FI are changed too
+        UDFMarkFcbDirty(Vcb, FileInfo->Fcb);
+        UDFPathCacheInvalidate(Vcb);
+
         ASSERT(UDFDirIndex(FileInfo->ParentFile->Dloc->DirIndex, FileInfo->Index)->FileInfo == FileInfo);
 
         RC = MyCloneUnicodeString(&LocalPath, (TargetDirInfo->Fcb->FCBFlags & UDF_FCB_ROOT_DIRECTORY) ?
@@ -2816,6 +2827,12 @@ UDFHardLink(
         RC = UDFHardLinkFile__(Vcb, ic, &Replace, &NewName, Dir1, Dir2, File1);
         if(!NT_SUCCESS(RC)) try_return (RC);
 
+        UDFMarkFcbDirty(Vcb, Dir1->Fcb);
+        UDFMarkFcbDirty(Vcb, Dir2->Fcb);
+        // link count in FE
+        UDFMarkFcbDirty(Vcb, File1->Fcb);
+        UDFPathCacheInvalidate(Vcb);
+
         // Update Parent Objects (mark 'em as modified)
         if(Vcb->CompatFlags & UDF_VCB_IC_UPDATE_DIR_WRITE) {
             if(DirObject2) {
@@ -470,7 +470,8 @@ SkipFlushDir:
 * Function: UDFFlushLogicalVolume()
 *
 * Description:
-*   Flush everything beginning from root directory.
+*   Flush objects modified since the previous flush, or everything
+*   beginning from root directory if UDF_FLUSH_FLAGS_FULL_TREE is set.
 *   Vcb must be previously acquired exclusively.
 *
 * Expected Interrupt Level (for execution) :
@@ -490,6 +491,8 @@ UDFFlushLogicalVolume(
 {
     ULONG ret_val = 0;
     IO_STATUS_BLOCK IoStatus;
+    BOOLEAN Batched;
+    PFCB Fcb;
 
     UDFPrint(("UDFFlushLogicalVolume: \n"));
 
@@ -505,7 +508,30 @@ UDFFlushLogicalVolume(
         // NOTE: This function may also be invoked internally as part of
         // processing a shutdown request.
         ASSERT(Vcb->RootDirFCB);
-        ret_val |= UDFFlushADirectory(Vcb, Vcb->RootDirFCB->FileInfo, &IoStatus, FlushFlags);
+        if(!(FlushFlags & UDF_FLUSH_FLAGS_FULL_TREE)) {
+            // visit only objects modified since the previous flush
+            ret_val |= UDFFlushDirtySet(Vcb, FlushFlags);
+        } else {
+            // Vcb is held exclusively, so FEs modified in the tree can be
+            // collected and written sorted by LBA
+            Batched = UDFMetaBatchBegin(Vcb);
+            ret_val |= UDFFlushADirectory(Vcb, Vcb->RootDirFCB->FileInfo, &IoStatus, FlushFlags);
+            if(Batched &&
+               !OS_SUCCESS(UDFMetaBatchEnd(Vcb))) {
+                // failed FEs are re-marked as dirty, keep the dirty set
+                UDFPrint(("UDFFlushLogicalVolume: some FEs are not written\n"));
+            } else
+            if(!(ret_val & UDF_FLUSH_FLAGS_INTERRUPTED)) {
+                // the whole tree is flushed now, the dirty set is stale
+                UDFAcquireResourceExclusive(&(Vcb->FlushResource),TRUE);
+                while(!IsListEmpty(&(Vcb->DirtyFcbList))) {
+                    Fcb = CONTAINING_RECORD(RemoveHeadList(&(Vcb->DirtyFcbList)), FCB, DirtyLinks);
+                    Fcb->DirtyLinks.Flink = Fcb->DirtyLinks.Blink = NULL;
+                }
+                Vcb->DirtyFcbCount = 0;
+                UDFReleaseResource(&(Vcb->FlushResource));
+            }
+        }
 
 //        if(UDFFlushIsBreaking(Vcb, FlushFlags))
 //            return;
@@ -584,7 +610,7 @@ UDFFlushIsBreaking(
     )
 {
     BOOLEAN ret_val = FALSE;
-//    if(!(FlushFlags & UDF_FLUSH_FLAGS_BREAKABLE))
+    if(!(FlushFlags & UDF_FLUSH_FLAGS_BREAKABLE))
         return FALSE;
     UDFAcquireResourceExclusive(&(Vcb->FlushResource),TRUE);
     ret_val = (Vcb->VCBFlags & VCB_STATE_FLUSH_BREAK_REQ) ? TRUE : FALSE;
@@ -606,3 +632,242 @@ UDFFlushTryBreak(
     Vcb->VCBFlags |= VCB_STATE_FLUSH_BREAK_REQ;
     UDFReleaseResource(&(Vcb->FlushResource));
 } // end UDFFlushTryBreak()
+
+/*
+  Add Fcb to the set of objects to be written by the next
+  Lite flush. Cheap enough to be called on each modification
+ */
+VOID
+UDFMarkFcbDirty(
+    IN PVCB         Vcb,
+    IN PFCB         Fcb
+    )
+{
+    if(!Fcb || Fcb->DirtyLinks.Flink ||
+       (Fcb->NodeIdentifier.NodeTypeCode != UDF_NODE_TYPE_FCB) ||
+       (Vcb->VCBFlags & VCB_STATE_VOLUME_READ_ONLY))
+        return;
+    UDFAcquireResourceExclusive(&(Vcb->FlushResource),TRUE);
+    if(!Fcb->DirtyLinks.Flink) {
+        InsertTailList(&(Vcb->DirtyFcbList), &(Fcb->DirtyLinks));
+        Vcb->DirtyFcbCount++;
+    }
+    UDFReleaseResource(&(Vcb->FlushResource));
+} // end UDFMarkFcbDirty()
+
+/*
+  Remove Fcb from the dirty set. Must be called before
+  Fcb structure is released
+ */
+VOID
+UDFForgetDirtyFcb(
+    IN PVCB         Vcb,
+    IN PFCB         Fcb
+    )
+{
+    if(!Fcb->DirtyLinks.Flink)
+        return;
+    UDFAcquireResourceExclusive(&(Vcb->FlushResource),TRUE);
+    if(Fcb->DirtyLinks.Flink) {
+        RemoveEntryList(&(Fcb->DirtyLinks));
+        Fcb->DirtyLinks.Flink = Fcb->DirtyLinks.Blink = NULL;
+        Vcb->DirtyFcbCount--;
+    }
+    UDFReleaseResource(&(Vcb->FlushResource));
+} // end UDFForgetDirtyFcb()
+
+/*
+  Flush FCBs modified since the previous flush instead of
+  walking the whole directory tree. FCBs left unflushed because
+  of break request stay in the set.
+  Vcb must be previously acquired exclusively.
+ */
+ULONG
+UDFFlushDirtySet(
+    IN PVCB         Vcb,
+    IN ULONG        FlushFlags
+    )
+{
+    IO_STATUS_BLOCK IoStatus;
+    PFCB Fcb;
+    ULONG ret_val = 0;
+    BOOLEAN Batched;
+
+    UDFPrint(("UDFFlushDirtySet: %d FCBs\n", Vcb->DirtyFcbCount));
+
+    Batched = UDFMetaBatchBegin(Vcb);
+    while(TRUE) {
+        UDFAcquireResourceExclusive(&(Vcb->FlushResource),TRUE);
+        if(IsListEmpty(&(Vcb->DirtyFcbList))) {
+            UDFReleaseResource(&(Vcb->FlushResource));
+            break;
+        }
+        Fcb = CONTAINING_RECORD(RemoveHeadList(&(Vcb->DirtyFcbList)), FCB, DirtyLinks);
+        Fcb->DirtyLinks.Flink = Fcb->DirtyLinks.Blink = NULL;
+        Vcb->DirtyFcbCount--;
+        UDFReleaseResource(&(Vcb->FlushResource));
+
+        // deleted files are never flushed, see UDFCleanUpFcbChain()
+        if(Fcb->FileInfo &&
+           !(Fcb->FCBFlags & UDF_FCB_DELETED)) {
+            ret_val |= UDFFlushAFile(Fcb, NULL, &IoStatus, FlushFlags);
+        }
+        if(UDFFlushIsBreaking(Vcb, FlushFlags)) {
+            ret_val |= UDF_FLUSH_FLAGS_INTERRUPTED;
+            break;
+        }
+    }
+    if(Batched &&
+       !OS_SUCCESS(UDFMetaBatchEnd(Vcb))) {
+        // failed FEs are re-marked as dirty and written by the next flush
+        UDFPrint(("UDFFlushDirtySet: some FEs are not written\n"));
+    }
+
+    return ret_val;
+} // end UDFFlushDirtySet()
+
+/*
+  Arm periodic background flush. Tree_FlushPriod controls Lite flush
+  of the dirty set, BM_FlushPriod controls write-back of the cached
+  blocks. Both are in seconds, 0 disables corresponding flush
+ */
+VOID
+UDFStartTreeFlush(
+    IN PVCB         Vcb
+    )
+{
+    LARGE_INTEGER DueTime;
+    ULONG Tick;
+
+    if(Vcb->TreeFlushTick ||
+       Vcb->CDR_Mode ||
+       (Vcb->VCBFlags & (VCB_STATE_VOLUME_READ_ONLY | VCB_STATE_RAW_DISK)))
+        return;
+
+    Tick = Vcb->Tree_FlushPriod;
+    if(!Tick ||
+       (Vcb->BM_FlushPriod && Vcb->BM_FlushPriod < Tick)) {
+        Tick = Vcb->BM_FlushPriod;
+    }
+    if(!Tick)
+        return;
+
+    UDFPrint(("UDFStartTreeFlush: tick %d sec\n", Tick));
+    Vcb->Tree_FlushTime =
+    Vcb->BM_FlushTime = 0;
+    Vcb->TreeFlushTick = Tick;
+    DueTime.QuadPart = -(LONGLONG)Tick * 10000000;
+    KeSetTimerEx(&(Vcb->TreeFlushTimer), DueTime, Tick * 1000, &(Vcb->TreeFlushDpc));
+} // end UDFStartTreeFlush()
+
+/*
+  Disarm background flush and wait for the running pass (if any).
+  Must be called before Vcb is released
+ */
+VOID
+UDFStopTreeFlush(
+    IN PVCB         Vcb
+    )
+{
+    LARGE_INTEGER delay;
+
+    if(!Vcb->TreeFlushTick)
+        return;
+
+    KeCancelTimer(&(Vcb->TreeFlushTimer));
+    KeFlushQueuedDpcs();
+    delay.QuadPart = -500000; // 0.05 sec
+    while(Vcb->TreeFlushActive) {
+        KeDelayExecutionThread(KernelMode, FALSE, &delay);
+    }
+    Vcb->TreeFlushTick = 0;
+} // end UDFStopTreeFlush()
+
+/*
+  Background flush timer routine. Flush itself requires PASSIVE_LEVEL,
+  so it is performed by UDFTreeFlushWorker()
+ */
+VOID
+NTAPI
+UDFTreeFlushDpc(
+    IN PKDPC        Dpc,
+    IN PVOID        DeferredContext,
+    IN PVOID        SystemArgument1,
+    IN PVOID        SystemArgument2
+    )
+{
+    PVCB Vcb = (PVCB)DeferredContext;
+
+    // previous pass is still running, skip this tick
+    if(InterlockedCompareExchange(&(Vcb->TreeFlushActive), 1, 0))
+        return;
+    ExQueueWorkItem(&(Vcb->TreeFlushItem), DelayedWorkQueue);
+} // end UDFTreeFlushDpc()
+
+/*
+  Background flush pass. Foreground requests have priority: volume is
+  never waited for and Lite flush is breakable by UDFFlushTryBreak()
+ */
+VOID
+NTAPI
+UDFTreeFlushWorker(
+    IN PVOID        Context
+    )
+{
+    PVCB Vcb = (PVCB)Context;
+    BOOLEAN FlushTree;
+    BOOLEAN FlushCache;
+    _SEH2_VOLATILE BOOLEAN AcquiredVcb = FALSE;
+
+    FsRtlEnterFileSystem();
+
+    _SEH2_TRY {
+        if((Vcb->VcbCondition != VcbMounted) ||
+           (Vcb->VCBFlags & (VCB_STATE_VOLUME_READ_ONLY |
+                             VCB_STATE_VOLUME_LOCKED |
+                             VCB_STATE_RAW_DISK)))
+            try_return(NOTHING);
+
+        Vcb->Tree_FlushTime += Vcb->TreeFlushTick;
+        Vcb->BM_FlushTime += Vcb->TreeFlushTick;
+        FlushTree = Vcb->Tree_FlushPriod &&
+                    (Vcb->Tree_FlushTime >= Vcb->Tree_FlushPriod) &&
+                    Vcb->DirtyFcbCount;
+        FlushCache = Vcb->BM_FlushPriod &&
+                     (Vcb->BM_FlushTime >= Vcb->BM_FlushPriod);
+        if(!FlushTree && !FlushCache)
+            try_return(NOTHING);
+
+        if(!UDFAcquireResourceExclusive(&(Vcb->VCBResource), FALSE))
+            try_return(NOTHING);
+        AcquiredVcb = TRUE;
+
+        // break requests posted before we got the volume are stale
+        UDFAcquireResourceExclusive(&(Vcb->FlushResource),TRUE);
+        Vcb->VCBFlags &= ~VCB_STATE_FLUSH_BREAK_REQ;
+        UDFReleaseResource(&(Vcb->FlushResource));
+
+        if(Vcb->VcbCondition == VcbMounted) {
+            if(FlushTree &&
+               !(UDFFlushLogicalVolume(NULL, NULL, Vcb, UDF_FLUSH_FLAGS_LITE | UDF_FLUSH_FLAGS_BREAKABLE) &
+                 UDF_FLUSH_FLAGS_INTERRUPTED)) {
+                Vcb->Tree_FlushTime = 0;
+            }
+            if(FlushCache) {
+                WCacheFlushAll__(&(Vcb->FastCache), Vcb);
+                Vcb->BM_FlushTime = 0;
+            }
+        }
+
+try_exit: NOTHING;
+    } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+        BrutePoint();
+    } _SEH2_END;
+
+    if(AcquiredVcb) {
+        UDFReleaseResource(&(Vcb->VCBResource));
+    }
+
+    InterlockedExchange(&(Vcb->TreeFlushActive), 0);
+    FsRtlExitFileSystem();
+} // end UDFTreeFlushWorker()
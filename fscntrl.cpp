@@ -252,6 +252,16 @@ UDFUserFsCtrlRequest(
         RC = UDFGetStatistics( IrpContext, Irp );
         break;
 
+    case IOCTL_UDF_GET_PERF_COUNTERS:
+
+        RC = UDFGetPerfCounters( IrpContext, Irp );
+        break;
+
+    case IOCTL_UDF_GET_LOCK_PROFILE:
+
+        RC = UDFGetLockProfile( IrpContext, Irp );
+        break;
+
     case FSCTL_LOCK_VOLUME:
 
         RC = UDFLockVolume( IrpContext, Irp );
@@ -645,6 +655,7 @@ try_raw_mount:
                        Vcb->VolIdent.Length );
 
         Vcb->VcbCondition = VcbMounted;
+        UDFStartTreeFlush(Vcb);
 
         UDFInterlockedDecrement((PLONG)&(Vcb->VCBOpenCount));
         Vcb->TotalAllocUnits = UDFGetTotalSpace(Vcb);
@@ -1064,7 +1075,7 @@ bl_unwind_1:
     DirNdx->SysAttr = FILE_ATTRIBUTE_READONLY;
     RtlInitUnicodeString(&DirNdx->FName, L".");
     DirNdx->FileInfo = RootFcb->FileInfo;
-    DirNdx->FI_Flags |= UDFBuildHashEntry(Vcb, &(DirNdx->FName), &(DirNdx->hashes), HASH_ALL | HASH_KEEP_NAME);
+    DirNdx->FI_Flags |= UDF_FI_FLAG_KEEP_NAME;
 
     DirNdx = UDFDirIndex(hDirNdx,1);
     DirNdx->FI_Flags = UDF_FI_FLAG_SYS_ATTR;
@@ -1073,7 +1084,6 @@ bl_unwind_1:
     }
     DirNdx->SysAttr = FILE_ATTRIBUTE_READONLY;
     RtlInitUnicodeString(&DirNdx->FName, L"Blank.CD");
-    DirNdx->FI_Flags |= UDFBuildHashEntry(Vcb, &(DirNdx->FName), &(DirNdx->hashes), HASH_ALL);
 
     RootFcb->FileInfo->Dloc->DirIndex = hDirNdx;
     RootFcb->FileInfo->Fcb = RootFcb;
@@ -1214,6 +1224,7 @@ UDFCleanupVCB(
 {
     _SEH2_TRY {
         UDFReleaseFileIdCache(Vcb);
+        UDFPathCacheRelease(Vcb);
         UDFReleaseDlocList(Vcb);
     } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
         BrutePoint();
@@ -1224,27 +1235,19 @@ UDFCleanupVCB(
     MyFreeMemoryAndPointer(Vcb->Vat);
     MyFreeMemoryAndPointer(Vcb->SparingTable);
 
-    if(Vcb->FSBM_Bitmap) {
-        DbgFreePool(Vcb->FSBM_Bitmap);
-        Vcb->FSBM_Bitmap = NULL;
-    }
-    if(Vcb->ZSBM_Bitmap) {
-        DbgFreePool(Vcb->ZSBM_Bitmap);
-        Vcb->ZSBM_Bitmap = NULL;
-    }
-    if(Vcb->BSBM_Bitmap) {
-        DbgFreePool(Vcb->BSBM_Bitmap);
-        Vcb->BSBM_Bitmap = NULL;
-    }
+    UDFSparseBitmapFree(&(Vcb->FSBM_Bitmap));
+    UDFSparseBitmapFree(&(Vcb->ZSBM_Bitmap));
+    UDFSparseBitmapFree(&(Vcb->BSBM_Bitmap));
 #ifdef UDF_TRACK_ONDISK_ALLOCATION_OWNERS
     if(Vcb->FSBM_Bitmap_owners) {
         DbgFreePool(Vcb->FSBM_Bitmap_owners);
         Vcb->FSBM_Bitmap_owners = NULL;
     }
 #endif //UDF_TRACK_ONDISK_ALLOCATION_OWNERS
-    if(Vcb->FSBM_OldBitmap) {
-        DbgFreePool(Vcb->FSBM_OldBitmap);
-        Vcb->FSBM_OldBitmap = NULL;
+    UDFSparseBitmapFree(&(Vcb->FSBM_OldBitmap));
+    if(Vcb->FSBM_DirtyMap) {
+        DbgFreePool(Vcb->FSBM_DirtyMap);
+        Vcb->FSBM_DirtyMap = NULL;
     }
 
     MyFreeMemoryAndPointer(Vcb->Statistics);
@@ -1418,6 +1421,193 @@ EO_stat:
     return status;
 } // end UDFGetStatistics()
 
+/*
+    This routine returns internal performance counters
+    (see UDF_PERF_COUNTERS_OUT in udfpubl.h)
+
+Arguments:
+    Irp - Supplies the Irp to process
+
+Return Value:
+    NTSTATUS - The return status for the operation
+*/
+NTSTATUS
+UDFGetPerfCounters(
+    IN PIRP_CONTEXT IrpContext,
+    IN PIRP Irp
+    )
+{
+    PEXTENDED_IO_STACK_LOCATION IrpSp = (PEXTENDED_IO_STACK_LOCATION)IoGetCurrentIrpStackLocation( Irp );
+    NTSTATUS status;
+
+    PUDF_PERF_COUNTERS_OUT Buffer;
+    UDF_PERF_COUNTERS_OUT Counters;
+    PUDF_DELAYED_CLOSE_SHARD Shard;
+    PVCB Vcb;
+    KIRQL SavedIrql;
+    ULONG BufferLength;
+    ULONG BytesToCopy;
+    ULONG i;
+
+    UDFPrint(("UDFGetPerfCounters\n"));
+
+    BufferLength = IrpSp->Parameters.FileSystemControl.OutputBufferLength;
+    Buffer = (PUDF_PERF_COUNTERS_OUT)(Irp->AssociatedIrp.SystemBuffer);
+
+    //  Make sure the buffer is big enough for at least the header.
+    if (BufferLength < sizeof(Counters.header)) {
+        status = STATUS_BUFFER_TOO_SMALL;
+        Irp->IoStatus.Information = 0;
+        goto EO_perf;
+    }
+
+    RtlZeroMemory(&Counters, sizeof(Counters));
+    Counters.header.Length = sizeof(Counters);
+
+    // delayed close queues are shared by all volumes
+    Counters.DelayedCloseShards = UDFGlobalData.DelayedCloseShardCount;
+    Counters.DelayedCloseWorkers = UDFGlobalData.DelayedCloseWorkers;
+    Counters.DelayedCloseDepth = UDFGlobalData.DelayedCloseCount;
+    Counters.DirDelayedCloseDepth = UDFGlobalData.DirDelayedCloseCount;
+    for(i=0; i<UDFGlobalData.DelayedCloseShardCount; i++) {
+        Shard = &UDFGlobalData.DelayedCloseShards[i];
+        Counters.DelayedCloseDrained += Shard->Drained;
+        Counters.DelayedCloseDrainTime += Shard->DrainTime;
+        if(Shard->MaxDrainTime > Counters.DelayedCloseMaxDrainTime)
+            Counters.DelayedCloseMaxDrainTime = Shard->MaxDrainTime;
+    }
+
+    for(i=0; i<UDF_PERF_MAX_ALLOC_CLASSES; i++) {
+        if(!MyAllocQuerySlabStats(i, &Counters.AllocClass[i].Size,
+                                     &Counters.AllocClass[i].LiveBytes,
+                                     &Counters.AllocClass[i].PeakBytes,
+                                     &Counters.AllocClass[i].Pages))
+            break;
+    }
+    Counters.AllocClasses = i;
+
+    for(i=0; i<UDF_PERF_OBJ_POOLS; i++) {
+        if(!UDFQueryObjPoolStats(i, &Counters.ObjPool[i].Size,
+                                    &Counters.ObjPool[i].Live,
+                                    &Counters.ObjPool[i].Allocs,
+                                    &Counters.ObjPool[i].Hits))
+            break;
+    }
+    Counters.ObjPools = i;
+
+    Vcb = (PVCB)(((PDEVICE_OBJECT)IrpSp->DeviceObject)->DeviceExtension);
+    if(Vcb && (Vcb->NodeIdentifier.NodeTypeCode == UDF_NODE_TYPE_VCB)) {
+        Counters.MountPhases = min(UDF_MOUNT_PHASES, UDF_PERF_MOUNT_PHASES);
+        for(i=0; i<Counters.MountPhases; i++) {
+            Counters.MountPhaseTime[i] = Vcb->MountPhaseTime[i];
+        }
+
+        KeAcquireSpinLock(&(Vcb->OverflowQueueSpinLock), &SavedIrql);
+        Counters.FspClasses = min(UDF_FSP_CLASSES, UDF_PERF_FSP_CLASSES);
+        Counters.FspWorkers = Vcb->PostedRequestCount;
+        Counters.FspMaxWorkers = FSP_PER_DEVICE_THRESHOLD+1;
+        Counters.FspShards = UDF_FSP_MAX_SHARDS;
+        Counters.FspSteals = Vcb->FspSteals;
+        for(i=0; i<Counters.FspClasses; i++) {
+            Counters.FspClass[i].Depth = Vcb->FspStats[i].Depth;
+            Counters.FspClass[i].MaxDepth = Vcb->FspStats[i].MaxDepth;
+            Counters.FspClass[i].Dispatched = Vcb->FspStats[i].Dispatched;
+            Counters.FspClass[i].WaitTime = Vcb->FspStats[i].WaitTime;
+            Counters.FspClass[i].MaxWaitTime = Vcb->FspStats[i].MaxWaitTime;
+        }
+        KeReleaseSpinLock(&(Vcb->OverflowQueueSpinLock), SavedIrql);
+
+        Counters.WCachePacketWrites = Vcb->FastCache.PacketWrites;
+        Counters.WCachePacketReads = Vcb->FastCache.PacketReads;
+        Counters.WCacheBytesWritten = Vcb->FastCache.BytesWritten;
+    }
+
+    //  Now see how many bytes we can copy.
+    if (BufferLength < sizeof(Counters)) {
+        BytesToCopy = BufferLength;
+        status = STATUS_BUFFER_OVERFLOW;
+    } else {
+        BytesToCopy = sizeof(Counters);
+        status = STATUS_SUCCESS;
+    }
+
+    RtlCopyMemory( Buffer, &Counters, BytesToCopy );
+    Irp->IoStatus.Information = BytesToCopy;
+EO_perf:
+    Irp->IoStatus.Status = status;
+
+    return status;
+} // end UDFGetPerfCounters()
+
+/*
+    This routine returns ERESOURCE contention statistics
+    (see UDF_LOCK_PROFILE_OUT in udfpubl.h)
+
+Arguments:
+    Irp - Supplies the Irp to process
+
+Return Value:
+    NTSTATUS - The return status for the operation
+*/
+NTSTATUS
+UDFGetLockProfile(
+    IN PIRP_CONTEXT IrpContext,
+    IN PIRP Irp
+    )
+{
+#ifdef UDF_LOCK_PROFILER
+    PEXTENDED_IO_STACK_LOCATION IrpSp = (PEXTENDED_IO_STACK_LOCATION)IoGetCurrentIrpStackLocation( Irp );
+    NTSTATUS status;
+
+    PUDF_LOCK_PROFILE_OUT Buffer;
+    PUDF_LOCK_PROFILE_OUT Profile;
+    ULONG BufferLength;
+    ULONG BytesToCopy;
+
+    UDFPrint(("UDFGetLockProfile\n"));
+
+    BufferLength = IrpSp->Parameters.FileSystemControl.OutputBufferLength;
+    Buffer = (PUDF_LOCK_PROFILE_OUT)(Irp->AssociatedIrp.SystemBuffer);
+    Irp->IoStatus.Information = 0;
+
+    //  Make sure the buffer is big enough for at least the header.
+    if (BufferLength < sizeof(Buffer->header)) {
+        status = STATUS_BUFFER_TOO_SMALL;
+        goto EO_lprof;
+    }
+
+    // too large to be kept on stack
+    Profile = (PUDF_LOCK_PROFILE_OUT)MyAllocatePool__(NonPagedPool, sizeof(UDF_LOCK_PROFILE_OUT));
+    if (!Profile) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto EO_lprof;
+    }
+    RtlZeroMemory(Profile, sizeof(UDF_LOCK_PROFILE_OUT));
+    DLDProfQuery(Profile);
+
+    //  Now see how many bytes we can copy.
+    if (BufferLength < sizeof(UDF_LOCK_PROFILE_OUT)) {
+        BytesToCopy = BufferLength;
+        status = STATUS_BUFFER_OVERFLOW;
+    } else {
+        BytesToCopy = sizeof(UDF_LOCK_PROFILE_OUT);
+        status = STATUS_SUCCESS;
+    }
+
+    RtlCopyMemory( Buffer, Profile, BytesToCopy );
+    MyFreePool__(Profile);
+    Irp->IoStatus.Information = BytesToCopy;
+EO_lprof:
+    Irp->IoStatus.Status = status;
+
+    return status;
+#else //UDF_LOCK_PROFILER
+    Irp->IoStatus.Information = 0;
+    Irp->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+    return STATUS_INVALID_DEVICE_REQUEST;
+#endif //UDF_LOCK_PROFILER
+} // end UDFGetLockProfile()
+
 
 /*
     This routine determines if pathname is valid path for UDF Filesystem
@@ -1874,7 +2064,7 @@ UDFGetVolumeBitmap(
     LARGE_INTEGER StartingLcn;
     PVOLUME_BITMAP_BUFFER OutputBuffer;
     ULONG i, lim;
-    PULONG FSBM;
+    PUDF_SPARSE_BITMAP FSBM;
 //    PULONG Dest;
     ULONG LSh;
 
@@ -1891,6 +2081,14 @@ UDFGetVolumeBitmap(
     PFCB Fcb = Ccb->Fcb;
     PVCB Vcb = Fcb->Vcb;
 
+    // FSBM of r/o volume may be not loaded yet
+    UDFLoadDeferredFreeSpaceBitmap(Vcb);
+    if(!UDFSparseBitmapInited(&(Vcb->FSBM_Bitmap))) {
+        Irp->IoStatus.Information = 0;
+        Irp->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
     InputBufferLength = IrpSp->Parameters.FileSystemControl.InputBufferLength;
     OutputBufferLength = IrpSp->Parameters.FileSystemControl.OutputBufferLength;
 
@@ -1948,13 +2146,14 @@ UDFGetVolumeBitmap(
 
         RtlZeroMemory( &OutputBuffer->Buffer[0], BytesToCopy );
         lim = BytesToCopy * 8;
-        FSBM = (PULONG)(Vcb->FSBM_Bitmap);
+        FSBM = &(Vcb->FSBM_Bitmap);
         LSh = Vcb->LB2B_Bits;
 //        Dest = (PULONG)(&OutputBuffer->Buffer[0]);
 
-        for(i=StartingCluster & ~7; i<lim; i++) {
-            if(UDFGetFreeBit(FSBM, i<<LSh))
-                UDFSetFreeBit(FSBM, i);
+        // set bit means allocated cluster
+        for(i=0; i<lim; i++) {
+            if(UDFSparseGetUsedBit(FSBM, (StartingCluster+i)<<LSh))
+                OutputBuffer->Buffer[i>>3] |= (UCHAR)(1 << (i&7));
         }
 
     } _SEH2_EXCEPT(UDFExceptionFilter(IrpContext, _SEH2_GetExceptionInformation())) {
@@ -18,6 +18,10 @@
 //#define MY_HEAP_FORCE_NONPAGED
 //#define MY_USE_INTERNAL_MEMMANAGER
 
+#ifdef MY_USE_INTERNAL_MEMMANAGER
+#define MY_HEAP_USE_SLABS
+#endif //MY_USE_INTERNAL_MEMMANAGER
+
 //#include "udffs.h"
 #include "Include/mem_tools.h"
 
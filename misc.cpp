@@ -91,21 +91,20 @@ UDFInitializeZones(VOID)
                                         TAG_OBJECT_NAME,
                                         0);
 
-        ExInitializeNPagedLookasideList(&UDFGlobalData.NonPagedFcbLookasideList,
-                                        NULL,
-                                        NULL,
-                                        POOL_NX_ALLOCATION | POOL_RAISE_IF_ALLOCATION_FAILURE,
-                                        sizeof(FCB),
-                                        TAG_FCB_NONPAGED,
-                                        0);
+        if(!NT_SUCCESS(RC = UDFInitializeObjPool(&UDFGlobalData.ObjPool[UDF_OBJ_POOL_FCB],
+                                        sizeof(FCB), UDF_FCB_MT, TAG_FCB_NONPAGED,
+                                        UDFFcbCtor, UDFFcbDtor)))
+            try_return(RC);
 
-        ExInitializePagedLookasideList(&UDFGlobalData.CcbLookasideList,
-                                        NULL,
-                                        NULL,
-                                        POOL_NX_ALLOCATION | POOL_RAISE_IF_ALLOCATION_FAILURE,
-                                        sizeof(CCB),
-                                        TAG_CCB,
-                                        0);
+        if(!NT_SUCCESS(RC = UDFInitializeObjPool(&UDFGlobalData.ObjPool[UDF_OBJ_POOL_CCB],
+                                        sizeof(CCB), PagedPool, TAG_CCB,
+                                        UDFCcbCtor, UDFCcbDtor)))
+            try_return(RC);
+
+        if(!NT_SUCCESS(RC = UDFInitializeObjPool(&UDFGlobalData.ObjPool[UDF_OBJ_POOL_DLOC],
+                                        sizeof(UDF_DATALOC_INFO), UDF_DATALOC_INFO_MT, TAG_DLOC,
+                                        UDFDlocCtor, NULL)))
+            try_return(RC);
 
         try_return(RC = STATUS_SUCCESS);
 
@@ -142,13 +141,216 @@ try_exit:   NOTHING;
 *************************************************************************/
 VOID UDFDestroyZones(VOID)
 {
+    ULONG i;
+
     ExDeleteNPagedLookasideList(&UDFGlobalData.IrpContextLookasideList);
     ExDeleteNPagedLookasideList(&UDFGlobalData.ObjectNameLookasideList);
-    ExDeleteNPagedLookasideList(&UDFGlobalData.NonPagedFcbLookasideList);
 
-    ExDeletePagedLookasideList(&UDFGlobalData.CcbLookasideList);
+    for(i=0; i<UDF_OBJ_POOLS; i++) {
+        UDFDeleteObjPool(&UDFGlobalData.ObjPool[i]);
+    }
 }
 
+/*
+    This routine initializes object pool with per-CPU stacks of
+    released objects
+ */
+NTSTATUS
+UDFInitializeObjPool(
+    PUDF_OBJ_POOL Pool,
+    ULONG Size,
+    POOL_TYPE PoolType,
+    ULONG Tag,
+    PUDF_OBJ_CTOR Ctor,
+    PUDF_OBJ_DTOR Dtor
+    )
+{
+    Pool->Size = Size;
+    Pool->PoolType = PoolType;
+    Pool->Tag = Tag;
+    Pool->Ctor = Ctor;
+    Pool->Dtor = Dtor;
+    Pool->CpuCount = UDFGlobalData.CPU_Count ? UDFGlobalData.CPU_Count : 1;
+    Pool->Cpu = (PUDF_OBJ_POOL_CPU)MyAllocatePool__(NonPagedPool, Pool->CpuCount*sizeof(UDF_OBJ_POOL_CPU));
+    if(!Pool->Cpu)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    RtlZeroMemory(Pool->Cpu, Pool->CpuCount*sizeof(UDF_OBJ_POOL_CPU));
+    return STATUS_SUCCESS;
+} // end UDFInitializeObjPool()
+
+/*
+    This routine frees all cached objects and per-CPU stacks of the pool
+ */
+VOID
+UDFDeleteObjPool(
+    PUDF_OBJ_POOL Pool
+    )
+{
+    PUDF_OBJ_POOL_CPU Cpu;
+    ULONG i;
+
+    if(!Pool->Cpu)
+        return;
+    for(i=0; i<Pool->CpuCount; i++) {
+        Cpu = &(Pool->Cpu[i]);
+        while(Cpu->Count) {
+            ExFreePool(Cpu->Obj[--(Cpu->Count)]);
+        }
+    }
+    MyFreePool__(Pool->Cpu);
+    Pool->Cpu = NULL;
+} // end UDFDeleteObjPool()
+
+/*
+    This routine takes object from per-CPU stack or allocates new one
+    if the stack is empty. Object is initialized by pool Ctor
+ */
+PVOID
+__fastcall
+UDFAllocateObj(
+    PUDF_OBJ_POOL Pool
+    )
+{
+    PUDF_OBJ_POOL_CPU Cpu;
+    PVOID Obj = NULL;
+    KIRQL irql;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    Cpu = &(Pool->Cpu[KeGetCurrentProcessorNumber() % Pool->CpuCount]);
+    Cpu->Allocs++;
+    if(Cpu->Count) {
+        Obj = Cpu->Obj[--(Cpu->Count)];
+        Cpu->Hits++;
+    }
+    KeLowerIrql(irql);
+
+    if(!Obj) {
+        Obj = ExAllocatePoolWithTag(Pool->PoolType, Pool->Size, Pool->Tag);
+        if(!Obj)
+            return NULL;
+    }
+    if(Pool->Ctor)
+        Pool->Ctor(Obj);
+    return Obj;
+} // end UDFAllocateObj()
+
+/*
+    This routine puts object to per-CPU stack or frees it if the
+    stack is full
+ */
+VOID
+__fastcall
+UDFReleaseObj(
+    PUDF_OBJ_POOL Pool,
+    PVOID Obj
+    )
+{
+    PUDF_OBJ_POOL_CPU Cpu;
+    KIRQL irql;
+
+    ASSERT(Obj);
+    if(Pool->Dtor)
+        Pool->Dtor(Obj);
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    Cpu = &(Pool->Cpu[KeGetCurrentProcessorNumber() % Pool->CpuCount]);
+    Cpu->Frees++;
+    if(Cpu->Count < UDF_OBJ_POOL_CPU_DEPTH) {
+        Cpu->Obj[(Cpu->Count)++] = Obj;
+        Obj = NULL;
+    }
+    KeLowerIrql(irql);
+
+    if(Obj)
+        ExFreePool(Obj);
+} // end UDFReleaseObj()
+
+/*
+    This routine returns usage statistics of specified object pool.
+    Per-CPU counters are summed without synchronization
+ */
+BOOLEAN
+UDFQueryObjPoolStats(
+    ULONG i,
+    PULONG Size,
+    PULONG Live,
+    PULONGLONG Allocs,
+    PULONGLONG Hits
+    )
+{
+    PUDF_OBJ_POOL Pool;
+    ULONGLONG Frees = 0;
+    ULONG j;
+
+    if(i >= UDF_OBJ_POOLS)
+        return FALSE;
+    Pool = &UDFGlobalData.ObjPool[i];
+    if(!Pool->Cpu)
+        return FALSE;
+    (*Size) = Pool->Size;
+    (*Allocs) = 0;
+    (*Hits) = 0;
+    for(j=0; j<Pool->CpuCount; j++) {
+        (*Allocs) += Pool->Cpu[j].Allocs;
+        (*Hits) += Pool->Cpu[j].Hits;
+        Frees += Pool->Cpu[j].Frees;
+    }
+    (*Live) = (ULONG)((*Allocs) - Frees);
+    return TRUE;
+} // end UDFQueryObjPoolStats()
+
+/*
+    Object pool Ctor/Dtor routines for FCB, CCB & Dloc
+ */
+VOID
+UDFFcbCtor(
+    PVOID Obj
+    )
+{
+    PFCB Fcb = (PFCB)Obj;
+
+    RtlZeroMemory(Fcb, sizeof(FCB));
+    Fcb->NodeIdentifier.NodeTypeCode = UDF_NODE_TYPE_FCB;
+    Fcb->NodeIdentifier.NodeByteSize = sizeof(FCB);
+} // end UDFFcbCtor()
+
+VOID
+UDFFcbDtor(
+    PVOID Obj
+    )
+{
+    // make stale references to released FCB detectable
+    ((PFCB)Obj)->NodeIdentifier.NodeTypeCode = 0;
+} // end UDFFcbDtor()
+
+VOID
+UDFCcbCtor(
+    PVOID Obj
+    )
+{
+    PCCB Ccb = (PCCB)Obj;
+
+    RtlZeroMemory(Ccb, sizeof(CCB));
+    Ccb->NodeIdentifier.NodeTypeCode = UDF_NODE_TYPE_CCB;
+    Ccb->NodeIdentifier.NodeByteSize = sizeof(CCB);
+} // end UDFCcbCtor()
+
+VOID
+UDFCcbDtor(
+    PVOID Obj
+    )
+{
+    ((PCCB)Obj)->NodeIdentifier.NodeTypeCode = 0;
+} // end UDFCcbDtor()
+
+VOID
+UDFDlocCtor(
+    PVOID Obj
+    )
+{
+    RtlZeroMemory(Obj, sizeof(UDF_DATALOC_INFO));
+} // end UDFDlocCtor()
+
 
 /*************************************************************************
 *
@@ -556,22 +758,8 @@ UDFReleaseObjectName(
 PCCB
 UDFAllocateCCB(VOID)
 {
-    PCCB NewCcb = NULL;
-
-    NewCcb = (PCCB)ExAllocateFromPagedLookasideList(&UDFGlobalData.CcbLookasideList);
-
-    if (!NewCcb) {
-        return NULL;
-    }
-
-    // zero out the allocated memory block
-    RtlZeroMemory(NewCcb, sizeof(CCB));
-
-    // set up some fields ...
-    NewCcb->NodeIdentifier.NodeTypeCode = UDF_NODE_TYPE_CCB;
-    NewCcb->NodeIdentifier.NodeByteSize = sizeof(CCB);
-
-    return NewCcb;
+    // CCB is zeroed & its NodeIdentifier is set by UDFCcbCtor()
+    return (PCCB)UDFAllocateObj(&UDFGlobalData.ObjPool[UDF_OBJ_POOL_CCB]);
 } // end UDFAllocateCCB()
 
 
@@ -596,7 +784,7 @@ UDFReleaseCCB(
 {
     ASSERT(Ccb);
 
-    ExFreeToPagedLookasideList(&UDFGlobalData.CcbLookasideList, Ccb);
+    UDFReleaseObj(&UDFGlobalData.ObjPool[UDF_OBJ_POOL_CCB], Ccb);
 
 } // end UDFReleaseCCB()
 
@@ -666,19 +854,13 @@ UDFCleanUpCCB(
 PFCB
 UDFAllocateFCB(VOID)
 {
-    PFCB Fcb = (PFCB)MyAllocatePool__(UDF_FCB_MT, sizeof(FCB));
+    // FCB is zeroed & its NodeIdentifier is set by UDFFcbCtor()
+    PFCB Fcb = (PFCB)UDFAllocateObj(&UDFGlobalData.ObjPool[UDF_OBJ_POOL_FCB]);
 
     if (!Fcb) {
         return NULL;
     }
 
-    // zero out the allocated memory block
-    RtlZeroMemory(Fcb, sizeof(FCB));
-
-    // set up some fields ...
-    Fcb->NodeIdentifier.NodeTypeCode = UDF_NODE_TYPE_FCB;
-    Fcb->NodeIdentifier.NodeByteSize = sizeof(FCB);
-
     UDFPrint(("UDFAllocateFCB: %x\n", Fcb));
     return(Fcb);
 } // end UDFAllocateFCB()
@@ -753,6 +935,8 @@ UDFCleanUpFCB(
 #endif
 
 
+        UDFForgetDirtyFcb(Fcb->Vcb, Fcb);
+
         // begin transaction {
         UDFTouch(&(Fcb->Vcb->FcbListResource));
         UDFAcquireResourceExclusive(&(Fcb->Vcb->FcbListResource), TRUE);
@@ -1036,6 +1220,9 @@ UDFPostRequest(
     KIRQL SavedIrql;
 //    PIO_STACK_LOCATION IrpSp;
     PVCB Vcb;
+    PUDF_FSP_CLASS_STATS Stats;
+    ULONG Class;
+    ULONG Shard;
 
 //    IrpSp = IoGetCurrentIrpStackLocation(Irp);
 
@@ -1055,12 +1242,14 @@ UDFPostRequest(
         IoMarkIrpPending(Irp);
 
     Vcb = (PVCB)(IrpContext->TargetDeviceObject->DeviceExtension);
+    Class = UDFFspClassify(IrpContext);
     KeAcquireSpinLock(&(Vcb->OverflowQueueSpinLock), &SavedIrql);
 
     if ( Vcb->PostedRequestCount > FSP_PER_DEVICE_THRESHOLD) {
 
         //  We cannot currently respond to this IRP so we'll just enqueue it
-        //  to the overflow queue on the volume.
+        //  to the overflow queue of its priority class on the current CPU.
+        //  Busy workers of the volume pick it up in UDFFspDequeue().
         //  Note: we just reuse LIST_ITEM field inside WorkQueueItem, this
         //  doesn't matter to regular processing of WorkItems.
         #ifdef UDF_DBG
@@ -1068,9 +1257,18 @@ UDFPostRequest(
         ASSERT(IrpContext->OverflowQueueMagic != UDF_OVERFLOWQ_MAGIC);
         #endif
 
-        InsertTailList( &(Vcb->OverflowQueue),
+        Shard = KeGetCurrentProcessorNumber() % UDF_FSP_MAX_SHARDS;
+        IrpContext->FspClass = (UCHAR)Class;
+        IrpContext->FspShard = (UCHAR)Shard;
+        // interrupt time is not changed with system clock
+        IrpContext->FspPostTime.QuadPart = KeQueryInterruptTime();
+        InsertTailList( &(Vcb->FspQueue[Class][Shard]),
                         &(IrpContext->WorkQueueItem.List) );
          Vcb->OverflowQueueCount++;
+         Stats = &(Vcb->FspStats[Class]);
+         Stats->Depth++;
+         if(Stats->Depth > Stats->MaxDepth)
+             Stats->MaxDepth = Stats->Depth;
          #ifdef UDF_DBG
          IrpContext->OverflowQueueMagic = UDF_OVERFLOWQ_MAGIC;
          #endif
@@ -1081,6 +1279,7 @@ UDFPostRequest(
         //  We are going to send this Irp to an ex worker thread so up
         //  the count.
         Vcb->PostedRequestCount++;
+        Vcb->FspStats[Class].Dispatched++;
 
         KeReleaseSpinLock( &(Vcb->OverflowQueueSpinLock), SavedIrql );
 
@@ -1099,6 +1298,118 @@ UDFPostRequest(
     return STATUS_PENDING;
 } // end UDFPostRequest()
 
+/*
+    This routine returns priority class of the overflow queue for
+    posted request: paging I/O, metadata (create, close, directory &
+    info requests), user data I/O & flushes and background requests
+ */
+ULONG
+UDFFspClassify(
+    IN PIRP_CONTEXT IrpContext
+    )
+{
+    PIRP Irp = IrpContext->Irp;
+
+    if(Irp && (Irp->Flags & IRP_PAGING_IO))
+        return UDF_FSP_CLASS_PAGING;
+    switch(IrpContext->MajorFunction) {
+    case IRP_MJ_READ:
+    case IRP_MJ_WRITE:
+    // caller waits for FlushFileBuffers() just like for data I/O
+    case IRP_MJ_FLUSH_BUFFERS:
+        return UDF_FSP_CLASS_USER;
+    case IRP_MJ_SHUTDOWN:
+        return UDF_FSP_CLASS_BACKGROUND;
+    default:
+        return UDF_FSP_CLASS_METADATA;
+    }
+} // end UDFFspClassify()
+
+/*
+    This routine picks the next request from the volume overflow queues.
+    Classes are served in priority order. Within a class the queue of
+    the current CPU is tried first, then requests are stolen from queues
+    of other CPUs. To prevent starvation of lower classes, the oldest
+    request waiting longer than UDF_FSP_AGING_TIME is served first
+    regardless of its class. Caller must hold OverflowQueueSpinLock
+ */
+PIRP_CONTEXT
+UDFFspDequeue(
+    IN PVCB Vcb
+    )
+{
+    PIRP_CONTEXT IrpContext;
+    PUDF_FSP_CLASS_STATS Stats;
+    PLIST_ENTRY Queue;
+    PLIST_ENTRY Oldest = NULL;
+    LARGE_INTEGER Now;
+    ULONGLONG WaitTime;
+    ULONGLONG OldestWaitTime = UDF_FSP_AGING_TIME;
+    ULONG Home;
+    ULONG c, i;
+    ULONG OldestClass = 0;
+    ULONG OldestShard = 0;
+
+    if(!Vcb->OverflowQueueCount)
+        return NULL;
+
+    Home = KeGetCurrentProcessorNumber() % UDF_FSP_MAX_SHARDS;
+    Now.QuadPart = KeQueryInterruptTime();
+    // aging: queues are FIFO, so only heads are checked. Paging I/O
+    // is served first anyway
+    for(c=UDF_FSP_CLASS_PAGING+1; c<UDF_FSP_CLASSES; c++) {
+        if(!Vcb->FspStats[c].Depth)
+            continue;
+        for(i=0; i<UDF_FSP_MAX_SHARDS; i++) {
+            Queue = &(Vcb->FspQueue[c][i]);
+            if(IsListEmpty(Queue))
+                continue;
+            IrpContext = CONTAINING_RECORD(Queue->Flink, IRP_CONTEXT, WorkQueueItem.List);
+            WaitTime = Now.QuadPart - IrpContext->FspPostTime.QuadPart;
+            if(WaitTime > OldestWaitTime) {
+                OldestWaitTime = WaitTime;
+                Oldest = Queue;
+                OldestClass = c;
+                OldestShard = i;
+            }
+        }
+    }
+    if(Oldest && !Vcb->FspStats[UDF_FSP_CLASS_PAGING].Depth) {
+        c = OldestClass;
+        i = (OldestShard + UDF_FSP_MAX_SHARDS - Home) % UDF_FSP_MAX_SHARDS;
+        Queue = Oldest;
+        goto dequeue;
+    }
+
+    for(c=0; c<UDF_FSP_CLASSES; c++) {
+        if(!Vcb->FspStats[c].Depth)
+            continue;
+        for(i=0; i<UDF_FSP_MAX_SHARDS; i++) {
+            Queue = &(Vcb->FspQueue[c][(Home+i) % UDF_FSP_MAX_SHARDS]);
+            if(IsListEmpty(Queue))
+                continue;
+            goto dequeue;
+        }
+        // Depth doesn't match queue contents
+        BrutePoint();
+    }
+    return NULL;
+
+dequeue:
+    Stats = &(Vcb->FspStats[c]);
+    IrpContext = CONTAINING_RECORD(RemoveHeadList(Queue), IRP_CONTEXT, WorkQueueItem.List);
+    if(i)
+        Vcb->FspSteals++;
+    Vcb->OverflowQueueCount--;
+    Stats->Depth--;
+    Stats->Dispatched++;
+    WaitTime = Now.QuadPart - IrpContext->FspPostTime.QuadPart;
+    Stats->WaitTime += WaitTime;
+    if(WaitTime > Stats->MaxWaitTime)
+        Stats->MaxWaitTime = WaitTime;
+    return IrpContext;
+} // end UDFFspDequeue()
+
 
 /*************************************************************************
 *
@@ -1126,10 +1437,10 @@ UDFFspDispatch(
     NTSTATUS         RC = STATUS_SUCCESS;
     PIRP_CONTEXT     IrpContext = (PIRP_CONTEXT)Context;
     PIRP_CONTEXT     PrevIrpContext = NULL;
+    PIRP_CONTEXT     NextIrpContext;
     PIRP             Irp = NULL;
     PVCB             Vcb;
     KIRQL            SavedIrql;
-    PLIST_ENTRY      Entry;
     BOOLEAN          SpinLock = FALSE;
 
     // ... (assertions etc)
@@ -1220,27 +1531,24 @@ UDFFspDispatch(
 
         KeAcquireSpinLock(&(Vcb->OverflowQueueSpinLock), &SavedIrql);
         SpinLock = TRUE;
-        if (!Vcb->OverflowQueueCount) {
+        NextIrpContext = UDFFspDequeue(Vcb);
+        if (!NextIrpContext) {
             KeReleaseSpinLock(&(Vcb->OverflowQueueSpinLock), SavedIrql);
             SpinLock = FALSE;
             break;
         }
 
-        Vcb->OverflowQueueCount--;
-        Entry = RemoveHeadList(&Vcb->OverflowQueue);
-
 #ifdef UDF_DBG
-        PIRP_CONTEXT qctx = CONTAINING_RECORD(Entry, IRP_CONTEXT, WorkQueueItem.List);
-        UDFPrint(("UDFFspDispatch: Dequeued Entry=%p NodeTypeCode=0x%x NodeByteSize=0x%x OverflowQueueMagic=0x%x\n",
-            qctx,
-            qctx->NodeIdentifier.NodeTypeCode,
-            qctx->NodeIdentifier.NodeByteSize,
-            qctx->OverflowQueueMagic));
-        ASSERT(qctx->NodeIdentifier.NodeTypeCode == UDF_NODE_TYPE_IRP_CONTEXT);
-        ASSERT(qctx->NodeIdentifier.NodeByteSize == sizeof(IRP_CONTEXT));
-        ASSERT(qctx->OverflowQueueMagic == UDF_OVERFLOWQ_MAGIC);
-        qctx->OverflowQueueMagic = 0;
-        // Optionally walk the queue...
+        UDFPrint(("UDFFspDispatch: Dequeued Entry=%p NodeTypeCode=0x%x NodeByteSize=0x%x OverflowQueueMagic=0x%x Class=%d\n",
+            NextIrpContext,
+            NextIrpContext->NodeIdentifier.NodeTypeCode,
+            NextIrpContext->NodeIdentifier.NodeByteSize,
+            NextIrpContext->OverflowQueueMagic,
+            NextIrpContext->FspClass));
+        ASSERT(NextIrpContext->NodeIdentifier.NodeTypeCode == UDF_NODE_TYPE_IRP_CONTEXT);
+        ASSERT(NextIrpContext->NodeIdentifier.NodeByteSize == sizeof(IRP_CONTEXT));
+        ASSERT(NextIrpContext->OverflowQueueMagic == UDF_OVERFLOWQ_MAGIC);
+        NextIrpContext->OverflowQueueMagic = 0;
 #endif
 
         KeReleaseSpinLock(&(Vcb->OverflowQueueSpinLock), SavedIrql);
@@ -1252,7 +1560,7 @@ UDFFspDispatch(
             PrevIrpContext = NULL;
         }
         PrevIrpContext = IrpContext;
-        IrpContext = CONTAINING_RECORD(Entry, IRP_CONTEXT, WorkQueueItem.List);
+        IrpContext = NextIrpContext;
         // **Set to FALSE for the new IRP_CONTEXT before next loop**
         IrpContext->IrpCompleted = FALSE;
     }
@@ -1298,6 +1606,7 @@ UDFInitializeVCB(
     NTSTATUS RC = STATUS_SUCCESS;
     PVCB     Vcb = NULL;
     SHORT    i;
+    SHORT    j;
 
     BOOLEAN VCBResourceInit     = FALSE;
     BOOLEAN BitMapResource1Init = FALSE;
@@ -1325,11 +1634,13 @@ UDFInitializeVCB(
     if(!NT_SUCCESS(RC))
         try_return(RC);
     VCBResourceInit = TRUE;
+    UDFProfileResource(&(Vcb->VCBResource), DLD_PROF_VCB);
 
     RC = UDFInitializeResourceLite(&(Vcb->BitMapResource1));
     if(!NT_SUCCESS(RC))
         try_return(RC);
     BitMapResource1Init = TRUE;
+    UDFProfileResource(&(Vcb->BitMapResource1), DLD_PROF_BITMAP);
 
     RC = UDFInitializeResourceLite(&(Vcb->FcbListResource));
     if(!NT_SUCCESS(RC))
@@ -1345,6 +1656,7 @@ UDFInitializeVCB(
     if(!NT_SUCCESS(RC))
         try_return(RC);
     DlocResourceInit = TRUE;
+    UDFProfileResource(&(Vcb->DlocResource), DLD_PROF_DLOC);
 
     RC = UDFInitializeResourceLite(&(Vcb->DlocResource2));
     if(!NT_SUCCESS(RC))
@@ -1360,11 +1672,13 @@ UDFInitializeVCB(
     if(!NT_SUCCESS(RC))
         try_return(RC);
     PreallocResourceInit = TRUE;
+    UDFProfileResource(&(Vcb->PreallocResource), DLD_PROF_PREALLOC);
 
     RC = UDFInitializeResourceLite(&(Vcb->IoResource));
     if(!NT_SUCCESS(RC))
         try_return(RC);
     IoResourceInit = TRUE;
+    UDFProfileResource(&(Vcb->IoResource), DLD_PROF_IO);
 
 //    RC = UDFInitializeResourceLite(&(Vcb->DelayedCloseResource));
 //    ASSERT(NT_SUCCESS(RC));
@@ -1425,13 +1739,26 @@ UDFInitializeVCB(
     InitializeListHead(&(Vcb->NextFCB));
     InitializeListHead(&(Vcb->NextNotifyIRP));
     InitializeListHead(&(Vcb->NextCCB));
+    InitializeListHead(&(Vcb->DirtyFcbList));
+
+    // Background tree flush timer, it is armed at mount time
+    KeInitializeTimer(&(Vcb->TreeFlushTimer));
+    KeInitializeDpc(&(Vcb->TreeFlushDpc), UDFTreeFlushDpc, Vcb);
+    ExInitializeWorkItem(&(Vcb->TreeFlushItem), UDFTreeFlushWorker, Vcb);
 
-    //  Initialize the overflow queue for the volume
+    //  Initialize the overflow queues for the volume
     Vcb->OverflowQueueCount = 0;
-    InitializeListHead(&(Vcb->OverflowQueue));
+    for(i=0; i<UDF_FSP_CLASSES; i++) {
+        for(j=0; j<UDF_FSP_MAX_SHARDS; j++) {
+            InitializeListHead(&(Vcb->FspQueue[i][j]));
+        }
+    }
+    RtlZeroMemory(&(Vcb->FspStats), sizeof(Vcb->FspStats));
+    Vcb->FspSteals = 0;
 
     Vcb->PostedRequestCount = 0;
     KeInitializeSpinLock(&(Vcb->OverflowQueueSpinLock));
+    KeInitializeSpinLock(&(Vcb->PathCacheLock));
 
     // Initialize the notify IRP list mutex
     FsRtlNotifyInitializeSync(&(Vcb->NotifyIRPMutex));
@@ -1903,6 +2230,8 @@ UDFDeleteVCB(
         delay.QuadPart -= 500000; // grow delay 0.05 sec
     }
 
+    UDFStopTreeFlush(Vcb);
+
     _SEH2_TRY {
         UDFPrint(("UDF: Flushing buffers\n"));
         UDFVRelease(Vcb);
@@ -211,6 +211,152 @@ UDFIsNameInExpression(
     return Match;
 } // end UDFIsNameInExpression()
 
+#define UDFIsWildCardChar(c) \
+    (((c) == L'*') || ((c) == L'?') || ((c) == DOS_STAR) || ((c) == DOS_QM) || ((c) == DOS_DOT))
+
+/*
+
+Routine Description:
+
+    This routine classifies search pattern once, so that  subsequent
+    UDFIsNameInCompiledPattern() calls can use direct comparison for
+    exact, 'prefix*', '*suffix' and '*.ext' patterns.
+    PtrSearchPattern must stay valid while compiled pattern is used.
+
+*/
+VOID
+UDFCompilePattern(
+    IN PUNICODE_STRING PtrSearchPattern,
+    IN BOOLEAN CanBe8dot3,
+    OUT PUDF_COMPILED_PATTERN Pattern
+    )
+{
+    USHORT i, l;
+    USHORT WcCount = 0;
+    USHORT WcPos = 0;
+    PWCHAR Buffer = PtrSearchPattern->Buffer;
+
+    l = PtrSearchPattern->Length / sizeof(WCHAR);
+    Pattern->Flags = 0;
+    Pattern->Literal = *PtrSearchPattern;
+
+    for(i=0; i<l; i++) {
+        if(UDFIsWildCardChar(Buffer[i])) {
+            WcCount++;
+            WcPos = i;
+        } else
+        if(Buffer[i] == L' ') {
+            // all DOS name generators drop spaces
+            Pattern->Flags |= UDF_PATTERN_FLAG_NO_SFN;
+        }
+    }
+    if(!CanBe8dot3)
+        Pattern->Flags |= UDF_PATTERN_FLAG_NO_SFN;
+
+    if(!WcCount) {
+        Pattern->Type = UDF_PATTERN_EXACT;
+    } else
+    if((WcCount == 1) && (Buffer[WcPos] == L'*') && (WcPos == l-1)) {
+        Pattern->Type = UDF_PATTERN_PREFIX;
+        Pattern->Literal.Length -= sizeof(WCHAR);
+    } else
+    if((WcCount == 1) && (Buffer[WcPos] == L'*') && !WcPos) {
+        Pattern->Type = UDF_PATTERN_SUFFIX;
+        Pattern->Literal.Buffer++;
+        Pattern->Literal.Length -= sizeof(WCHAR);
+    } else {
+        Pattern->Type = UDF_PATTERN_GENERIC;
+    }
+    Pattern->Literal.MaximumLength = Pattern->Literal.Length;
+} // end UDFCompilePattern()
+
+/*
+    Compare Length bytes of Name with Literal. Literal is  already
+    upcased when IgnoreCase is TRUE.
+ */
+__inline
+BOOLEAN
+UDFIsNamePartEqual(
+    IN PWCHAR Name,
+    IN PWCHAR Literal,
+    IN USHORT Length,
+    IN BOOLEAN IgnoreCase
+    )
+{
+    USHORT i;
+
+    if(!IgnoreCase)
+        return (RtlCompareMemory(Name, Literal, Length) == Length);
+    for(i=0; i<Length/sizeof(WCHAR); i++) {
+        if(RtlUpcaseUnicodeChar(Name[i]) != Literal[i])
+            return FALSE;
+    }
+    return TRUE;
+} // end UDFIsNamePartEqual()
+
+BOOLEAN
+UDFMatchCompiledPattern(
+    IN PUNICODE_STRING FileName,
+    IN PUNICODE_STRING PtrSearchPattern,
+    IN PUDF_COMPILED_PATTERN Pattern,
+    IN BOOLEAN IgnoreCase
+    )
+{
+    switch(Pattern->Type) {
+    case UDF_PATTERN_EXACT:
+        return (FileName->Length == Pattern->Literal.Length) &&
+               UDFIsNamePartEqual(FileName->Buffer, Pattern->Literal.Buffer, Pattern->Literal.Length, IgnoreCase);
+    case UDF_PATTERN_PREFIX:
+        return (FileName->Length >= Pattern->Literal.Length) &&
+               UDFIsNamePartEqual(FileName->Buffer, Pattern->Literal.Buffer, Pattern->Literal.Length, IgnoreCase);
+    case UDF_PATTERN_SUFFIX:
+        return (FileName->Length >= Pattern->Literal.Length) &&
+               UDFIsNamePartEqual((PWCHAR)(((PCHAR)(FileName->Buffer)) + FileName->Length - Pattern->Literal.Length),
+                                  Pattern->Literal.Buffer, Pattern->Literal.Length, IgnoreCase);
+    default:
+        return FsRtlIsNameInExpression( PtrSearchPattern, FileName, IgnoreCase, NULL );
+    }
+} // end UDFMatchCompiledPattern()
+
+/*
+
+Routine Description:
+
+    Same as UDFIsNameInExpression(), but uses pattern  precompiled
+    with UDFCompilePattern().
+
+*/
+BOOLEAN
+UDFIsNameInCompiledPattern(
+    IN PVCB Vcb,
+    IN PUNICODE_STRING FileName,
+    IN PUNICODE_STRING PtrSearchPattern,
+    IN PUDF_COMPILED_PATTERN Pattern,
+    IN BOOLEAN IgnoreCase,
+    IN BOOLEAN CanBe8dot3,
+    IN BOOLEAN KeepIntact // passed to UDFDOSName
+    )
+{
+    UNICODE_STRING      ShortName;
+    WCHAR               Buffer[13];
+
+    if(!PtrSearchPattern) return TRUE;
+
+    if(UDFMatchCompiledPattern(FileName, PtrSearchPattern, Pattern, IgnoreCase))
+        return TRUE;
+
+    // check if SFN can match this pattern
+    if(!CanBe8dot3 || (Pattern->Flags & UDF_PATTERN_FLAG_NO_SFN))
+        return FALSE;
+
+    ShortName.Buffer = (PWCHAR)(&Buffer);
+    ShortName.MaximumLength = 13*sizeof(WCHAR);
+    UDFDOSName(Vcb, &ShortName, FileName, KeepIntact);
+
+    // see UDFIsNameInExpression()
+    return UDFMatchCompiledPattern(&ShortName, PtrSearchPattern, Pattern, FALSE);
+} // end UDFIsNameInCompiledPattern()
+
 
 BOOLEAN
 __fastcall
@@ -298,3 +444,138 @@ UDFCanNameBeA8dot3(
     }
     return TRUE;
 } // end UDFCanNameBeA8dot3()
+
+/*
+    Path cache hash. Case is never folded: cached positions are valid
+    for exact spelling only, see UDFDirIndexCheckHint()
+ */
+ULONG
+UDFPathCacheHash(
+    IN PUNICODE_STRING Name,
+    IN BOOLEAN IgnoreCase
+    )
+{
+    ULONG i, l;
+    ULONG hash = IgnoreCase ? 1 : 0;
+    PWCHAR buff = Name->Buffer;
+
+    l = Name->Length / sizeof(WCHAR);
+    for(i=0; i<l; i++, buff++) {
+        hash = hash * 37 + (*buff);
+    }
+    return hash;
+} // end UDFPathCacheHash()
+
+/*
+    This routine looks for path (relative to root directory) in
+    full path lookup cache. It returns number of path components
+    with known DirIndex positions (0 if not found).
+    Positions are hints only: caller should check each of them
+    with UDFDirIndexCheckHint() before use.
+ */
+ULONG
+UDFPathCacheLookup(
+    IN PVCB Vcb,
+    IN PUNICODE_STRING Name,
+    IN BOOLEAN IgnoreCase,
+    OUT PULONG Index,
+    OUT lb_addr* FileEntryLoc
+    )
+{
+    UDF_PATH_CACHE_ITEM Item;
+    UNICODE_STRING CachedName;
+    KIRQL SavedIrql;
+    ULONG hash;
+
+    if(!Vcb->PathCache ||
+       !Name->Length ||
+       (Name->Length > UDF_PATH_CACHE_MAX_NAME*sizeof(WCHAR)))
+        return 0;
+
+    hash = UDFPathCacheHash(Name, IgnoreCase);
+
+    // Names are compared out of spin lock, RtlCompareUnicodeString()
+    // can't be used at DISPATCH_LEVEL
+    KeAcquireSpinLock(&(Vcb->PathCacheLock), &SavedIrql);
+    Item = Vcb->PathCache[hash % UDF_PATH_CACHE_SIZE];
+    KeReleaseSpinLock(&(Vcb->PathCacheLock), SavedIrql);
+
+    if((Item.Hash != hash) ||
+       (Item.Length != Name->Length) ||
+       (Item.IgnoreCase != IgnoreCase) ||
+       (Item.Generation != Vcb->PathCacheGeneration))
+        return 0;
+
+    CachedName.Buffer = Item.Name;
+    CachedName.Length =
+    CachedName.MaximumLength = Item.Length;
+    if(RtlCompareUnicodeString(&CachedName, Name, FALSE))
+        return 0;
+
+    RtlCopyMemory(Index, Item.Index, Item.Depth*sizeof(ULONG));
+    (*FileEntryLoc) = Item.FileEntryLoc;
+    return Item.Depth;
+} // end UDFPathCacheLookup()
+
+/*
+    This routine remembers DirIndex positions of path components.
+    Cache is filled by successful opens, older path sharing the
+    same slot is evicted
+ */
+VOID
+UDFPathCacheStore(
+    IN PVCB Vcb,
+    IN PUNICODE_STRING Name,
+    IN BOOLEAN IgnoreCase,
+    IN PULONG Index,
+    IN ULONG Depth,
+    IN lb_addr* FileEntryLoc,
+    IN LONG Generation
+    )
+{
+    PUDF_PATH_CACHE_ITEM Cache;
+    UDF_PATH_CACHE_ITEM Item;
+    KIRQL SavedIrql;
+
+    if(!Depth ||
+       (Depth > UDF_PATH_CACHE_MAX_DEPTH) ||
+       !Name->Length ||
+       (Name->Length > UDF_PATH_CACHE_MAX_NAME*sizeof(WCHAR)))
+        return;
+
+    if(!Vcb->PathCache) {
+        Cache = (PUDF_PATH_CACHE_ITEM)MyAllocatePool__(NonPagedPool, sizeof(UDF_PATH_CACHE_ITEM)*UDF_PATH_CACHE_SIZE);
+        if(!Cache)
+            return;
+        RtlZeroMemory(Cache, sizeof(UDF_PATH_CACHE_ITEM)*UDF_PATH_CACHE_SIZE);
+        if(InterlockedCompareExchangePointer((PVOID*)&(Vcb->PathCache), Cache, NULL)) {
+            MyFreePool__(Cache);
+        }
+    }
+
+    Item.Hash = UDFPathCacheHash(Name, IgnoreCase);
+    // generation is taken before the walk, so entry built from
+    // path changed during the walk is born stale
+    Item.Generation = Generation;
+    Item.Length = Name->Length;
+    Item.Depth = (USHORT)Depth;
+    Item.IgnoreCase = IgnoreCase;
+    Item.FileEntryLoc = (*FileEntryLoc);
+    RtlCopyMemory(Item.Index, Index, Depth*sizeof(ULONG));
+    RtlCopyMemory(Item.Name, Name->Buffer, Name->Length);
+
+    KeAcquireSpinLock(&(Vcb->PathCacheLock), &SavedIrql);
+    Vcb->PathCache[Item.Hash % UDF_PATH_CACHE_SIZE] = Item;
+    KeReleaseSpinLock(&(Vcb->PathCacheLock), SavedIrql);
+} // end UDFPathCacheStore()
+
+VOID
+UDFPathCacheRelease(
+    IN PVCB Vcb
+    )
+{
+    if(!Vcb->PathCache)
+        return;
+    MyFreePool__(Vcb->PathCache);
+    Vcb->PathCache = NULL;
+} // end UDFPathCacheRelease()
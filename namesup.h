@@ -19,6 +19,18 @@ extern BOOLEAN UDFIsNameInExpression(IN PVCB Vcb,
                                      IN BOOLEAN CanBe8dot3,
                                      IN BOOLEAN KeepIntact);
 
+extern VOID UDFCompilePattern(IN PUNICODE_STRING PtrSearchPattern,
+                              IN BOOLEAN CanBe8dot3,
+                              OUT PUDF_COMPILED_PATTERN Pattern);
+
+extern BOOLEAN UDFIsNameInCompiledPattern(IN PVCB Vcb,
+                                          IN PUNICODE_STRING FileName,
+                                          IN PUNICODE_STRING PtrSearchPattern,
+                                          IN PUDF_COMPILED_PATTERN Pattern,
+                                          IN BOOLEAN IgnoreCase,
+                                          IN BOOLEAN CanBe8dot3,
+                                          IN BOOLEAN KeepIntact);
+
 extern BOOLEAN UDFDoesNameContainWildCards(IN PUNICODE_STRING SearchPattern);
 
 extern BOOLEAN __fastcall UDFIsNameValid(IN PUNICODE_STRING SearchPattern,
@@ -30,4 +42,23 @@ extern BOOLEAN __fastcall UDFIsMatchAllMask(IN PUNICODE_STRING Name,
 
 extern BOOLEAN __fastcall UDFCanNameBeA8dot3(IN PUNICODE_STRING Name);
 
+extern ULONG UDFPathCacheHash(IN PUNICODE_STRING Name,
+                              IN BOOLEAN IgnoreCase);
+
+extern ULONG UDFPathCacheLookup(IN PVCB Vcb,
+                                IN PUNICODE_STRING Name,
+                                IN BOOLEAN IgnoreCase,
+                                OUT PULONG Index,
+                                OUT lb_addr* FileEntryLoc);
+
+extern VOID UDFPathCacheStore(IN PVCB Vcb,
+                              IN PUNICODE_STRING Name,
+                              IN BOOLEAN IgnoreCase,
+                              IN PULONG Index,
+                              IN ULONG Depth,
+                              IN lb_addr* FileEntryLoc,
+                              IN LONG Generation);
+
+extern VOID UDFPathCacheRelease(IN PVCB Vcb);
+
 #endif //__UDF_NAME_SUP__H__
\ No newline at end of file
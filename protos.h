@@ -88,7 +88,7 @@ extern ULONG    UDFCleanUpFcbChain(IN PVCB Vcb,
 
 extern VOID UDFCloseAllDelayed(PVCB Vcb);
 
-extern VOID NTAPI UDFDelayedClose(PVOID unused = NULL);
+extern VOID NTAPI UDFDelayedClose(PVOID Context);
 
 extern NTSTATUS UDFCloseAllXXXDelayedInDir(IN PVCB           Vcb,
                                            IN PUDF_FILE_INFO FileInfo,
@@ -216,20 +216,6 @@ OUT struct _FILE_NETWORK_OPEN_INFORMATION*      Buffer,
 OUT PIO_STATUS_BLOCK                            IoStatus,
 IN PDEVICE_OBJECT                               DeviceObject);
 
-extern BOOLEAN NTAPI UDFFastIoMdlRead(
-IN PFILE_OBJECT             FileObject,
-IN PLARGE_INTEGER           FileOffset,
-IN ULONG                    Length,
-IN ULONG                    LockKey,
-OUT PMDL*                   MdlChain,
-OUT PIO_STATUS_BLOCK        IoStatus,
-IN PDEVICE_OBJECT           DeviceObject);
-
-extern BOOLEAN UDFFastIoMdlReadComplete(
-IN PFILE_OBJECT             FileObject,
-OUT PMDL                    MdlChain,
-IN PDEVICE_OBJECT           DeviceObject);
-
 extern BOOLEAN NTAPI UDFFastIoPrepareMdlWrite(
 IN PFILE_OBJECT             FileObject,
 IN PLARGE_INTEGER           FileOffset,
@@ -239,12 +225,6 @@ OUT PMDL*                   MdlChain,
 OUT PIO_STATUS_BLOCK        IoStatus,
 IN PDEVICE_OBJECT           DeviceObject);
 
-extern BOOLEAN NTAPI UDFFastIoMdlWriteComplete(
-IN PFILE_OBJECT             FileObject,
-IN PLARGE_INTEGER           FileOffset,
-OUT PMDL                    MdlChain,
-IN PDEVICE_OBJECT           DeviceObject);
-
 extern NTSTATUS NTAPI UDFFastIoAcqModWrite(
 IN PFILE_OBJECT             FileObject,
 IN PLARGE_INTEGER           EndingOffset,
@@ -469,6 +449,33 @@ IN ULONG        FlushFlags = 0);
 extern VOID UDFFlushTryBreak(
 IN PVCB         Vcb);
 
+extern VOID UDFMarkFcbDirty(
+IN PVCB         Vcb,
+IN PFCB         Fcb);
+
+extern VOID UDFForgetDirtyFcb(
+IN PVCB         Vcb,
+IN PFCB         Fcb);
+
+extern ULONG UDFFlushDirtySet(
+IN PVCB         Vcb,
+IN ULONG        FlushFlags = 0);
+
+extern VOID UDFStartTreeFlush(
+IN PVCB         Vcb);
+
+extern VOID UDFStopTreeFlush(
+IN PVCB         Vcb);
+
+extern VOID NTAPI UDFTreeFlushDpc(
+IN PKDPC        Dpc,
+IN PVOID        DeferredContext,
+IN PVOID        SystemArgument1,
+IN PVOID        SystemArgument2);
+
+extern VOID NTAPI UDFTreeFlushWorker(
+IN PVOID        Context);
+
 /*************************************************************************
 * Prototypes for the file fscntrl.cpp
 *************************************************************************/
@@ -506,6 +513,12 @@ extern NTSTATUS UDFIsVolumeDirty(IN PIRP_CONTEXT IrpContext,
 extern NTSTATUS UDFGetStatistics(IN PIRP_CONTEXT IrpContext,
                                  IN PIRP Irp);
 
+extern NTSTATUS UDFGetPerfCounters(IN PIRP_CONTEXT IrpContext,
+                                   IN PIRP Irp);
+
+extern NTSTATUS UDFGetLockProfile(IN PIRP_CONTEXT IrpContext,
+                                  IN PIRP Irp);
+
 extern NTSTATUS UDFLockVolume (IN PIRP_CONTEXT IrpContext,
                                IN PIRP Irp,
                                IN ULONG PID = -1);
@@ -583,6 +596,49 @@ VOID);
 extern VOID UDFDestroyZones(
 VOID);
 
+extern NTSTATUS UDFInitializeObjPool(
+PUDF_OBJ_POOL               Pool,
+ULONG                       Size,
+POOL_TYPE                   PoolType,
+ULONG                       Tag,
+PUDF_OBJ_CTOR               Ctor,
+PUDF_OBJ_DTOR               Dtor);
+
+extern VOID UDFDeleteObjPool(
+PUDF_OBJ_POOL               Pool);
+
+extern PVOID __fastcall UDFAllocateObj(
+PUDF_OBJ_POOL               Pool);
+
+extern VOID __fastcall UDFReleaseObj(
+PUDF_OBJ_POOL               Pool,
+PVOID                       Obj);
+
+extern BOOLEAN UDFQueryObjPoolStats(
+ULONG                       i,
+PULONG                      Size,
+PULONG                      Live,
+PULONGLONG                  Allocs,
+PULONGLONG                  Hits);
+
+extern VOID UDFFcbCtor(
+PVOID                       Obj);
+
+extern VOID UDFFcbDtor(
+PVOID                       Obj);
+
+extern VOID UDFCcbCtor(
+PVOID                       Obj);
+
+extern VOID UDFCcbDtor(
+PVOID                       Obj);
+
+extern VOID UDFDlocCtor(
+PVOID                       Obj);
+
+#define UDFAllocateDloc()       ((PUDF_DATALOC_INFO)UDFAllocateObj(&UDFGlobalData.ObjPool[UDF_OBJ_POOL_DLOC]))
+#define UDFReleaseDlocObj(Dloc) UDFReleaseObj(&UDFGlobalData.ObjPool[UDF_OBJ_POOL_DLOC], (Dloc))
+
 extern BOOLEAN __fastcall UDFIsIrpTopLevel(
 PIRP                        Irp);                   // the IRP sent to our dispatch routine
 
@@ -622,7 +678,7 @@ UDFReleaseFCB(
 {
     ASSERT(Fcb);
 
-    MyFreePool__(Fcb);
+    UDFReleaseObj(&UDFGlobalData.ObjPool[UDF_OBJ_POOL_FCB], Fcb);
 
     return;
 }
@@ -647,6 +703,16 @@ UDFOverflowQueueWorker(
     IN PVOID Context
     );
 
+ULONG
+UDFFspClassify(
+    IN PIRP_CONTEXT IrpContext
+    );
+
+PIRP_CONTEXT
+UDFFspDequeue(
+    IN PVCB Vcb
+    );
+
 VOID
 NTAPI
 UDFFspDispatch(
@@ -620,13 +620,14 @@ UDFCommonRead(
             // Check and see if this request requires a MDL returned to the caller
             if (IrpSp->MinorFunction & IRP_MN_MDL) {
                 // Caller does want a MDL returned. Note that this mode
-                // implies that the caller is prepared to block
+                // implies that the caller is prepared to block.
+                // MDL is released with IRP_MN_COMPLETE, see UDFMdlComplete()
+                if(!CanWait)
+                    try_return(RC = STATUS_PENDING);
                 MmPrint(("    CcMdlRead()\n"));
-//                CcMdlRead(FileObject, &ByteOffset, TruncatedLength, &(Irp->MdlAddress), &(Irp->IoStatus));
-//                NumberBytesRead = Irp->IoStatus.Information;
-//                RC = Irp->IoStatus.Status;
-                NumberBytesRead = 0;
-                RC = STATUS_INVALID_PARAMETER;
+                CcMdlRead(FileObject, &ByteOffset, TruncatedLength, &(Irp->MdlAddress), &(Irp->IoStatus));
+                NumberBytesRead = Irp->IoStatus.Information;
+                RC = Irp->IoStatus.Status;
 
                 try_return(RC);
             }
@@ -730,8 +731,10 @@ UDFCommonRead(
                 }
             }
 
+            // large aligned requests go directly to device unless WCache
+            // is already locked by UDFIsFileCached__()
             RC = UDFReadFile__(Vcb, Fcb->FileInfo, ByteOffset.QuadPart, TruncatedLength,
-                           CacheLocked, (PCHAR)SystemBuffer, &NumberBytesRead);
+                           CacheLocked, (PCHAR)SystemBuffer, &NumberBytesRead, !CacheLocked);
 /*                // AFAIU, CacheManager wants this:
             if(!NT_SUCCESS(RC)) {
                 NumberBytesRead = 0;
@@ -94,6 +94,30 @@ struct UDFObjectName {
 };
 using PtrUDFObjectName = UDFObjectName*;
 
+/**************************************************************************
+    Directory search pattern, compiled once per CCB by UDFCompilePattern().
+    Simple patterns (exact name, 'prefix*', '*suffix', '*.ext') are matched
+    by plain memory comparison instead of FsRtlIsNameInExpression().
+    Literal points into the CCB's DirectorySearchPattern buffer.
+**************************************************************************/
+struct UDF_COMPILED_PATTERN {
+    // UDF_PATTERN_XXX
+    UCHAR                               Type;
+    // UDF_PATTERN_FLAG_XXX
+    UCHAR                               Flags;
+    // non-wildcard part of the pattern
+    UNICODE_STRING                      Literal;
+};
+using PUDF_COMPILED_PATTERN = UDF_COMPILED_PATTERN*;
+
+#define UDF_PATTERN_GENERIC                     (0x00)
+#define UDF_PATTERN_EXACT                       (0x01)
+#define UDF_PATTERN_PREFIX                      (0x02)
+#define UDF_PATTERN_SUFFIX                      (0x03)
+
+// the pattern can never match generated 8.3 name, skip SFN retry
+#define UDF_PATTERN_FLAG_NO_SFN                 (0x01)
+
 /**************************************************************************
     Each file open instance is represented by a context control block.
     For each successful create/open request; a file object and a CCB will
@@ -118,6 +142,7 @@ struct CCB {
     // if this CCB represents a directory object open, we may
     //  need to maintain a search pattern
     PUNICODE_STRING                     DirectorySearchPattern;
+    UDF_COMPILED_PATTERN                CompiledPattern;
     HASH_ENTRY                          hashes;
     ULONG                               TreeLength;
     // Acces rights previously granted to caller's thread
@@ -283,6 +308,8 @@ struct FCB : UDFNTRequiredFCB {
     // Pointer to IrpContextLite in delayed queue.
     IRP_CONTEXT_LITE* IrpContextLite;
     uint32                              CcbCount;
+    // link in Vcb->DirtyFcbList, Flink is NULL when not listed
+    LIST_ENTRY                          DirtyLinks;
 };
 using PFCB = FCB*;
 
@@ -344,6 +371,16 @@ enum VCB_CONDITION {
     VcbDismountInProgress
 };
 
+// per-class statistics of volume overflow queues, protected by
+// OverflowQueueSpinLock. Times are in 100ns units.
+typedef struct _UDF_FSP_CLASS_STATS {
+    ULONG                       Depth;
+    ULONG                       MaxDepth;
+    ULONGLONG                   Dispatched;
+    ULONGLONG                   WaitTime;
+    ULONGLONG                   MaxWaitTime;
+} UDF_FSP_CLASS_STATS, *PUDF_FSP_CLASS_STATS;
+
 struct VCB : FCB {
 
     // Condition flag for the Vcb.
@@ -396,12 +433,13 @@ struct VCB : FCB {
     ULONG PostedRequestCount;
     ULONG ThreadsPerCpu;
     //  The following field indicates the number of IRP's waiting
-    //  to be serviced in the overflow queue.
+    //  to be serviced in the overflow queues.
     ULONG OverflowQueueCount;
-    //  The following field contains the queue header of the overflow queue.
-    //  The Overflow queue is a list of IRP's linked via the IRP's ListEntry
-    //  field.
-    LIST_ENTRY OverflowQueue;
+    //  Overflow queues, one per priority class and CPU shard. IRP contexts
+    //  are linked via WorkQueueItem.List, see UDFFspDequeue().
+    LIST_ENTRY FspQueue[UDF_FSP_CLASSES][UDF_FSP_MAX_SHARDS];
+    UDF_FSP_CLASS_STATS FspStats[UDF_FSP_CLASSES];
+    ULONGLONG FspSteals;
     //  The following spinlock protects access to all the above fields.
     KSPIN_LOCK OverflowQueueSpinLock;
     ULONG StopOverflowQueue;
@@ -418,9 +456,24 @@ struct VCB : FCB {
     ULONG           SkipCountLimit;
     ULONG           SkipEjectCountLimit;
 
+    // FCBs modified since the last tree flush, protected by FlushResource.
+    // See UDFMarkFcbDirty() & UDFFlushDirtySet()
+    LIST_ENTRY      DirtyFcbList;
+    ULONG           DirtyFcbCount;
+    // background flush, see UDFStartTreeFlush()
+    KTIMER          TreeFlushTimer;
+    KDPC            TreeFlushDpc;
+    WORK_QUEUE_ITEM TreeFlushItem;
+    LONG            TreeFlushActive;
+    ULONG           TreeFlushTick;
+
     // File Id cache
     struct _UDFFileIDCacheItem* FileIdCache;
     ULONG           FileIdCount;
+    // Full path lookup cache
+    struct _UDF_PATH_CACHE_ITEM* PathCache;
+    KSPIN_LOCK      PathCacheLock;
+    LONG            PathCacheGeneration;
     //
     ULONG           MediaLockCount;
 
@@ -507,6 +560,14 @@ struct VCB : FCB {
     PCHAR           fZBuffer;
     ULONG           fZBufferSize;
 
+    // FileEntry write batch, see UDFMetaBatchBegin()
+    PVOID           MetaBatchOwner;
+    ULONG           MetaBatchDepth;
+    ULONG           MetaBatchCount;
+    OSSTATUS        MetaBatchStatus;
+    PUDF_META_BATCH_ITEM MetaBatchItem;
+    PCHAR           MetaBatchBuffer;
+
     ULONG           IoErrorCounter;
     // Media change count (equal to the same field in CDFS VCB)
     ULONG           MediaChangeCount;
@@ -579,9 +640,8 @@ struct VCB : FCB {
     uint32          SparingTableModified;
     // free space bitmap
     ULONG           FSBM_ByteCount;
-    // the following 2 fields are equal to NTIFS's RTL_BITMAP structure
     ULONG           FSBM_BitCount;
-    PCHAR           FSBM_Bitmap;     // 0 - free, 1 - used
+    UDF_SPARSE_BITMAP FSBM_Bitmap;   // 1 - free, 0 - used
 #ifdef UDF_TRACK_ONDISK_ALLOCATION_OWNERS
     PULONG          FSBM_Bitmap_owners; // 0 - free
     // -1 - used by unknown
@@ -592,12 +652,35 @@ struct VCB : FCB {
 #endif //UDF_TRACK_FS_STRUCTURES
 #endif //UDF_TRACK_ONDISK_ALLOCATION_OWNERS
 
-    PCHAR           FSBM_OldBitmap;  // 0 - free, 1 - used
+    // FSBM state recorded on disk during last flush
+    UDF_SPARSE_BITMAP FSBM_OldBitmap; // 1 - free, 0 - used
+    // FSBM chunks (1 << FSBM_DirtyChunkSh blocks each) changed since last
+    // flush of on-disk space bitmaps
+    PULONG          FSBM_DirtyMap;
+    ULONG           FSBM_DirtyChunkSh;
+    ULONG           FSBM_DirtyChunks;
+    BOOLEAN         FSBM_AllDirty;
+    // Partitions[].FreeBlocks are in sync with FSBM
+    BOOLEAN         FSBM_FreeCountValid;
+    // FSBM of r/o volume is built on first demand,
+    // see UDFLoadDeferredFreeSpaceBitmap()
+#define UDF_FSBM_NOT_DEFERRED       0
+#define UDF_FSBM_DEFERRED           1
+#define UDF_FSBM_LOADED             2
+    ULONG           FSBM_LazyState;
+#define UDF_FSBM_MAX_DEFERRED       8
+    ULONG           FSBM_DeferredCount;
+    struct {
+        uint32                  RefPartNum;
+        uint32                  Lba;
+        BOOLEAN                 HasPhd;
+        PARTITION_HEADER_DESC   phd;
+    } FSBM_Deferred[UDF_FSBM_MAX_DEFERRED];
     ULONG           BitmapModified;
 
-    PCHAR           ZSBM_Bitmap;     // 0 - data, 1 - zero-filleld
+    UDF_SPARSE_BITMAP ZSBM_Bitmap;   // 0 - data, 1 - zero-filleld
 
-    PCHAR           BSBM_Bitmap;     // 0 - normal, 1 - bad-block
+    UDF_SPARSE_BITMAP BSBM_Bitmap;   // 0 - normal, 1 - bad-block
 
     // pointers to Volume Descriptor Sequences
     ULONG VDS1;
@@ -605,6 +688,18 @@ struct VCB : FCB {
     ULONG VDS2;
     ULONG VDS2_Len;
 
+    // time spent in mount phases (100ns units), see UDFGetDiskInfoAndVerify()
+#define UDF_MOUNT_PHASE_ANCHOR      0
+#define UDF_MOUNT_PHASE_VRS         1
+#define UDF_MOUNT_PHASE_VDS         2   // includes LVID, sparing, FSBM & VAT
+#define UDF_MOUNT_PHASE_LVID        3
+#define UDF_MOUNT_PHASE_SPARING     4
+#define UDF_MOUNT_PHASE_FSBM        5
+#define UDF_MOUNT_PHASE_VAT         6
+#define UDF_MOUNT_PHASE_FILESET     7
+#define UDF_MOUNT_PHASES            8
+    ULONGLONG       MountPhaseTime[UDF_MOUNT_PHASES];
+
     ULONG           Modified;
 
     // System Stream Dir
@@ -673,6 +768,8 @@ using PVCB = VCB*;
 
 // input flush flags
 #define         UDF_FLUSH_FLAGS_BREAKABLE           (0x00000001)
+// walk the whole directory tree instead of the dirty set (dismount)
+#define         UDF_FLUSH_FLAGS_FULL_TREE           (0x00000002)
 // see also udf_rel.h
 #define         UDF_FLUSH_FLAGS_LITE                (0x80000000)
 // output flush flags
@@ -779,6 +876,10 @@ typedef struct IRP_CONTEXT {
     ULONG                           OverflowQueueMagic;
 #endif
     BOOLEAN                         IrpCompleted;
+    // overflow queue this context is parked in, see UDFPostRequest()
+    UCHAR                           FspClass;
+    UCHAR                           FspShard;
+    LARGE_INTEGER                   FspPostTime;
 
     // Io context for a read request.
     // Address of Fcb for teardown oplock in create case.
@@ -859,9 +960,69 @@ struct IRP_CONTEXT_LITE {
     //  Real device object.  This represents the physical device closest to the media.
     PDEVICE_OBJECT                  RealDevice;
     ULONG                           TreeLength;
+    //  Index of the delayed close shard this entry is queued to.
+    ULONG                           Shard;
 };
 using PIRP_CONTEXT_LITE = IRP_CONTEXT_LITE*;
 
+/**************************************************************************
+    Delayed close queues are split into per-CPU shards. Each shard is
+    protected by its own spin lock and is drained by its own worker, so
+    closes issued on different processors do not contend with each other.
+    DelayedCloseResource is only taken exclusively to flush the queues
+    (see UDFCloseAllDelayed()).
+**************************************************************************/
+typedef struct _UDF_DELAYED_CLOSE_SHARD {
+    KSPIN_LOCK                  Lock;
+    LIST_ENTRY                  DelayedCloseQueue;
+    LIST_ENTRY                  DirDelayedCloseQueue;
+    WORK_QUEUE_ITEM             CloseItem;
+    BOOLEAN                     FspCloseActive;
+    // statistics, updated by the shard worker only
+    ULONGLONG                   Drained;
+    ULONGLONG                   DrainTime;
+    ULONGLONG                   MaxDrainTime;
+} UDF_DELAYED_CLOSE_SHARD, *PUDF_DELAYED_CLOSE_SHARD;
+
+#define UDF_DELAYED_CLOSE_BATCH     8
+
+/**************************************************************************
+    Object pools for open-file metadata (FCB, CCB, Dloc). Each pool keeps
+    per-CPU stack of released objects, so common open/close cycle doesn't
+    reach the pool allocator. Per-CPU part is accessed at DISPATCH_LEVEL
+    on owning CPU only and needs no lock. Ctor is called for each object
+    returned by UDFAllocateObj(), Dtor - for each object passed to
+    UDFReleaseObj().
+**************************************************************************/
+#define UDF_OBJ_POOL_FCB            0
+#define UDF_OBJ_POOL_CCB            1
+#define UDF_OBJ_POOL_DLOC           2
+#define UDF_OBJ_POOLS               3
+
+#define UDF_OBJ_POOL_CPU_DEPTH      32
+
+typedef VOID (*PUDF_OBJ_CTOR)(PVOID Obj);
+typedef VOID (*PUDF_OBJ_DTOR)(PVOID Obj);
+
+typedef struct _UDF_OBJ_POOL_CPU {
+    ULONG                       Count;
+    PVOID                       Obj[UDF_OBJ_POOL_CPU_DEPTH];
+    // statistics
+    ULONGLONG                   Allocs;
+    ULONGLONG                   Hits;       // allocations served by this stack
+    ULONGLONG                   Frees;
+} UDF_OBJ_POOL_CPU, *PUDF_OBJ_POOL_CPU;
+
+typedef struct _UDF_OBJ_POOL {
+    ULONG                       Size;
+    POOL_TYPE                   PoolType;
+    ULONG                       Tag;
+    PUDF_OBJ_CTOR               Ctor;
+    PUDF_OBJ_DTOR               Dtor;
+    ULONG                       CpuCount;
+    PUDF_OBJ_POOL_CPU           Cpu;
+} UDF_OBJ_POOL, *PUDF_OBJ_POOL;
+
 /**************************************************************************
     we will store all of our global variables in one structure.
     Global variables are not specific to any mounted volume BUT
@@ -895,9 +1056,9 @@ typedef struct _UDFData {
     // Our lookaside lists.
     NPAGED_LOOKASIDE_LIST IrpContextLookasideList;
     NPAGED_LOOKASIDE_LIST ObjectNameLookasideList;
-    NPAGED_LOOKASIDE_LIST NonPagedFcbLookasideList;
 
-    PAGED_LOOKASIDE_LIST CcbLookasideList;
+    // FCB, CCB & Dloc pools (UDF_OBJ_POOL_XXX)
+    UDF_OBJ_POOL                ObjPool[UDF_OBJ_POOLS];
 
     // delayed close support
     ERESOURCE                   DelayedCloseResource;
@@ -907,14 +1068,14 @@ typedef struct _UDFData {
     ULONG                       MaxDirDelayedCloseCount;
     ULONG                       DirDelayedCloseCount;
     ULONG                       MinDirDelayedCloseCount;
-    LIST_ENTRY                  DelayedCloseQueue;
-    LIST_ENTRY                  DirDelayedCloseQueue;
-    WORK_QUEUE_ITEM             CloseItem;
+    PUDF_DELAYED_CLOSE_SHARD    DelayedCloseShards;
+    ULONG                       DelayedCloseShardCount;
+    LONG                        DelayedCloseWorkers;
     WORK_QUEUE_ITEM             LicenseKeyItem;
     BOOLEAN                     LicenseKeyItemStarted;
-    BOOLEAN                     FspCloseActive;
-    BOOLEAN                     ReduceDelayedClose;
-    BOOLEAN                     ReduceDirDelayedClose;
+    // changed with Interlocked...(), see UDFDelayedClose()
+    LONG                        ReduceDelayedClose;
+    LONG                        ReduceDirDelayedClose;
 
     ULONG                       CPU_Count;
     LARGE_INTEGER               UDFLargeZero;
@@ -943,6 +1104,7 @@ typedef struct _UDFData {
 #define TAG_OBJECT_NAME         'nodU'
 #define TAG_FCB_NONPAGED        'nfdU'
 #define TAG_CCB                 'ccdU'
+#define TAG_DLOC                'ldlU'
 #define TAG_VPB                 'pvdU'
 
 // some valid flags for the VCB
@@ -1034,6 +1196,28 @@ typedef struct _UDFFileIDCacheItem {
     BOOLEAN CaseSens;
 } UDFFileIDCacheItem, *PUDFFileIDCacheItem;
 
+// Full path lookup cache, see UDFPathCacheLookup()
+#define UDF_PATH_CACHE_SIZE         256
+#define UDF_PATH_CACHE_MAX_DEPTH    16
+#define UDF_PATH_CACHE_MAX_NAME     128
+
+typedef struct _UDF_PATH_CACHE_ITEM {
+    ULONG   Hash;
+    LONG    Generation;
+    USHORT  Length;         // in bytes, 0 means free slot
+    USHORT  Depth;
+    BOOLEAN IgnoreCase;
+    // FileEntry of the last path component
+    lb_addr FileEntryLoc;
+    // DirIndex position of each path component
+    ULONG   Index[UDF_PATH_CACHE_MAX_DEPTH];
+    WCHAR   Name[UDF_PATH_CACHE_MAX_NAME];
+} UDF_PATH_CACHE_ITEM, *PUDF_PATH_CACHE_ITEM;
+
+// must be called when a name is added to directory, removed or changed
+#define UDFPathCacheInvalidate(Vcb) \
+    InterlockedIncrement(&((Vcb)->PathCacheGeneration))
+
 #define DIRTY_PAGE_LIMIT   32
 
 #define UDFBugCheck(A,B,C) { KeBugCheckEx(UDFS_FILE_SYSTEM, UDF_BUG_CHECK_ID | __LINE__, A, B, C ); }
@@ -19,26 +19,6 @@
 
 #define         UDF_BUG_CHECK_ID                UDF_FILE_UDF_INFO_ALLOC
 
-static const int8 bit_count_tab[] = {
-    0, 1, 1, 2, 1, 2, 2, 3,   1, 2, 2, 3, 2, 3, 3, 4,
-    1, 2, 2, 3, 2, 3, 3, 4,   2, 3, 3, 4, 3, 4, 4, 5,
-    1, 2, 2, 3, 2, 3, 3, 4,   2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5,   3, 4, 4, 5, 4, 5, 5, 6,
-    1, 2, 2, 3, 2, 3, 3, 4,   2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5,   3, 4, 4, 5, 4, 5, 5, 6,
-    2, 3, 3, 4, 3, 4, 4, 5,   3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6,   4, 5, 5, 6, 5, 6, 6, 7,
-
-    1, 2, 2, 3, 2, 3, 3, 4,   2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5,   3, 4, 4, 5, 4, 5, 5, 6,
-    2, 3, 3, 4, 3, 4, 4, 5,   3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6,   4, 5, 5, 6, 5, 6, 6, 7,
-    2, 3, 3, 4, 3, 4, 4, 5,   3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6,   4, 5, 5, 6, 5, 6, 6, 7,
-    3, 4, 4, 5, 4, 5, 5, 6,   4, 5, 5, 6, 5, 6, 6, 7,
-    4, 5, 5, 6, 5, 6, 6, 7,   5, 6, 6, 7, 6, 7, 7, 8
-};
-
 /*
     This routine converts physical address to logical in specified partition
  */
@@ -318,7 +298,7 @@ UDFFindMinSuitableExtent(
     )
 {
     SIZE_T i, len;
-    uint32* cur;
+    PUDF_SPARSE_BITMAP cur;
     SIZE_T best_lba=0;
     SIZE_T best_len=0;
     SIZE_T max_lba=0;
@@ -338,7 +318,7 @@ UDFFindMinSuitableExtent(
     // align Length according to _Logical_ block size & convert it to BCount
     i = (1<<Vcb->LB2B_Bits)-1;
     Length = (Length+i) & ~i;
-    cur = (uint32*)(Vcb->FSBM_Bitmap);
+    cur = &(Vcb->FSBM_Bitmap);
 
 retry_no_align:
 
@@ -354,8 +334,8 @@ retry_no_align:
             if(i >= SearchLim)
                 break;
         }
-        len = UDFGetBitmapLen(cur, i, SearchLim);
-        if(UDFGetFreeBit(cur, i)) { // is the extent found free or used ?
+        len = UDFSparseGetBitmapLen(cur, i, SearchLim);
+        if(UDFSparseGetFreeBit(cur, i)) { // is the extent found free or used ?
             // wow! it is free!
             if(len >= Length) {
                 // minimize extent length
@@ -483,7 +463,7 @@ UDFCheckSpaceAllocation_(
                     AdPrint(("USED Mapping covers block(s) beyond media @%x\n",lba+j));
                     break;
                 }
-                if(!UDFGetUsedBit(Vcb->FSBM_Bitmap, lba+j)) {
+                if(!UDFSparseGetUsedBit(&(Vcb->FSBM_Bitmap), lba+j)) {
                     BrutePoint();
                     AdPrint(("USED Mapping covers FREE block(s) @%x\n",lba+j));
                     break;
@@ -499,7 +479,7 @@ UDFCheckSpaceAllocation_(
                     AdPrint(("USED Mapping covers block(s) beyond media @%x\n",lba+j));
                     break;
                 }
-                if(!UDFGetFreeBit(Vcb->FSBM_Bitmap, lba+j)) {
+                if(!UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), lba+j)) {
                     BrutePoint();
                     AdPrint(("FREE Mapping covers USED block(s) @%x\n",lba+j));
                     break;
@@ -513,6 +493,616 @@ UDFCheckSpaceAllocation_(
 } // end UDFCheckSpaceAllocation_()
 #endif //UDF_CHECK_DISK_ALLOCATION
 
+#define UDFSparseSetCount(bm)   ((uint16*)((bm)->Leaf + (bm)->LeafCount))
+
+/*
+    This routine allocates top level of two-level bitmap. All bits are
+    initially clear. Several threads may try to initialize the same
+    bitmap, only the first one wins
+ */
+OSSTATUS
+UDFSparseBitmapInit(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 BitCount,
+    IN POOL_TYPE PoolType,
+    IN BOOLEAN Collapse
+    )
+{
+    uint32** top;
+    uint32 LeafCount;
+    uint32 sz;
+
+    if(bm->Leaf)
+        return STATUS_SUCCESS;
+    LeafCount = (BitCount >> UDF_SBM_LEAF_SH) + ((BitCount & (UDF_SBM_LEAF_BITS-1)) ? 1 : 0);
+    sz = LeafCount * (sizeof(uint32*) + sizeof(uint16));
+    top = (uint32**)DbgAllocatePoolWithTag(PoolType, sz, 'mNWD');
+    if(!top)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    RtlZeroMemory(top, sz);
+    bm->LeafCount = LeafCount;
+    bm->BitCount = BitCount;
+    bm->PoolType = PoolType;
+    bm->Collapse = Collapse;
+    if(InterlockedCompareExchangePointer((PVOID*)&(bm->Leaf), top, NULL)) {
+        DbgFreePool(top);
+    }
+    return STATUS_SUCCESS;
+} // end UDFSparseBitmapInit()
+
+/*
+    This routine releases two-level bitmap
+ */
+VOID
+UDFSparseBitmapFree(
+    IN PUDF_SPARSE_BITMAP bm
+    )
+{
+    uint32 l;
+
+    if(!bm->Leaf)
+        return;
+    for(l=0; l<bm->LeafCount; l++) {
+        if(bm->Leaf[l] > UDF_SBM_LEAF_ALL_SET)
+            DbgFreePool(bm->Leaf[l]);
+    }
+    DbgFreePool(bm->Leaf);
+    bm->Leaf = NULL;
+} // end UDFSparseBitmapFree()
+
+/*
+    This routine replaces uniform leaf 'l' with allocated one having
+    the same contents. Returns the leaf or NULL if it cannot be allocated
+ */
+uint32*
+UDFSparseExpandLeaf(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 l,
+    IN uint32* leaf
+    )
+{
+    uint32** top = bm->Leaf;
+    uint32* new_leaf;
+
+    new_leaf = (uint32*)DbgAllocatePoolWithTag(bm->PoolType, UDF_SBM_LEAF_BITS/8, 'mNWD');
+    if(!new_leaf)
+        return NULL;
+    RtlFillMemory(new_leaf, UDF_SBM_LEAF_BITS/8, (leaf == UDF_SBM_LEAF_ALL_SET) ? 0xff : 0x00);
+    // publish atomically, someone may be doing the same
+    if((uint32*)InterlockedCompareExchangePointer((PVOID*)&(top[l]), new_leaf, leaf) == leaf)
+        return new_leaf;
+    DbgFreePool(new_leaf);
+    ASSERT(top[l] > UDF_SBM_LEAF_ALL_SET);
+    return top[l];
+} // end UDFSparseExpandLeaf()
+
+/*
+    This routine sets or clears bc bits starting from 'bit' in two-level
+    bitmap. Leaves are allocated on demand. When bm->Collapse is set,
+    leaves that become uniform are released; caller must serialize access
+    in this case. Otherwise leaves are never released and readers may
+    access the bitmap without lock.
+    Returns FALSE if bitmap is not initialized or leaf cannot be allocated
+ */
+BOOLEAN
+UDFSparseChangeBits(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit,
+    IN uint32 bc,
+    IN BOOLEAN Set
+    )
+{
+    uint32** top = bm->Leaf;
+    uint16* SetCount;
+    uint32* leaf;
+    uint32* uniform = Set ? UDF_SBM_LEAF_ALL_SET : UDF_SBM_LEAF_ALL_CLR;
+    uint32 l, lo, n, j;
+
+    if(!top)
+        return FALSE;
+    if(bit >= bm->BitCount)
+        return TRUE;
+    bc = min(bc, bm->BitCount - bit);
+    SetCount = UDFSparseSetCount(bm);
+
+    while(bc) {
+        l = bit >> UDF_SBM_LEAF_SH;
+        lo = bit & (UDF_SBM_LEAF_BITS-1);
+        n = min(bc, UDF_SBM_LEAF_BITS - lo);
+        bit += n;
+        bc -= n;
+
+        leaf = top[l];
+        if(leaf == uniform)
+            continue;
+        if(n == UDF_SBM_LEAF_BITS && bm->Collapse) {
+            // whole leaf is covered
+            if(leaf > UDF_SBM_LEAF_ALL_SET)
+                DbgFreePool(leaf);
+            top[l] = uniform;
+            SetCount[l] = Set ? UDF_SBM_LEAF_BITS : 0;
+            continue;
+        }
+        if(leaf <= UDF_SBM_LEAF_ALL_SET) {
+            leaf = UDFSparseExpandLeaf(bm, l, leaf);
+            if(!leaf)
+                return FALSE;
+        }
+        for(j=lo; j<lo+n; j++) {
+            if(UDFGetBit(leaf, j) == Set)
+                continue;
+            if(Set) {
+                UDFSetBit(leaf, j);
+                SetCount[l]++;
+            } else {
+                UDFClrBit(leaf, j);
+                SetCount[l]--;
+            }
+        }
+        if(bm->Collapse) {
+            if(!SetCount[l]) {
+                DbgFreePool(leaf);
+                top[l] = UDF_SBM_LEAF_ALL_CLR;
+            } else
+            if(SetCount[l] == UDF_SBM_LEAF_BITS) {
+                DbgFreePool(leaf);
+                top[l] = UDF_SBM_LEAF_ALL_SET;
+            }
+        }
+    }
+    return TRUE;
+} // end UDFSparseChangeBits()
+
+/*
+    This routine allocates all leaves UDFSparseChangeBits() would need
+    to set or clear bc bits starting from 'bit'. Unless the range is
+    changed by someone else in between, the following UDFSparseChangeBits()
+    call with the same arguments can't fail.
+    Returns FALSE if bitmap is not initialized or leaf cannot be allocated
+ */
+BOOLEAN
+UDFSparseReserveBits(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit,
+    IN uint32 bc,
+    IN BOOLEAN Set
+    )
+{
+    uint32** top = bm->Leaf;
+    uint32* leaf;
+    uint32* uniform = Set ? UDF_SBM_LEAF_ALL_SET : UDF_SBM_LEAF_ALL_CLR;
+    uint32 l, lo, n;
+
+    if(!top)
+        return FALSE;
+    if(bit >= bm->BitCount)
+        return TRUE;
+    bc = min(bc, bm->BitCount - bit);
+
+    while(bc) {
+        l = bit >> UDF_SBM_LEAF_SH;
+        lo = bit & (UDF_SBM_LEAF_BITS-1);
+        n = min(bc, UDF_SBM_LEAF_BITS - lo);
+        bit += n;
+        bc -= n;
+
+        leaf = top[l];
+        if((leaf == uniform) ||
+           (leaf > UDF_SBM_LEAF_ALL_SET) ||
+           (n == UDF_SBM_LEAF_BITS && bm->Collapse))
+            continue;
+        if(!UDFSparseExpandLeaf(bm, l, leaf))
+            return FALSE;
+    }
+    return TRUE;
+} // end UDFSparseReserveBits()
+
+/*
+    This routine looks for first set bit in [bit, lim) range of two-level
+    bitmap. Clear leaves and zero words are skipped as a whole.
+    Returns lim if there is no one
+ */
+uint32
+UDFSparseFindNextSet(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit,
+    IN uint32 lim
+    )
+{
+    uint32* leaf;
+    uint32 end;
+    uint32 l, w;
+
+    if(!bm->Leaf)
+        return lim;
+    end = min(lim, bm->BitCount);
+    while(bit < end) {
+        l = bit >> UDF_SBM_LEAF_SH;
+        leaf = bm->Leaf[l];
+        if(leaf == UDF_SBM_LEAF_ALL_CLR) {
+            if(l+1 >= bm->LeafCount)
+                break;
+            bit = (l+1) << UDF_SBM_LEAF_SH;
+            continue;
+        }
+        if(leaf == UDF_SBM_LEAF_ALL_SET)
+            return bit;
+        w = leaf[(bit & (UDF_SBM_LEAF_BITS-1)) >> 5] >> (bit & 31);
+        if(!w) {
+            if((bit | 31) == 0xffffffff)
+                break;
+            bit = (bit | 31) + 1;
+            continue;
+        }
+        while(!(w & 1)) {
+            w >>= 1;
+            bit++;
+        }
+        return (bit < end) ? bit : lim;
+    }
+    return lim;
+} // end UDFSparseFindNextSet()
+
+/*
+    This routine returns 32 bits of two-level bitmap starting from
+    arbitrary position. Bits beyond the end of bitmap are read as clear
+ */
+uint32
+UDFSparseGetWord(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit
+    )
+{
+    uint32* leaf;
+    uint32 l, w, sh, i;
+    uint32 r = 0;
+
+    if(!bm->Leaf)
+        return 0;
+    sh = bit & 31;
+    bit &= ~31;
+    // get 2 aligned words, since requested range may cross word boundary
+    for(i=0; i<(sh ? 2 : 1); i++, bit+=32) {
+        l = bit >> UDF_SBM_LEAF_SH;
+        if(l >= bm->LeafCount)
+            break;
+        leaf = bm->Leaf[l];
+        if(leaf == UDF_SBM_LEAF_ALL_CLR) {
+            w = 0;
+        } else
+        if(leaf == UDF_SBM_LEAF_ALL_SET) {
+            w = 0xffffffff;
+        } else {
+            w = leaf[(bit & (UDF_SBM_LEAF_BITS-1)) >> 5];
+        }
+        if(!i) {
+            r = w >> sh;
+        } else {
+            r |= w << (32-sh);
+        }
+    }
+    return r;
+} // end UDFSparseGetWord()
+
+/*
+    This routine returns length of bit-chain starting from Offs bit in
+    two-level bitmap. Scan is limited with Lim. Uniform leaves are
+    skipped as a whole. Bits beyond the end of bitmap are read as clear
+ */
+SIZE_T
+UDFSparseGetBitmapLen(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 Offs,
+    IN uint32 Lim          // NOT included
+    )
+{
+    uint32* leaf;
+    uint32* uniform;
+    uint32 l, j, lo, hi, end;
+    uint32 w;
+    BOOLEAN bit;
+    SIZE_T len = 0;
+
+    if(Offs >= Lim)
+        return 0;
+    bit = UDFSparseGetBit(bm, Offs);
+    uniform = bit ? UDF_SBM_LEAF_ALL_SET : UDF_SBM_LEAF_ALL_CLR;
+    w = bit ? 0xffffffff : 0;
+
+    while(Offs < Lim) {
+        l = Offs >> UDF_SBM_LEAF_SH;
+        if(!bm->Leaf || l >= bm->LeafCount) {
+            if(!bit)
+                len += Lim - Offs;
+            break;
+        }
+        end = min(Lim, (l+1) << UDF_SBM_LEAF_SH);
+        leaf = bm->Leaf[l];
+        if(leaf == uniform) {
+            j = end - Offs;
+        } else
+        if(leaf <= UDF_SBM_LEAF_ALL_SET) {
+            break;
+        } else {
+            // don't touch words beyond the leaf
+            lo = Offs & (UDF_SBM_LEAF_BITS-1);
+            hi = lo + (end - Offs);
+            for(j=lo; j<hi; ) {
+                if(!(j & 31) && (j+32 <= hi) && (leaf[j>>5] == w)) {
+                    j += 32;
+                    continue;
+                }
+                if(UDFGetBit(leaf, j) != bit)
+                    break;
+                j++;
+            }
+            j -= lo;
+        }
+        len += j;
+        Offs += j;
+        if(Offs < end)
+            break;
+    }
+    return len;
+} // end UDFSparseGetBitmapLen()
+
+/*
+    This routine counts set bits of two-level bitmap in [bit, bit+bc) range
+ */
+uint32
+UDFSparseCountSet(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit,
+    IN uint32 bc
+    )
+{
+    uint32* leaf;
+    uint32 l, lo, n;
+    uint32 s = 0;
+
+    if(!bm->Leaf || bit >= bm->BitCount)
+        return 0;
+    bc = min(bc, bm->BitCount - bit);
+    while(bc) {
+        l = bit >> UDF_SBM_LEAF_SH;
+        lo = bit & (UDF_SBM_LEAF_BITS-1);
+        n = min(bc, UDF_SBM_LEAF_BITS - lo);
+        leaf = bm->Leaf[l];
+        if(leaf == UDF_SBM_LEAF_ALL_SET) {
+            s += n;
+        } else
+        if(leaf != UDF_SBM_LEAF_ALL_CLR) {
+            s += UDFCountFreeBits((int8*)leaf, lo, n);
+        }
+        bit += n;
+        bc -= n;
+    }
+    return s;
+} // end UDFSparseCountSet()
+
+/*
+    This routine copies [bit, bit+bc) range of src two-level bitmap to dst.
+    Both bitmaps must have the same size. Returns FALSE if dst leaf cannot
+    be allocated, dst range is partially updated in this case
+ */
+BOOLEAN
+UDFSparseCopyBits(
+    IN PUDF_SPARSE_BITMAP dst,
+    IN PUDF_SPARSE_BITMAP src,
+    IN uint32 bit,
+    IN uint32 bc
+    )
+{
+    uint32 lim = bit + bc;
+    SIZE_T n;
+
+    ASSERT(dst->BitCount == src->BitCount);
+    while(bit < lim) {
+        n = UDFSparseGetBitmapLen(src, bit, lim);
+        if(!n)
+            break;
+        if(!UDFSparseChangeBits(dst, bit, n, UDFSparseGetBit(src, bit)))
+            return FALSE;
+        bit += n;
+    }
+    return TRUE;
+} // end UDFSparseCopyBits()
+
+/*
+    This routine compares [bit, bit+bc) range of two two-level bitmaps
+    of the same size. Leaves, that are uniform in both bitmaps, are
+    compared without scanning
+ */
+BOOLEAN
+UDFSparseCompareBits(
+    IN PUDF_SPARSE_BITMAP bm1,
+    IN PUDF_SPARSE_BITMAP bm2,
+    IN uint32 bit,
+    IN uint32 bc
+    )
+{
+    uint32* leaf1;
+    uint32* leaf2;
+    uint32 l, lo, n, j, m;
+
+    ASSERT(bm1->BitCount == bm2->BitCount);
+    if(!bm1->Leaf || !bm2->Leaf)
+        return (bm1->Leaf == bm2->Leaf);
+    if(bit >= bm1->BitCount)
+        return TRUE;
+    bc = min(bc, bm1->BitCount - bit);
+    while(bc) {
+        l = bit >> UDF_SBM_LEAF_SH;
+        lo = bit & (UDF_SBM_LEAF_BITS-1);
+        n = min(bc, UDF_SBM_LEAF_BITS - lo);
+        leaf1 = bm1->Leaf[l];
+        leaf2 = bm2->Leaf[l];
+        if((leaf1 != leaf2) || (leaf1 > UDF_SBM_LEAF_ALL_SET)) {
+            for(j=0; j<n; j+=32) {
+                m = ((n-j) >= 32) ? 0xffffffff : (((uint32)1 << (n-j)) - 1);
+                if((UDFSparseGetWord(bm1, bit+j) ^ UDFSparseGetWord(bm2, bit+j)) & m)
+                    return FALSE;
+            }
+        }
+        bit += n;
+        bc -= n;
+    }
+    return TRUE;
+} // end UDFSparseCompareBits()
+
+/*
+    This routine marks FSBM chunks covering specified range as modified,
+    so they will be written to on-disk space bitmaps during next flush
+ */
+void
+UDFSetBitmapDirty(
+    IN PVCB Vcb,
+    IN uint32 lba,
+    IN uint32 len
+    )
+{
+    uint32 c, c_end;
+
+    if(!Vcb->FSBM_DirtyMap || !len)
+        return;
+    c = lba >> Vcb->FSBM_DirtyChunkSh;
+    c_end = min((lba+len-1) >> Vcb->FSBM_DirtyChunkSh, Vcb->FSBM_DirtyChunks-1);
+    for(; c<=c_end; c++) {
+        UDFSetBit(Vcb->FSBM_DirtyMap, c);
+    }
+} // end UDFSetBitmapDirty()
+
+/*
+    This routine checks if any FSBM chunk covering specified range was
+    modified since last flush. The range may end beyond FSBM (the last
+    logical block of partition is rounded up when LBlock > sector), the
+    tail is ignored
+ */
+BOOLEAN
+UDFIsBitmapRangeDirty(
+    IN PVCB Vcb,
+    IN uint32 lba,
+    IN uint32 len
+    )
+{
+    uint32 c, c_end;
+
+    if(!Vcb->FSBM_DirtyMap)
+        return TRUE;
+    if(!len)
+        return FALSE;
+    c = lba >> Vcb->FSBM_DirtyChunkSh;
+    c_end = (lba+len-1) >> Vcb->FSBM_DirtyChunkSh;
+    if(c_end >= Vcb->FSBM_DirtyChunks) {
+        // only the rounded up tail may be out of FSBM
+        ASSERT(lba < Vcb->FSBM_BitCount);
+        ASSERT(lba+len-1 < Vcb->FSBM_BitCount + (1 << Vcb->LB2B_Bits));
+        c_end = Vcb->FSBM_DirtyChunks-1;
+    }
+    for(; c<=c_end; c++) {
+        if(UDFGetBit(Vcb->FSBM_DirtyMap, c))
+            return TRUE;
+    }
+    return FALSE;
+} // end UDFIsBitmapRangeDirty()
+
+/*
+    This routine counts free (set) bits of FSBM in range [lba, lba+len).
+    Whole 32-bit words are counted at once
+ */
+uint32
+__fastcall
+UDFCountFreeBits(
+    IN int8* bm,
+    IN uint32 lba,
+    IN uint32 len
+    )
+{
+    uint32* cur;
+    uint32 lim = lba+len;
+    uint32 s=0, w;
+
+    // head, up to word boundary
+    for(; (lba < lim) && (lba & 31); lba++) {
+        if(UDFGetFreeBit(bm, lba))
+            s++;
+    }
+    cur = ((uint32*)bm) + (lba >> 5);
+    for(; lba+32 <= lim; lba+=32) {
+        w = *(cur++);
+        if(!w)
+            continue;
+        if(w == 0xffffffff) {
+            s += 32;
+            continue;
+        }
+        w = w - ((w >> 1) & 0x55555555);
+        w = (w & 0x33333333) + ((w >> 2) & 0x33333333);
+        s += (((w + (w >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+    }
+    // tail
+    for(; lba < lim; lba++) {
+        if(UDFGetFreeBit(bm, lba))
+            s++;
+    }
+    return s;
+} // end UDFCountFreeBits()
+
+/*
+    This routine must be called before range [lba, lba+len) is marked as
+    Used/Free in FSBM. It updates free block counters of all partitions
+    overlapping the range, so UDFGetPartFreeSpace() needn't scan FSBM
+ */
+void
+UDFUpdatePartFreeCount(
+    IN PVCB Vcb,
+    IN uint32 lba,
+    IN uint32 len,
+    IN BOOLEAN asUsed
+    )
+{
+    uint32 i, s, e, n;
+
+    if(!Vcb->FSBM_FreeCountValid || !UDFSparseBitmapInited(&(Vcb->FSBM_Bitmap)))
+        return;
+    for(i=0; i<Vcb->PartitionMaps; i++) {
+        s = max(lba, UDFPartStart(Vcb, i));
+        e = min(lba+len, UDFPartEnd(Vcb, i));
+        if(s >= e)
+            continue;
+        n = UDFSparseCountSet(&(Vcb->FSBM_Bitmap), s, e-s);
+        if(asUsed) {
+            Vcb->Partitions[i].FreeBlocks -= n;
+        } else {
+            Vcb->Partitions[i].FreeBlocks += (e-s) - n;
+        }
+    }
+} // end UDFUpdatePartFreeCount()
+
+/*
+    This routine rebuilds free block counters of all partitions.
+    It is called after FSBM is changed without UDFMarkSpaceAsXXXNoProtect_()
+    (e.g. when it is loaded from media)
+ */
+void
+UDFRecountPartFreeSpace(
+    IN PVCB Vcb
+    )
+{
+    uint32 i, s, e;
+
+    if(!UDFSparseBitmapInited(&(Vcb->FSBM_Bitmap))) {
+        Vcb->FSBM_FreeCountValid = FALSE;
+        return;
+    }
+    for(i=0; i<Vcb->PartitionMaps; i++) {
+        s = UDFPartStart(Vcb, i);
+        e = min(UDFPartEnd(Vcb, i), Vcb->FSBM_BitCount);
+        Vcb->Partitions[i].FreeBlocks = (s < e) ? UDFSparseCountSet(&(Vcb->FSBM_Bitmap), s, e-s) : 0;
+    }
+    Vcb->FSBM_FreeCountValid = TRUE;
+} // end UDFRecountPartFreeSpace()
+
 void
 UDFMarkBadSpaceAsUsed(
     IN PVCB Vcb,
@@ -521,14 +1111,20 @@ UDFMarkBadSpaceAsUsed(
     )
 {
     uint32 j;
-#define BIT_C   (sizeof(Vcb->BSBM_Bitmap[0])*8)
-    len = (lba+len+BIT_C-1)/BIT_C;
-    if(Vcb->BSBM_Bitmap) {
-        for(j=lba/BIT_C; j<len; j++) {
-            Vcb->FSBM_Bitmap[j] &= ~Vcb->BSBM_Bitmap[j];
+
+    if(!UDFSparseBitmapInited(&(Vcb->BSBM_Bitmap)))
+        return;
+    UDFSetBitmapDirty(Vcb, lba, len);
+    // only leaves containing bad blocks are visited
+    for(j=lba; (j = UDFSparseFindNextSet(&(Vcb->BSBM_Bitmap), j, lba+len)) < lba+len; j++) {
+        if(!UDFSparseReserveUsedBits(&(Vcb->FSBM_Bitmap), j, 1)) {
+            BrutePoint();
+            UDFPrint(("Can't mark BB @%x as used in FSBM\n", j));
+            continue;
         }
+        UDFUpdatePartFreeCount(Vcb, j, 1, TRUE);
+        UDFSparseSetUsedBit(&(Vcb->FSBM_Bitmap), j);
     }
-#undef BIT_C
 } // UDFMarkBadSpaceAsUsed()
 
 /*
@@ -601,11 +1197,12 @@ UDFMarkSpaceAsXXXNoProtect_(
             }
             len = Vcb->LastPossibleLBA - lba;
         }
+        UDFSetBitmapDirty(Vcb, lba, len);
 
 #ifdef UDF_TRACK_ONDISK_ALLOCATION
         if(lba)
-            bit_before = UDFGetBit(Vcb->FSBM_Bitmap, lba-1);
-        bit_after = UDFGetBit(Vcb->FSBM_Bitmap, lba+len);
+            bit_before = UDFSparseGetBit(&(Vcb->FSBM_Bitmap), lba-1);
+        bit_after = UDFSparseGetBit(&(Vcb->FSBM_Bitmap), lba+len);
 #endif //UDF_TRACK_ONDISK_ALLOCATION
 
         // mark frag as XXX (see asUsed parameter)
@@ -614,10 +1211,19 @@ UDFMarkSpaceAsXXXNoProtect_(
                 UDFSetUsedBit(Vcb->FSBM_Bitmap, lba+j);
             }*/
             ASSERT(len);
-            UDFSetUsedBits(Vcb->FSBM_Bitmap, lba, len);
+            // leaves are allocated before free counters are touched.
+            // UDFAllocFreeExtent_() reserves them before the extent is
+            // returned, so newly allocated space never gets here
+            if(!UDFSparseReserveUsedBits(&(Vcb->FSBM_Bitmap), lba, len)) {
+                BrutePoint();
+                UDFPrint(("Can't mark %x blocks @%x as used in FSBM\n", len, lba));
+            } else {
+                UDFUpdatePartFreeCount(Vcb, lba, len, TRUE);
+                UDFSparseSetUsedBits(&(Vcb->FSBM_Bitmap), lba, len);
+            }
 #ifdef UDF_TRACK_ONDISK_ALLOCATION
             for(j=0;j<len;j++) {
-                ASSERT(UDFGetUsedBit(Vcb->FSBM_Bitmap, lba+j));
+                ASSERT(UDFSparseGetUsedBit(&(Vcb->FSBM_Bitmap), lba+j));
             }
 #endif //UDF_TRACK_ONDISK_ALLOCATION
 
@@ -636,21 +1242,30 @@ UDFMarkSpaceAsXXXNoProtect_(
                 UDFSetFreeBit(Vcb->FSBM_Bitmap, lba+j);
             }*/
             ASSERT(len);
-            UDFSetFreeBits(Vcb->FSBM_Bitmap, lba, len);
+            if(!UDFSparseReserveFreeBits(&(Vcb->FSBM_Bitmap), lba, len)) {
+                // blocks remain used, leak is better than corruption
+                BrutePoint();
+                UDFPrint(("Can't mark %x blocks @%x as free in FSBM\n", len, lba));
+            } else {
+                UDFUpdatePartFreeCount(Vcb, lba, len, FALSE);
+                UDFSparseSetFreeBits(&(Vcb->FSBM_Bitmap), lba, len);
+            }
 #ifdef UDF_TRACK_ONDISK_ALLOCATION
             for(j=0;j<len;j++) {
-                ASSERT(UDFGetFreeBit(Vcb->FSBM_Bitmap, lba+j));
+                ASSERT(UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), lba+j));
             }
 #endif //UDF_TRACK_ONDISK_ALLOCATION
             if(asXXX & AS_BAD) {
-                UDFSetBits(Vcb->BSBM_Bitmap, lba, len);
+                if(OS_SUCCESS(UDFSparseBitmapInit(&(Vcb->BSBM_Bitmap), Vcb->LastPossibleLBA+1, NonPagedPool, FALSE))) {
+                    UDFSparseSetBits(&(Vcb->BSBM_Bitmap), lba, len);
+                }
             }
             UDFMarkBadSpaceAsUsed(Vcb, lba, len);
 
             if(asXXX & AS_DISCARDED) {
                 UDFUnmapRange(Vcb, lba, len);
                 WCacheDiscardBlocks__(&(Vcb->FastCache), Vcb, lba, len);
-                UDFSetZeroBits(Vcb->ZSBM_Bitmap, lba, len);
+                UDFSparseSetZeroBits(&(Vcb->ZSBM_Bitmap), lba, len);
             }
             if(Vcb->Vat) {
                 // mark logical blocks in VAT as free
@@ -668,8 +1283,8 @@ UDFMarkSpaceAsXXXNoProtect_(
 
 #ifdef UDF_TRACK_ONDISK_ALLOCATION
         if(lba)
-            ASSERT(bit_before == UDFGetBit(Vcb->FSBM_Bitmap, lba-1));
-        ASSERT(bit_after == UDFGetBit(Vcb->FSBM_Bitmap, lba+len));
+            ASSERT(bit_before == UDFSparseGetBit(&(Vcb->FSBM_Bitmap), lba-1));
+        ASSERT(bit_after == UDFSparseGetBit(&(Vcb->FSBM_Bitmap), lba+len));
 #endif //UDF_TRACK_ONDISK_ALLOCATION
 
         i++;
@@ -779,7 +1394,7 @@ no_free_space_err:
         ASSERT(Ext.extLocation);
 
         // mark newly allocated blocks as zero-filled
-        UDFSetZeroBits(Vcb->ZSBM_Bitmap, Ext.extLocation, (Ext.extLength & UDF_EXTENT_LENGTH_MASK) >> BSh);
+        UDFSparseSetZeroBits(&(Vcb->ZSBM_Bitmap), Ext.extLocation, (Ext.extLength & UDF_EXTENT_LENGTH_MASK) >> BSh);
 
         if(AllocFlags & EXTENT_FLAG_VERIFY) {
             if(!UDFCheckArea(Vcb, Ext.extLocation, Ext.extLength >> BSh)) {
@@ -792,6 +1407,20 @@ no_free_space_err:
             }
         }
 
+        // make sure FSBM can record the allocation, otherwise the extent
+        // would remain free and could be given to someone else
+        if(!UDFSparseReserveUsedBits(&(Vcb->FSBM_Bitmap), Ext.extLocation, Ext.extLength >> BSh)) {
+            BrutePoint();
+            if(ExtInfo->Mapping) {
+                UDFMarkSpaceAsXXXNoProtect(Vcb, 0, ExtInfo->Mapping, AS_DISCARDED); // free
+                MyFreePool__(ExtInfo->Mapping);
+                ExtInfo->Mapping = NULL;
+            }
+            UDFReleaseResource(&(Vcb->BitMapResource1));
+            ExtInfo->Length = 0;
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
         Ext.extLength |= EXTENT_NOT_RECORDED_ALLOCATED << 30;
         if(!(ExtInfo->Mapping)) {
             // create new
@@ -842,18 +1471,60 @@ UDFGetPartFreeSpace(
     IN uint32 partNum
     )
 {
-    uint32 lim/*, len=1*/;
     uint32 s=0;
-    uint32 j;
-    PUCHAR cur = (PUCHAR)(Vcb->FSBM_Bitmap);
+#ifdef UDF_DBG
+    uint32 e;
+#endif // UDF_DBG
 
-    lim = (UDFPartEnd(Vcb,partNum)+7)/8;
-    for(j=(UDFPartStart(Vcb,partNum)+7)/8; j<lim/* && len*/; j++) {
-        s+=bit_count_tab[cur[j]];
+    if(!UDFSparseBitmapInited(&(Vcb->FSBM_Bitmap))) {
+        // FSBM is not loaded yet, see UDFLoadDeferredFreeSpaceBitmap()
+        s = UDFGetPartFreeSpaceLVID(Vcb, partNum);
+        return (s == (-1)) ? 0 : (s << Vcb->LB2B_Bits);
     }
+    if(partNum >= Vcb->PartitionMaps)
+        return 0;
+    if(!Vcb->FSBM_FreeCountValid) {
+        // counters are maintained by UDFMarkSpaceAsXXXNoProtect_(),
+        // build them once after FSBM was loaded
+        UDFAcquireResourceExclusive(&(Vcb->BitMapResource1),TRUE);
+        if(!Vcb->FSBM_FreeCountValid)
+            UDFRecountPartFreeSpace(Vcb);
+        UDFReleaseResource(&(Vcb->BitMapResource1));
+    }
+#ifdef UDF_DBG
+    // cross-check counter with full FSBM scan
+    UDFAcquireResourceShared(&(Vcb->BitMapResource1),TRUE);
+    s = UDFPartStart(Vcb, partNum);
+    e = min(UDFPartEnd(Vcb, partNum), Vcb->FSBM_BitCount);
+    ASSERT(Vcb->Partitions[partNum].FreeBlocks ==
+           ((s < e) ? UDFSparseCountSet(&(Vcb->FSBM_Bitmap), s, e-s) : 0));
+    s = Vcb->Partitions[partNum].FreeBlocks;
+    UDFReleaseResource(&(Vcb->BitMapResource1));
+#else // UDF_DBG
+    s = Vcb->Partitions[partNum].FreeBlocks;
+#endif // UDF_DBG
     return s;
 } // end UDFGetPartFreeSpace()
 
+/*
+    Returns LBlock-count recorded in Free Space Table of LVID
+    or (-1) if it is not available or may be out of date
+ */
+uint32
+UDFGetPartFreeSpaceLVID(
+    IN PVCB Vcb,
+    IN uint32 partNum
+    )
+{
+    LogicalVolIntegrityDesc* lvid = Vcb->LVid;
+
+    if(!lvid ||
+       (lvid->integrityType != INTEGRITY_TYPE_CLOSE) ||
+       (partNum >= lvid->numOfPartitions))
+        return (-1);
+    return ((uint32*)(lvid+1))[partNum];
+} // end UDFGetPartFreeSpaceLVID()
+
 int64
 __fastcall
 UDFGetFreeSpace(
@@ -866,6 +1537,15 @@ UDFGetFreeSpace(
 
     if(!Vcb->CDR_Mode &&
        !(Vcb->VCBFlags & UDF_VCB_FLAGS_RAW_DISK)) {
+        if(Vcb->FSBM_LazyState == UDF_FSBM_DEFERRED) {
+            // use LVID Free Space Table if it is valid
+            for(i=0;i<Vcb->PartitionMaps;i++) {
+                if(UDFGetPartFreeSpaceLVID(Vcb, i) == (-1)) {
+                    UDFLoadDeferredFreeSpaceBitmap(Vcb);
+                    break;
+                }
+            }
+        }
         for(i=0;i<Vcb->PartitionMaps;i++) {
 /*            lim = UDFPartEnd(Vcb,i);
             for(j=UDFPartStart(Vcb,i); j<lim && len; ) {
@@ -921,15 +1601,17 @@ UDFIsBlockAllocated(
     )
 {
     ULONG ret_val = 0;
-    uint32* bm;
+    PUDF_SPARSE_BITMAP bm;
 //    return TRUE;
     if(!(((PVCB)_Vcb)->VCBFlags & UDF_VCB_ASSUME_ALL_USED)) {
         // check used
-        if((bm = (uint32*)(((PVCB)_Vcb)->FSBM_Bitmap)))
-            ret_val = (UDFGetUsedBit(bm, Lba) ? WCACHE_BLOCK_USED : 0);
+        bm = &(((PVCB)_Vcb)->FSBM_Bitmap);
+        if(UDFSparseBitmapInited(bm))
+            ret_val = (UDFSparseGetUsedBit(bm, Lba) ? WCACHE_BLOCK_USED : 0);
         // check zero-filled
-        if((bm = (uint32*)(((PVCB)_Vcb)->ZSBM_Bitmap)))
-            ret_val |= (UDFGetZeroBit(bm, Lba) ? WCACHE_BLOCK_ZERO : 0);
+        bm = &(((PVCB)_Vcb)->ZSBM_Bitmap);
+        if(UDFSparseBitmapInited(bm))
+            ret_val |= (UDFSparseGetZeroBit(bm, Lba) ? WCACHE_BLOCK_ZERO : 0);
     } else {
         ret_val = WCACHE_BLOCK_USED;
     }
@@ -937,8 +1619,8 @@ UDFIsBlockAllocated(
 
     // WCache works with LOGICAL addresses, not PHYSICAL, BB check must be performed UNDER cache
 /*
-    if(bm = (uint32*)(((PVCB)_Vcb)->BSBM_Bitmap)) {
-        ret_val |= (UDFGetBadBit(bm, Lba) ? WCACHE_BLOCK_BAD : 0);
+    if(UDFSparseBitmapInited(&(((PVCB)_Vcb)->BSBM_Bitmap))) {
+        ret_val |= (UDFSparseGetBit(&(((PVCB)_Vcb)->BSBM_Bitmap), Lba) ? WCACHE_BLOCK_BAD : 0);
         if(ret_val & WCACHE_BLOCK_BAD) {
             UDFPrint(("Marked BB @ %#x\n", Lba));
         }
@@ -28,6 +28,7 @@
 #define         UDF_BUG_CHECK_ID                UDF_FILE_UDF_INFO_DIR
 
 #define         MEM_USDIRHASH_TAG               "USDirHash"
+#define         MEM_DIR_NEG_TAG                 "DirNeg"
 
 #define UDF_DUMP_DIRTREE
 #ifdef UDF_DUMP_DIRTREE
@@ -107,9 +108,122 @@ UDFDirIndexFree(
     for(k=0; k<hDirNdx->FrameCount; k++, FrameList++) {
         if(*FrameList) MyFreePool__(*FrameList);
     }
+    if(hDirNdx->NegCache) MyFreePool__(hDirNdx->NegCache);
     MyFreePool__(hDirNdx);
 } // UDFDirIndexFree();
 
+/*
+    This routine releases negative lookup cache of DirIndex.
+    It must be called each time a name appears in the directory
+ */
+void
+UDFDirIndexInvalidateNegCache(
+    IN PDIR_INDEX_HDR hDirNdx
+    )
+{
+    if(!hDirNdx || !hDirNdx->NegCache)
+        return;
+    MyFreePool__(hDirNdx->NegCache);
+    hDirNdx->NegCache = NULL;
+} // end UDFDirIndexInvalidateNegCache()
+
+#define UDFNegCacheBloomMask(h) \
+    ( (((uint64)1) << ((h) & 63)) | (((uint64)1) << (((h) >> 6) & 63)) )
+
+/*
+    This routine checks if Name is known to be absent in directory.
+    Matched entry is moved to the head of LRU list
+ */
+BOOLEAN
+UDFDirIndexNegCacheLookup(
+    IN PDIR_INDEX_HDR hDirNdx,
+    IN PUNICODE_STRING Name,
+    IN PHASH_ENTRY hashes,
+    IN BOOLEAN IgnoreCase
+    )
+{
+    PDIR_NEG_CACHE NegCache;
+    PDIR_NEG_CACHE_ENTRY Entry;
+    DIR_NEG_CACHE_ENTRY TmpEntry;
+    UNICODE_STRING CachedName;
+    uint64 Mask;
+    uint32 i;
+
+    if(!hDirNdx || !(NegCache = hDirNdx->NegCache))
+        return FALSE;
+    Mask = UDFNegCacheBloomMask(hashes->hLfn);
+    if((NegCache->Bloom & Mask) != Mask)
+        return FALSE;
+
+    for(i=0; i<NegCache->Count; i++) {
+        Entry = &(NegCache->Entry[i]);
+        if((Entry->hLfn != hashes->hLfn) ||
+           (Entry->Length != Name->Length))
+            continue;
+        // case-sensitive miss says nothing about other spellings of the name
+        if(!Entry->IgnoreCase &&
+           (IgnoreCase || (Entry->hPosix != hashes->hPosix)))
+            continue;
+        CachedName.Buffer = Entry->Name;
+        CachedName.Length =
+        CachedName.MaximumLength = Entry->Length;
+        if(RtlCompareUnicodeString(&CachedName, Name, Entry->IgnoreCase))
+            continue;
+        if(i) {
+            TmpEntry = *Entry;
+            RtlMoveMemory(&(NegCache->Entry[1]), &(NegCache->Entry[0]), i*sizeof(DIR_NEG_CACHE_ENTRY));
+            NegCache->Entry[0] = TmpEntry;
+        }
+        return TRUE;
+    }
+    return FALSE;
+} // end UDFDirIndexNegCacheLookup()
+
+/*
+    This routine remembers that Name is absent in directory.
+    The least recently used entry is dropped when the cache is full
+ */
+void
+UDFDirIndexNegCacheAdd(
+    IN PDIR_INDEX_HDR hDirNdx,
+    IN PUNICODE_STRING Name,
+    IN PHASH_ENTRY hashes,
+    IN BOOLEAN IgnoreCase
+    )
+{
+    PDIR_NEG_CACHE NegCache;
+    PDIR_NEG_CACHE_ENTRY Entry;
+    uint32 i;
+
+    if(!hDirNdx ||
+       (Name->Length > UDF_NEG_CACHE_MAX_NAME*sizeof(WCHAR)))
+        return;
+    if(!(NegCache = hDirNdx->NegCache)) {
+        NegCache = (PDIR_NEG_CACHE)MyAllocatePoolTag__(UDF_DIR_INDEX_MT, sizeof(DIR_NEG_CACHE), MEM_DIR_NEG_TAG);
+        if(!NegCache)
+            return;
+        NegCache->Count = 0;
+        hDirNdx->NegCache = NegCache;
+    }
+
+    i = min(NegCache->Count, UDF_NEG_CACHE_SIZE-1);
+    RtlMoveMemory(&(NegCache->Entry[1]), &(NegCache->Entry[0]), i*sizeof(DIR_NEG_CACHE_ENTRY));
+    NegCache->Count = i+1;
+
+    Entry = &(NegCache->Entry[0]);
+    Entry->hLfn = hashes->hLfn;
+    Entry->hPosix = hashes->hPosix;
+    Entry->Length = Name->Length;
+    Entry->IgnoreCase = IgnoreCase;
+    RtlCopyMemory(Entry->Name, Name->Buffer, Name->Length);
+
+    // rebuild filter, evicted name must not stay there
+    NegCache->Bloom = 0;
+    for(i=0; i<NegCache->Count; i++) {
+        NegCache->Bloom |= UDFNegCacheBloomMask(NegCache->Entry[i].hLfn);
+    }
+} // end UDFDirIndexNegCacheAdd()
+
 /*
     This routine grows DirIndex array
  */
@@ -419,6 +533,47 @@ UDFBuildHashEntry(
     return RetFlags;
 } // UDFBuildHashEntry()
 
+/*
+    This routine calculates hashes for DirIndex entry on demand.
+    UDFIndexDirectory() doesn't build them, so the cost of  name
+    upcasing & 8.3 name generation is paid only by entries  that
+    are really touched by case-insensitive or 8.3 lookups.
+    It may be called by several readers holding directory lock  shared
+    at once. Hashes are calculated in local copy & stored before the
+    single store to #HashMask publishes them. Concurrent builders store
+    equal values, a lost #HashMask bit only causes recalculation.
+ */
+void
+UDFDirIndexBuildHashes(
+    IN PVCB Vcb,
+    IN PDIR_INDEX_ITEM DirNdx,
+    IN uint8 Mask
+    )
+{
+    HASH_ENTRY hashes;
+    uint8 HashMask = DirNdx->HashMask;
+    uint8 Flags;
+
+    Mask &= HASH_ALL & ~HashMask;
+    if(!Mask)
+        return;
+    if(DirNdx->FI_Flags & UDF_FI_FLAG_KEEP_NAME)
+        Mask |= HASH_KEEP_NAME;
+    Flags = UDFBuildHashEntry(Vcb, &(DirNdx->FName), &hashes, Mask);
+
+    if(Mask & HASH_POSIX)
+        DirNdx->hashes.hPosix = hashes.hPosix;
+    if(Mask & HASH_ULFN)
+        DirNdx->hashes.hLfn = hashes.hLfn;
+    if(Mask & HASH_DOS) {
+        DirNdx->hashes.hDos = hashes.hDos;
+        if(Flags & UDF_FI_FLAG_DOS)
+            DirNdx->FI_Flags |= UDF_FI_FLAG_DOS;
+    }
+    KeMemoryBarrier();
+    DirNdx->HashMask = HashMask | (Mask & HASH_ALL);
+} // end UDFDirIndexBuildHashes()
+
 #ifdef UDF_CHECK_UTIL
 uint32
 UDFFindNextFI(
@@ -576,8 +731,7 @@ UDFIndexDirectory(
     RtlInitUnicodeString(&DirNdx->FName, L".");
     DirNdx->FileInfo = FileInfo;
     DirNdx->FI_Flags |= UDF_FI_FLAG_KEEP_NAME;
-    DirNdx->FI_Flags |= UDFBuildHashEntry(Vcb, &(DirNdx->FName), &(DirNdx->hashes),
-        HASH_ALL | HASH_KEEP_NAME);
+    // hashes are built on demand, see UDFDirIndexBuildHashes()
     Count++;
     FileId = (PFILE_IDENT_DESC)buff;
     status = STATUS_SUCCESS;
@@ -618,7 +772,6 @@ UDFIndexDirectory(
             DirNdx->FileInfo = (FileInfo->ParentFile) ?
                                       FileInfo->ParentFile : FileInfo;
             DirNdx->FI_Flags |= UDF_FI_FLAG_KEEP_NAME;
-            DirNdx->FI_Flags |= UDFBuildHashEntry(Vcb, &(DirNdx->FName), &(DirNdx->hashes), HASH_ALL | HASH_KEEP_NAME);
         } else {
             // init plain file/dir entry
             ASSERT( (Offset+sizeof(FILE_IDENT_DESC)+FileId->lengthOfImpUse+FileId->lengthFileIdent) <=
@@ -628,7 +781,6 @@ UDFIndexDirectory(
                              FileId->lengthFileIdent,
                              &valueCRC);
             UDFNormalizeFileName(&(DirNdx->FName), valueCRC);
-            DirNdx->FI_Flags |= UDFBuildHashEntry(Vcb, &(DirNdx->FName), &(DirNdx->hashes), HASH_ALL);
         }
         if((FileId->fileCharacteristics & FILE_METADATA)
                        ||
@@ -651,7 +803,7 @@ UDFIndexDirectory(
 #ifdef UDF_CHECK_DISK_ALLOCATION
         if(!(FileId->fileCharacteristics & FILE_DELETED) &&
             (UDFPartLbaToPhys(Vcb, &(DirNdx->FileEntryLoc)) != LBA_OUT_OF_EXTENT) &&
-             UDFGetFreeBit(((uint32*)(Vcb->FSBM_Bitmap)), UDFPartLbaToPhys(Vcb, &(DirNdx->FileEntryLoc)) )) {
+             UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), UDFPartLbaToPhys(Vcb, &(DirNdx->FileEntryLoc)) )) {
 
             AdPrint(("Ref to Discarded block %x\n",UDFPartLbaToPhys(Vcb, &(DirNdx->FileEntryLoc)) ));
             BrutePoint();
@@ -952,11 +1104,17 @@ UDFFindFile(
     PDIR_INDEX_ITEM DirNdx;
     UDF_DIR_SCAN_CONTEXT ScanContext;
     uint_di j=(-1), k=(-1);
+    uint_di StartIndex = (*Index);
     HASH_ENTRY hashes;
     BOOLEAN CanBe8d3;
 
     UDFBuildHashEntry(Vcb, Name, &hashes, HASH_POSIX | HASH_ULFN);
 
+    // repeated miss, do not scan DirIndex again
+    if(NotDeleted &&
+       UDFDirIndexNegCacheLookup(DirInfo->Dloc->DirIndex, Name, &hashes, IgnoreCase))
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+
     if((CanBe8d3 = UDFCanNameBeA8dot3(Name))) {
         ShortName.MaximumLength = 13 * sizeof(WCHAR);
         ShortName.Buffer = (PWCHAR)&ShortNameBuffer;
@@ -969,6 +1127,7 @@ UDFFindFile(
         // perform case sensetive sequential directory scan
 
         while((DirNdx = UDFDirIndexScan(&ScanContext, NULL))) {
+            UDFDirIndexEnsureHashes(Vcb, DirNdx, HASH_POSIX);
             if( (DirNdx->hashes.hPosix == hashes.hPosix) &&
                  DirNdx->FName.Buffer &&
                 (!RtlCompareUnicodeString(&(DirNdx->FName), Name, FALSE)) &&
@@ -977,7 +1136,7 @@ UDFFindFile(
                 return STATUS_SUCCESS;
             }
         }
-        return STATUS_OBJECT_NAME_NOT_FOUND;
+        goto not_found;
     }
 
     if(hashes.hPosix == hashes.hLfn) {
@@ -986,6 +1145,7 @@ UDFFindFile(
             if(!DirNdx->FName.Buffer ||
                (NotDeleted && UDFIsDeleted(DirNdx)) )
                 continue;
+            UDFDirIndexEnsureHashes(Vcb, DirNdx, CanBe8d3 ? (HASH_ULFN | HASH_DOS) : HASH_ULFN);
             if( (DirNdx->hashes.hLfn == hashes.hLfn) &&
                 (!RtlCompareUnicodeString(&(DirNdx->FName), Name, IgnoreCase)) ) {
                 (*Index) = ScanContext.i;
@@ -1008,6 +1168,7 @@ UDFFindFile(
             if(!DirNdx->FName.Buffer ||
                (NotDeleted && UDFIsDeleted(DirNdx)) )
                 continue;
+            UDFDirIndexEnsureHashes(Vcb, DirNdx, CanBe8d3 ? HASH_ALL : (HASH_POSIX | HASH_ULFN));
             if( (DirNdx->hashes.hPosix == hashes.hPosix) &&
                 (!RtlCompareUnicodeString(&(DirNdx->FName), Name, FALSE)) ) {
                 (*Index) = ScanContext.i;
@@ -1039,10 +1200,115 @@ UDFFindFile(
         return STATUS_SUCCESS;
     }
 
+not_found:
+    // remember the miss, only whole-directory scans are reliable
+    if(NotDeleted && !StartIndex)
+        UDFDirIndexNegCacheAdd(DirInfo->Dloc->DirIndex, Name, &hashes, IgnoreCase);
+
     return STATUS_OBJECT_NAME_NOT_FOUND;
 
 } // end UDFFindFile()
 
+/*
+    This routine looks for already opened (having FileInfo) file in
+    directory. Unlike UDFFindFile() it never updates DirIndex (hashes,
+    negative cache), so it may be called when DirInfo is held shared
+    by several threads.
+    It returns NULL if the file is not opened yet or can be reached
+    by DOS name or via parallel link only. In this case caller should
+    lock DirInfo exclusively and use UDFOpenFile__().
+ */
+PUDF_FILE_INFO
+UDFFindOpenedFile(
+    IN PVCB Vcb,
+    IN BOOLEAN IgnoreCase,
+    IN PUNICODE_STRING Name,
+    IN PUDF_FILE_INFO DirInfo,
+    IN uint_di* IndexHint
+    )
+{
+    PDIR_INDEX_ITEM DirNdx;
+    PDIR_INDEX_ITEM Found = NULL;
+    UDF_DIR_SCAN_CONTEXT ScanContext;
+    HASH_ENTRY hashes;
+
+    // no opened files, don't scan twice
+    if(!DirInfo->Dloc->DirIndex ||
+       !UDFIsDirOpened__(DirInfo))
+        return NULL;
+
+    // position remembered by path cache, no scan is needed
+    if(IndexHint &&
+       UDFDirIndexCheckHint(DirInfo, Name, *IndexHint)) {
+        Found = UDFDirIndex(DirInfo->Dloc->DirIndex, *IndexHint);
+        goto check_found;
+    }
+
+    UDFBuildHashEntry(Vcb, Name, &hashes, HASH_ULFN);
+
+    if(!UDFDirIndexInitScan(DirInfo, &ScanContext, 2))
+        return NULL;
+
+    while((DirNdx = UDFDirIndexScan(&ScanContext, NULL))) {
+        if(!DirNdx->FName.Buffer ||
+           (DirNdx->FName.Length != Name->Length) ||
+           UDFIsDeleted(DirNdx))
+            continue;
+        // use hash only if it was already calculated by UDFFindFile()
+        if((DirNdx->HashMask & HASH_ULFN) &&
+           (DirNdx->hashes.hLfn != hashes.hLfn))
+            continue;
+        if(RtlCompareUnicodeString(&(DirNdx->FName), Name, IgnoreCase))
+            continue;
+        // exact match has priority, the same way as in UDFFindFile()
+        if(!IgnoreCase ||
+           !RtlCompareUnicodeString(&(DirNdx->FName), Name, FALSE)) {
+            Found = DirNdx;
+            break;
+        }
+        if(!Found)
+            Found = DirNdx;
+    }
+check_found:
+    if(!Found ||
+       !Found->FileInfo ||
+       (Found->FileInfo->ParentFile != DirInfo))
+        return NULL;
+    return Found->FileInfo;
+} // end UDFFindOpenedFile()
+
+/*
+    This routine checks if DirIndex entry at given position is still
+    alive and has exactly the same name (and FileEntry location if
+    specified). Exact match is the one UDFFindFile() would prefer even
+    for case-insensitive open, so the position may be used instead of
+    directory scan. Other spellings are resolved by the scan.
+ */
+BOOLEAN
+UDFDirIndexCheckHint(
+    IN PUDF_FILE_INFO DirInfo,
+    IN PUNICODE_STRING Name,
+    IN uint_di Index,
+    IN lb_addr* FileEntryLoc
+    )
+{
+    PDIR_INDEX_ITEM DirNdx;
+
+    if(!DirInfo->Dloc->DirIndex ||
+       (Index < 2) ||
+       !(DirNdx = UDFDirIndex(DirInfo->Dloc->DirIndex, Index)))
+        return FALSE;
+    if(!DirNdx->FName.Buffer ||
+       (DirNdx->FName.Length != Name->Length) ||
+       UDFIsDeleted(DirNdx))
+        return FALSE;
+    if(FileEntryLoc &&
+       ((DirNdx->FileEntryLoc.logicalBlockNum != FileEntryLoc->logicalBlockNum) ||
+        (DirNdx->FileEntryLoc.partitionReferenceNum != FileEntryLoc->partitionReferenceNum)))
+        return FALSE;
+    return !RtlCompareUnicodeString(&(DirNdx->FName), Name, FALSE);
+} // end UDFDirIndexCheckHint()
+
 /*
     This routine returns pointer to parent DirIndex
 */
@@ -1233,15 +1499,14 @@ UDFStoreDloc(
         UDFReleaseResource(&(Vcb->DlocResource));
         return STATUS_SUCCESS;
     }
-    // allocate common DataLocation (Dloc) descriptor
-    Dloc = fi->Dloc = (PUDF_DATALOC_INFO)MyAllocatePoolTag__(UDF_DATALOC_INFO_MT, sizeof(UDF_DATALOC_INFO), MEM_DLOC_INF_TAG);
+    // allocate common DataLocation (Dloc) descriptor (zeroed by pool Ctor)
+    Dloc = fi->Dloc = UDFAllocateDloc();
     if(!Dloc) {
         UDFReleaseResource(&(Vcb->DlocResource));
         return STATUS_INSUFFICIENT_RESOURCES;
     }
     Vcb->DlocList[i].Lba = Lba;
     Vcb->DlocList[i].Dloc = Dloc;
-    RtlZeroMemory(Dloc, sizeof(UDF_DATALOC_INFO));
     Dloc->LinkedFileInfo = fi;
     UDFAcquireDloc(Vcb, Dloc);
     UDFReleaseResource(&(Vcb->DlocResource));
@@ -1272,7 +1537,7 @@ UDFRemoveDloc(
     ASSERT(Vcb->DlocList);
     RtlZeroMemory(&(Vcb->DlocList[i]), sizeof(UDF_DATALOC_INDEX));
     UDFReleaseResource(&(Vcb->DlocResource));
-    MyFreePool__(Dloc);
+    UDFReleaseDlocObj(Dloc);
     return STATUS_SUCCESS;
 } // end UDFRemoveDloc()
 
@@ -1322,7 +1587,7 @@ UDFFreeDloc(
         RtlZeroMemory(&(Vcb->DlocList[i]), sizeof(UDF_DATALOC_INDEX));
     }
     UDFReleaseResource(&(Vcb->DlocResource));
-    MyFreePool__(Dloc);
+    UDFReleaseDlocObj(Dloc);
 } // end UDFFreeDloc()
 
 /*
@@ -1359,7 +1624,7 @@ UDFReleaseDlocList(
     UDFAcquireResourceExclusive(&(Vcb->DlocResource),TRUE);
     for(uint32 i=0; i<Vcb->DlocCount; i++) {
         if(Vcb->DlocList[i].Dloc)
-            MyFreePool__(Vcb->DlocList[i].Dloc);
+            UDFReleaseDlocObj(Vcb->DlocList[i].Dloc);
     }
     MyFreePool__(Vcb->DlocList);
     Vcb->DlocList = NULL;
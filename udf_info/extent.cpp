@@ -734,7 +734,8 @@ UDFReadMappingFromXEntry(
     IN uint32 PartNum,
     IN tag* XEntry,
     IN OUT uint32* Offset,
-    OUT PEXTENT_INFO AllocLoc // .Mapping must be intialized (non-Zero)
+    OUT PEXTENT_INFO AllocLoc, // .Mapping must be intialized (non-Zero)
+    IN int8* AllocDescsBuf     // AllocDescs, if they are not kept in XEntry
     )
 {
     PEXTENT_AD Extent;
@@ -774,6 +775,8 @@ UDFReadMappingFromXEntry(
     } else {
         return NULL;
     }
+    if(AllocDescsBuf)
+        AllocDescs = AllocDescsBuf;
 
     // for compatibility with Adaptec DirectCD
 //    if(!(Vcb->UDF_VCB_IC_ADAPTEC_NONALLOC_COMPAT))
@@ -796,7 +799,7 @@ UDFReadMappingFromXEntry(
     }
     default : {  // case ICB_FLAG_AD_IN_ICB
         Extent = NULL;
-        *Offset = (uintptr_t)AllocDescs - (uintptr_t)XEntry;
+        *Offset = AllocLoc->Offset;
         AllocLoc->Offset=0;
         AllocLoc->Length=0;
         if(AllocLoc->Mapping) MyFreePool__(AllocLoc->Mapping);
@@ -1667,9 +1670,9 @@ UDFAllocateFESpace(
                 Extent.extLength = Vcb->LBlockSize | (EXTENT_NOT_RECORDED_ALLOCATED << 30);
                 Extent.extLocation = Ext->Mapping[i].extLocation;
 
-                if(Vcb->BSBM_Bitmap) {
+                if(UDFSparseBitmapInited(&(Vcb->BSBM_Bitmap))) {
                     uint32 lba = Ext->Mapping[i].extLocation;
-                    if(UDFGetBadBit((uint32*)(Vcb->BSBM_Bitmap), lba)) {
+                    if(UDFSparseGetBit(&(Vcb->BSBM_Bitmap), lba)) {
                         UDFPrint(("Remove BB @ %x from FE charge\n", lba));
                         Ext->Mapping[i].extLength |= (EXTENT_NOT_RECORDED_NOT_ALLOCATED << 30);
                         Ext->Mapping[i].extLocation = 0;
@@ -2385,8 +2388,8 @@ UDFResizeExtent(
                     // how many sectors we should add
                     req_s = lim - s;
                     ASSERT(req_s);
-                    if((lba < pe) && UDFGetFreeBit(Vcb->FSBM_Bitmap, lba)) {
-                        s += UDFGetBitmapLen((uint32*)(Vcb->FSBM_Bitmap), lba, min(pe, lba+req_s));
+                    if((lba < pe) && UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), lba)) {
+                        s += UDFSparseGetBitmapLen(&(Vcb->FSBM_Bitmap), lba, min(pe, lba+req_s));
                     }
 /*                    for(s1=lba; (s<lim) && (s1<pe) && UDFGetFreeBit(Vcb->FSBM_Bitmap, s1); s1++) {
                         s++;
@@ -2457,8 +2460,8 @@ UDFResizeExtent(
 
                         UDFAcquireResourceExclusive(&(Vcb->BitMapResource1),TRUE);
                         //ASSERT(req_s);
-                        if((lba < pe) && UDFGetFreeBit(Vcb->FSBM_Bitmap, lba)) {
-                            s += (d = UDFGetBitmapLen((uint32*)(Vcb->FSBM_Bitmap), lba, min(pe, lba+req_s)));
+                        if((lba < pe) && UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), lba)) {
+                            s += (d = UDFSparseGetBitmapLen(&(Vcb->FSBM_Bitmap), lba, min(pe, lba+req_s)));
                         }
     /*                    for(s1=lba; (s<lim) && (s1<pe) && UDFGetFreeBit(Vcb->FSBM_Bitmap, s1); s1++) {
                             s++;
@@ -3024,7 +3027,8 @@ UDFReadExtent(
     IN SIZE_T Length,
     IN BOOLEAN Direct,
     OUT int8* Buffer,
-    OUT PSIZE_T ReadBytes
+    OUT PSIZE_T ReadBytes,
+    IN BOOLEAN NoCache
     )
 {
     (*ReadBytes) = 0;
@@ -3052,7 +3056,11 @@ UDFReadExtent(
         // check for reading tail
         to_read = min(to_read, Length);
         if(flags == EXTENT_RECORDED_ALLOCATED) {
-            status = UDFReadData(Vcb, TRUE, ( ((uint64)Lba) << Vcb->BlockSizeBits) + sect_offs, to_read, Direct, Buffer, &_ReadBytes);
+            if(NoCache && !Direct) {
+                status = UDFReadDataNoCache(Vcb, ( ((uint64)Lba) << Vcb->BlockSizeBits) + sect_offs, to_read, Buffer, &_ReadBytes);
+            } else {
+                status = UDFReadData(Vcb, TRUE, ( ((uint64)Lba) << Vcb->BlockSizeBits) + sect_offs, to_read, Direct, Buffer, &_ReadBytes);
+            }
             (*ReadBytes) += _ReadBytes;
             if(!OS_SUCCESS(status)) return status;
         } else {
@@ -3189,7 +3197,8 @@ UDFWriteExtent(
     IN BOOLEAN Direct,         // setting this flag delays flushing of given
                                // data to indefinite term
     IN int8* Buffer,
-    OUT PSIZE_T WrittenBytes
+    OUT PSIZE_T WrittenBytes,
+    IN BOOLEAN NoCache
     )
 {
     if(!ExtInfo || !ExtInfo->Mapping)
@@ -3311,7 +3320,11 @@ UDFWriteExtent(
         }
         ASSERT(to_write);
 //        if(!prepare) {
-        status = UDFWriteData(Vcb, TRUE, ( ((uint64)Lba) << Vcb->BlockSizeBits) + sect_offs, to_write, Direct, Buffer, &_WrittenBytes);
+        if(NoCache && !Direct) {
+            status = UDFWriteDataNoCache(Vcb, ( ((uint64)Lba) << Vcb->BlockSizeBits) + sect_offs, to_write, Buffer, &_WrittenBytes);
+        } else {
+            status = UDFWriteData(Vcb, TRUE, ( ((uint64)Lba) << Vcb->BlockSizeBits) + sect_offs, to_write, Direct, Buffer, &_WrittenBytes);
+        }
         *WrittenBytes += _WrittenBytes;
         if(!OS_SUCCESS(status)) return status;
 /*        } else {
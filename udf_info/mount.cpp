@@ -35,6 +35,22 @@
 
 #define         UDF_BUG_CHECK_ID                UDF_FILE_UDF_INFO_MOUNT
 #define         MRW_DMA_OFFSET           0x500
+// max distance between anchor candidates fetched with a single request
+#define         UDF_ANCHOR_PROBE_RUN     16
+// VRS area probed by UDFFindVRS(): FirstLBA+0x10 ... FirstLBA+0x20
+#define         UDF_VRS_PROBE_BLOCKS     (0x20 - 0x10 + 1)
+// max length of a single mount-time prefetch request
+#define         UDF_MOUNT_PREFETCH_MAX   64
+
+#define UDFMountPhaseStart(t) \
+    KeQuerySystemTime((PLARGE_INTEGER)&(t))
+
+#define UDFMountPhaseEnd(Vcb, ph, t) \
+{ \
+    LONGLONG _t1; \
+    KeQuerySystemTime((PLARGE_INTEGER)&_t1); \
+    (Vcb)->MountPhaseTime[ph] += _t1 - (t); \
+}
 
 OSSTATUS
 __fastcall
@@ -181,6 +197,208 @@ UDFPrepareXSpaceBitmap(
     return STATUS_SUCCESS;
 } // end UDFPrepareXSpaceBitmap()
 
+#define UDFXSpaceBitmapRecorded(xsbm) \
+    (!((xsbm).extLength) || (((xsbm).extLength >> 30) == EXTENT_RECORDED_ALLOCATED))
+
+/*
+    This routine marks blocks containing BAD sectors as used in FSBM.
+    Returns STATUS_INSUFFICIENT_RESOURCES if FSBM can't be updated,
+    bitmaps must not be written in this case (BAD blocks would be
+    recorded as free)
+ */
+OSSTATUS
+UDFMarkBadBitsAsUsed(
+    IN PVCB Vcb,
+    IN uint32 pstart,
+    IN uint32 pend,
+    IN uint32 d
+    )
+{
+    uint32 i, lb;
+    PUDF_SPARSE_BITMAP bad_bm = &(Vcb->BSBM_Bitmap);
+    PUDF_SPARSE_BITMAP new_bm = &(Vcb->FSBM_Bitmap);
+
+    if(!UDFSparseBitmapInited(bad_bm))
+        return STATUS_SUCCESS;
+    // regions of good blocks are skipped as a whole
+    for(i=pstart; (i = UDFSparseFindNextSet(bad_bm, i, pend)) < pend; i = lb+d) {
+        // logical blocks are counted from partition start, which is
+        // not necessary LBlock-aligned
+        lb = pstart + ((i - pstart) & ~(d-1));
+        // TODO: would be nice to add these blocks to unallocatable space
+        if(!UDFSparseSetUsedBits(new_bm, lb, min(d, pend - lb))) {
+            UDFPrint(("Can't mark BB @%x as used in FSBM\n", lb));
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        UDFSetBitmapDirty(Vcb, lb, min(d, pend - lb));
+    }
+    return STATUS_SUCCESS;
+} // end UDFMarkBadBitsAsUsed()
+
+/*
+    This routine writes back only those blocks of recorded Freed or
+    Unallocated space bitmap, that describe FSBM chunks modified since
+    last flush
+ */
+OSSTATUS
+UDFUpdateXSpaceBitmapBlocks(
+    IN PVCB Vcb,
+    IN PSHORT_AD XSpaceBitmap,
+    IN uint32 pstart,
+    IN uint32 pend
+    )
+{
+    uint32 i, j, jb, je, k, ob, d;
+    uint32 BS, BSh, XSl, nbits, blen;
+    uint32 RefPartNum;
+    uint32 N, O;
+    uint32* w;
+    int8* buf;
+    PUDF_SPARSE_BITMAP new_bm = &(Vcb->FSBM_Bitmap);
+    PUDF_SPARSE_BITMAP old_bm = &(Vcb->FSBM_OldBitmap);
+    EXTENT_MAP TmpExt;
+    EXTENT_INFO ExtInfo;
+    lb_addr locAddr;
+    OSSTATUS status = STATUS_SUCCESS;
+    SIZE_T ReadBytes, WrittenBytes;
+
+    if(!(XSpaceBitmap->extLength))
+        return STATUS_SUCCESS;
+
+    BS = Vcb->BlockSize;
+    BSh = Vcb->BlockSizeBits;
+    d = 1 << Vcb->LB2B_Bits;
+
+    // use the same geometry as UDFPrepareXSpaceBitmap() does
+    RefPartNum = Vcb->PartitionMaps - 1;
+    XSl = sizeof(SPACE_BITMAP_DESC) +
+          ((UDFPartStart(Vcb, RefPartNum) + UDFPartLen(Vcb, RefPartNum) + 7) >> 3);
+    XSl = min(XSpaceBitmap->extLength, XSl);
+    if(XSl <= sizeof(SPACE_BITMAP_DESC))
+        return STATUS_SUCCESS;
+    nbits = (XSl - sizeof(SPACE_BITMAP_DESC)) << 3;
+
+    locAddr.partitionReferenceNum = (uint16)RefPartNum;
+    locAddr.logicalBlockNum = XSpaceBitmap->extPosition;
+    TmpExt.extLength = XSpaceBitmap->extLength;
+    TmpExt.extLocation = UDFPartLbaToPhys(Vcb, &locAddr);
+    if(TmpExt.extLocation == LBA_OUT_OF_EXTENT) {
+        BrutePoint();
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+    ExtInfo.Mapping = UDFExtentToMapping(&TmpExt);
+    if(!ExtInfo.Mapping)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    ExtInfo.Offset = 0;
+    ExtInfo.Length = XSl;
+
+    buf = (int8*)DbgAllocatePool(NonPagedPool, BS);
+    if(!buf) {
+        MyFreePool__(ExtInfo.Mapping);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for(k=0; (k << BSh) < XSl; k++) {
+        // on-disk bits [jb, je) are stored in k-th block of the extent
+        jb = k << (BSh+3);
+        jb = (jb > (sizeof(SPACE_BITMAP_DESC)<<3)) ? (jb - (sizeof(SPACE_BITMAP_DESC)<<3)) : 0;
+        je = ((k+1) << (BSh+3)) - (sizeof(SPACE_BITMAP_DESC)<<3);
+        je = min(je, nbits);
+        je = min(je, (pend - pstart + d - 1) / d);
+        if(jb >= je)
+            break;
+
+        // skip block if none of FSBM chunks described by it was modified.
+        // Last on-disk bit may describe partial logical block, so the
+        // range may end beyond pend
+        if(!UDFIsBitmapRangeDirty(Vcb, pstart + jb*d, (je - jb)*d))
+            continue;
+
+        blen = min(BS, XSl - (k << BSh));
+        status = UDFReadExtent(Vcb, &ExtInfo, (int64)k << BSh, blen, FALSE, buf, &ReadBytes);
+        if(!OS_SUCCESS(status))
+            break;
+
+        for(j=jb; j<je; ) {
+            ob = (sizeof(SPACE_BITMAP_DESC)<<3) + j - (k << (BSh+3));
+            i = pstart + j*d;
+            if((d == 1) && !(ob & 31) && (je - j >= 32)) {
+                // deallocated during last session -> free, allocated -> used
+                N = UDFSparseGetWord(new_bm, i);
+                O = UDFSparseGetWord(old_bm, i);
+                w = &(((uint32*)buf)[ob>>5]);
+                *w = N & (*w | ~O);
+                j += 32;
+                continue;
+            }
+            if(UDFSparseGetUsedBit(old_bm, i) && UDFSparseGetFreeBit(new_bm, i)) {
+                UDFSetFreeBit(buf, ob);
+            } else if(UDFSparseGetUsedBit(new_bm, i)) {
+                UDFSetUsedBit(buf, ob);
+            }
+            j++;
+        }
+
+        status = UDFWriteExtent(Vcb, &ExtInfo, (int64)k << BSh, blen, FALSE, buf, &WrittenBytes);
+        if(!OS_SUCCESS(status))
+            break;
+    }
+
+    DbgFreePool(buf);
+    MyFreePool__(ExtInfo.Mapping);
+    return status;
+} // end UDFUpdateXSpaceBitmapBlocks()
+
+/*
+    This routine writes two-level bitmap to the extent starting from
+    its first bit. Mixed leaves are written directly, uniform ones are
+    expanded block by block
+ */
+OSSTATUS
+UDFWriteSparseBitmapExtent(
+    IN PVCB Vcb,
+    IN PEXTENT_INFO ExtInfo,
+    IN int64 Offset,
+    IN uint32 Length,
+    IN PUDF_SPARSE_BITMAP bm
+    )
+{
+    uint32 l, k, len, blen;
+    uint32 BS = min(Vcb->BlockSize, UDF_SBM_LEAF_BITS/8);
+    uint32* leaf;
+    int8* fill = NULL;
+    OSSTATUS status = STATUS_SUCCESS;
+    SIZE_T WrittenBytes;
+
+    if(!bm->Leaf)
+        return STATUS_INVALID_PARAMETER;
+    for(l=0; (l < bm->LeafCount) && Length; l++) {
+        len = min(UDF_SBM_LEAF_BITS/8, Length);
+        leaf = bm->Leaf[l];
+        if(leaf > UDF_SBM_LEAF_ALL_SET) {
+            status = UDFWriteExtent(Vcb, ExtInfo, Offset, len, FALSE, (int8*)leaf, &WrittenBytes);
+        } else {
+            if(!fill) {
+                fill = (int8*)DbgAllocatePool(NonPagedPool, BS);
+                if(!fill)
+                    return STATUS_INSUFFICIENT_RESOURCES;
+            }
+            RtlFillMemory(fill, BS, (leaf == UDF_SBM_LEAF_ALL_SET) ? 0xff : 0x00);
+            for(k=0; (k < len) && OS_SUCCESS(status); k += blen) {
+                blen = min(BS, len - k);
+                status = UDFWriteExtent(Vcb, ExtInfo, Offset+k, blen, FALSE, fill, &WrittenBytes);
+            }
+        }
+        if(!OS_SUCCESS(status))
+            break;
+        Offset += len;
+        Length -= len;
+    }
+    if(fill)
+        DbgFreePool(fill);
+    return status;
+} // end UDFWriteSparseBitmapExtent()
+
 /*
     This routine updates Freed & Unallocated space bitmaps
  */
@@ -193,9 +411,8 @@ UDFUpdateXSpaceBitmaps(
 {
     uint32 i,j,d;
     uint32 plen, pstart, pend;
-    int8* bad_bm;
-    int8* old_bm;
-    int8* new_bm;
+    PUDF_SPARSE_BITMAP old_bm;
+    PUDF_SPARSE_BITMAP new_bm;
     int8* fpart_bm;
     int8* upart_bm;
     OSSTATUS status, status2;
@@ -208,6 +425,26 @@ UDFUpdateXSpaceBitmaps(
     UDF_CHECK_BITMAP_RESOURCE(Vcb);
 
     plen = UDFPartLen(Vcb, RefPartNum);
+
+    if(!Vcb->FSBM_AllDirty && Vcb->FSBM_DirtyMap &&
+       UDFXSpaceBitmapRecorded(phd->unallocatedSpaceBitmap) &&
+       UDFXSpaceBitmapRecorded(phd->freedSpaceBitmap)) {
+        // both bitmaps are already recorded and we know which parts
+        // of FSBM were changed since last flush, so update only
+        // affected blocks instead of reading & writing whole bitmaps
+        pstart = UDFPartStart(Vcb, RefPartNum);
+        pend = min(pstart + plen, Vcb->FSBM_BitCount);
+        d = 1 << Vcb->LB2B_Bits;
+        status = UDFMarkBadBitsAsUsed(Vcb, pstart, pend, d);
+        if(!OS_SUCCESS(status))
+            return status;
+        status  = UDFUpdateXSpaceBitmapBlocks(Vcb, &(phd->unallocatedSpaceBitmap), pstart, pend);
+        status2 = UDFUpdateXSpaceBitmapBlocks(Vcb, &(phd->freedSpaceBitmap), pstart, pend);
+        if(!OS_SUCCESS(status))
+            return status;
+        return status2;
+    }
+
     // prepare bitmaps for updating
 
     status =  UDFPrepareXSpaceBitmap(Vcb, &(phd->unallocatedSpaceBitmap), &USBMExtInfo, &USBM, &USl);
@@ -218,16 +455,15 @@ UDFUpdateXSpaceBitmaps(
     }
 
     pstart = UDFPartStart(Vcb, RefPartNum);
-    new_bm = Vcb->FSBM_Bitmap;
-    old_bm = Vcb->FSBM_OldBitmap;
-    bad_bm = Vcb->BSBM_Bitmap;
+    new_bm = &(Vcb->FSBM_Bitmap);
+    old_bm = &(Vcb->FSBM_OldBitmap);
 
     if((status  == STATUS_INSUFFICIENT_RESOURCES) ||
        (status2 == STATUS_INSUFFICIENT_RESOURCES)) {
         // try to recover insufficient resources
         if(USl && USBMExtInfo.Mapping) {
             USl -= sizeof(SPACE_BITMAP_DESC);
-            status  = UDFWriteExtent(Vcb, &USBMExtInfo, sizeof(SPACE_BITMAP_DESC), USl, FALSE, new_bm, &WrittenBytes);
+            status  = UDFWriteSparseBitmapExtent(Vcb, &USBMExtInfo, sizeof(SPACE_BITMAP_DESC), USl, new_bm);
 #ifdef UDF_DBG
         } else {
             UDFPrint(("Can't update USBM\n"));
@@ -237,7 +473,7 @@ UDFUpdateXSpaceBitmaps(
 
         if(FSl && FSBMExtInfo.Mapping) {
             FSl -= sizeof(SPACE_BITMAP_DESC);
-            status2 = UDFWriteExtent(Vcb, &FSBMExtInfo, sizeof(SPACE_BITMAP_DESC), FSl, FALSE, new_bm, &WrittenBytes);
+            status2 = UDFWriteSparseBitmapExtent(Vcb, &FSBMExtInfo, sizeof(SPACE_BITMAP_DESC), FSl, new_bm);
         } else {
             status2 = status;
             UDFPrint(("Can't update FSBM\n"));
@@ -251,21 +487,25 @@ UDFUpdateXSpaceBitmaps(
 
         d=1<<Vcb->LB2B_Bits;
         // if we have some bad bits, mark corresponding area as BAD
-        if(bad_bm) {
-            for(i=pstart; i<pend; i++) {
-                if(UDFGetBadBit(bad_bm, i)) {
-                    // TODO: would be nice to add these blocks to unallocatable space
-                    UDFSetUsedBits(new_bm, i & ~(d-1), d);
-                }
+        status = UDFMarkBadBitsAsUsed(Vcb, pstart, pend, d);
+        if(!OS_SUCCESS(status)) {
+            if(USBM) {
+                DbgFreePool(USBM);
+                MyFreePool__(USBMExtInfo.Mapping);
             }
+            if(FSBM) {
+                DbgFreePool(FSBM);
+                MyFreePool__(FSBMExtInfo.Mapping);
+            }
+            return status;
         }
         j=0;
         for(i=pstart; i<pend; i+=d) {
-            if(UDFGetUsedBit(old_bm, i) && UDFGetFreeBit(new_bm, i)) {
+            if(UDFSparseGetUsedBit(old_bm, i) && UDFSparseGetFreeBit(new_bm, i)) {
                 // sector was deallocated during last session
                 if(USBM) UDFSetFreeBit(upart_bm, j);
                 if(FSBM) UDFSetFreeBit(fpart_bm, j);
-            } else if(UDFGetUsedBit(new_bm, i)) {
+            } else if(UDFSparseGetUsedBit(new_bm, i)) {
                 // allocated
                 if(USBM) UDFSetUsedBit(upart_bm, j);
                 if(FSBM) UDFSetUsedBit(fpart_bm, j);
@@ -864,7 +1104,7 @@ UDFUpdateNonAllocated(
     uint32 RefPartNum;
     uint32 i;
     uint32 plen, pstart, pend;
-    int8* bad_bm;
+    PUDF_SPARSE_BITMAP bad_bm = &(Vcb->BSBM_Bitmap);
     EXTENT_AD Ext;
     PEXTENT_MAP Map = NULL;
     PEXTENT_INFO DataLoc;
@@ -873,7 +1113,7 @@ UDFUpdateNonAllocated(
     if(!Vcb->NonAllocFileInfo) {
         return STATUS_SUCCESS;
     }
-    if(!(bad_bm = Vcb->BSBM_Bitmap)) {
+    if(!UDFSparseBitmapInited(bad_bm)) {
         return STATUS_SUCCESS;
     }
 
@@ -889,9 +1129,7 @@ UDFUpdateNonAllocated(
     pend = min(pstart + plen, Vcb->FSBM_BitCount);
 
     //BrutePoint();
-    for(i=pstart; i<pend; i++) {
-        if(!UDFGetBadBit(bad_bm, i))
-            continue;
+    for(i=pstart; (i = UDFSparseFindNextSet(bad_bm, i, pend)) < pend; i++) {
         // add BAD blocks to unallocatable space
         // if the block is already in NonAllocatable, ignore it
         if(UDFLocateLbaInExtent(Vcb, DataLoc->Mapping, i) != LBA_OUT_OF_EXTENT) {
@@ -917,6 +1155,78 @@ UDFUpdateNonAllocated(
     return STATUS_SUCCESS;
 } // end UDFUpdateNonAllocated()
 
+/*
+    This routine drops dirty marks from FSBM chunks, that are equal to
+    their last flushed state. Returns TRUE if any chunk remains dirty
+ */
+BOOLEAN
+UDFTrimBitmapDirtyMap(
+    IN PVCB Vcb
+    )
+{
+    uint32 c, off, len;
+    uint32 csh = Vcb->FSBM_DirtyChunkSh;
+    BOOLEAN dirty = FALSE;
+
+    for(c=0; c<Vcb->FSBM_DirtyChunks; c++) {
+        if(!(c & 31) && !(Vcb->FSBM_DirtyMap[c>>5])) {
+            c += 31;
+            continue;
+        }
+        if(!UDFGetBit(Vcb->FSBM_DirtyMap, c))
+            continue;
+        off = c << csh;
+        if(off >= Vcb->FSBM_BitCount) {
+            UDFClrBit(Vcb->FSBM_DirtyMap, c);
+            continue;
+        }
+        len = min((uint32)1 << csh, Vcb->FSBM_BitCount - off);
+        if(UDFSparseCompareBits(&(Vcb->FSBM_Bitmap), &(Vcb->FSBM_OldBitmap), off, len)) {
+            UDFClrBit(Vcb->FSBM_DirtyMap, c);
+        } else {
+            dirty = TRUE;
+        }
+    }
+    return dirty;
+} // end UDFTrimBitmapDirtyMap()
+
+/*
+    This routine makes FSBM state recorded on disk the new reference
+    for the next flush and resets dirty tracking
+ */
+void
+UDFSyncOldBitmap(
+    IN PVCB Vcb
+    )
+{
+    uint32 c, off;
+    uint32 csh;
+    BOOLEAN ok = TRUE;
+
+    if(Vcb->FSBM_AllDirty || !Vcb->FSBM_DirtyMap) {
+        ok = UDFSparseCopyBits(&(Vcb->FSBM_OldBitmap), &(Vcb->FSBM_Bitmap), 0, Vcb->FSBM_BitCount);
+    } else {
+        csh = Vcb->FSBM_DirtyChunkSh;
+        for(c=0; c<Vcb->FSBM_DirtyChunks; c++) {
+            if(!UDFGetBit(Vcb->FSBM_DirtyMap, c))
+                continue;
+            off = c << csh;
+            if(off >= Vcb->FSBM_BitCount)
+                break;
+            if(!UDFSparseCopyBits(&(Vcb->FSBM_OldBitmap), &(Vcb->FSBM_Bitmap), off,
+                                  min((uint32)1 << csh, Vcb->FSBM_BitCount - off))) {
+                ok = FALSE;
+                break;
+            }
+        }
+    }
+    if(Vcb->FSBM_DirtyMap) {
+        RtlZeroMemory(Vcb->FSBM_DirtyMap, ((Vcb->FSBM_DirtyChunks+31)>>5)*sizeof(uint32));
+        // copy is partially updated, compare whole bitmap next time
+        Vcb->FSBM_AllDirty = !ok;
+    }
+} // end UDFSyncOldBitmap()
+
 /*
     This routine rebuilds & flushes all system areas
  */
@@ -968,7 +1278,14 @@ UDFUmount__(
 
     UDF_CHECK_BITMAP_RESOURCE(Vcb);
     // check if we should update BM
-    if(Vcb->FSBM_ByteCount == RtlCompareMemory(Vcb->FSBM_Bitmap, Vcb->FSBM_OldBitmap, Vcb->FSBM_ByteCount)) {
+    if(!Vcb->FSBM_AllDirty && Vcb->FSBM_DirtyMap) {
+        if(UDFTrimBitmapDirtyMap(Vcb)) {
+            flags |= 1;
+        } else {
+            flags &= ~1;
+        }
+    } else
+    if(UDFSparseCompareBits(&(Vcb->FSBM_Bitmap), &(Vcb->FSBM_OldBitmap), 0, Vcb->FSBM_BitCount)) {
         flags &= ~1;
     } else {
         flags |= 1;
@@ -990,7 +1307,7 @@ UDFUmount__(
     }
 
     if(flags & 1)
-        RtlCopyMemory(Vcb->FSBM_OldBitmap, Vcb->FSBM_Bitmap, Vcb->FSBM_ByteCount);
+        UDFSyncOldBitmap(Vcb);
 
 //skip_update_bitmap:
 
@@ -1006,7 +1323,10 @@ UDFUmount__(
 /*
     Find an anchor volume descriptor.
     The UDFGetDiskInfoAndVerify() will invoke this routine to find & check
-    Anchor Volume Descriptors on the target device
+    Anchor Volume Descriptors on the target device.
+    Neighbouring candidates are fetched with coalesced multi-block requests
+    first, results are still checked in priority order. Candidates which
+    can't be fetched this way are read one by one as before.
 */
 lba_t
 UDFFindAnchor(
@@ -1016,10 +1336,16 @@ UDFFindAnchor(
 //    OSSTATUS    RC = STATUS_SUCCESS;
 
     uint16 ident;
-    uint32 i;
+    uint32 i, j, k, n;
     uint32 LastBlock;
     OSSTATUS status;
     int8* Buf = (int8*)MyAllocatePool__(NonPagedPool,Vcb->BlockSize);
+    int8* RunBuf;
+    int8* Prefetched;
+    uint32 Order[MAX_ANCHOR_LOCATIONS];
+    BOOLEAN Loaded[MAX_ANCHOR_LOCATIONS];
+    uint32 RunStart, RunLen;
+    SIZE_T ReadBytes;
     BOOLEAN MRW_candidate;
     BOOLEAN IsMRW = (Vcb->MRWStatus != 0);
     if(!Buf)
@@ -1043,16 +1369,58 @@ UDFFindAnchor(
 //    Vcb->Anchor[8] = Vcb->LastLBA - 512 - 2;
 //    Vcb->Anchor[9] = Vcb->LastLBA - 512 - 7;
 
-    LastBlock = 0;
-    // ... and check them
-    for (i=0; i<sizeof(Vcb->Anchor)/sizeof(int); i++) {
+    // ... fetch them with as few requests as possible ...
+    RtlZeroMemory(Loaded, sizeof(Loaded));
+    n = 0;
+    for (i=0; i<MAX_ANCHOR_LOCATIONS; i++) {
         if(Vcb->Anchor[i] > Vcb->LastLBA)
             Vcb->Anchor[i] = 0;
+        if(!Vcb->Anchor[i])
+            continue;
+        // insertion sort by location
+        for(j=n; j && (Vcb->Anchor[Order[j-1]] > Vcb->Anchor[i]); j--)
+            Order[j] = Order[j-1];
+        Order[j] = i;
+        n++;
+    }
+    Prefetched = (int8*)MyAllocatePool__(NonPagedPool, MAX_ANCHOR_LOCATIONS << Vcb->BlockSizeBits);
+    RunBuf = (int8*)MyAllocatePool__(NonPagedPool, UDF_ANCHOR_PROBE_RUN << Vcb->BlockSizeBits);
+    if(Prefetched && RunBuf) {
+        for(i=0; i<n; i=j) {
+            RunStart = Vcb->Anchor[Order[i]];
+            for(j=i+1; (j<n) && (Vcb->Anchor[Order[j]] - RunStart < UDF_ANCHOR_PROBE_RUN); j++);
+            // a lonely candidate is read by UDFReadTagged() below
+            if(j-i < 2)
+                continue;
+            RunLen = Vcb->Anchor[Order[j-1]] - RunStart + 1;
+            UDFPrint(("prefetch Anchors %x-%x\n", RunStart, RunStart+RunLen-1));
+            if(!OS_SUCCESS(UDFReadSectors(Vcb, FALSE, RunStart, RunLen, FALSE, RunBuf, &ReadBytes)))
+                continue;
+            for(k=i; k<j; k++) {
+                RtlCopyMemory(Prefetched + (Order[k] << Vcb->BlockSizeBits),
+                              RunBuf + ((Vcb->Anchor[Order[k]] - RunStart) << Vcb->BlockSizeBits),
+                              Vcb->BlockSize);
+                Loaded[Order[k]] = TRUE;
+            }
+        }
+    }
+    if(RunBuf)
+        MyFreePool__(RunBuf);
+
+    LastBlock = 0;
+    // ... and check them
+    for (i=0; i<MAX_ANCHOR_LOCATIONS; i++) {
         MRW_candidate = FALSE;
         if(Vcb->Anchor[i]) {
             UDFPrint(("check Anchor %x\n", Vcb->Anchor[i]));
-            if(!OS_SUCCESS(status = UDFReadTagged(Vcb,Buf,
-                Vcb->Anchor[i], Vcb->Anchor[i], &ident))) {
+            if(Loaded[i]) {
+                status = UDFCheckTagged(Vcb, Prefetched + (i << Vcb->BlockSizeBits),
+                    Vcb->Anchor[i], Vcb->Anchor[i], &ident);
+            } else {
+                status = UDFReadTagged(Vcb,Buf,
+                    Vcb->Anchor[i], Vcb->Anchor[i], &ident);
+            }
+            if(!OS_SUCCESS(status)) {
 
                 // Fucking MRW...
                 if(!IsMRW && (i<2) &&
@@ -1086,6 +1454,8 @@ MRW_workaround:
                         ASSERT(Vcb->LastReadTrack == 1);
                         Vcb->TrackMap[Vcb->LastReadTrack].Flags |= TrackMap_FixMRWAddressing;
                         WCachePurgeAll__(&(Vcb->FastCache), Vcb);
+                        // prefetched blocks were read with old addressing
+                        RtlZeroMemory(Loaded, sizeof(Loaded));
                         UDFPrint(("UDF: MRW on non-MRW drive => ReadOnly"));
                         Vcb->VCBFlags |= VCB_STATE_VOLUME_READ_ONLY;
 
@@ -1098,12 +1468,16 @@ MRW_workaround:
     }
 
     UDFPrint(("UDF: -----------------\nUDF: Last block %x\n",LastBlock));
+    if(Prefetched)
+        MyFreePool__(Prefetched);
     MyFreePool__(Buf);
     return LastBlock;
 } // end UDFFindAnchor()
 
 /*
-    Look for Volume recognition sequence
+    Look for Volume recognition sequence.
+    The whole VRS area is read with a single request, per-block reads
+    are used only if it fails (e.g. on partially recorded media).
  */
 uint32
 UDFFindVRS(
@@ -1115,23 +1489,36 @@ UDFFindVRS(
     uint32       retStat = 0;
     uint32       BeginOffset = Vcb->FirstLBA;
     OSSTATUS     RC;
-    int8*        buffer = (int8*)MyAllocatePool__(NonPagedPool,Vcb->BlockSize);
+    int8*        buffer;
     SIZE_T       ReadBytes;
+    BOOLEAN      Coalesced = FALSE;
 
-    if(!buffer) return 0;
     // Relative to First LBA in Last Session
     offset = Vcb->FirstLBA + 0x10;
 
     UDFPrint(("UDFFindVRS:\n"));
 
+    buffer = (int8*)MyAllocatePool__(NonPagedPool, UDF_VRS_PROBE_BLOCKS << Vcb->BlockSizeBits);
+    if(buffer) {
+        RC = UDFReadSectors(Vcb, FALSE, offset, UDF_VRS_PROBE_BLOCKS, FALSE, buffer, &ReadBytes);
+        Coalesced = OS_SUCCESS(RC);
+    } else {
+        buffer = (int8*)MyAllocatePool__(NonPagedPool,Vcb->BlockSize);
+        if(!buffer) return 0;
+    }
+
     // Process the sequence (if applicable)
     for (;(offset-BeginOffset <=0x20); offset ++) {
-        // Read a block
-        RC = UDFReadSectors(Vcb, FALSE, offset, 1, FALSE, buffer, &ReadBytes);
-        if(!OS_SUCCESS(RC)) continue;
+        if(Coalesced) {
+            vsd = (VolStructDesc *)(buffer + ((offset - BeginOffset - 0x10) << Vcb->BlockSizeBits));
+        } else {
+            // Read a block
+            RC = UDFReadSectors(Vcb, FALSE, offset, 1, FALSE, buffer, &ReadBytes);
+            if(!OS_SUCCESS(RC)) continue;
+            vsd = (VolStructDesc *)(buffer);
+        }
 
         // Look for ISO descriptors
-        vsd = (VolStructDesc *)(buffer);
 
         if(vsd->stdIdent[0]) {
             if(!strncmp((int8*)(&vsd->stdIdent), STD_ID_CD001, STD_ID_LEN))
@@ -1381,6 +1768,7 @@ UDFLoadLogicalVol(
     uint16 i, offset;
     uint8 type;
     OSSTATUS status = STATUS_SUCCESS;
+    LONGLONG PhaseStart;
     UDFPrint(("UDF: LogicalVolDesc\n"));
     // Validate partition map counter
     if(!(Vcb->Partitions)) {
@@ -1462,7 +1850,9 @@ UDFLoadLogicalVol(
                 UDFPrint(("Load sparing table\n"));
                 PSPARABLE_PARTITION_MAP spm = (PSPARABLE_PARTITION_MAP)(((uint8*)(lvd+1))+offset);
                 Vcb->Partitions[i].PartitionType = UDF_SPARABLE_MAP15;
+                UDFMountPhaseStart(PhaseStart);
                 status = UDFLoadSparingTable(Vcb, spm);
+                UDFMountPhaseEnd(Vcb, UDF_MOUNT_PHASE_SPARING, PhaseStart);
             }
             else if(!strncmp((int8*)&(upm2->partIdent.ident), UDF_ID_METADATA, strlen(UDF_ID_METADATA)))
             {
@@ -1491,8 +1881,11 @@ UDFLoadLogicalVol(
     }
     if(OS_SUCCESS(status)) {
         // load Integrity Desc if any
-        if(lvd->integritySeqExt.extLength)
+        if(lvd->integritySeqExt.extLength) {
+            UDFMountPhaseStart(PhaseStart);
             status = UDFLoadLogicalVolInt(DeviceObject,Vcb,lvd->integritySeqExt);
+            UDFMountPhaseEnd(Vcb, UDF_MOUNT_PHASE_LVID, PhaseStart);
+        }
     }
     return status;
 } // end UDFLoadLogicalVol()
@@ -1617,35 +2010,32 @@ err_addxsbm_1:
         j = 0;
         for(;(l = UDFGetBitmapLen((uint32*)tmp_bm, j, lim2)) && (i<lim);) {
             // expand LBlocks to Sectors...
-            l2 = l << Vcb->LB2B_Bits;
+            l2 = min(l << Vcb->LB2B_Bits, lim - i);
             // ...and mark them
             if(bm_type == UDF_FSPACE_BM) {
                 bit_set = UDFGetFreeBit(tmp_bm, j);
-                for(k=0;(k<l2) && (i<lim);k++) {
-                    if(bit_set) {
-                        // FREE block
-                        UDFSetFreeBit(Vcb->FSBM_Bitmap, i);
-                        UDFSetFreeBitOwner(Vcb, i);
-                        UDFSetZeroBit(Vcb->ZSBM_Bitmap, i);
-                    } else {
-                        // USED block
-                        UDFClrZeroBit(Vcb->ZSBM_Bitmap, i);
+                if(bit_set) {
+                    // FREE blocks
+                    UDFSparseSetFreeBits(&(Vcb->FSBM_Bitmap), i, l2);
+                    for(k=0;k<l2;k++) {
+                        UDFSetFreeBitOwner(Vcb, i+k);
                     }
-                    i++;
+                    UDFSparseSetZeroBits(&(Vcb->ZSBM_Bitmap), i, l2);
+                } else {
+                    // USED blocks
+                    UDFSparseClrZeroBits(&(Vcb->ZSBM_Bitmap), i, l2);
                 }
             } else {
                 bit_set = UDFGetZeroBit(tmp_bm, j);
-                for(k=0;(k<l2) && (i<lim);k++) {
-                    if(bit_set) {
-                        // ZERO block
-                        UDFSetZeroBit(Vcb->ZSBM_Bitmap, i);
-                    } else {
-                        // DATA block
-                        UDFClrZeroBit(Vcb->ZSBM_Bitmap, i);
-                    }
-                    i++;
+                if(bit_set) {
+                    // ZERO blocks
+                    UDFSparseSetZeroBits(&(Vcb->ZSBM_Bitmap), i, l2);
+                } else {
+                    // DATA blocks
+                    UDFSparseClrZeroBits(&(Vcb->ZSBM_Bitmap), i, l2);
                 }
             }
+            i += l2;
             j += l;
         }
         DbgFreePool(tmp);
@@ -1832,6 +2222,7 @@ UDFVerifyFreeSpaceBitmap(
     lb_addr locAddr;
 
     UDFPrint(("UDFVerifyFreeSpaceBitmap:\n"));
+    Vcb->FSBM_FreeCountValid = FALSE;
     // read info for partition header (if any)
     if(phd) {
         // read unallocated Bitmap
@@ -1922,35 +2313,65 @@ UDFBuildFreeSpaceBitmap(
     PEXTENT_MAP Extent;
     lb_addr locAddr;
     BOOLEAN UnallocSpaceExtent = FALSE;
+    BOOLEAN Collapse;
+
+#ifndef UDF_CHECK_DISK_ALLOCATION
+    // r/o volume doesn't need FSBM until someone asks for free space
+    // (or VAT is loaded), so just remember where it comes from
+    if((Vcb->FSBM_LazyState == UDF_FSBM_NOT_DEFERRED) &&
+       !UDFSparseBitmapInited(&(Vcb->FSBM_Bitmap)) &&
+       (Vcb->VCBFlags & (VCB_STATE_VOLUME_READ_ONLY | VCB_STATE_MEDIA_WRITE_PROTECT))) {
+        UDFPrint(("UDF: defer FSBM loading\n"));
+        Vcb->FSBM_LazyState = UDF_FSBM_DEFERRED;
+        // WCache must not treat any block as free
+        Vcb->VCBFlags |= UDF_VCB_ASSUME_ALL_USED;
+    }
+    if(Vcb->FSBM_LazyState == UDF_FSBM_DEFERRED) {
+        if(Vcb->FSBM_DeferredCount < UDF_FSBM_MAX_DEFERRED) {
+            i = Vcb->FSBM_DeferredCount++;
+            Vcb->FSBM_Deferred[i].RefPartNum = RefPartNum;
+            Vcb->FSBM_Deferred[i].Lba = Lba;
+            Vcb->FSBM_Deferred[i].HasPhd = (phd != NULL);
+            if(phd)
+                Vcb->FSBM_Deferred[i].phd = *phd;
+            return STATUS_SUCCESS;
+        }
+        // too many pieces, load all now
+        if(!OS_SUCCESS(status = UDFLoadDeferredFreeSpaceBitmap(Vcb)))
+            return status;
+    }
+#endif //UDF_CHECK_DISK_ALLOCATION
+
+    // free block counters are rebuilt on demand, see UDFGetPartFreeSpace()
+    Vcb->FSBM_FreeCountValid = FALSE;
+    if(!UDFSparseBitmapInited(&(Vcb->FSBM_Bitmap))) {
+        // init Bitmap buffer if necessary. All blocks are initially used.
+        // Uniform leaves may be released only while nobody else looks at
+        // the bitmaps (mount), deferred FSBM is built on a live volume.
+        // See also UDFGetDiskInfoAndVerify()
+        Collapse = (Vcb->FSBM_LazyState != UDF_FSBM_LOADED);
+        i = Vcb->LastPossibleLBA+1;
+        if(!OS_SUCCESS(UDFSparseBitmapInit(&(Vcb->FSBM_Bitmap), i, NonPagedPool, Collapse)))
+            return STATUS_INSUFFICIENT_RESOURCES;
 
-    if(!(Vcb->FSBM_Bitmap)) {
-        // init Bitmap buffer if necessary
-        Vcb->FSBM_Bitmap = (int8*)DbgAllocatePool(NonPagedPool, (i = (Vcb->LastPossibleLBA+1+7)>>3) );
-        if(!(Vcb->FSBM_Bitmap)) return STATUS_INSUFFICIENT_RESOURCES;
-
-        Vcb->ZSBM_Bitmap = (int8*)DbgAllocatePool(NonPagedPool, (i = (Vcb->LastPossibleLBA+1+7)>>3) );
-        if(!(Vcb->ZSBM_Bitmap)) {
+        if(!OS_SUCCESS(UDFSparseBitmapInit(&(Vcb->ZSBM_Bitmap), i, NonPagedPool, Collapse))) {
 #ifdef UDF_TRACK_ONDISK_ALLOCATION_OWNERS
 free_fsbm:
 #endif //UDF_TRACK_ONDISK_ALLOCATION_OWNERS
-            MyFreePool__(Vcb->FSBM_Bitmap);
-            Vcb->FSBM_Bitmap = NULL;
+            UDFSparseBitmapFree(&(Vcb->FSBM_Bitmap));
             return STATUS_INSUFFICIENT_RESOURCES;
         }
 
-        RtlZeroMemory(Vcb->FSBM_Bitmap, i);
-        RtlZeroMemory(Vcb->ZSBM_Bitmap, i);
 #ifdef UDF_TRACK_ONDISK_ALLOCATION_OWNERS
         Vcb->FSBM_Bitmap_owners = (uint32*)DbgAllocatePool(NonPagedPool, (Vcb->LastPossibleLBA+1)*sizeof(uint32));
         if(!(Vcb->FSBM_Bitmap_owners)) {
-            MyFreePool__(Vcb->ZSBM_Bitmap);
-            Vcb->ZSBM_Bitmap = NULL;
+            UDFSparseBitmapFree(&(Vcb->ZSBM_Bitmap));
             goto free_fsbm;
         }
         RtlFillMemory(Vcb->FSBM_Bitmap_owners, (Vcb->LastPossibleLBA+1)*sizeof(uint32), 0xff);
 #endif //UDF_TRACK_ONDISK_ALLOCATION_OWNERS
-        Vcb->FSBM_ByteCount = i;
-        Vcb->FSBM_BitCount = Vcb->LastPossibleLBA+1;
+        Vcb->FSBM_ByteCount = (i+7)>>3;
+        Vcb->FSBM_BitCount = i;
     }
     // read info for partition header (if any)
     if(phd) {
@@ -2026,7 +2447,52 @@ free_fsbm:
         MyFreePool__(AllocDesc);
     }
     return status;
-} // end UDFVerifyFreeSpaceBitmap()
+} // end UDFBuildFreeSpaceBitmap()
+
+/*
+    This routine builds FreeSpaceBitmap postponed by UDFBuildFreeSpaceBitmap()
+    during mount of r/o volume. It is safe to call it any time, it does
+    nothing if FSBM is already loaded
+ */
+OSSTATUS
+UDFLoadDeferredFreeSpaceBitmap(
+    IN PVCB Vcb
+    )
+{
+    OSSTATUS status = STATUS_SUCCESS;
+    uint32 i, n;
+    ULONG Modified;
+
+    if(Vcb->FSBM_LazyState != UDF_FSBM_DEFERRED)
+        return STATUS_SUCCESS;
+
+    UDFAcquireResourceExclusive(&(Vcb->BitMapResource1),TRUE);
+    if(Vcb->FSBM_LazyState == UDF_FSBM_DEFERRED) {
+        UDFPrint(("UDF: load deferred FSBM\n"));
+        // don't let UDFBuildFreeSpaceBitmap() postpone it again
+        Vcb->FSBM_LazyState = UDF_FSBM_LOADED;
+        n = Vcb->FSBM_DeferredCount;
+        Vcb->FSBM_DeferredCount = 0;
+        // loading FSBM doesn't modify the volume
+        Modified = Vcb->Modified;
+        for(i=0; i<n; i++) {
+            status = UDFBuildFreeSpaceBitmap(Vcb, Vcb->FSBM_Deferred[i].RefPartNum,
+                                             Vcb->FSBM_Deferred[i].HasPhd ? &(Vcb->FSBM_Deferred[i].phd) : NULL,
+                                             Vcb->FSBM_Deferred[i].Lba);
+            if(!OS_SUCCESS(status)) {
+                // UDFGetPartFreeSpace() falls back to LVID without FSBM
+                UDFSparseBitmapFree(&(Vcb->FSBM_Bitmap));
+                break;
+            }
+        }
+        Vcb->Modified = Modified;
+        if(UDFSparseBitmapInited(&(Vcb->FSBM_Bitmap)))
+            Vcb->VCBFlags &= ~UDF_VCB_ASSUME_ALL_USED;
+        Vcb->BitmapModified = TRUE;
+    }
+    UDFReleaseResource(&(Vcb->BitMapResource1));
+    return status;
+} // end UDFLoadDeferredFreeSpaceBitmap()
 
 /*
     process Partition descriptor
@@ -2041,6 +2507,7 @@ UDFLoadPartDesc(
     uint32 i;
     OSSTATUS RC;
     BOOLEAN Found = FALSE;
+    LONGLONG PhaseStart;
     UDFPrint(("UDF: Pard Descr:\n"));
     UDFPrint((" volDescSeqNum   = %x\n", p->volDescSeqNum));
     UDFPrint((" partitionFlags  = %x\n", p->partitionFlags));
@@ -2099,7 +2566,9 @@ UDFLoadPartDesc(
                         phd->freedSpaceBitmap.extPosition;
                     UDFPrint(("freedSpaceBitmap (part %d)\n", i));
                 }
+                UDFMountPhaseStart(PhaseStart);
                 RC = UDFBuildFreeSpaceBitmap(Vcb, i, phd, 0);
+                UDFMountPhaseEnd(Vcb, UDF_MOUNT_PHASE_FSBM, PhaseStart);
                 //Vcb->Modified = FALSE;
                 UDFPreClrModified(Vcb);
                 UDFClrModified(Vcb);
@@ -2108,7 +2577,12 @@ UDFLoadPartDesc(
 
                 if ((Vcb->Partitions[i].PartitionType == UDF_VIRTUAL_MAP15) ||
                     (Vcb->Partitions[i].PartitionType == UDF_VIRTUAL_MAP20)) {
-                    RC = UDFLoadVAT(Vcb, i);
+                    UDFMountPhaseStart(PhaseStart);
+                    // VAT is synchronized with FSBM
+                    RC = UDFLoadDeferredFreeSpaceBitmap(Vcb);
+                    if(OS_SUCCESS(RC))
+                        RC = UDFLoadVAT(Vcb, i);
+                    UDFMountPhaseEnd(Vcb, UDF_MOUNT_PHASE_VAT, PhaseStart);
                     if(!OS_SUCCESS(RC))
                         return RC;
                     WCacheFlushAll__(&(Vcb->FastCache), Vcb);
@@ -2243,6 +2717,37 @@ UDFVerifyPartDesc(
     return STATUS_SUCCESS;
 } // end UDFVerifyPartDesc()
 
+/*
+    This routine reads a range of fs structures with a single request,
+    so that following per-block reads are served from WCache. Errors
+    are ignored here, per-block reads will report them.
+ */
+VOID
+UDFPrefetchBlocks(
+    IN PVCB Vcb,
+    IN uint32 Lba,
+    IN uint32 BCount
+    )
+{
+    int8* Buf;
+    SIZE_T ReadBytes;
+
+    if(!Vcb->FastCache.ReadProc || (BCount < 2) ||
+       (Lba > Vcb->LastLBA))
+        return;
+    if(BCount > UDF_MOUNT_PREFETCH_MAX)
+        BCount = UDF_MOUNT_PREFETCH_MAX;
+    if(BCount > Vcb->LastLBA - Lba + 1)
+        BCount = Vcb->LastLBA - Lba + 1;
+
+    Buf = (int8*)MyAllocatePool__(NonPagedPool, BCount << Vcb->BlockSizeBits);
+    if(!Buf)
+        return;
+    UDFPrint(("UDF: prefetch %x - %x\n", Lba, Lba+BCount-1));
+    UDFReadSectors(Vcb, FALSE, Lba, BCount, FALSE, Buf, &ReadBytes);
+    MyFreePool__(Buf);
+} // end UDFPrefetchBlocks()
+
 /*
     This routine scans VDS & fills special array with Desc locations
  */
@@ -2384,6 +2889,7 @@ UDFProcessSequence(
     uint32   i,j;
     uint16  ident;
     int8*  Buf2 = NULL;
+    LONGLONG PhaseStart;
 
     _SEH2_TRY {
         if(!Buf) try_return(RC = STATUS_INSUFFICIENT_RESOURCES);
@@ -2433,7 +2939,9 @@ UDFProcessSequence(
                             RC = UDFLoadPartDesc(Vcb,Buf2);
                             if(!OS_SUCCESS(RC)) try_return(RC);
                         } else if(ident == TID_UNALLOC_SPACE_DESC) {
+                            UDFMountPhaseStart(PhaseStart);
                             RC = UDFBuildFreeSpaceBitmap(Vcb,0,NULL,j);
+                            UDFMountPhaseEnd(Vcb, UDF_MOUNT_PHASE_FSBM, PhaseStart);
                             //Vcb->Modified = FALSE;
                             UDFPreClrModified(Vcb);
                             UDFClrModified(Vcb);
@@ -2650,6 +3158,13 @@ UDFLoadPartition(
             reserve_e = reserve_e >> Vcb->BlockSizeBits;
             reserve_e += reserve_s;
 
+            // Both sequences are read anyway (the reserve one is at least
+            // verified), so fetch them before parsing starts
+            if(OS_SUCCESS(UDFIsCachedBadSequence(Vcb, main_s)))
+                UDFPrefetchBlocks(Vcb, main_s, main_e - main_s);
+            if(OS_SUCCESS(UDFIsCachedBadSequence(Vcb, reserve_s)))
+                UDFPrefetchBlocks(Vcb, reserve_s, reserve_e - reserve_s);
+
             // Check if it is known bad sequence
             RC = UDFIsCachedBadSequence(Vcb, main_s);
             if(OS_SUCCESS(RC)) {
@@ -2841,6 +3356,10 @@ UDFLoadSparingTable(
         TabSize = RELOC_MAP_GRAN;
         Vcb->SparingBlockSize = PartMap->packetLength;
     }
+    // fetch all copies before parsing the 1st one
+    for(i=0;i<PartMap->numSparingTables;i++) {
+        UDFPrefetchBlocks(Vcb, ((uint32*)(PartMap+1))[i], BC);
+    }
     // walk through all available Sparing Tables
     for(i=0;i<PartMap->numSparingTables;i++) {
         // read (next) table
@@ -2977,16 +3496,24 @@ UDFGetDiskInfoAndVerify(
 
     int8*           Buf = NULL;
     SIZE_T          ReadBytes;
+    LONGLONG        PhaseStart;
+    lba_t           LastBlock;
 
     UDFPrint(("UDFGetDiskInfoAndVerify\n"));
+    RtlZeroMemory(Vcb->MountPhaseTime, sizeof(Vcb->MountPhaseTime));
     _SEH2_TRY {
 
-        if(!UDFFindAnchor(Vcb)) {
+        UDFMountPhaseStart(PhaseStart);
+        LastBlock = UDFFindAnchor(Vcb);
+        UDFMountPhaseEnd(Vcb, UDF_MOUNT_PHASE_ANCHOR, PhaseStart);
+        if(!LastBlock) {
             if(Vcb->FsDeviceType == FILE_DEVICE_CD_ROM_FILE_SYSTEM) {
                 // check if this disc is mountable for CDFS
                 UDFPrint(("   FILE_DEVICE_CD_ROM_FILE_SYSTEM\n"));
 check_NSR:
+                UDFMountPhaseStart(PhaseStart);
                 NSRDesc = UDFFindVRS(Vcb);
+                UDFMountPhaseEnd(Vcb, UDF_MOUNT_PHASE_VRS, PhaseStart);
                 if(!(NSRDesc & VRS_ISO9660_FOUND)) {
                     // no CDFS VRS found
                     UDFPrint(("UDFGetDiskInfoAndVerify: no CDFS VRS found\n"));
@@ -3020,7 +3547,9 @@ check_NSR:
             Vcb->NSRDesc = NSRDesc;
         }
 
+        UDFMountPhaseStart(PhaseStart);
         RC = UDFLoadPartition(DeviceObject,Vcb,&fileset);
+        UDFMountPhaseEnd(Vcb, UDF_MOUNT_PHASE_VDS, PhaseStart);
         if(!OS_SUCCESS(RC)) {
             if(RC == STATUS_UNRECOGNIZED_VOLUME) {
                 UDFPrint(("UDFGetDiskInfoAndVerify: check NSR presence\n"));
@@ -3032,14 +3561,40 @@ check_NSR:
         FileSetDesc = (PFILE_SET_DESC)MyAllocatePool__(NonPagedPool,Vcb->BlockSize);
         if(!FileSetDesc) try_return(RC = STATUS_INSUFFICIENT_RESOURCES);
 
+        UDFMountPhaseStart(PhaseStart);
         RC = UDFFindLastFileSet(Vcb,&fileset,FileSetDesc);
+        UDFMountPhaseEnd(Vcb, UDF_MOUNT_PHASE_FILESET, PhaseStart);
         if(!OS_SUCCESS(RC)) try_return(RC);
 
         UDFLoadFileset(Vcb,FileSetDesc, &(Vcb->RootLbAddr), &(Vcb->SysStreamLbAddr));
 
-        Vcb->FSBM_OldBitmap = (int8*)DbgAllocatePool(NonPagedPool, Vcb->FSBM_ByteCount);
-        if(!(Vcb->FSBM_OldBitmap)) try_return(RC = STATUS_INSUFFICIENT_RESOURCES);
-        RtlCopyMemory(Vcb->FSBM_OldBitmap, Vcb->FSBM_Bitmap, Vcb->FSBM_ByteCount);
+        // FSBM & ZSBM are read without lock (e.g. by WCache), so their
+        // leaves must not be released once the volume becomes alive
+        Vcb->FSBM_Bitmap.Collapse = FALSE;
+        Vcb->ZSBM_Bitmap.Collapse = FALSE;
+
+        if(Vcb->FSBM_LazyState == UDF_FSBM_DEFERRED) {
+            // r/o volume never flushes FSBM, so neither a copy of it
+            // nor a dirty map is needed
+            try_return(RC);
+        }
+
+        // the copy is accessed under BitMapResource1 only
+        if(!OS_SUCCESS(UDFSparseBitmapInit(&(Vcb->FSBM_OldBitmap), Vcb->FSBM_BitCount, NonPagedPool, TRUE)) ||
+           !UDFSparseCopyBits(&(Vcb->FSBM_OldBitmap), &(Vcb->FSBM_Bitmap), 0, Vcb->FSBM_BitCount))
+            try_return(RC = STATUS_INSUFFICIENT_RESOURCES);
+
+        // track FSBM modifications in BlockSize*8-bit chunks, i.e. one chunk
+        // per block of on-disk space bitmap. First flush after mount
+        // processes whole bitmap
+        if(!Vcb->FSBM_DirtyMap) {
+            Vcb->FSBM_DirtyChunkSh = Vcb->BlockSizeBits + 3;
+            Vcb->FSBM_DirtyChunks = (Vcb->FSBM_BitCount >> Vcb->FSBM_DirtyChunkSh) + 1;
+            Vcb->FSBM_DirtyMap = (PULONG)DbgAllocatePool(NonPagedPool, ((Vcb->FSBM_DirtyChunks+31)>>5)*sizeof(uint32));
+            if(Vcb->FSBM_DirtyMap)
+                RtlZeroMemory(Vcb->FSBM_DirtyMap, ((Vcb->FSBM_DirtyChunks+31)>>5)*sizeof(uint32));
+        }
+        Vcb->FSBM_AllDirty = TRUE;
 
 try_exit:   NOTHING;
     } _SEH2_FINALLY {
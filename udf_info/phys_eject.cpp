@@ -27,8 +27,9 @@ UDFDoDismountSequence(
 //    OSSTATUS      RC;
     ULONG i;
 
-    // flush system cache
-    UDFFlushLogicalVolume(NULL, NULL, Vcb, 0);
+    // flush system cache, the volume is going away, so don't rely
+    // on the dirty set
+    UDFFlushLogicalVolume(NULL, NULL, Vcb, UDF_FLUSH_FLAGS_FULL_TREE);
     UDFPrint(("UDFDoDismountSequence:\n"));
 
     delay.QuadPart = -1000000; // 0.1 sec
@@ -23,10 +23,19 @@ typedef struct _UDF_VERIFY_ITEM {
     lba_t      lba;
     ULONG      crc;
     PUCHAR     Buffer;
-    LIST_ENTRY vrfList;
+    LIST_ENTRY vrfList;     // age order
+    LIST_ENTRY hashList;    // lookup by lba
     BOOLEAN    queued;
 } UDF_VERIFY_ITEM, *PUDF_VERIFY_ITEM;
 
+#define UDF_VERIFY_HASH_SIZE  1024
+#define UDFVHash(lba)         ((lba) & (UDF_VERIFY_HASH_SIZE-1))
+
+// max length of single read-back request
+#define UDF_VERIFY_MAX_RUN    (1024*1024/2048)
+// max number of verify requests queued at a time (except forced flush)
+#define UDF_VERIFY_MAX_QUEUED 2
+
 typedef struct _UDF_VERIFY_REQ_RANGE {
     lba_t      lba;
     uint32     BCount;
@@ -78,13 +87,20 @@ UDFVInit(
         }
         res_inited = TRUE;
         VerifyCtx->ItemCount = 0;
-        VerifyCtx->StoredBitMap = (uint8*)DbgAllocatePoolWithTag(PagedPool, (i = (Vcb->LastPossibleLBA+1+7)>>3), 'mNWD' );
-        if(VerifyCtx->StoredBitMap) {
-            RtlZeroMemory(VerifyCtx->StoredBitMap, i);
-        } else {
+        // verify cache is small, so leaves are allocated for regions with
+        // remembered blocks only
+        status = UDFSparseBitmapInit(&(VerifyCtx->StoredBitMap), Vcb->LastPossibleLBA+1, PagedPool, TRUE);
+        if(!OS_SUCCESS(status)) {
             UDFPrint(("Can't alloc verify bitmap for %x blocks\n", Vcb->LastPossibleLBA));
+            try_return(status);
+        }
+        VerifyCtx->HashTable = (PLIST_ENTRY)DbgAllocatePoolWithTag(PagedPool, UDF_VERIFY_HASH_SIZE*sizeof(LIST_ENTRY), 'hvWD');
+        if(!VerifyCtx->HashTable) {
             try_return(status = STATUS_INSUFFICIENT_RESOURCES);
         }
+        for(i=0; i<UDF_VERIFY_HASH_SIZE; i++) {
+            InitializeListHead(&(VerifyCtx->HashTable[i]));
+        }
         InitializeListHead(&(VerifyCtx->vrfList));
         KeInitializeEvent(&(VerifyCtx->vrfEvent), SynchronizationEvent, FALSE);
         VerifyCtx->WaiterCount = 0;
@@ -98,6 +114,7 @@ try_exit: NOTHING;
             if(res_inited) {
                 ExDeleteResourceLite(&(VerifyCtx->VerifyLock));
             }
+            UDFSparseBitmapFree(&(VerifyCtx->StoredBitMap));
         }
     } _SEH2_END;
     return status;
@@ -157,7 +174,8 @@ UDFVRelease(
     UDFReleaseResource(&(VerifyCtx->VerifyLock));
 
     ExDeleteResourceLite(&(VerifyCtx->VerifyLock));
-    DbgFreePool(VerifyCtx->StoredBitMap);
+    UDFSparseBitmapFree(&(VerifyCtx->StoredBitMap));
+    DbgFreePool(VerifyCtx->HashTable);
 
     RtlZeroMemory(VerifyCtx, sizeof(UDF_VERIFY_CTX));
 
@@ -180,6 +198,10 @@ UDFVStoreBlock(
     vItem = (PUDF_VERIFY_ITEM)DbgAllocatePoolWithTag(PagedPool, sizeof(UDF_VERIFY_ITEM)+Vcb->BlockSize, 'bvWD');
     if(!vItem)
         return NULL;
+    if(!UDFSparseSetBit(&(VerifyCtx->StoredBitMap), LBA)) {
+        DbgFreePool(vItem);
+        return NULL;
+    }
     RtlCopyMemory(vItem+1, Buffer, Vcb->BlockSize);
     vItem->lba = LBA;
     vItem->crc = crc32((PUCHAR)Buffer, Vcb->BlockSize);
@@ -187,11 +209,59 @@ UDFVStoreBlock(
     vItem->queued = FALSE;
     InitializeListHead(&(vItem->vrfList));
     InsertTailList(Link, &(vItem->vrfList));
-    UDFSetBit(VerifyCtx->StoredBitMap, LBA);
+    InsertTailList(&(VerifyCtx->HashTable[UDFVHash(LBA)]), &(vItem->hashList));
     VerifyCtx->ItemCount++;
     return vItem;
 } // end UDFVStoreBlock()
 
+/*
+    This routine looks for remembered copy of specified block.
+    VerifyLock must be held
+ */
+PUDF_VERIFY_ITEM
+UDFVFindBlock(
+    PUDF_VERIFY_CTX VerifyCtx,
+    IN uint32 LBA
+    )
+{
+    PLIST_ENTRY Head;
+    PLIST_ENTRY Link;
+    PUDF_VERIFY_ITEM vItem;
+
+    if(!UDFSparseGetBit(&(VerifyCtx->StoredBitMap), LBA))
+        return NULL;
+    Head = &(VerifyCtx->HashTable[UDFVHash(LBA)]);
+    for(Link = Head->Flink; Link != Head; Link = Link->Flink) {
+        vItem = CONTAINING_RECORD( Link, UDF_VERIFY_ITEM, hashList );
+        if(vItem->lba == LBA)
+            return vItem;
+    }
+    ASSERT(FALSE);
+    return NULL;
+} // end UDFVFindBlock()
+
+/*
+    This routine checks if copy of specified block is remembered.
+    StoredBitMap releases leaves when they become clear, so it must
+    be accessed under VerifyLock
+ */
+BOOLEAN
+__fastcall
+UDFVIsStored(
+    IN PVCB Vcb,
+    IN lba_t lba
+    )
+{
+    BOOLEAN stored;
+
+    if(!Vcb->VerifyCtx.VInited)
+        return FALSE;
+    UDFAcquireResourceShared(&(Vcb->VerifyCtx.VerifyLock), TRUE);
+    stored = UDFSparseGetBit(&(Vcb->VerifyCtx.StoredBitMap), lba);
+    UDFReleaseResource(&(Vcb->VerifyCtx.VerifyLock));
+    return stored;
+} // end UDFVIsStored()
+
 VOID
 UDFVUpdateBlock(
     IN PVCB Vcb,
@@ -212,8 +282,9 @@ UDFVRemoveBlock(
     )
 {
     UDFPrint(("v-del %x\n", vItem->lba));
-    UDFClrBit(VerifyCtx->StoredBitMap, vItem->lba);
+    UDFSparseClrBit(&(VerifyCtx->StoredBitMap), vItem->lba);
     RemoveEntryList(&(vItem->vrfList));
+    RemoveEntryList(&(vItem->hashList));
     VerifyCtx->ItemCount--;
     DbgFreePool(vItem);
     return;
@@ -229,13 +300,9 @@ UDFVWrite(
     IN uint32 Flags
     )
 {
-    PLIST_ENTRY Link;
     PUDF_VERIFY_ITEM vItem;
-    //PUDF_VERIFY_ITEM vItem1;
     PUDF_VERIFY_CTX VerifyCtx = &Vcb->VerifyCtx;
     ULONG i;
-    ULONG n;
-    //uint32 prev_lba;
 
     if(!VerifyCtx->VInited) {
         return STATUS_SUCCESS;
@@ -243,113 +310,12 @@ UDFVWrite(
 
     UDFAcquireResourceExclusive(&(VerifyCtx->VerifyLock), TRUE);
 
-    for(i=0, n=0; i<BCount; i++) {
-        if(UDFGetBit(VerifyCtx->StoredBitMap, LBA+i)) {
-            // some blocks are remembered
-            n++;
-        }
-    }
-
-    if(n == BCount) {
-        // update all blocks
-        n = 0;
-        Link = VerifyCtx->vrfList.Blink;
-        while(Link != &(VerifyCtx->vrfList)) {
-            vItem = CONTAINING_RECORD( Link, UDF_VERIFY_ITEM, vrfList );
-            Link = Link->Blink;
-            if(vItem->lba >= LBA && vItem->lba < LBA+BCount) {
-                ASSERT(UDFGetBit(VerifyCtx->StoredBitMap, vItem->lba));
-                UDFVUpdateBlock(Vcb, ((PUCHAR)Buffer)+(vItem->lba-LBA)*Vcb->BlockSize, vItem);
-                n++;
-                if(n == BCount) {
-                    // all updated
-                    break;
-                }
-            }
-        }
-    } else
-    if(n) {
-#if 0
-        // find remembered blocks (the 1st one)
-        Link = VerifyCtx->vrfList.Blink;
-        while(Link != &(VerifyCtx->vrfList)) {
-            vItem = CONTAINING_RECORD( Link, UDF_VERIFY_ITEM, vrfList );
-            Link = Link->Blink;
-            if(vItem->lba >= LBA && vItem->lba < LBA+BCount) {
-                //UDFVRemoveBlock(VerifyCtx, vItem);
-                break;
-            }
-        }
-
-        // check if contiguous
-        i=1;
-        prev_lba = vItem->lba;
-        vItem1 = vItem;
-        Link = Link->Blink;
-        while((i < n) && (Link != &(VerifyCtx->vrfList))) {
-            vItem = CONTAINING_RECORD( Link, UDF_VERIFY_ITEM, vrfList );
-            Link = Link->Blink;
-            if(vItem->lba > LBA || vItem->lba >= LBA+BCount) {
-                // end
-                break;
-            }
-            if(vItem->lba < prev_lba) {
-                // not sorted
-                break;
-            }
-            prev_lba = vItem->lba;
-            i++;
-        }
-
-        if(i == n) {
-            // cont
+    // update remembered blocks in place, remember the rest
+    for(i=0; i<BCount; i++) {
+        vItem = UDFVFindBlock(VerifyCtx, LBA+i);
+        if(vItem) {
+            UDFVUpdateBlock(Vcb, ((PUCHAR)Buffer)+i*Vcb->BlockSize, vItem);
         } else {
-            // drop all and add again
-        }
-
-        vItem1 = vItem;
-        for(i=0; i<BCount; i++) {
-            if(vItem->lba == LBA+i) {
-                ASSERT(UDFGetBit(VerifyCtx->StoredBitMap, LBA+i));
-                UDFVUpdateBlock(Vcb, ((PUCHAR)Buffer)+i*Vcb->BlockSize, vItem);
-                continue;
-            }
-            if(vItem1->lba == LBA+i) {
-                ASSERT(UDFGetBit(VerifyCtx->StoredBitMap, LBA+i));
-                UDFVUpdateBlock(Vcb, ((PUCHAR)Buffer)+i*Vcb->BlockSize, vItem1);
-                continue;
-            }
-            if(vItem1->lba > LBA+i) {
-                // just insert this block
-                ASSERT(!UDFGetBit(VerifyCtx->StoredBitMap, LBA+i));
-                UDFVStoreBlock(Vcb, LBA+i, ((PUCHAR)Buffer)+i*Vcb->BlockSize, &(vItem1->vrfList));
-            } else {
-                vItem = CONTAINING_RECORD( vItem->vrfList.Blink, UDF_VERIFY_ITEM, vrfList );
-            }
-        }
-#else
-        Link = VerifyCtx->vrfList.Blink;
-        i=0;
-        while(Link != &(VerifyCtx->vrfList)) {
-            vItem = CONTAINING_RECORD( Link, UDF_VERIFY_ITEM, vrfList );
-            Link = Link->Blink;
-            if(vItem->lba >= LBA && vItem->lba < LBA+BCount) {
-                UDFVRemoveBlock(VerifyCtx, vItem);
-                i++;
-                if(i == n) {
-                    // all killed
-                    break;
-                }
-            }
-        }
-        goto remember_all;
-#endif
-
-    } else {
-remember_all:
-        // remember all blocks
-        for(i=0; i<BCount; i++) {
-            ASSERT(!UDFGetBit(VerifyCtx->StoredBitMap, LBA+i));
             UDFVStoreBlock(Vcb, LBA+i, ((PUCHAR)Buffer)+i*Vcb->BlockSize, &(VerifyCtx->vrfList));
         }
     }
@@ -379,14 +345,13 @@ UDFVRead(
     IN uint32 Flags
     )
 {
-    PLIST_ENTRY Link;
     PUDF_VERIFY_ITEM vItem;
     PUDF_VERIFY_CTX VerifyCtx = &Vcb->VerifyCtx;
     ULONG crc;
     ULONG i;
-    ULONG n;
     OSSTATUS status = STATUS_SUCCESS;
-    uint32* bm;
+    PUCHAR p;
+    PUDF_SPARSE_BITMAP bm;
 
     if(!VerifyCtx->VInited) {
         return STATUS_SUCCESS;
@@ -395,82 +360,59 @@ UDFVRead(
 
     UDFAcquireResourceExclusive(&(VerifyCtx->VerifyLock), TRUE);
 
-    for(i=0, n=0; i<BCount; i++) {
-        if(UDFGetBit(VerifyCtx->StoredBitMap, LBA+i)) {
-            // some blocks are remembered
-            n++;
-        }
-    }
-
-    if(!n) {
+    if(!UDFSparseTestBits(&(VerifyCtx->StoredBitMap), LBA, BCount)) {
         // no blocks are remembered
         UDFReleaseResource(&(VerifyCtx->VerifyLock));
         return STATUS_SUCCESS;
     }
 
-    Link = VerifyCtx->vrfList.Flink;
-    i=0;
-    while(Link != &(VerifyCtx->vrfList)) {
-        vItem = CONTAINING_RECORD( Link, UDF_VERIFY_ITEM, vrfList );
-        Link = Link->Flink;
-        if(vItem->lba >= LBA && vItem->lba < LBA+BCount) {
-            ASSERT(UDFGetBit(VerifyCtx->StoredBitMap, vItem->lba));
-            i++;
-            if(!(Flags & PH_READ_VERIFY_CACHE)) {
-                crc = crc32((PUCHAR)Buffer+(vItem->lba - LBA)*Vcb->BlockSize, Vcb->BlockSize);
-                if(vItem->crc != crc) {
-                    UDFPrint(("UDFVRead: stored %x != %x\n", vItem->crc, crc));
-                    RtlCopyMemory((PUCHAR)Buffer+(vItem->lba - LBA)*Vcb->BlockSize, vItem->Buffer, Vcb->BlockSize);
-                    status = STATUS_FT_WRITE_RECOVERY;
-
-                    if(!(bm = (uint32*)(Vcb->BSBM_Bitmap))) {
-                        crc = (Vcb->LastPossibleLBA+1+7) >> 3; // reuse 'crc' variable
-                        bm = (uint32*)(Vcb->BSBM_Bitmap = (int8*)DbgAllocatePoolWithTag(NonPagedPool, crc, 'mNWD' ));
-                        if(bm) {
-                            RtlZeroMemory(bm, crc);
-                        } else {
-                            UDFPrint(("Can't alloc BSBM for %x blocks\n", Vcb->LastPossibleLBA));
-                        }
-                    }
-                    if(bm) {
-                        UDFSetBit(bm, vItem->lba);
-                        UDFPrint(("Set BB @ %#x\n", vItem->lba));
-                    }
+    for(i=0; i<BCount; i++) {
+        if(!(vItem = UDFVFindBlock(VerifyCtx, LBA+i)))
+            continue;
+        p = (PUCHAR)Buffer+(i << Vcb->BlockSizeBits);
+        if(!(Flags & PH_READ_VERIFY_CACHE)) {
+            crc = crc32(p, Vcb->BlockSize);
+            if(vItem->crc != crc) {
+                UDFPrint(("UDFVRead: stored %x != %x\n", vItem->crc, crc));
+                RtlCopyMemory(p, vItem->Buffer, Vcb->BlockSize);
+                status = STATUS_FT_WRITE_RECOVERY;
+
+                if(OS_SUCCESS(UDFSparseBitmapInit(&(Vcb->BSBM_Bitmap), Vcb->LastPossibleLBA+1, NonPagedPool, FALSE)) &&
+                   UDFSparseSetBit(&(Vcb->BSBM_Bitmap), vItem->lba)) {
+                    UDFPrint(("Set BB @ %#x\n", vItem->lba));
+                } else {
+                    UDFPrint(("Can't alloc BSBM for %x blocks\n", Vcb->LastPossibleLBA));
+                }
 #ifdef _BROWSE_UDF_
-                    bm = (uint32*)(Vcb->FSBM_Bitmap);
-                    if(bm) {
-                        UDFSetUsedBit(bm, vItem->lba);
+                bm = &(Vcb->FSBM_Bitmap);
+                if(UDFSparseBitmapInited(bm)) {
+                    // same as in UDFTIOVerify(): counters are rebuilt
+                    // by UDFGetPartFreeSpace()
+                    UDFAcquireResourceExclusive(&(Vcb->BitMapResource1),TRUE);
+                    Vcb->FSBM_FreeCountValid = FALSE;
+                    if(UDFSparseSetUsedBit(bm, vItem->lba)) {
                         UDFPrint(("Set BB @ %#x as used\n", vItem->lba));
+                        UDFSetBitmapDirty(Vcb, vItem->lba, 1);
+                    } else {
+                        UDFPrint(("Can't mark BB @ %#x as used\n", vItem->lba));
                     }
-#endif //_BROWSE_UDF_
-                } else {
-                    // ok
+                    UDFReleaseResource(&(Vcb->BitMapResource1));
                 }
+#endif //_BROWSE_UDF_
             } else {
-                UDFPrint(("UDFVRead: get cached @ %x\n", vItem->lba));
-                RtlCopyMemory((PUCHAR)Buffer+(vItem->lba - LBA)*Vcb->BlockSize, vItem->Buffer, Vcb->BlockSize);
-            }
-            if(i >= n) {
-                // no more blocks expected
-                break;
+                // ok
             }
+        } else {
+            UDFPrint(("UDFVRead: get cached @ %x\n", vItem->lba));
+            RtlCopyMemory(p, vItem->Buffer, Vcb->BlockSize);
         }
     }
 
     if((status == STATUS_SUCCESS && !(Flags & PH_KEEP_VERIFY_CACHE)) || (Flags & PH_FORGET_VERIFIED)) {
         // ok, forget this, no errors found
-        Link = VerifyCtx->vrfList.Flink;
-        i = 0;
-        while(Link != &(VerifyCtx->vrfList)) {
-            vItem = CONTAINING_RECORD( Link, UDF_VERIFY_ITEM, vrfList );
-            Link = Link->Flink;
-            if(vItem->lba >= LBA && vItem->lba < LBA+BCount) {
-                i++;
+        for(i=0; i<BCount; i++) {
+            if((vItem = UDFVFindBlock(VerifyCtx, LBA+i))) {
                 UDFVRemoveBlock(VerifyCtx, vItem);
-                if(i >= n) {
-                    // no more blocks expected
-                    break;
-                }
             }
         }
     }
@@ -488,11 +430,9 @@ UDFVForget(
     IN uint32 Flags
     )
 {
-    PLIST_ENTRY Link;
     PUDF_VERIFY_ITEM vItem;
     PUDF_VERIFY_CTX VerifyCtx = &Vcb->VerifyCtx;
     ULONG i;
-    ULONG n;
     OSSTATUS status = STATUS_SUCCESS;
 
     if(!VerifyCtx->VInited) {
@@ -501,31 +441,9 @@ UDFVForget(
 
     UDFAcquireResourceExclusive(&(VerifyCtx->VerifyLock), TRUE);
 
-    for(i=0, n=0; i<BCount; i++) {
-        if(UDFGetBit(VerifyCtx->StoredBitMap, LBA+i)) {
-            // some blocks are remembered
-            n++;
-        }
-    }
-
-    if(!n) {
-        // no blocks are remembered
-        UDFReleaseResource(&(VerifyCtx->VerifyLock));
-        return STATUS_SUCCESS;
-    }
-
-    Link = VerifyCtx->vrfList.Flink;
-    i = 0;
-    while(Link != &(VerifyCtx->vrfList)) {
-        vItem = CONTAINING_RECORD( Link, UDF_VERIFY_ITEM, vrfList );
-        Link = Link->Flink;
-        if(vItem->lba >= LBA && vItem->lba < LBA+BCount) {
-            i++;
+    for(i=0; i<BCount; i++) {
+        if((vItem = UDFVFindBlock(VerifyCtx, LBA+i))) {
             UDFVRemoveBlock(VerifyCtx, vItem);
-            if(i >= n) {
-                // no more blocks expected
-                break;
-            }
         }
     }
 
@@ -534,6 +452,28 @@ UDFVForget(
 
 } // end UDFVForget()
 
+/*
+    This routine clears 'queued' flag of remembered blocks described
+    by verify request. VerifyLock must be held
+ */
+VOID
+UDFVUnqueueRanges(
+    PUDF_VERIFY_CTX VerifyCtx,
+    PUDF_VERIFY_REQ VerifyReq
+    )
+{
+    PUDF_VERIFY_ITEM vItem;
+    ULONG i, j;
+
+    for(i=0; i<VerifyReq->nReq; i++) {
+        for(j=0; j<VerifyReq->vr[i].BCount; j++) {
+            if((vItem = UDFVFindBlock(VerifyCtx, VerifyReq->vr[i].lba+j))) {
+                vItem->queued = FALSE;
+            }
+        }
+    }
+} // end UDFVUnqueueRanges()
+
 VOID
 NTAPI
 UDFVWorkItem(
@@ -586,6 +526,11 @@ UDFVWorkItem(
         }
     }
 #endif
+    // blocks left in cache were not verified (e.g. read failed without
+    // recovery), let next UDFVVerify() pick them again
+    UDFAcquireResourceExclusive(&(Vcb->VerifyCtx.VerifyLock), TRUE);
+    UDFVUnqueueRanges(&(Vcb->VerifyCtx), VerifyReq);
+    UDFReleaseResource(&(Vcb->VerifyCtx.VerifyLock));
     DbgFreePool(VerifyReq->Buffer);
     DbgFreePool(VerifyReq);
     InterlockedDecrement((PLONG)&(Vcb->VerifyCtx.QueuedCount));
@@ -595,6 +540,41 @@ UDFVWorkItem(
     return;
 } // end UDFVWorkItem()
 
+/*
+    This routine allocates read-back buffer for verify request and
+    queues it for processing in worker thread. VerifyLock must be held
+ */
+VOID
+UDFVQueueRequest(
+    IN PVCB Vcb,
+    IN PUDF_VERIFY_REQ VerifyReq,
+    IN ULONG max_len
+    )
+{
+    PUDF_VERIFY_CTX VerifyCtx = &Vcb->VerifyCtx;
+
+    VerifyReq->Buffer = (PUCHAR)DbgAllocatePoolWithTag(NonPagedPool, max_len * Vcb->BlockSize, 'bNWD');
+    if(!VerifyReq->Buffer) {
+        UDFVUnqueueRanges(VerifyCtx, VerifyReq);
+        DbgFreePool(VerifyReq);
+        return;
+    }
+    InterlockedIncrement((PLONG)&(VerifyCtx->QueuedCount));
+
+    ExInitializeWorkItem( &(VerifyReq->VerifyItem),
+                          UDFVWorkItem,
+                          VerifyReq );
+    ExQueueWorkItem( &(VerifyReq->VerifyItem), CriticalWorkQueue );
+} // end UDFVQueueRequest()
+
+/*
+    This routine queues read-back of the oldest remembered blocks.
+    Each picked block is extended to the longest run of remembered
+    blocks around it, so data written in several portions (or in
+    different order) is verified with large sequential reads.
+    At most UDF_VERIFY_MAX_QUEUED requests are in progress unless
+    UFD_VERIFY_FLAG_FORCE is specified
+ */
 VOID
 UDFVVerify(
     IN PVCB Vcb,
@@ -604,17 +584,17 @@ UDFVVerify(
     PUDF_VERIFY_CTX VerifyCtx = &Vcb->VerifyCtx;
     PLIST_ENTRY Link;
     PUDF_VERIFY_ITEM vItem;
+    PUDF_VERIFY_ITEM vItem1;
     PUDF_VERIFY_REQ VerifyReq = NULL;
     ULONG len, max_len=0;
-    lba_t prev_lba;
-    //PUCHAR tmp_buff;
+    lba_t lba;
     ULONG i;
-    BOOLEAN do_vrf = FALSE;
 
     if(!VerifyCtx->VInited) {
         return;
     }
-    if(VerifyCtx->QueuedCount) {
+    if(VerifyCtx->QueuedCount >= UDF_VERIFY_MAX_QUEUED &&
+       !(Flags & UFD_VERIFY_FLAG_FORCE)) {
         if(Flags & UFD_VERIFY_FLAG_WAIT) {
             UDFPrint(("  wait for verify flush\n"));
             goto wait;
@@ -644,81 +624,61 @@ UDFVVerify(
     }
 
     Link = VerifyCtx->vrfList.Flink;
-    prev_lba = -2;
-    len = 0;
 
-    while(i) {
-        ASSERT(Link != &(VerifyCtx->vrfList));
-/*
-        if(Link == &(VerifyCtx->vrfList)) {
-            if(!len)
-                break;
-            i=1;
-            goto queue_req;
-        }
-*/
+    while(i && (Link != &(VerifyCtx->vrfList))) {
         vItem = CONTAINING_RECORD( Link, UDF_VERIFY_ITEM, vrfList );
         Link = Link->Flink;
+        if(vItem->queued) {
+            continue;
+        }
 
-        //
-        if(!vItem->queued && (prev_lba+len == vItem->lba)) {
-            vItem->queued = TRUE;
-            len++;
-        } else {
-            if(len) {
-                do_vrf = TRUE;
-            } else {
-                len = 1;
-                prev_lba = vItem->lba;
+        if(!VerifyReq) {
+            VerifyReq = (PUDF_VERIFY_REQ)DbgAllocatePoolWithTag(NonPagedPool, sizeof(UDF_VERIFY_REQ), 'bNWD');
+            if(!VerifyReq) {
+                break;
             }
+            RtlZeroMemory(VerifyReq, sizeof(UDF_VERIFY_REQ));
+            VerifyReq->Vcb = Vcb;
+        }
+
+        // collect contiguous run of remembered blocks
+        vItem->queued = TRUE;
+        lba = vItem->lba;
+        len = 1;
+        while(len < UDF_VERIFY_MAX_RUN &&
+              (vItem1 = UDFVFindBlock(VerifyCtx, lba-1)) &&
+              !vItem1->queued) {
+            vItem1->queued = TRUE;
+            lba--;
+            len++;
         }
-        if((i == 1) && len) {
-            do_vrf = TRUE;
-        }
-        if(len >= 0x100) {
-            do_vrf = TRUE;
+        while(len < UDF_VERIFY_MAX_RUN &&
+              (vItem1 = UDFVFindBlock(VerifyCtx, lba+len)) &&
+              !vItem1->queued) {
+            vItem1->queued = TRUE;
+            len++;
         }
-        if(do_vrf) {
-//queue_req:
-            if(!VerifyReq) {
-                VerifyReq = (PUDF_VERIFY_REQ)DbgAllocatePoolWithTag(NonPagedPool, sizeof(UDF_VERIFY_REQ), 'bNWD');
-                if(VerifyReq) {
-                    RtlZeroMemory(VerifyReq, sizeof(UDF_VERIFY_REQ));
-                    VerifyReq->Vcb    = Vcb;
-                }
-            }
-            if(VerifyReq) {
+        i -= min(i, len);
 
-                VerifyReq->vr[VerifyReq->nReq].lba    = prev_lba;
-                VerifyReq->vr[VerifyReq->nReq].BCount = len;
-                VerifyReq->nReq++;
-                if(max_len < len) {
-                    max_len = len;
-                }
-
-                if((VerifyReq->nReq >= MAX_VREQ_RANGES) || (i == 1)) {
-
-                    VerifyReq->Buffer = (PUCHAR)DbgAllocatePoolWithTag(NonPagedPool, max_len * Vcb->BlockSize, 'bNWD');
-                    if(VerifyReq->Buffer) {
-                        InterlockedIncrement((PLONG)&(VerifyCtx->QueuedCount));
+        VerifyReq->vr[VerifyReq->nReq].lba    = lba;
+        VerifyReq->vr[VerifyReq->nReq].BCount = len;
+        VerifyReq->nReq++;
+        if(max_len < len) {
+            max_len = len;
+        }
 
-                        ExInitializeWorkItem( &(VerifyReq->VerifyItem),
-                                              UDFVWorkItem,
-                                              VerifyReq );
-                        ExQueueWorkItem( &(VerifyReq->VerifyItem), CriticalWorkQueue );
-                    } else {
-                        DbgFreePool(VerifyReq);
-                    }
-                    VerifyReq = NULL;
-                    max_len = 0;
-                } else {
-                }
+        if(VerifyReq->nReq >= MAX_VREQ_RANGES) {
+            UDFVQueueRequest(Vcb, VerifyReq, max_len);
+            VerifyReq = NULL;
+            max_len = 0;
+            if(VerifyCtx->QueuedCount >= UDF_VERIFY_MAX_QUEUED &&
+               !(Flags & UFD_VERIFY_FLAG_FORCE)) {
+                break;
             }
-            len = 1;
-            prev_lba = vItem->lba;
-            do_vrf = FALSE;
         }
-        i--;
+    }
+    if(VerifyReq) {
+        UDFVQueueRequest(Vcb, VerifyReq, max_len);
     }
 
     if(!(Flags & UFD_VERIFY_FLAG_LOCKED)) {
@@ -324,6 +324,108 @@ UDFReadFileEntry(
     return STATUS_SUCCESS;
 } // UDFReadFileEntry()
 
+/*
+    This routine reads (Extended)FileEntry according to FileDesc.
+    The descriptor is validated right in the cached block, then its
+    header and Extended Attributes are copied to the buffer allocated
+    with exact size (FileEntryLen), this buffer is kept in Dloc.
+    Allocation Descriptors are copied to caller's buffer (AdBuf) if
+    they fit, otherwise to temporary pool buffer, caller parses them
+    with UDFLoadExtInfo() & frees the pool buffer (parsing may require
+    I/O, that can't be performed while cached block is accessed
+    directly). In-ICB data is not copied, it is accessed via DataLoc.
+ */
+OSSTATUS
+UDFReadFileEntryInPlace(
+    IN PVCB Vcb,
+    IN long_ad* Icb,
+    OUT tag** FileEntry, // here we can also get ExtendedFileEntry
+    OUT int8** AllocDescs,
+    IN int8* AdBuf,
+    IN uint32 AdBufLen,
+ IN OUT uint16* Ident
+    )
+{
+    OSSTATUS status;
+    uint32 Block;
+    uint32 l, ea, ad;
+    uint16 AllocMode;
+    int8* Buf;
+    int8* tmp_buff = NULL;
+    SIZE_T ReadBytes;
+    BOOLEAN Direct = FALSE;
+
+    (*FileEntry) = NULL;
+    (*AllocDescs) = NULL;
+    Block = UDFPartLbaToPhys(Vcb, &(Icb->extLocation));
+    if(Block == LBA_OUT_OF_EXTENT)
+        return STATUS_FILE_CORRUPT_ERROR;
+
+    if(Vcb->FastCache.ReadProc && (KeGetCurrentIrql() < DISPATCH_LEVEL)) {
+        status = WCacheDirect__(&(Vcb->FastCache), Vcb, Block, FALSE, (PCHAR*)&Buf, FALSE);
+        Direct = TRUE;
+    } else {
+        tmp_buff = Buf = (int8*)MyAllocatePool__(NonPagedPool, Vcb->BlockSize);
+        if(!tmp_buff)
+            return STATUS_INSUFFICIENT_RESOURCES;
+        status = UDFReadSectors(Vcb, FALSE, Block, 1, FALSE, Buf, &ReadBytes);
+    }
+    if(!OS_SUCCESS(status)) {
+        UDFPrint(("UDF: Block=%x, Location=%x: read failed\n", Block, Icb->extLocation.logicalBlockNum));
+        goto EO_ReadFE;
+    }
+    if(!OS_SUCCESS(status = UDFCheckTagged(Vcb, Buf, Block, Icb->extLocation.logicalBlockNum, Ident)))
+        goto EO_ReadFE;
+
+    if((*Ident) == TID_FILE_ENTRY) {
+        l = sizeof(FILE_ENTRY);
+        ea = ((PFILE_ENTRY)Buf)->lengthExtendedAttr;
+        ad = ((PFILE_ENTRY)Buf)->lengthAllocDescs;
+        AllocMode = ((PFILE_ENTRY)Buf)->icbTag.flags & ICB_FLAG_ALLOC_MASK;
+    } else
+    if((*Ident) == TID_EXTENDED_FILE_ENTRY) {
+        l = sizeof(EXTENDED_FILE_ENTRY);
+        ea = ((PEXTENDED_FILE_ENTRY)Buf)->lengthExtendedAttr;
+        ad = ((PEXTENDED_FILE_ENTRY)Buf)->lengthAllocDescs;
+        AllocMode = ((PEXTENDED_FILE_ENTRY)Buf)->icbTag.flags & ICB_FLAG_ALLOC_MASK;
+    } else {
+        UDFPrint(("  Not a FileEntry (lbn=%x, tag=%x)\n", Icb->extLocation.logicalBlockNum, (*Ident)));
+        status = STATUS_FILE_CORRUPT_ERROR;
+        goto EO_ReadFE;
+    }
+    if((ea > Vcb->BlockSize) || (ad > Vcb->BlockSize) ||
+       (l+ea+ad > Vcb->BlockSize)) {
+        UDFPrint(("  FileEntry is too long (lbn=%x, ea=%x, ad=%x)\n", Icb->extLocation.logicalBlockNum, ea, ad));
+        status = STATUS_FILE_CORRUPT_ERROR;
+        goto EO_ReadFE;
+    }
+    l += ea;
+    (*FileEntry) = (tag*)MyAllocatePoolTag__(NonPagedPool, l, MEM_FE_TAG);
+    if(!(*FileEntry)) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto EO_ReadFE;
+    }
+    RtlCopyMemory(*FileEntry, Buf, l);
+    if(ad && (AllocMode != ICB_FLAG_AD_IN_ICB)) {
+        (*AllocDescs) = (ad <= AdBufLen) ? AdBuf : (int8*)MyAllocatePool__(NonPagedPool, ad);
+        if(!(*AllocDescs)) {
+            MyFreePool__(*FileEntry);
+            (*FileEntry) = NULL;
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto EO_ReadFE;
+        }
+        RtlCopyMemory(*AllocDescs, Buf+l, ad);
+    }
+
+EO_ReadFE:
+    if(Direct) {
+        WCacheEODirect__(&(Vcb->FastCache), Vcb);
+    } else {
+        MyFreePool__(tmp_buff);
+    }
+    return status;
+} // UDFReadFileEntryInPlace()
+
 /*
     Decides if a Unicode character matches one of a list
     of ASCII characters.
@@ -1028,14 +1130,15 @@ UDFLoadExtInfo(
     IN PFILE_ENTRY fe,
     IN PLONG_AD fe_loc,
  IN OUT PEXTENT_INFO FExtInfo,  // user data
- IN OUT PEXTENT_INFO AExtInfo   // alloc descs
+ IN OUT PEXTENT_INFO AExtInfo,  // alloc descs
+    IN int8* AllocDescs         // alloc descs, if they are not kept in fe
     )
 {
     EXTENT_AD TmpExt;
 
     UDFPrint(("  UDFLoadExtInfo:\n"));
     FExtInfo->Mapping = UDFReadMappingFromXEntry(Vcb, fe_loc->extLocation.partitionReferenceNum,
-                                       (tag*)fe, &(FExtInfo->Offset), AExtInfo);
+                                       (tag*)fe, &(FExtInfo->Offset), AExtInfo, AllocDescs);
     if(!(FExtInfo->Mapping)) {
         if(!(FExtInfo->Offset))
             return STATUS_UNSUCCESSFUL;
@@ -1577,7 +1680,8 @@ UDFWriteFile__(
     IN SIZE_T Length,
     IN BOOLEAN Direct,
     IN int8* Buffer,
-    OUT PSIZE_T WrittenBytes
+    OUT PSIZE_T WrittenBytes,
+    IN BOOLEAN NoCache
     )
 {
     int64 t, elen;
@@ -1606,7 +1710,7 @@ UDFWriteFile__(
     if(t <= Dloc->DataLoc.Length) {
         // write Alloc-Rec area
         ExtPrint(("  WAlloc-Rec: %I64x <= %I64x\n", t, Dloc->DataLoc.Length));
-        status = UDFWriteExtent(Vcb, &(Dloc->DataLoc), Offset, Length, Direct, Buffer, WrittenBytes);
+        status = UDFWriteExtent(Vcb, &(Dloc->DataLoc), Offset, Length, Direct, Buffer, WrittenBytes, NoCache);
         return status;
     }
     elen = UDFGetExtentLength(Dloc->DataLoc.Mapping);
@@ -1628,7 +1732,7 @@ UDFWriteFile__(
             Dloc->DataLoc.Modified = TRUE;
         }
         Dloc->DataLoc.Length = t;
-        return UDFWriteExtent(Vcb, &(Dloc->DataLoc), Offset, Length, Direct, Buffer, WrittenBytes);
+        return UDFWriteExtent(Vcb, &(Dloc->DataLoc), Offset, Length, Direct, Buffer, WrittenBytes, NoCache);
     }
     // We should not get here if Direct=TRUE
     if(Direct) return STATUS_INVALID_PARAMETER;
@@ -1711,7 +1815,7 @@ UDFWriteFile__(
     // & now we'll write out data to well prepared extent...
     // ... like all normal people do...
     ExtPrint(("  write user data\n"));
-    if(!OS_SUCCESS(status = UDFWriteExtent(Vcb, &(Dloc->DataLoc), Offset, Length, FALSE, Buffer, WrittenBytes)))
+    if(!OS_SUCCESS(status = UDFWriteExtent(Vcb, &(Dloc->DataLoc), Offset, Length, FALSE, Buffer, WrittenBytes, NoCache)))
         return status;
     UDFSetFileSize(FileInfo, t);
     Dloc->DataLoc.Modified = TRUE;
@@ -1987,6 +2091,8 @@ UDFOpenFile__(
     PUDF_FILE_INFO FileInfo;
     PUDF_FILE_INFO ParFileInfo;
     SIZE_T ReadBytes;
+    int8* AllocDescs;
+    int8 AdBuf[UDF_FE_AD_STACK_BUF];
     *_FileInfo = NULL;
     if(!hDirNdx) return STATUS_NOT_A_DIRECTORY;
 
@@ -2070,11 +2176,6 @@ UDFOpenFile__(
         UDFInsertLinkedFile(FileInfo, FileInfo->Dloc->LinkedFileInfo);
     if(FileInfo->Dloc->FileEntry)
         goto init_tree_entry;
-    // read (Ex)FileEntry
-    FileInfo->Dloc->FileEntry = (tag*)MyAllocatePoolTag__(NonPagedPool, Vcb->LBlockSize, MEM_FE_TAG);
-    if(!(FileInfo->Dloc->FileEntry)) return STATUS_INSUFFICIENT_RESOURCES;
-    if(!OS_SUCCESS(status = UDFReadFileEntry(Vcb, &(FileInfo->FileIdent->icb), (PFILE_ENTRY)(FileInfo->Dloc->FileEntry), &Ident)))
-        return status;
     // build mappings for Data & AllocDescs
     if(!FileInfo->Dloc->AllocLoc.Mapping) {
         FEExt.extLength = FileInfo->FileIdent->icb.extLength;
@@ -2085,9 +2186,18 @@ UDFOpenFile__(
         if(!(FileInfo->Dloc->AllocLoc.Mapping))
             return STATUS_INSUFFICIENT_RESOURCES;
     }
+    // read (Ex)FileEntry
+    // The buffer is allocated with exact size of FE header & EAs, so it
+    // is not reallocated after parsing. AllocDescs are parsed from the
+    // temporary copy, which is usually kept on stack.
+    if(!OS_SUCCESS(status = UDFReadFileEntryInPlace(Vcb, &(FileInfo->FileIdent->icb), &(FileInfo->Dloc->FileEntry),
+                                                    &AllocDescs, AdBuf, sizeof(AdBuf), &Ident)))
+        return status;
     // read location info
     status = UDFLoadExtInfo(Vcb, (PFILE_ENTRY)(FileInfo->Dloc->FileEntry), &(FileInfo->FileIdent->icb),
-                           &(FileInfo->Dloc->DataLoc), &(FileInfo->Dloc->AllocLoc) );
+                           &(FileInfo->Dloc->DataLoc), &(FileInfo->Dloc->AllocLoc), AllocDescs);
+    if(AllocDescs && (AllocDescs != AdBuf))
+        MyFreePool__(AllocDescs);
     if(!OS_SUCCESS(status))
         return status;
     // init (Ex)FileEntry mapping
@@ -2107,10 +2217,6 @@ init_tree_entry:
     } else {
         DirNdx->FI_Flags &= ~UDF_FI_FLAG_LINKED;
     }
-    // resize FE cache (0x800 instead of 0x40 is not a good idea)
-    if(!MyReallocPool__((int8*)((FileInfo->Dloc->FileEntry)), Vcb->LBlockSize,
-                     (int8**)&((FileInfo->Dloc->FileEntry)), FileInfo->Dloc->FileEntryLen))
-        return STATUS_INSUFFICIENT_RESOURCES;
     // check if this file has a SDir
     if((FileInfo->Dloc->FileEntry->tagIdent == TID_EXTENDED_FILE_ENTRY) &&
        ((PEXTENDED_FILE_ENTRY)(FileInfo->Dloc->FileEntry))->streamDirectoryICB.extLength )
@@ -2783,7 +2889,8 @@ CrF__1:
         RtlCopyMemory(DirNdx->FName.Buffer, _fn->Buffer, _fn->Length);
         DirNdx->FName.Buffer[_fn->Length/sizeof(WCHAR)] = 0;
 CrF__2:
-        DirNdx->FI_Flags |= UDFBuildHashEntry(Vcb, &(DirNdx->FName), &(DirNdx->hashes), HASH_ALL);
+        UDFDirIndexInvalidateHashes(DirNdx);
+        UDFDirIndexInvalidateNegCache(DirInfo->Dloc->DirIndex);
         // we get here immediately when 'undel' occured
         FileInfo->Index = i;
         DirNdx->FI_Flags |= UDF_FI_FLAG_FI_MODIFIED;
@@ -2828,7 +2935,7 @@ CrF__2:
 
 #ifdef UDF_CHECK_DISK_ALLOCATION
         if(  /*FileInfo->Fcb &&*/
-             UDFGetFreeBit(((uint32*)(Vcb->FSBM_Bitmap)), FileInfo->Dloc->FELoc.Mapping[0].extLocation)) {
+             UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), FileInfo->Dloc->FELoc.Mapping[0].extLocation)) {
 
             if(!FileInfo->FileIdent ||
                !(FileInfo->FileIdent->fileCharacteristics & FILE_DELETED)) {
@@ -3033,7 +3140,7 @@ UDFCloseFile__(
     }
 #ifdef UDF_CHECK_DISK_ALLOCATION
     if(  FileInfo->Fcb &&
-         UDFGetFreeBit(((uint32*)(Vcb->FSBM_Bitmap)), FileInfo->Dloc->FELoc.Mapping[0].extLocation)) {
+         UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), FileInfo->Dloc->FELoc.Mapping[0].extLocation)) {
 
         //ASSERT(FileInfo->Dloc->FELoc.Mapping[0].extLocation);
         if(UDFIsAStreamDir(FileInfo)) {
@@ -3060,7 +3167,7 @@ UDFCloseFile__(
         }
     } else {
         if(!FileInfo->Dloc->FELoc.Mapping[0].extLocation ||
-            UDFGetFreeBit(((uint32*)(Vcb->FSBM_Bitmap)), FileInfo->Dloc->FELoc.Mapping[0].extLocation)) {
+            UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), FileInfo->Dloc->FELoc.Mapping[0].extLocation)) {
             UDFCheckSpaceAllocation(Vcb, 0, FileInfo->Dloc->DataLoc.Mapping, AS_FREE); // check if free
         } else {
             UDFCheckSpaceAllocation(Vcb, 0, FileInfo->Dloc->DataLoc.Mapping, AS_USED); // check if used
@@ -3127,7 +3234,7 @@ UDFCloseFile__(
 //    ASSERT(FileInfo->Dloc->FELoc.Mapping[0].extLocation);
     if((FileInfo->Dloc->FileEntry->descVersion != 2) &&
        (FileInfo->Dloc->FileEntry->descVersion != 3)) {
-        ASSERT(UDFGetFreeBit(((uint32*)(Vcb->FSBM_Bitmap)), FileInfo->Dloc->FELoc.Mapping[0].extLocation));
+        ASSERT(UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), FileInfo->Dloc->FELoc.Mapping[0].extLocation));
     }
 #endif // UDF_DBG
     return STATUS_SUCCESS;
@@ -3189,7 +3296,8 @@ UDFRenameMoveFile__(
             if(CS0) MyFreePool__(CS0);
 
             DirNdx2->FI_Flags |= UDF_FI_FLAG_FI_MODIFIED;
-            UDFBuildHashEntry(Vcb, &(DirNdx2->FName), &(DirNdx2->hashes), HASH_ALL);
+            UDFDirIndexInvalidateHashes(DirNdx2);
+            UDFDirIndexInvalidateNegCache(DirInfo2->Dloc->DirIndex);
             return STATUS_SUCCESS;
 /*        } else
         if(!OS_SUCCESS(status) && (fn->Length == UDFDirIndex(DirInfo2->Dloc->DirIndex, j=FileInfo->Index)->FName.Length)) {
@@ -3203,6 +3311,7 @@ UDFRenameMoveFile__(
 
     // PHASE 0
     // try to create new FileIdent & FileEntry in Dir2
+    UDFDirIndexInvalidateNegCache(DirInfo2->Dloc->DirIndex);
 
 RenameRetry:
     if(!OS_SUCCESS(status = UDFCreateFile__(Vcb, IgnoreCase, fn, UDFGetFileEALength(FileInfo),
@@ -3716,9 +3825,10 @@ err_vat_15:
         len = Vcb->VatCount;
         RtlFillMemory(&(Vcb->Vat[Vcb->NWA-root]), (Vcb->LastPossibleLBA-Vcb->NWA+1)*sizeof(uint32), 0xff);
         // sync VAT and FSBM
+        Vcb->FSBM_FreeCountValid = FALSE;
         for(i=0; i<len; i++) {
             if(Vcb->Vat[i] == UDF_VAT_FREE_ENTRY) {
-                UDFSetFreeBit(Vcb->FSBM_Bitmap, root+i);
+                UDFSparseSetFreeBit(&(Vcb->FSBM_Bitmap), root+i);
             }
         }
         len = Vcb->LastPossibleLBA;
@@ -3727,12 +3837,12 @@ err_vat_15:
             for (j = 0; (j < PACKETSIZE_UDF) && (i < len); j++, i++)
             {
                 UDFPrint(("udf_info:FSBM_Bitmap Set Free: %x\n", root + i));
-                UDFSetFreeBit(Vcb->FSBM_Bitmap, i);
+                UDFSparseSetFreeBit(&(Vcb->FSBM_Bitmap), i);
             }
             for (j = 0; (j < 7) && (i < len); j++, i++)
             {
                 UDFPrint(("udf_info:FSBM_Bitmap Set Used: %x\n", root + i));
-                UDFSetUsedBit(Vcb->FSBM_Bitmap, i);
+                UDFSparseSetUsedBit(&(Vcb->FSBM_Bitmap), i);
             }
         }
         DbgFreePool(VatOldData);
@@ -3827,6 +3937,240 @@ UDFIsDirEmpty(
     return TRUE;
 } // end UDFIsDirEmpty()
 
+/*
+    This routine opens (or joins, if it is already opened by current
+    thread) FileEntry write batch. While the batch is opened, UDFFlushFE()
+    called by the same thread doesn't write single-block FEs immediately,
+    but collects them and UDFMetaBatchFlush() writes them sorted by LBA,
+    contiguous blocks with single request.
+    Returns FALSE if batch cannot be used, UDFMetaBatchEnd() must not be
+    called in this case.
+    Caller must prevent FE space reallocation and release of collected
+    Dlocs while the batch is opened (e.g. by holding Vcb exclusively)
+ */
+BOOLEAN
+UDFMetaBatchBegin(
+    IN PVCB Vcb
+    )
+{
+    PVOID Thread = PsGetCurrentThread();
+
+    if(Vcb->MetaBatchOwner == Thread) {
+        Vcb->MetaBatchDepth++;
+        return TRUE;
+    }
+    if(Vcb->CDR_Mode ||
+       (Vcb->VCBFlags & VCB_STATE_VOLUME_READ_ONLY)) {
+        return FALSE;
+    }
+    if(InterlockedCompareExchangePointer(&(Vcb->MetaBatchOwner), Thread, NULL) != NULL) {
+        return FALSE;
+    }
+    // 2nd half of the buffer is used for sorting
+    Vcb->MetaBatchBuffer = (PCHAR)MyAllocatePool__(NonPagedPool, (UDF_META_BATCH_MAX*2) << Vcb->BlockSizeBits);
+    Vcb->MetaBatchItem = (PUDF_META_BATCH_ITEM)MyAllocatePool__(NonPagedPool, UDF_META_BATCH_MAX*sizeof(UDF_META_BATCH_ITEM));
+    if(!Vcb->MetaBatchBuffer || !Vcb->MetaBatchItem) {
+        if(Vcb->MetaBatchBuffer) MyFreePool__(Vcb->MetaBatchBuffer);
+        if(Vcb->MetaBatchItem) MyFreePool__(Vcb->MetaBatchItem);
+        Vcb->MetaBatchBuffer = NULL;
+        Vcb->MetaBatchItem = NULL;
+        Vcb->MetaBatchOwner = NULL;
+        return FALSE;
+    }
+    Vcb->MetaBatchCount = 0;
+    Vcb->MetaBatchDepth = 1;
+    Vcb->MetaBatchStatus = STATUS_SUCCESS;
+    return TRUE;
+} // end UDFMetaBatchBegin()
+
+/*
+    This routine handles FileEntry that was not written by the batch.
+    FE is marked as modified, so it is written again by the next flush.
+    Blocks failed with STATUS_DEVICE_DATA_ERROR are marked in BSBM, so
+    UDFFlushFE() relocates FE there just like after unbatched write.
+ */
+VOID
+UDFMetaBatchFailFE(
+    IN PVCB Vcb,
+    IN PUDF_META_BATCH_ITEM Item,
+    IN OSSTATUS status
+    )
+{
+    UDFPrint(("  FE @%x is not written (%x)\n", Item->Lba, status));
+    if(status == STATUS_DEVICE_DATA_ERROR) {
+        if(OS_SUCCESS(UDFSparseBitmapInit(&(Vcb->BSBM_Bitmap), Vcb->LastPossibleLBA+1, NonPagedPool, FALSE)))
+            UDFSparseSetBit(&(Vcb->BSBM_Bitmap), Item->Lba);
+    }
+    Item->Dloc->FE_Flags |= UDF_FE_FLAG_FE_MODIFIED;
+    UDFMarkFcbDirty(Vcb, Item->Dloc->CommonFcb);
+} // end UDFMetaBatchFailFE()
+
+/*
+    This routine writes collected FileEntries. Only FE bytes are taken
+    from the batch, the rest of each block (AllocDescs or in-ICB data
+    written by UDFFlushFE() before) is read back and written unchanged.
+    Returns the first error, failed FEs are handled by UDFMetaBatchFailFE()
+ */
+OSSTATUS
+UDFMetaBatchFlush(
+    IN PVCB Vcb
+    )
+{
+    ULONG Order[UDF_META_BATCH_MAX];
+    ULONG n = Vcb->MetaBatchCount;
+    ULONG i, j, k;
+    ULONG BSh = Vcb->BlockSizeBits;
+    PUDF_META_BATCH_ITEM Item = Vcb->MetaBatchItem;
+    PCHAR Sorted = Vcb->MetaBatchBuffer + (UDF_META_BATCH_MAX << BSh);
+    OSSTATUS status;
+    OSSTATUS RC = STATUS_SUCCESS;
+    SIZE_T ReadBytes;
+    SIZE_T WrittenBytes;
+
+    if(!n)
+        return STATUS_SUCCESS;
+    UDFPrint(("UDFMetaBatchFlush: %d FEs\n", n));
+    // sort by LBA
+    for(i=0; i<n; i++) {
+        for(j=i; j && (Item[Order[j-1]].Lba > Item[i].Lba); j--) {
+            Order[j] = Order[j-1];
+        }
+        Order[j] = i;
+    }
+    // read-modify-write, blocks that can't be read are dropped from the batch
+    for(i=0; i<n; i++) {
+        status = UDFReadSectors(Vcb, TRUE, Item[Order[i]].Lba, 1, FALSE,
+                                Sorted + (i << BSh), &ReadBytes);
+        if(!OS_SUCCESS(status)) {
+            UDFMetaBatchFailFE(Vcb, &(Item[Order[i]]), status);
+            Item[Order[i]].Length = 0;
+            if(OS_SUCCESS(RC))
+                RC = status;
+            continue;
+        }
+        RtlCopyMemory(Sorted + (i << BSh), Vcb->MetaBatchBuffer + (Order[i] << BSh), Item[Order[i]].Length);
+    }
+    // write runs of contiguous blocks
+    for(i=0; i<n; i=k) {
+        k = i+1;
+        if(!Item[Order[i]].Length)
+            continue;
+        for(; (k<n) && Item[Order[k]].Length && (Item[Order[k]].Lba == Item[Order[i]].Lba+(k-i)); k++);
+        status = UDFWriteSectors(Vcb, TRUE, Item[Order[i]].Lba, k-i, FALSE,
+                                 Sorted + (i << BSh), &WrittenBytes);
+        if(OS_SUCCESS(status))
+            continue;
+        UDFPrint(("  write @%x (%x) failed (%x)\n", Item[Order[i]].Lba, k-i, status));
+        // find out which FEs are not written
+        for(j=i; j<k; j++) {
+            if(k-i > 1) {
+                status = UDFWriteSectors(Vcb, TRUE, Item[Order[j]].Lba, 1, FALSE,
+                                         Sorted + (j << BSh), &WrittenBytes);
+            }
+            if(!OS_SUCCESS(status)) {
+                UDFMetaBatchFailFE(Vcb, &(Item[Order[j]]), status);
+                if(OS_SUCCESS(RC))
+                    RC = status;
+            }
+        }
+    }
+    Vcb->MetaBatchCount = 0;
+    if(OS_SUCCESS(Vcb->MetaBatchStatus))
+        Vcb->MetaBatchStatus = RC;
+    return RC;
+} // end UDFMetaBatchFlush()
+
+/*
+    This routine closes FileEntry write batch opened by UDFMetaBatchBegin()
+    Returns the first error of all UDFMetaBatchFlush() calls made
+    while the batch was opened
+ */
+OSSTATUS
+UDFMetaBatchEnd(
+    IN PVCB Vcb
+    )
+{
+    OSSTATUS status;
+
+    ASSERT(Vcb->MetaBatchOwner == PsGetCurrentThread());
+    if(--Vcb->MetaBatchDepth)
+        return STATUS_SUCCESS;
+    UDFMetaBatchFlush(Vcb);
+    status = Vcb->MetaBatchStatus;
+    MyFreePool__(Vcb->MetaBatchBuffer);
+    MyFreePool__(Vcb->MetaBatchItem);
+    Vcb->MetaBatchBuffer = NULL;
+    Vcb->MetaBatchItem = NULL;
+    Vcb->MetaBatchOwner = NULL;
+    return status;
+} // end UDFMetaBatchEnd()
+
+/*
+    This routine puts FileEntry to the write batch if it occupies single
+    recorded block and the batch is opened by current thread.
+    Returns FALSE if FE must be written immediately
+ */
+BOOLEAN
+UDFMetaBatchAddFE(
+    IN PVCB Vcb,
+    IN PUDF_DATALOC_INFO Dloc
+    )
+{
+    PEXTENT_INFO FELoc = &(Dloc->FELoc);
+    PUDF_META_BATCH_ITEM Item;
+    ULONG i, n;
+    uint32 lba = 0;
+    BOOLEAN Batched;
+
+    if(Vcb->MetaBatchOwner != PsGetCurrentThread())
+        return FALSE;
+    Batched = !(FELoc->Offset ||
+                (FELoc->Length > Vcb->BlockSize) ||
+                (FELoc->Mapping[0].extLength >> 30) != EXTENT_RECORDED_ALLOCATED ||
+                (FELoc->Mapping[0].extLength & UDF_EXTENT_LENGTH_MASK) < FELoc->Length);
+    if(Batched)
+        lba = FELoc->Mapping[0].extLocation;
+    // FE queued earlier in this batch may be relocated or grow since then.
+    // Its stale copy must not be written over the old location, drop it
+    Item = Vcb->MetaBatchItem;
+    i = 0;
+    while(i < Vcb->MetaBatchCount) {
+        if((Item[i].Dloc != Dloc) ||
+           (Batched && (Item[i].Lba == lba))) {
+            i++;
+            continue;
+        }
+        UDFPrint(("  drop stale FE @%x from batch\n", Item[i].Lba));
+        n = --Vcb->MetaBatchCount;
+        if(i != n) {
+            Item[i] = Item[n];
+            RtlCopyMemory(Vcb->MetaBatchBuffer + (i << Vcb->BlockSizeBits),
+                          Vcb->MetaBatchBuffer + (n << Vcb->BlockSizeBits), Item[i].Length);
+        }
+    }
+    if(!Batched)
+        return FALSE;
+    // FE may be flushed several times during the batch
+    for(i=0; i<Vcb->MetaBatchCount; i++) {
+        if(Vcb->MetaBatchItem[i].Lba == lba)
+            break;
+    }
+    if(i == UDF_META_BATCH_MAX) {
+        // failed FEs are re-marked as dirty by UDFMetaBatchFailFE()
+        UDFMetaBatchFlush(Vcb);
+        i = 0;
+    }
+    if(i == Vcb->MetaBatchCount) {
+        Vcb->MetaBatchItem[i].Lba = lba;
+        Vcb->MetaBatchCount++;
+    }
+    // only FE bytes are kept, the tail of the block is merged on flush
+    Vcb->MetaBatchItem[i].Length = (ULONG)(FELoc->Length);
+    Vcb->MetaBatchItem[i].Dloc = Dloc;
+    RtlCopyMemory(Vcb->MetaBatchBuffer + (i << Vcb->BlockSizeBits), Dloc->FileEntry, (ULONG)(FELoc->Length));
+    return TRUE;
+} // end UDFMetaBatchAddFE()
+
 /*
  */
 OSSTATUS
@@ -3917,7 +4261,7 @@ retry_flush_FE:
     }
 /*    if(FileInfo->Fcb &&
        ((FileInfo->Dloc->FELoc.Mapping[0].extLocation > Vcb->LastLBA) ||
-        UDFGetFreeBit(((uint32*)(Vcb->FSBM_Bitmap)), FileInfo->Dloc->FELoc.Mapping[0].extLocation)) ) {
+        UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), FileInfo->Dloc->FELoc.Mapping[0].extLocation)) ) {
         BrutePoint();
     }*/
 /*    if(FileInfo->Dloc->FELoc.Mapping[0].extLocation) {
@@ -3939,8 +4283,8 @@ retry_flush_FE:
 
         // if FE is located in remapped block, place it to reliable space
         lba = FileInfo->Dloc->FELoc.Mapping[0].extLocation;
-        if(Vcb->BSBM_Bitmap) {
-            if(UDFGetBadBit((uint32*)(Vcb->BSBM_Bitmap), lba)) {
+        if(UDFSparseBitmapInited(&(Vcb->BSBM_Bitmap))) {
+            if(UDFSparseGetBit(&(Vcb->BSBM_Bitmap), lba)) {
                 AdPrint(("  bad block under FE @%x\n", lba));
                 goto relocate_FE;
             }
@@ -3957,9 +4301,13 @@ retry_flush_FE:
         // FileInfo->Dloc->FELoc.Length += UDFGetFileSize(FileInfo);
         // FileInfo->Dloc->FELoc.Length = FileInfo->Dloc->FileEntry->descCRCLength + sizeof(tag);
         UDFPrint(("descCRCLength %x\n", FileInfo->Dloc->FileEntry->descCRCLength));
-        status = UDFWriteExtent(
-            Vcb, &(FileInfo->Dloc->FELoc), 0, (uint32)(FileInfo->Dloc->FELoc.Length), FALSE,
-            (int8 *)(FileInfo->Dloc->FileEntry), &WrittenBytes);
+        if(UDFMetaBatchAddFE(Vcb, FileInfo->Dloc)) {
+            status = STATUS_SUCCESS;
+        } else {
+            status = UDFWriteExtent(
+                Vcb, &(FileInfo->Dloc->FELoc), 0, (uint32)(FileInfo->Dloc->FELoc.Length), FALSE,
+                (int8 *)(FileInfo->Dloc->FileEntry), &WrittenBytes);
+        }
         if(!OS_SUCCESS(status)) {
             UDFPrint(("  FlushFE: UDFWriteExtent(2) failed (%x)\n", status));
             if(status == STATUS_DEVICE_DATA_ERROR) {
@@ -4123,7 +4471,7 @@ UDFFlushFile__(
     }
 #ifdef UDF_CHECK_DISK_ALLOCATION
     if( FileInfo->Fcb &&
-        UDFGetFreeBit(((uint32*)(Vcb->FSBM_Bitmap)), FileInfo->Dloc->FELoc.Mapping[0].extLocation)) {
+        UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), FileInfo->Dloc->FELoc.Mapping[0].extLocation)) {
 
         if(UDFIsAStreamDir(FileInfo)) {
             if(!UDFIsSDirDeleted(FileInfo)) {
@@ -4354,24 +4702,41 @@ UDFReadTagged(
     )
 {
     OSSTATUS RC;
-    tag* PTag = (tag*)Buf;
-//    icbtag* Icb = (icbtag*)(Buf+1);
-    uint8 checksum;
-    unsigned int i;
     SIZE_T ReadBytes;
-    int8* tb;
 
     // Read the block
     if(Block == 0xFFFFFFFF)
         return NULL;
 
-    _SEH2_TRY {
-        RC = UDFReadSectors(Vcb, FALSE, Block, 1, FALSE, Buf, &ReadBytes);
-        if(!OS_SUCCESS(RC)) {
-            UDFPrint(("UDF: Block=%x, Location=%x: read failed\n", Block, Location));
-            try_return(RC);
-        }
+    RC = UDFReadSectors(Vcb, FALSE, Block, 1, FALSE, Buf, &ReadBytes);
+    if(!OS_SUCCESS(RC)) {
+        UDFPrint(("UDF: Block=%x, Location=%x: read failed\n", Block, Location));
+        return RC;
+    }
+    return UDFCheckTagged(Vcb, Buf, Block, Location, Ident);
+} // end UDFReadTagged()
 
+/*
+    Check the first block of a tagged descriptor, which is already
+    in memory (e.g. read by a coalesced multi-block request).
+*/
+OSSTATUS
+UDFCheckTagged(
+    PVCB Vcb,
+    int8* Buf,
+    uint32 Block,
+    uint32 Location,
+    uint16 *Ident
+    )
+{
+    OSSTATUS RC;
+    tag* PTag = (tag*)Buf;
+//    icbtag* Icb = (icbtag*)(Buf+1);
+    uint8 checksum;
+    unsigned int i;
+    int8* tb;
+
+    _SEH2_TRY {
         *Ident = PTag->tagIdent;
 
         if(Location != PTag->tagLocation) {
@@ -4423,7 +4788,7 @@ try_exit:    NOTHING;
     } _SEH2_END
 
     return RC;
-} // end UDFReadTagged()
+} // end UDFCheckTagged()
 
 /*
     This routine creates hard link for the file from DirInfo1
@@ -4470,6 +4835,7 @@ UDFHardLinkFile__(
 
     // PHASE 0
     // try to create new FileIdent & FileEntry in Dir2
+    UDFDirIndexInvalidateNegCache(DirInfo2->Dloc->DirIndex);
 
 HLinkRetry:
     if(!OS_SUCCESS(status = UDFCreateFile__(Vcb, IgnoreCase, fn, UDFGetFileEALength(FileInfo),
@@ -4837,7 +5203,7 @@ UDFRecordVAT(
     len = min(UDFPartLen(Vcb, PartNum), Vcb->FSBM_BitCount - root);
     len = min(Vcb->VatCount, len);
     for(i=0; i<len; i++) {
-        if(UDFGetFreeBit(Vcb->FSBM_Bitmap, root+i))
+        if(UDFSparseGetFreeBit(&(Vcb->FSBM_Bitmap), root+i))
             Vat[i] = UDF_VAT_FREE_ENTRY;
     }
     // Ok, now we shall construct new VAT image...
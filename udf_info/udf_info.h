@@ -47,7 +47,8 @@ OSSTATUS UDFReadExtent(IN PVCB Vcb,
                        IN SIZE_T Length,
                        IN BOOLEAN Direct,
                        OUT int8* Buffer,
-                       OUT PSIZE_T ReadBytes);
+                       OUT PSIZE_T ReadBytes,
+                       IN BOOLEAN NoCache = FALSE); // try to bypass WCache
 // builds mapping for specified amount of data at any offset from specified extent.
 OSSTATUS
 UDFReadExtentLocation(IN PVCB Vcb,
@@ -78,6 +79,26 @@ uint8    UDFBuildHashEntry(IN PVCB Vcb,
 #define HASH_ALL   0x07
 #define HASH_KEEP_NAME 0x08  // keep DOS '.' and '..' intact
 
+// calculate missing hashes for DirIndex entry (on demand)
+void     UDFDirIndexBuildHashes(IN PVCB Vcb,
+                                IN PDIR_INDEX_ITEM DirNdx,
+                                IN uint8 Mask);
+
+__inline
+void
+UDFDirIndexEnsureHashes(
+    IN PVCB Vcb,
+    IN PDIR_INDEX_ITEM DirNdx,
+    IN uint8 Mask
+    )
+{
+    if((DirNdx->HashMask & Mask) != Mask)
+        UDFDirIndexBuildHashes(Vcb, DirNdx, Mask);
+}
+
+#define UDFDirIndexInvalidateHashes(DirNdx) \
+    do { (DirNdx)->HashMask = 0; (DirNdx)->FI_Flags &= ~UDF_FI_FLAG_DOS; } while(0)
+
 // get dirindex's frame
 PDIR_INDEX_ITEM UDFDirIndexGetFrame(IN PDIR_INDEX_HDR hDirNdx,
                                     IN uint32 Frame,
@@ -86,6 +107,8 @@ PDIR_INDEX_ITEM UDFDirIndexGetFrame(IN PDIR_INDEX_HDR hDirNdx,
                                     IN uint_di Rel);
 // release DirIndex
 void UDFDirIndexFree(PDIR_INDEX_HDR hDirNdx);
+// drop negative lookup cache (must be called when a name is added to directory)
+void UDFDirIndexInvalidateNegCache(IN PDIR_INDEX_HDR hDirNdx);
 // grow DirIndex
 OSSTATUS UDFDirIndexGrow(IN PDIR_INDEX_HDR* _hDirNdx,
                          IN uint_di d);
@@ -121,6 +144,17 @@ __inline OSSTATUS UDFFindFile__(IN PVCB Vcb,
     uint_di i=0;
     return UDFFindFile(Vcb, IgnoreCase, TRUE, Name, DirInfo, &i);
 }
+// search for already opened file, DirInfo may be locked shared
+PUDF_FILE_INFO UDFFindOpenedFile(IN PVCB Vcb,
+                                 IN BOOLEAN IgnoreCase,
+                                 IN PUNICODE_STRING Name,
+                                 IN PUDF_FILE_INFO DirInfo,
+                                 IN uint_di* IndexHint = NULL);
+// check if cached DirIndex position still refers to the Name
+BOOLEAN UDFDirIndexCheckHint(IN PUDF_FILE_INFO DirInfo,
+                             IN PUNICODE_STRING Name,
+                             IN uint_di Index,
+                             IN lb_addr* FileEntryLoc = NULL);
 
 // calculate file mapping length (in bytes) including ZERO-terminator
 uint32   UDFGetMappingLength(IN PEXTENT_MAP Extent);
@@ -152,13 +186,25 @@ PEXTENT_MAP UDFReadMappingFromXEntry(IN PVCB Vcb,
                                      IN uint32 PartNum,
                                      IN tag* XEntry,
                                      IN OUT uint32* Offset,
-                                     OUT PEXTENT_INFO AllocLoc);
+                                     OUT PEXTENT_INFO AllocLoc,
+                                     IN int8* AllocDescsBuf = NULL);
 // read FileEntry described in FileIdentDesc
 OSSTATUS UDFReadFileEntry(IN PVCB Vcb,
 //                          IN PFILE_IDENT_DESC FileDesc,
                           IN long_ad* Icb,
                        IN OUT PFILE_ENTRY FileEntry, // here we can also get ExtendedFileEntry
                        IN OUT uint16* Ident);
+// validate FileEntry in cached block & return exactly sized copy of it
+// and temporary copy of its AllocDescs (in AdBuf if they fit)
+OSSTATUS UDFReadFileEntryInPlace(IN PVCB Vcb,
+                                 IN long_ad* Icb,
+                                 OUT tag** FileEntry, // here we can also get ExtendedFileEntry
+                                 OUT int8** AllocDescs,
+                                 IN int8* AdBuf,
+                                 IN uint32 AdBufLen,
+                                 IN OUT uint16* Ident);
+// AllocDescs of most files fit into this stack buffer of UDFOpenFile__()
+#define UDF_FE_AD_STACK_BUF     256
 // scan FileSet sequence & return last valid FileSet
 OSSTATUS UDFFindLastFileSet(IN PVCB Vcb,
                             IN lb_addr *Addr,  // Addr for the 1st FileSet
@@ -275,6 +321,47 @@ void     UDFCheckSpaceAllocation_(IN PVCB Vcb,
 #define UDFCheckSpaceAllocation(Vcb, FileInfo, Map, asXXX) {;}
 #endif //UDF_CHECK_DISK_ALLOCATION
 
+// remember that FSBM was changed in specified range
+void
+UDFSetBitmapDirty(
+    IN PVCB Vcb,
+    IN uint32 lba,
+    IN uint32 len
+    );
+
+// check if FSBM was changed in specified range since last flush
+BOOLEAN
+UDFIsBitmapRangeDirty(
+    IN PVCB Vcb,
+    IN uint32 lba,
+    IN uint32 len
+    );
+
+// count free blocks in FSBM in specified range
+uint32
+__fastcall
+UDFCountFreeBits(
+    IN int8* bm,
+    IN uint32 lba,
+    IN uint32 len
+    );
+
+// account range which is about to be marked as Used/Freed
+// in per-partition free block counters
+void
+UDFUpdatePartFreeCount(
+    IN PVCB Vcb,
+    IN uint32 lba,
+    IN uint32 len,
+    IN BOOLEAN asUsed
+    );
+
+// rebuild per-partition free block counters from FSBM
+void
+UDFRecountPartFreeSpace(
+    IN PVCB Vcb
+    );
+
 // mark space described by Mapping as Used/Freed (optionaly)
 // this routine doesn't acquire any resource
 void
@@ -346,6 +433,10 @@ uint32 __fastcall
 UDFGetPartFreeSpace(IN PVCB Vcb,
                            IN uint32 partNum);
 
+uint32
+UDFGetPartFreeSpaceLVID(IN PVCB Vcb,
+                        IN uint32 partNum);
+
 #define UDF_PREALLOC_CLASS_FE    0x00
 #define UDF_PREALLOC_CLASS_DIR   0x01
 
@@ -447,12 +538,15 @@ OSSTATUS UDFBuildFreeSpaceBitmap(IN PVCB Vcb,
                                 IN uint32 PartNdx,
                                 IN PPARTITION_HEADER_DESC phd,
                                 IN uint32 Lba);
+// build FreeSpaceBitmap postponed by UDFBuildFreeSpaceBitmap() (if any)
+OSSTATUS UDFLoadDeferredFreeSpaceBitmap(IN PVCB Vcb);
 // fill ExtentInfo for specified FileEntry
 OSSTATUS UDFLoadExtInfo(IN PVCB Vcb,
                         IN PFILE_ENTRY fe,
                         IN PLONG_AD fe_loc,
                         IN OUT PEXTENT_INFO FExtInfo,
-                        IN OUT PEXTENT_INFO AExtInfo);
+                        IN OUT PEXTENT_INFO AExtInfo,
+                        IN int8* AllocDescs = NULL);
 // convert standard Unicode to compressed
 void
 __fastcall UDFCompressUnicode(IN PUNICODE_STRING UName,
@@ -513,7 +607,8 @@ OSSTATUS UDFWriteExtent(IN PVCB Vcb,
                         IN BOOLEAN Direct,         // setting this flag delays flushing of given
                                                    // data to indefinite term
                         IN int8* Buffer,
-                        OUT PSIZE_T WrittenBytes);
+                        OUT PSIZE_T WrittenBytes,
+                        IN BOOLEAN NoCache = FALSE); // try to bypass WCache
 
 // deallocate/zero data at any offset from specified extent.
 OSSTATUS UDFZeroExtent(IN PVCB Vcb,
@@ -611,7 +706,8 @@ OSSTATUS UDFWriteFile__(IN PVCB Vcb,
                         IN SIZE_T Length,
                         IN BOOLEAN Direct,
                         IN int8* Buffer,
-                        OUT PSIZE_T WrittenBytes);
+                        OUT PSIZE_T WrittenBytes,
+                        IN BOOLEAN NoCache = FALSE); // try to bypass WCache
 // mark file as deleted & decrease file link counter.
 OSSTATUS UDFUnlinkFile__(IN PVCB Vcb,
                          IN PUDF_FILE_INFO FileInfo,
@@ -658,11 +754,12 @@ OSSTATUS UDFReadFile__(IN PVCB Vcb,
                        IN SIZE_T Length,
                        IN BOOLEAN Direct,
                        OUT int8* Buffer,
-                       OUT PSIZE_T ReadBytes)
+                       OUT PSIZE_T ReadBytes,
+                       IN BOOLEAN NoCache = FALSE) // try to bypass WCache
 {
     ValidateFileInfo(FileInfo);
 
-    return UDFReadExtent(Vcb, &(FileInfo->Dloc->DataLoc), Offset, Length, Direct, Buffer, ReadBytes);
+    return UDFReadExtent(Vcb, &(FileInfo->Dloc->DataLoc), Offset, Length, Direct, Buffer, ReadBytes, NoCache);
 } // end UDFReadFile__()*/
 
 /*
@@ -720,6 +817,21 @@ OSSTATUS UDFPrepareXSpaceBitmap(IN PVCB Vcb,
 OSSTATUS UDFUpdateXSpaceBitmaps(IN PVCB Vcb,
                                 IN uint32 PartNum,
                                 IN PPARTITION_HEADER_DESC phd); // partition header pointing to Bitmaps
+// update only modified blocks of recorded Freed or Unallocated space bitmap
+OSSTATUS UDFUpdateXSpaceBitmapBlocks(IN PVCB Vcb,
+                                     IN PSHORT_AD XSpaceBitmap,
+                                     IN uint32 pstart,
+                                     IN uint32 pend);
+// write two-level bitmap to the extent as is
+OSSTATUS UDFWriteSparseBitmapExtent(IN PVCB Vcb,
+                                    IN PEXTENT_INFO ExtInfo,
+                                    IN int64 Offset,
+                                    IN uint32 Length,
+                                    IN PUDF_SPARSE_BITMAP bm);
+// drop dirty marks from FSBM chunks equal to their last flushed state
+BOOLEAN  UDFTrimBitmapDirtyMap(IN PVCB Vcb);
+// make current FSBM the reference for the next flush
+void     UDFSyncOldBitmap(IN PVCB Vcb);
 // update Partition Desc & associated data structures
 OSSTATUS UDFUpdatePartDesc(PVCB Vcb,
                            int8* Buf);
@@ -785,6 +897,12 @@ PDIR_INDEX_HDR UDFGetDirIndexByFileInfo(IN PUDF_FILE_INFO FileInfo);
     (((FileInfo)->Dloc->DataLoc.Mapping) ? UDFGetExtentLength((FileInfo)->Dloc->DataLoc.Mapping) : Vcb->LBlockSize)
 // check if the directory is empty
 BOOLEAN  UDFIsDirEmpty(IN PDIR_INDEX_HDR hCurDirNdx);
+// collect FileEntries written by current thread and write them
+// sorted by LBA when the outermost batch is closed
+#define UDF_META_BATCH_MAX   64
+BOOLEAN  UDFMetaBatchBegin(IN PVCB Vcb);
+OSSTATUS UDFMetaBatchEnd(IN PVCB Vcb);
+OSSTATUS UDFMetaBatchFlush(IN PVCB Vcb);
 // flush FE
 OSSTATUS UDFFlushFE(IN PVCB Vcb,
                     IN PUDF_FILE_INFO FileInfo,
@@ -854,6 +972,12 @@ OSSTATUS UDFReadTagged(IN PVCB Vcb,
                        IN uint32 Block,
                        IN uint32 Location,
                        OUT uint16 *Ident);
+// check the first block of a tagged descriptor already read to Buf
+OSSTATUS UDFCheckTagged(IN PVCB Vcb,
+                        IN int8* Buf,
+                        IN uint32 Block,
+                        IN uint32 Location,
+                        OUT uint16 *Ident);
 // get physycal Lba for partition-relative addr
 uint32
 __fastcall UDFPartLbaToPhys(IN PVCB Vcb,
@@ -885,6 +1009,10 @@ OSSTATUS UDFLoadLogicalVol(PDEVICE_OBJECT DeviceObject,
 // process Partition descriptor
 OSSTATUS UDFLoadPartDesc(PVCB      Vcb,
                          int8*     Buf);
+// read a range of fs structures into cache with a single request
+VOID     UDFPrefetchBlocks(IN PVCB Vcb,
+                           IN uint32 Lba,
+                           IN uint32 BCount);
 // scan VDS & fill special array
 OSSTATUS UDFReadVDS(IN PVCB Vcb,
                     IN uint32 block,
@@ -1119,6 +1247,124 @@ UDFDirIndex(
 #define UDFSetZeroBits(arr,bit,bc)  UDFSetBits(arr,bit,bc)
 #define UDFClrZeroBits(arr,bit,bc)  UDFClrBits(arr,bit,bc)
 
+// two-level bitmap, see UDF_SPARSE_BITMAP
+OSSTATUS
+UDFSparseBitmapInit(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 BitCount,
+    IN POOL_TYPE PoolType,
+    IN BOOLEAN Collapse
+    );
+
+VOID
+UDFSparseBitmapFree(
+    IN PUDF_SPARSE_BITMAP bm
+    );
+
+BOOLEAN
+UDFSparseChangeBits(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit,
+    IN uint32 bc,
+    IN BOOLEAN Set
+    );
+
+// allocates leaves UDFSparseChangeBits() needs for the same arguments
+BOOLEAN
+UDFSparseReserveBits(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit,
+    IN uint32 bc,
+    IN BOOLEAN Set
+    );
+
+// returns first set bit in [bit, lim) or lim if there is no one
+uint32
+UDFSparseFindNextSet(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit,
+    IN uint32 lim
+    );
+
+__inline
+BOOLEAN
+UDFSparseGetBit(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit
+    )
+{
+    uint32* leaf;
+
+    if(!bm->Leaf || bit >= bm->BitCount)
+        return FALSE;
+    leaf = bm->Leaf[bit >> UDF_SBM_LEAF_SH];
+    if(leaf <= UDF_SBM_LEAF_ALL_SET)
+        return (leaf == UDF_SBM_LEAF_ALL_SET);
+    return UDFGetBit(leaf, bit & (UDF_SBM_LEAF_BITS-1));
+} // end UDFSparseGetBit()
+
+#define UDFSparseBitmapInited(bm)       ((bm)->Leaf != NULL)
+#define UDFSparseSetBit(bm,bit)         UDFSparseChangeBits(bm,bit,1,TRUE)
+#define UDFSparseClrBit(bm,bit)         UDFSparseChangeBits(bm,bit,1,FALSE)
+#define UDFSparseSetBits(bm,bit,bc)     UDFSparseChangeBits(bm,bit,bc,TRUE)
+#define UDFSparseClrBits(bm,bit,bc)     UDFSparseChangeBits(bm,bit,bc,FALSE)
+#define UDFSparseTestBits(bm,bit,bc)    (UDFSparseFindNextSet(bm,bit,(bit)+(bc)) < (bit)+(bc))
+
+// get 32 bits starting from arbitrary position
+uint32
+UDFSparseGetWord(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit
+    );
+
+SIZE_T
+UDFSparseGetBitmapLen(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 Offs,
+    IN uint32 Lim          // NOT included
+    );
+
+uint32
+UDFSparseCountSet(
+    IN PUDF_SPARSE_BITMAP bm,
+    IN uint32 bit,
+    IN uint32 bc
+    );
+
+BOOLEAN
+UDFSparseCopyBits(
+    IN PUDF_SPARSE_BITMAP dst,
+    IN PUDF_SPARSE_BITMAP src,
+    IN uint32 bit,
+    IN uint32 bc
+    );
+
+// returns TRUE if ranges are equal
+BOOLEAN
+UDFSparseCompareBits(
+    IN PUDF_SPARSE_BITMAP bm1,
+    IN PUDF_SPARSE_BITMAP bm2,
+    IN uint32 bit,
+    IN uint32 bc
+    );
+
+// FSBM (set - free, clear - used) & ZSBM (set - zero-filled) are kept
+// in two-level form
+#define UDFSparseGetFreeBit(bm,bit)         UDFSparseGetBit(bm,bit)
+#define UDFSparseGetUsedBit(bm,bit)         (!UDFSparseGetBit(bm,bit))
+#define UDFSparseSetFreeBit(bm,bit)         UDFSparseSetBit(bm,bit)
+#define UDFSparseSetUsedBit(bm,bit)         UDFSparseClrBit(bm,bit)
+#define UDFSparseSetFreeBits(bm,bit,bc)     UDFSparseSetBits(bm,bit,bc)
+#define UDFSparseSetUsedBits(bm,bit,bc)     UDFSparseClrBits(bm,bit,bc)
+#define UDFSparseReserveFreeBits(bm,bit,bc) UDFSparseReserveBits(bm,bit,bc,TRUE)
+#define UDFSparseReserveUsedBits(bm,bit,bc) UDFSparseReserveBits(bm,bit,bc,FALSE)
+
+#define UDFSparseGetZeroBit(bm,bit)         UDFSparseGetBit(bm,bit)
+#define UDFSparseSetZeroBit(bm,bit)         UDFSparseSetBit(bm,bit)
+#define UDFSparseClrZeroBit(bm,bit)         UDFSparseClrBit(bm,bit)
+#define UDFSparseSetZeroBits(bm,bit,bc)     UDFSparseSetBits(bm,bit,bc)
+#define UDFSparseClrZeroBits(bm,bit,bc)     UDFSparseClrBits(bm,bit,bc)
+
 #if defined UDF_DBG
   #ifdef UDF_TRACK_ONDISK_ALLOCATION_OWNERS
     #define UDFSetFreeBitOwner(Vcb, i) (Vcb)->FSBM_Bitmap_owners[i] = 0;
@@ -1224,17 +1470,11 @@ UDFVFlush(
     IN PVCB Vcb
     );
 
-__inline
 BOOLEAN
 __fastcall UDFVIsStored(
     IN PVCB Vcb,
     IN lba_t lba
-    )
-{
-    if(!Vcb->VerifyCtx.VInited)
-        return FALSE;
-    return UDFGetBit(Vcb->VerifyCtx.StoredBitMap, lba);
-} // end UDFVIsStored()
+    );
 
 BOOLEAN
 __fastcall
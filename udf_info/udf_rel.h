@@ -91,6 +91,7 @@ typedef struct _UDFPartMap
     uint16  PartitionType;
     uint16  PartitionNum;
     uint16  VolumeSeqNum;
+    uint32  FreeBlocks;   // free blocks in FSBM, see UDFGetPartFreeSpace()
 } UDFPartMap, *PUDFPartMap;
 
 
@@ -131,6 +132,32 @@ typedef struct _HASH_ENTRY {
     uint32 hPosix;                     // hash for Posix Lfn
 } HASH_ENTRY, *PHASH_ENTRY;
 
+/**
+    Negative lookup cache. Keeps names recently looked up in the
+    directory and not found, so repeated misses do not scan the whole
+    DirIndex. The Bloom filter (over hLfn) rejects other names at once,
+    entries keep exact name copies in LRU order (Entry[0] is the most
+    recent one). Only misses of NotDeleted lookups are cached, so only
+    adding a name can make an entry stale. The cache is dropped by
+    UDFDirIndexInvalidateNegCache() when a name is created.
+*/
+#define UDF_NEG_CACHE_SIZE      8
+#define UDF_NEG_CACHE_MAX_NAME  64      // in WCHARs, longer names are not cached
+
+typedef struct _DIR_NEG_CACHE_ENTRY {
+    uint32      hLfn;
+    uint32      hPosix;
+    uint16      Length;                 // in bytes
+    BOOLEAN     IgnoreCase;
+    WCHAR       Name[UDF_NEG_CACHE_MAX_NAME];
+} DIR_NEG_CACHE_ENTRY, *PDIR_NEG_CACHE_ENTRY;
+
+typedef struct _DIR_NEG_CACHE {
+    uint64      Bloom;
+    uint32      Count;
+    DIR_NEG_CACHE_ENTRY Entry[UDF_NEG_CACHE_SIZE];
+} DIR_NEG_CACHE, *PDIR_NEG_CACHE;
+
 typedef struct _DIR_INDEX_HDR {
     uint_di     FirstFree;
     uint_di     LastUsed;
@@ -140,6 +167,7 @@ typedef struct _DIR_INDEX_HDR {
     EXTENT_INFO FECharge;        // file entry charge
     EXTENT_INFO FEChargeSDir;    // file entry charge for streams
     ULONG       DIFlags;
+    PDIR_NEG_CACHE NegCache;     // allocated on first cached miss
 //    struct _DIR_INDEX_ITEM* FrameList[0];
 } DIR_INDEX_HDR, *PDIR_INDEX_HDR;
 
@@ -197,6 +225,14 @@ typedef struct _DIR_INDEX_ITEM {
     than one FileIdent. It happends when we use HardLinks.
 */
     uint8 FI_Flags;                    // FileIdent-related flags
+/**
+    Set of HASH_XXX bits telling which members of #hashes  (and
+    #UDF_FI_FLAG_DOS) are already valid. Hashes are  not  built
+    while indexing the directory, they are calculated on demand
+    by UDFDirIndexBuildHashes(). Must be reset  with
+    UDFDirIndexInvalidateHashes() when #FName is changed.
+*/
+    uint8 HashMask;                    // valid hashes
 /**
     Points to FileInfo structure for  opened  files.  This  field
     must be NULL if the file is not opened.
@@ -224,6 +260,8 @@ typedef struct _DIR_INDEX_ITEM {
 
 #define UDF_FI_FLAG_DOS          (0x10)// Lfn-style name is equal to DOS-style (case insensetive)
 #define UDF_FI_FLAG_KEEP_NAME    (0x20)
+/// Cached attributes of linked entry were just loaded by UDFLoadDirInfoBatch() & need not be re-read
+#define UDF_FI_FLAG_ATTR_FRESH   (0x40)
 
 #define UDF_DATALOC_INFO_MT PagedPool
 
@@ -319,6 +357,15 @@ typedef struct _UDF_DATALOC_INFO {
     struct _UDF_FILE_INFO* SDirInfo;
 } UDF_DATALOC_INFO, *PUDF_DATALOC_INFO;
 
+/**
+    FileEntry collected by UDFMetaBatchAddFE()
+*/
+typedef struct _UDF_META_BATCH_ITEM {
+    uint32            Lba;
+    uint32            Length;      // FE bytes, the rest of the block is preserved
+    PUDF_DATALOC_INFO Dloc;
+} UDF_META_BATCH_ITEM, *PUDF_META_BATCH_ITEM;
+
 /// Was modified & should be flushed
 #define UDF_FE_FLAG_FE_MODIFIED  (0x01)
 /// File contains Stream Dir
@@ -540,10 +587,31 @@ typedef struct _UDF_ALLOCATION_CACHE_ITEM {
 
 #endif //UDF_DBG
 
+/*
+    Two-level block bitmap. Top level holds one pointer per leaf of
+    UDF_SBM_LEAF_BITS bits. Leaves with all bits clear (or all set) are
+    not allocated and are represented by special pointer values, so
+    memory usage depends on number of mixed regions rather than on
+    volume size.
+ */
+#define UDF_SBM_LEAF_SH         15
+#define UDF_SBM_LEAF_BITS       (1 << UDF_SBM_LEAF_SH)
+#define UDF_SBM_LEAF_ALL_CLR    ((uint32*)0)
+#define UDF_SBM_LEAF_ALL_SET    ((uint32*)1)
+
+typedef struct _UDF_SPARSE_BITMAP {
+    uint32**   Leaf;        // top level, followed by uint16 SetCount[LeafCount]
+    uint32     LeafCount;
+    uint32     BitCount;
+    POOL_TYPE  PoolType;
+    BOOLEAN    Collapse;    // release leaves when they become uniform
+} UDF_SPARSE_BITMAP, *PUDF_SPARSE_BITMAP;
+
 typedef struct _UDF_VERIFY_CTX {
-    uint8*     StoredBitMap;
+    UDF_SPARSE_BITMAP StoredBitMap;
     ULONG      ItemCount;
     LIST_ENTRY vrfList;
+    PLIST_ENTRY HashTable;
     ERESOURCE  VerifyLock;
     KEVENT     vrfEvent;
     uint32     WaiterCount;
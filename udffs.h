@@ -88,13 +88,32 @@
 
 //#define UDF_ALLOW_PRETEND_DELETED
 
+// collect ERESOURCE contention statistics (see IOCTL_UDF_GET_LOCK_PROFILE)
+//#define UDF_LOCK_PROFILER
+
 #define UDF_DEFAULT_BM_FLUSH_TIMEOUT 16         // seconds
 #define UDF_DEFAULT_TREE_FLUSH_TIMEOUT 5        // seconds
 
+// non-cached transfers of at least this size (bytes) bypass WCache
+// on random-writable media, see UDFWriteDataNoCache()
+#define UDF_DIRECT_IO_THRESHOLD     (64*1024)
+
 #define UDF_DEFAULT_FSP_THREAD_PER_CPU  (4)
 #define UDF_FSP_THREAD_PER_CPU (Vcb->ThreadsPerCpu)
 #define FSP_PER_DEVICE_THRESHOLD (UDFGlobalData.CPU_Count*UDF_FSP_THREAD_PER_CPU)
 
+// requests waiting for a free FSP worker are kept in per-CPU queues
+// of the following priority classes (lower value is served first)
+#define UDF_FSP_CLASS_PAGING        0
+#define UDF_FSP_CLASS_METADATA      1
+#define UDF_FSP_CLASS_USER          2
+#define UDF_FSP_CLASS_BACKGROUND    3
+#define UDF_FSP_CLASSES             4
+#define UDF_FSP_MAX_SHARDS          8
+// requests waiting longer than this (100ns units) are served before
+// younger requests of higher priority classes, see UDFFspDequeue()
+#define UDF_FSP_AGING_TIME          (200*10000)   // 200 ms
+
 /************* END OF OPTIONS **************/
 
 // Common include files - should be in the include dir of the MS supplied IFS Kit
@@ -283,6 +302,47 @@ UDFFreePool(
 */
 #endif //UDF_DBG
 
+#include "udfpubl.h"
+#include "dldetect.h"
+
+#ifdef UDF_LOCK_PROFILER
+
+#undef UDFAcquireResourceExclusive
+#undef UDFAcquireResourceShared
+#undef UDFReleaseResource
+#undef UDFDeleteResource
+#undef UDFConvertExclusiveToSharedLite
+#undef UDFInitializeResourceLite
+#undef UDFAcquireSharedStarveExclusive
+#undef UDFAcquireSharedWaitForExclusive
+
+#define UDFAcquireResourceExclusive(Resource,CanWait)  \
+    (DLDProfAcquire((Resource),(CanWait),DLD_PROF_EXCLUSIVE,UDF_BUG_CHECK_ID,__LINE__))
+#define UDFAcquireResourceShared(Resource,CanWait) \
+    (DLDProfAcquire((Resource),(CanWait),DLD_PROF_SHARED,UDF_BUG_CHECK_ID,__LINE__))
+#define UDFReleaseResource(Resource)    \
+    (DLDProfRelease((Resource)))
+#define UDFDeleteResource(Resource)    \
+    (DLDProfDeleteResource((Resource)))
+#define UDFConvertExclusiveToSharedLite(Resource) \
+    (DLDProfConvertExclusiveToShared((Resource)))
+#define UDFInitializeResourceLite(Resource) \
+    (DLDProfInitializeResource((Resource),DLD_PROF_OTHER))
+#define UDFAcquireSharedStarveExclusive(Resource,CanWait) \
+    (DLDProfAcquire((Resource),(CanWait),DLD_PROF_STARVE_EXCL,UDF_BUG_CHECK_ID,__LINE__))
+#define UDFAcquireSharedWaitForExclusive(Resource,CanWait) \
+    (DLDProfAcquire((Resource),(CanWait),DLD_PROF_WAIT_EXCL,UDF_BUG_CHECK_ID,__LINE__))
+
+// assign lock class to initialized resource
+#define UDFProfileResource(Resource,Class) \
+    DLDProfSetClass((Resource),(Class))
+
+#else //UDF_LOCK_PROFILER
+
+#define UDFProfileResource(Resource,Class)
+
+#endif //UDF_LOCK_PROFILER
+
 #define UDFRaiseStatus(IC,S) {                              \
     (IC)->ExceptionCode = (S);                              \
     ExRaiseStatus( (S) );                                   \
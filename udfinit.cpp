@@ -58,6 +58,7 @@ DriverEntry(
     NTSTATUS        RC = STATUS_SUCCESS;
     BOOLEAN         InternalMMInitialized = FALSE;
     HKEY            hUdfRootKey;
+    ULONG           i;
 
     _SEH2_TRY {
         _SEH2_TRY {
@@ -98,6 +99,12 @@ DriverEntry(
             }
             InternalMMInitialized = TRUE;
 
+#ifdef UDF_LOCK_PROFILER
+            if(!DLDProfInit()) {
+                UDFPrint(("UDF: lock profiler is disabled\n"));
+            }
+#endif //UDF_LOCK_PROFILER
+
             // before we proceed with any more initialization, read in
             //  user supplied configurable values ...
 
@@ -114,14 +121,28 @@ DriverEntry(
             RtlInitUnicodeString(&UDFGlobalData.UnicodeStrSDir, L":");
             RtlInitUnicodeString(&UDFGlobalData.AclName, UDF_SN_NT_ACL);
 
+            UDFGlobalData.CPU_Count = KeNumberProcessors;
+
             UDFPrint(("UDF: Init delayed close queues\n"));
 #ifdef UDF_DELAYED_CLOSE
-            InitializeListHead( &UDFGlobalData.DelayedCloseQueue );
-            InitializeListHead( &UDFGlobalData.DirDelayedCloseQueue );
-
-            ExInitializeWorkItem( &UDFGlobalData.CloseItem,
-                                  UDFDelayedClose,
-                                  NULL );
+            // one shard per CPU
+            UDFGlobalData.DelayedCloseShardCount = UDFGlobalData.CPU_Count;
+            UDFGlobalData.DelayedCloseShards = (PUDF_DELAYED_CLOSE_SHARD)
+                MyAllocatePool__(NonPagedPool, UDFGlobalData.DelayedCloseShardCount*sizeof(UDF_DELAYED_CLOSE_SHARD));
+            if(!UDFGlobalData.DelayedCloseShards) try_return (RC = STATUS_INSUFFICIENT_RESOURCES);
+            RtlZeroMemory(UDFGlobalData.DelayedCloseShards, UDFGlobalData.DelayedCloseShardCount*sizeof(UDF_DELAYED_CLOSE_SHARD));
+
+            for(i=0; i<UDFGlobalData.DelayedCloseShardCount; i++) {
+                PUDF_DELAYED_CLOSE_SHARD Shard = &UDFGlobalData.DelayedCloseShards[i];
+
+                KeInitializeSpinLock( &Shard->Lock );
+                InitializeListHead( &Shard->DelayedCloseQueue );
+                InitializeListHead( &Shard->DirDelayedCloseQueue );
+
+                ExInitializeWorkItem( &Shard->CloseItem,
+                                      UDFDelayedClose,
+                                      Shard );
+            }
 
             UDFGlobalData.DelayedCloseCount = 0;
             UDFGlobalData.DirDelayedCloseCount = 0;
@@ -152,8 +173,6 @@ DriverEntry(
             if (!NT_SUCCESS(RC))
                 try_return(RC);
 
-            UDFGlobalData.CPU_Count = KeNumberProcessors;
-
             UDFPrint(("UDF: Create CD dev obj\n"));
             if (!NT_SUCCESS(RC = UDFCreateFsDeviceObject(UDF_FS_NAME_CD,
                                     DriverObject,
@@ -199,6 +218,15 @@ DriverEntry(
             UDFPrint(("UDF: failed with status %x\n", RC));
             // Now, delete any device objects, etc. we may have created
 
+#ifdef UDF_LOCK_PROFILER
+            DLDProfFree();
+#endif //UDF_LOCK_PROFILER
+#ifdef UDF_DELAYED_CLOSE
+            if (UDFGlobalData.DelayedCloseShards) {
+                MyFreePool__(UDFGlobalData.DelayedCloseShards);
+                UDFGlobalData.DelayedCloseShards = NULL;
+            }
+#endif //UDF_DELAYED_CLOSE
             if (InternalMMInitialized) {
                 MyAllocRelease();
             }
@@ -343,12 +371,12 @@ UDFInitializeFunctionPointers(
     PtrFastIoDispatch->AcquireForCcFlush        = UDFFastIoAcqCcFlush;
     PtrFastIoDispatch->ReleaseForCcFlush        = UDFFastIoRelCcFlush;
 
-/*    // MDL functionality
+    // MDL functionality
 
-    PtrFastIoDispatch->MdlRead                  = UDFFastIoMdlRead;
-    PtrFastIoDispatch->MdlReadComplete          = UDFFastIoMdlReadComplete;
+    PtrFastIoDispatch->MdlRead                  = FsRtlMdlReadDev;
+    PtrFastIoDispatch->MdlReadComplete          = FsRtlMdlReadCompleteDev;
     PtrFastIoDispatch->PrepareMdlWrite          = UDFFastIoPrepareMdlWrite;
-    PtrFastIoDispatch->MdlWriteComplete         = UDFFastIoMdlWriteComplete;*/
+    PtrFastIoDispatch->MdlWriteComplete         = FsRtlMdlWriteCompleteDev;
 
     //  this FSD does not support compressed read/write functionality,
     //  NTFS does, and if we design a FSD that can provide such functionality,
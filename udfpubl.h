@@ -48,6 +48,8 @@ Environment:
 #define IOCTL_UDF_IS_VOLUME_JUST_MOUNTED        CTL_CODE(IOCTL_UDFFS_BASE, 0x000d, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_UDF_REGISTER_AUTOFORMAT           CTL_CODE(IOCTL_UDFFS_BASE, 0x000e, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_UDF_SET_OPTIONS                   CTL_CODE(IOCTL_UDFFS_BASE, 0x000f, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_UDF_GET_PERF_COUNTERS             CTL_CODE(IOCTL_UDFFS_BASE, 0x0010, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_UDF_GET_LOCK_PROFILE              CTL_CODE(IOCTL_UDFFS_BASE, 0x0011, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
 typedef struct _UDF_GET_FILE_ALLOCATION_MODE_OUT {
 
@@ -115,6 +117,108 @@ typedef struct _UDF_GET_VERSION_OUT {
 #define UDF_USER_FS_FLAGS_PART_RO        0x0100     // partition is r/o
 #define UDF_USER_FS_FLAGS_NEW_FS_RO      0x0200
 
+// Returned by IOCTL_UDF_GET_PERF_COUNTERS (FSCTL on a volume).
+// New counters are appended to the end, header.Length tells the caller
+// how many bytes are valid. Times are in 100ns units.
+#define UDF_PERF_MAX_ALLOC_CLASSES  16
+// MountPhaseTime[] order: anchor, VRS, VDS (incl. the following 4 phases),
+// LVID, sparing tables, free space bitmap, VAT, fileset.
+#define UDF_PERF_MOUNT_PHASES       8
+// FspClass[] order: paging I/O, metadata, user I/O & flush, background
+#define UDF_PERF_FSP_CLASSES        4
+// ObjPool[] order: FCB, CCB, Dloc. Hit rate is Hits/Allocs
+#define UDF_PERF_OBJ_POOLS          3
+
+typedef struct _UDF_PERF_COUNTERS_OUT {
+    struct {
+        ULONG                     Length;
+    } header;
+    // delayed close queues
+    ULONG                     DelayedCloseShards;
+    ULONG                     DelayedCloseWorkers;
+    ULONG                     DelayedCloseDepth;
+    ULONG                     DirDelayedCloseDepth;
+    ULONGLONG                 DelayedCloseDrained;
+    ULONGLONG                 DelayedCloseDrainTime;
+    ULONGLONG                 DelayedCloseMaxDrainTime;
+    // internal allocator size classes (zero if not used)
+    ULONG                     AllocClasses;
+    struct {
+        ULONG                 Size;
+        ULONG                 LiveBytes;
+        ULONG                 PeakBytes;
+        ULONG                 Pages;
+    } AllocClass[UDF_PERF_MAX_ALLOC_CLASSES];
+    // last mount (or remount) of this volume
+    ULONG                     MountPhases;
+    ULONGLONG                 MountPhaseTime[UDF_PERF_MOUNT_PHASES];
+    // posted request queues of this volume
+    ULONG                     FspClasses;
+    ULONG                     FspWorkers;
+    ULONG                     FspMaxWorkers;
+    ULONG                     FspShards;
+    ULONGLONG                 FspSteals;
+    struct {
+        ULONG                 Depth;
+        ULONG                 MaxDepth;
+        ULONGLONG             Dispatched;
+        ULONGLONG             WaitTime;
+        ULONGLONG             MaxWaitTime;
+    } FspClass[UDF_PERF_FSP_CLASSES];
+    // write cache packet updates (Read/Modify/Write), packet rewrites
+    // per MB written is WCachePacketWrites*0x100000/WCacheBytesWritten
+    ULONGLONG                 WCachePacketWrites;
+    ULONGLONG                 WCachePacketReads;
+    ULONGLONG                 WCacheBytesWritten;
+    // open-file metadata object pools
+    ULONG                     ObjPools;
+    struct {
+        ULONG                 Size;
+        ULONG                 Live;
+        ULONGLONG             Allocs;
+        ULONGLONG             Hits;     // served from per-CPU stack
+    } ObjPool[UDF_PERF_OBJ_POOLS];
+} UDF_PERF_COUNTERS_OUT, *PUDF_PERF_COUNTERS_OUT;
+
+// Returned by IOCTL_UDF_GET_LOCK_PROFILE (FSCTL on a volume) if driver was
+// built with UDF_LOCK_PROFILER. Class[] order: other, VCBResource,
+// BitMapResource1, DlocResource, IoResource, PreallocResource, WCacheLock,
+// FCB MainResource, FCB PagingIoResource.
+// Histogram bucket 0 counts events shorter than 1us, bucket i>0 counts
+// events in [2^(i-1), 2^i) us, the last bucket counts all longer events.
+// Hold time is measured for exclusive ownership only.
+#define UDF_LOCK_PROF_CLASSES       9
+#define UDF_LOCK_PROF_BUCKETS       20
+#define UDF_LOCK_PROF_SITES         8
+
+typedef struct _UDF_LOCK_PROF_SITE {
+    ULONG                     BugCheckId;     // source file id
+    ULONG                     Line;
+    ULONG                     Contentions;
+    ULONG                     Reserved;
+    ULONGLONG                 WaitTime;
+} UDF_LOCK_PROF_SITE, *PUDF_LOCK_PROF_SITE;
+
+typedef struct _UDF_LOCK_PROF_CLASS {
+    ULONGLONG                 Acquired;
+    ULONGLONG                 Contended;      // had to wait
+    ULONGLONG                 Failed;         // busy and CanWait == FALSE
+    ULONGLONG                 WaitTime;
+    ULONGLONG                 HoldTime;
+    ULONG                     WaitHist[UDF_LOCK_PROF_BUCKETS];
+    ULONG                     HoldHist[UDF_LOCK_PROF_BUCKETS];
+    // call sites with the largest total wait time
+    UDF_LOCK_PROF_SITE        Sites[UDF_LOCK_PROF_SITES];
+} UDF_LOCK_PROF_CLASS, *PUDF_LOCK_PROF_CLASS;
+
+typedef struct _UDF_LOCK_PROFILE_OUT {
+    struct {
+        ULONG                 Length;
+        ULONG                 Classes;
+    } header;
+    UDF_LOCK_PROF_CLASS       Class[UDF_LOCK_PROF_CLASSES];
+} UDF_LOCK_PROFILE_OUT, *PUDF_LOCK_PROFILE_OUT;
+
 #endif  //IOCTL_UDF_DISABLE_DRIVER
 
 #define         UDF_PART_DAMAGED_RW                 (0x00)
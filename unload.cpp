@@ -34,6 +34,15 @@ UDFDriverUnload(
         KeDelayExecutionThread(KernelMode, FALSE, &delay);
     }
 
+    // all volumes are dismounted, so delayed close queues are empty
+    // and no delayed close worker is running
+#ifdef UDF_DELAYED_CLOSE
+    if(UDFGlobalData.DelayedCloseShards) {
+        MyFreePool__(UDFGlobalData.DelayedCloseShards);
+        UDFGlobalData.DelayedCloseShards = NULL;
+    }
+#endif //UDF_DELAYED_CLOSE
+
     // Create counted string version of our Win32 device name.
 
 
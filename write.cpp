@@ -693,14 +693,16 @@ UDFCommonWrite(
             // Check and see if this request requires a MDL returned to the caller
             if (IrpSp->MinorFunction & IRP_MN_MDL) {
                 // Caller does want a MDL returned. Note that this mode
-                // implies that the caller is prepared to block
+                // implies that the caller is prepared to block.
+                // Data is committed with IRP_MN_COMPLETE, see UDFMdlComplete()
+                if(!CanWait)
+                    try_return(RC = STATUS_PENDING);
+                Fcb->NtReqFCBFlags |= UDF_NTREQ_FCB_MODIFIED;
+                UDFMarkFcbDirty(Vcb, Fcb);
                 MmPrint(("    CcPrepareMdlWrite()\n"));
-//                CcPrepareMdlWrite(FileObject, &ByteOffset, TruncatedLength, &(Irp->MdlAddress), &(Irp->IoStatus));
-//                NumberBytesWritten = Irp->IoStatus.Information;
-//                RC = Irp->IoStatus.Status;
-
-                NumberBytesWritten = 0;
-                RC = STATUS_INVALID_PARAMETER;
+                CcPrepareMdlWrite(FileObject, &ByteOffset, TruncatedLength, &(Irp->MdlAddress), &(Irp->IoStatus));
+                NumberBytesWritten = Irp->IoStatus.Information;
+                RC = Irp->IoStatus.Status;
 
                 try_return(RC);
             }
@@ -715,6 +717,7 @@ UDFCommonWrite(
                 try_return(RC = STATUS_INVALID_USER_BUFFER);
             ASSERT(SystemBuffer);
             Fcb->NtReqFCBFlags |= UDF_NTREQ_FCB_MODIFIED;
+            UDFMarkFcbDirty(Vcb, Fcb);
             PerfPrint(("UDFCommonWrite: CcCopyWrite %x bytes at %x\n", TruncatedLength, ByteOffset.LowPart));
             MmPrint(("    CcCopyWrite()\n"));
             if(!CcCopyWrite(FileObject, &(ByteOffset), TruncatedLength, CanWait, SystemBuffer)) {
@@ -799,8 +802,11 @@ UDFCommonWrite(
                 try_return(RC = STATUS_INVALID_USER_BUFFER);
             }
             Fcb->NtReqFCBFlags |= UDF_NTREQ_FCB_MODIFIED;
+            UDFMarkFcbDirty(Vcb, Fcb);
+            // large aligned requests go directly to device unless WCache
+            // is already locked by UDFIsFileCached__()
             RC = UDFWriteFile__(Vcb, Fcb->FileInfo, ByteOffset.QuadPart, TruncatedLength,
-                           CacheLocked, (PCHAR)SystemBuffer, &NumberBytesWritten);
+                           CacheLocked, (PCHAR)SystemBuffer, &NumberBytesWritten, !CacheLocked);
 
             UDFUnlockCallersBuffer(IrpContext, Irp, SystemBuffer);
 